@@ -0,0 +1,189 @@
+// clock_gettime is not declared in strict C99 mode
+#define _POSIX_C_SOURCE 200112L
+
+#include "builtins.h"
+#include "compile.h"
+#include "environment.h"
+#include "eval.h"
+#include "lexer.h"
+#include "lusp.h"
+#include "object.h"
+#include "state.h"
+#include "write.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// every benchmark reports the best of several runs
+#define BENCH_RUNS 5
+
+// lexer inputs are generated by repeating a line until they reach this size
+#define LEXER_INPUT_SIZE (4 << 20)
+
+struct script_t
+{
+	const char* name;
+	const char* source;
+};
+
+// integer and real arithmetic paths, dominated by calls, comparisons and binops on unboxed registers
+static const struct script_t g_numeric_scripts[] =
+{
+	{"fib", "let fib = 0 fib = |n| if n < 2 n else fib(n - 1) + fib(n - 2) fib(32)"},
+	{"arith", "let g = 0 g = |n| if n < 2 n else g(n - 1) + g(n - 2) + n * 7 - n / 3 + n % 5 - 1 + 2 * 3 - 4 + 5 * 6 - 7 + 8 * 9 - n g(30)"},
+	{"real", "let fib = 0 fib = |x| if x < 2.0 x else fib(x - 1.0) + fib(x - 2.0) * 1.5 - 0.25 fib(30.0)"},
+};
+
+static double get_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void bench_numeric(struct lusp_state_t* state, struct lusp_environment_t* env)
+{
+	for (size_t i = 0; i < sizeof(g_numeric_scripts) / sizeof(g_numeric_scripts[0]); ++i)
+	{
+		const struct script_t* script = &g_numeric_scripts[i];
+
+		struct lusp_object_t closure = lusp_compile(env, 0, script->source, LUSP_COMPILE_DEFAULT);
+		struct lusp_object_t result = lusp_mknull();
+
+		double best = 0;
+
+		for (int run = 0; run < BENCH_RUNS; ++run)
+		{
+			double start = get_time();
+
+			enum lusp_eval_status_t status = lusp_eval(state, closure, &result);
+
+			double time = get_time() - start;
+
+			if (status != LUSP_EVAL_OK)
+			{
+				printf("numeric/%s: evaluation aborted (%d)\n", script->name, status);
+				break;
+			}
+
+			if (run == 0 || time < best) best = time;
+		}
+
+		printf("numeric/%s: %.3f s, result ", script->name, best);
+		lusp_write(result);
+		printf("\n");
+	}
+}
+
+// lexer inputs, from short tokens to long comments, identifiers and strings that SIMD scanning helps with most
+static const struct script_t g_lexer_lines[] =
+{
+	{"short", "let x%u = fib(n - 1) + fib(n - 2) * 3 print(x%u, [1, 2.5, \"a\"], #t) { f(%u) }\n"},
+	{"rules", "; generated rule %u with a descriptive comment line\n"
+	          "let rule_value_%u_threshold = \"tenant_%u_configuration_string_value\"\n"
+	          "        print(rule_value_%u_threshold, compute_score_for_item(%u, 1.5))\n"},
+	{"long", "; rule %u: this comment explains in a lot of detail why the value below is configured the way it is, "
+	         "which takes a while since the history of the value is long and nobody remembers all of it anymore\n"
+	         "let configuration_value_for_tenant_%u_that_has_a_really_long_and_descriptive_name_for_no_particular_reason = "
+	         "\"value %u: lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore "
+	         "et dolore magna aliqua. ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea "
+	         "commodo consequat. duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla "
+	         "pariatur, excepteur sint occaecat\"\n"},
+};
+
+static void lexer_error(struct lusp_lexer_t* lexer, const char* message, ...)
+{
+	printf("lexer error at line %u: %s\n", lexer->lexeme_line, message);
+	exit(1);
+}
+
+static char* generate_lexer_input(const char* line, size_t* size)
+{
+	char* result = (char*)malloc(LEXER_INPUT_SIZE + 4096);
+	size_t length = 0;
+
+	// every argument is the line index, so that identifiers and strings vary
+	for (unsigned int i = 0; length < LEXER_INPUT_SIZE; ++i)
+		length += (size_t)snprintf(result + length, 4096, line, i, i, i, i, i);
+
+	*size = length;
+
+	return result;
+}
+
+static void bench_lexer(struct lusp_state_t* state, struct lusp_environment_t* env)
+{
+	(void)state;
+	(void)env;
+
+	for (size_t i = 0; i < sizeof(g_lexer_lines) / sizeof(g_lexer_lines[0]); ++i)
+	{
+		size_t size;
+		char* input = generate_lexer_input(g_lexer_lines[i].source, &size);
+
+		double best = 0;
+		unsigned int count = 0;
+
+		for (int run = 0; run < BENCH_RUNS; ++run)
+		{
+			double start = get_time();
+
+			struct lusp_lexer_t lexer;
+			lusp_lexer_init(&lexer, input, 0, lexer_error);
+
+			for (count = 1; lexer.lexeme != LUSP_LEXEME_EOF; ++count) lusp_lexer_next(&lexer);
+
+			lusp_lexer_term(&lexer);
+
+			double time = get_time() - start;
+
+			if (run == 0 || time < best) best = time;
+		}
+
+		printf("lexer/%s: %.1f MB/s, %u lexemes in %.1f MB\n", g_lexer_lines[i].name, (double)size / best / 1e6, count, (double)size / 1e6);
+
+		free(input);
+	}
+}
+
+struct bench_t
+{
+	const char* name;
+	void (*function)(struct lusp_state_t* state, struct lusp_environment_t* env);
+};
+
+static const struct bench_t g_benches[] =
+{
+	{"numeric", bench_numeric},
+	{"lexer", bench_lexer},
+};
+
+// usage: lusp_bench [name...]; runs the named benchmarks, or all of them
+int main(int argc, char** argv)
+{
+	if (!lusp_init(0, 0)) return 1;
+
+	struct lusp_state_t* state = lusp_state_create(0);
+	struct lusp_environment_t* env = lusp_environment_create(state);
+
+	lusp_register_builtins(env);
+
+	for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); ++i)
+	{
+		bool selected = argc < 2;
+
+		for (int j = 1; j < argc; ++j)
+			if (strcmp(argv[j], g_benches[i].name) == 0)
+				selected = true;
+
+		if (selected) g_benches[i].function(state, env);
+	}
+
+	lusp_state_destroy(state);
+	lusp_term();
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include "arena.h"
+
+#include "memory.h"
+
+#include <assert.h>
+
+struct mem_arena_chunk_t
+{
+	struct mem_arena_chunk_t* next;
+	size_t size;
+
+	char data[1];
+};
+
+void mem_arena_init(struct mem_arena_t* arena, size_t chunk_size)
+{
+	arena->chunks = 0;
+	arena->free = 0;
+	arena->offset = 0;
+	arena->chunk_size = chunk_size;
+}
+
+static void free_chunks(struct mem_arena_chunk_t* chunk)
+{
+	while (chunk)
+	{
+		struct mem_arena_chunk_t* next = chunk->next;
+
+		lusp_memory_deallocate(chunk);
+
+		chunk = next;
+	}
+}
+
+void mem_arena_term(struct mem_arena_t* arena)
+{
+	free_chunks(arena->chunks);
+	free_chunks(arena->free);
+
+	mem_arena_init(arena, arena->chunk_size);
+}
+
+static struct mem_arena_chunk_t* get_chunk(struct mem_arena_t* arena, size_t size)
+{
+	// reuse the first released chunk that is large enough
+	for (struct mem_arena_chunk_t** link = &arena->free; *link; link = &(*link)->next)
+		if ((*link)->size >= size)
+		{
+			struct mem_arena_chunk_t* chunk = *link;
+			*link = chunk->next;
+
+			return chunk;
+		}
+
+	// allocations larger than a chunk get a dedicated chunk
+	size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+	struct mem_arena_chunk_t* chunk = (struct mem_arena_chunk_t*)lusp_memory_allocate(offsetof(struct mem_arena_chunk_t, data) + chunk_size);
+	assert(chunk);
+
+	chunk->size = chunk_size;
+
+	return chunk;
+}
+
+void* mem_arena_allocate(struct mem_arena_t* arena, size_t size)
+{
+	// keep allocations pointer-aligned
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+	if (!arena->chunks || arena->offset + size > arena->chunks->size)
+	{
+		struct mem_arena_chunk_t* chunk = get_chunk(arena, size);
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->offset = 0;
+	}
+
+	void* result = arena->chunks->data + arena->offset;
+	arena->offset += size;
+
+	return result;
+}
+
+size_t mem_arena_get_size(struct mem_arena_t* arena)
+{
+	size_t result = 0;
+
+	for (struct mem_arena_chunk_t* chunk = arena->chunks; chunk; chunk = chunk->next)
+		result += chunk->size;
+
+	return result;
+}
+
+struct mem_arena_mark_t mem_arena_get_mark(struct mem_arena_t* arena)
+{
+	struct mem_arena_mark_t mark = {arena->chunks, arena->offset};
+
+	return mark;
+}
+
+void mem_arena_release(struct mem_arena_t* arena, struct mem_arena_mark_t mark)
+{
+	// move chunks allocated after the mark to the free list
+	while (arena->chunks != mark.chunk)
+	{
+		struct mem_arena_chunk_t* chunk = arena->chunks;
+		assert(chunk);
+
+		arena->chunks = chunk->next;
+
+		chunk->next = arena->free;
+		arena->free = chunk;
+	}
+
+	arena->offset = mark.offset;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+struct mem_arena_chunk_t;
+
+// linear allocator for temporary data that is released in bulk; released chunks are kept for reuse
+struct mem_arena_t
+{
+	// chunks in use, most recent first, and chunks available for reuse
+	struct mem_arena_chunk_t* chunks;
+	struct mem_arena_chunk_t* free;
+
+	// allocation offset in the most recent chunk
+	size_t offset;
+
+	// minimal chunk size
+	size_t chunk_size;
+};
+
+struct mem_arena_mark_t
+{
+	struct mem_arena_chunk_t* chunk;
+	size_t offset;
+};
+
+void mem_arena_init(struct mem_arena_t* arena, size_t chunk_size);
+void mem_arena_term(struct mem_arena_t* arena);
+
+void* mem_arena_allocate(struct mem_arena_t* arena, size_t size);
+
+// total size of chunks in use
+size_t mem_arena_get_size(struct mem_arena_t* arena);
+
+// releases all allocations made after mark was taken
+struct mem_arena_mark_t mem_arena_get_mark(struct mem_arena_t* arena);
+void mem_arena_release(struct mem_arena_t* arena, struct mem_arena_mark_t mark);
@@ -0,0 +1,610 @@
+#include "bignum.h"
+
+#include "memory.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+// operands with fewer limbs are multiplied using schoolbook algorithm
+#define KARATSUBA_THRESHOLD 32
+
+struct operand_t
+{
+	const uint32_t* limbs;
+	unsigned int count;
+	bool negative;
+
+	// storage for integer operands
+	uint32_t buffer[2];
+};
+
+static inline unsigned int trim(const uint32_t* limbs, unsigned int count)
+{
+	while (count > 0 && limbs[count - 1] == 0) count--;
+
+	return count;
+}
+
+static inline uint32_t* allocate_limbs(unsigned int count)
+{
+	// allocate at least one limb so that empty results are valid
+	uint32_t* result = (uint32_t*)lusp_memory_allocate((count ? count : 1) * sizeof(uint32_t));
+	assert(result);
+
+	return result;
+}
+
+static void load_operand(struct operand_t* result, struct lusp_object_t* object)
+{
+	if (object->type == LUSP_OBJECT_BIGNUM)
+	{
+		result->limbs = object->bignum->limbs;
+		result->count = object->bignum->count;
+		result->negative = object->bignum->negative;
+	}
+	else
+	{
+		assert(object->type == LUSP_OBJECT_INTEGER);
+
+		// negate in unsigned arithmetic so that INT64_MIN works
+		uint64_t magnitude = (object->integer < 0) ? 0 - (uint64_t)object->integer : (uint64_t)object->integer;
+
+		result->buffer[0] = (uint32_t)magnitude;
+		result->buffer[1] = (uint32_t)(magnitude >> 32);
+		result->limbs = result->buffer;
+		result->count = trim(result->buffer, 2);
+		result->negative = object->integer < 0;
+	}
+}
+
+static struct lusp_object_t make_result(const uint32_t* limbs, unsigned int count, bool negative)
+{
+	count = trim(limbs, count);
+
+	// values that fit in int64_t are stored as integers
+	if (count <= 2)
+	{
+		uint64_t magnitude = (count > 0 ? limbs[0] : 0) | (count > 1 ? (uint64_t)limbs[1] << 32 : 0);
+
+		if (magnitude <= (uint64_t)INT64_MAX + negative)
+			return lusp_mkinteger(negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude);
+	}
+
+	struct lusp_bignum_t* value = (struct lusp_bignum_t*)lusp_memory_allocate(sizeof(struct lusp_bignum_t) - sizeof(uint32_t) + sizeof(uint32_t) * count);
+	assert(value);
+
+	value->negative = negative;
+	value->count = count;
+	memcpy(value->limbs, limbs, count * sizeof(uint32_t));
+
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_BIGNUM;
+	result.bignum = value;
+	return result;
+}
+
+static int compare_magnitude(const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	if (an != bn) return an < bn ? -1 : 1;
+
+	for (unsigned int i = an; i > 0; --i)
+		if (a[i - 1] != b[i - 1])
+			return a[i - 1] < b[i - 1] ? -1 : 1;
+
+	return 0;
+}
+
+// r = a + b; requires an >= bn, r has room for an + 1 limbs
+static void add_magnitude(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	uint64_t carry = 0;
+
+	for (unsigned int i = 0; i < an; ++i)
+	{
+		carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+
+	r[an] = (uint32_t)carry;
+}
+
+// r = a - b; requires a >= b, r has room for an limbs
+static void subtract_magnitude(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	uint64_t borrow = 0;
+
+	for (unsigned int i = 0; i < an; ++i)
+	{
+		uint64_t diff = (uint64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+		r[i] = (uint32_t)diff;
+		borrow = diff >> 63;
+	}
+
+	assert(borrow == 0);
+}
+
+// r += x; r has rn limbs and the sum must fit
+static void add_into(uint32_t* r, unsigned int rn, const uint32_t* x, unsigned int xn)
+{
+	uint64_t carry = 0;
+	unsigned int i = 0;
+
+	for (; i < xn; ++i)
+	{
+		carry += (uint64_t)r[i] + x[i];
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+
+	for (; carry && i < rn; ++i)
+	{
+		carry += r[i];
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+
+	assert(carry == 0);
+}
+
+// r -= x; requires r >= x
+static void subtract_into(uint32_t* r, unsigned int rn, const uint32_t* x, unsigned int xn)
+{
+	uint64_t borrow = 0;
+	unsigned int i = 0;
+
+	for (; i < xn; ++i)
+	{
+		uint64_t diff = (uint64_t)r[i] - x[i] - borrow;
+		r[i] = (uint32_t)diff;
+		borrow = diff >> 63;
+	}
+
+	for (; borrow && i < rn; ++i)
+	{
+		uint64_t diff = (uint64_t)r[i] - borrow;
+		r[i] = (uint32_t)diff;
+		borrow = diff >> 63;
+	}
+
+	assert(borrow == 0);
+}
+
+static void multiply_schoolbook(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	memset(r, 0, (an + bn) * sizeof(uint32_t));
+
+	for (unsigned int j = 0; j < bn; ++j)
+	{
+		uint64_t carry = 0;
+
+		for (unsigned int i = 0; i < an; ++i)
+		{
+			carry += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t)carry;
+			carry >>= 32;
+		}
+
+		r[an + j] = (uint32_t)carry;
+	}
+}
+
+static void multiply_magnitude(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn);
+
+// requires bn <= an < 2 * bn; r has room for an + bn limbs
+static void multiply_karatsuba(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	// split both operands at m limbs: a = a1 * B^m + a0, b = b1 * B^m + b0
+	unsigned int m = an / 2;
+
+	const uint32_t* a0 = a;
+	const uint32_t* a1 = a + m;
+	const uint32_t* b0 = b;
+	const uint32_t* b1 = b + m;
+
+	unsigned int a1n = an - m;
+	unsigned int b1n = bn - m;
+
+	// z0 = a0 * b0 goes to the low 2m limbs, z2 = a1 * b1 goes to the remaining limbs
+	multiply_magnitude(r, a0, m, b0, m);
+	multiply_magnitude(r + 2 * m, a1, a1n, b1, b1n);
+
+	// z1 = (a0 + a1) * (b0 + b1) - z0 - z2
+	unsigned int san = a1n + 1;
+	unsigned int sbn = (b1n > m ? b1n : m) + 1;
+
+	uint32_t* sa = allocate_limbs(san);
+	uint32_t* sb = allocate_limbs(sbn);
+	uint32_t* z1 = allocate_limbs(san + sbn);
+
+	add_magnitude(sa, a1, a1n, a0, m);
+	(b1n > m) ? add_magnitude(sb, b1, b1n, b0, m) : add_magnitude(sb, b0, m, b1, b1n);
+
+	multiply_magnitude(z1, sa, san, sb, sbn);
+
+	subtract_into(z1, san + sbn, r, 2 * m);
+	subtract_into(z1, san + sbn, r + 2 * m, an + bn - 2 * m);
+
+	// r += z1 * B^m
+	add_into(r + m, an + bn - m, z1, trim(z1, san + sbn));
+
+	lusp_memory_deallocate(z1);
+	lusp_memory_deallocate(sb);
+	lusp_memory_deallocate(sa);
+}
+
+// r = a * b; r has room for an + bn limbs and must not overlap with a or b
+static void multiply_magnitude(uint32_t* r, const uint32_t* a, unsigned int an, const uint32_t* b, unsigned int bn)
+{
+	// make a the longer operand
+	if (an < bn)
+	{
+		const uint32_t* t = a;
+		a = b;
+		b = t;
+
+		unsigned int tn = an;
+		an = bn;
+		bn = tn;
+	}
+
+	if (bn < KARATSUBA_THRESHOLD)
+	{
+		multiply_schoolbook(r, a, an, b, bn);
+		return;
+	}
+
+	if (an < 2 * bn)
+	{
+		multiply_karatsuba(r, a, an, b, bn);
+		return;
+	}
+
+	// unbalanced operands: multiply b by bn-sized chunks of a
+	uint32_t* t = allocate_limbs(2 * bn);
+
+	memset(r, 0, (an + bn) * sizeof(uint32_t));
+
+	for (unsigned int i = 0; i < an; i += bn)
+	{
+		unsigned int cn = (an - i < bn) ? an - i : bn;
+
+		multiply_magnitude(t, a + i, cn, b, bn);
+		add_into(r + i, an + bn - i, t, cn + bn);
+	}
+
+	lusp_memory_deallocate(t);
+}
+
+static unsigned int count_leading_zeros(uint32_t value)
+{
+	unsigned int result = 0;
+
+	while ((value & 0x80000000) == 0)
+	{
+		value <<= 1;
+		result++;
+	}
+
+	return result;
+}
+
+// q = u / v, r = u % v; requires un >= vn >= 1 and v[vn - 1] != 0, q has room for un - vn + 1 limbs, r has room for vn limbs
+// reference: Knuth, TAOCP vol. 2, 4.3.1, algorithm D
+static void divide_magnitude(uint32_t* q, uint32_t* r, const uint32_t* u, unsigned int un, const uint32_t* v, unsigned int vn)
+{
+	const uint64_t base = (uint64_t)1 << 32;
+
+	if (vn == 1)
+	{
+		// short division
+		uint64_t rem = 0;
+
+		for (unsigned int i = un; i > 0; --i)
+		{
+			uint64_t cur = (rem << 32) | u[i - 1];
+			q[i - 1] = (uint32_t)(cur / v[0]);
+			rem = cur % v[0];
+		}
+
+		r[0] = (uint32_t)rem;
+		return;
+	}
+
+	// normalize so that the top bit of divisor is set
+	unsigned int s = count_leading_zeros(v[vn - 1]);
+
+	uint32_t* vs = allocate_limbs(vn);
+	uint32_t* us = allocate_limbs(un + 1);
+
+	for (unsigned int i = vn - 1; i > 0; --i)
+		vs[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+	vs[0] = v[0] << s;
+
+	us[un] = s ? u[un - 1] >> (32 - s) : 0;
+	for (unsigned int i = un - 1; i > 0; --i)
+		us[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+	us[0] = u[0] << s;
+
+	for (unsigned int j = un - vn + 1; j > 0; --j)
+	{
+		unsigned int k = j - 1;
+
+		// estimate quotient digit
+		uint64_t num = ((uint64_t)us[k + vn] << 32) | us[k + vn - 1];
+		uint64_t qhat = num / vs[vn - 1];
+		uint64_t rhat = num % vs[vn - 1];
+
+		while (qhat >= base || qhat * vs[vn - 2] > ((rhat << 32) | us[k + vn - 2]))
+		{
+			qhat--;
+			rhat += vs[vn - 1];
+			if (rhat >= base) break;
+		}
+
+		// multiply and subtract
+		int64_t borrow = 0;
+		int64_t t;
+
+		for (unsigned int i = 0; i < vn; ++i)
+		{
+			uint64_t p = qhat * vs[i];
+			t = (int64_t)us[i + k] - borrow - (int64_t)(p & 0xffffffff);
+			us[i + k] = (uint32_t)t;
+			borrow = (int64_t)(p >> 32) - (t >> 32);
+		}
+
+		t = (int64_t)us[k + vn] - borrow;
+		us[k + vn] = (uint32_t)t;
+
+		q[k] = (uint32_t)qhat;
+
+		// estimate was one too large, add back
+		if (t < 0)
+		{
+			q[k]--;
+
+			uint64_t carry = 0;
+
+			for (unsigned int i = 0; i < vn; ++i)
+			{
+				carry += (uint64_t)us[i + k] + vs[i];
+				us[i + k] = (uint32_t)carry;
+				carry >>= 32;
+			}
+
+			us[k + vn] += (uint32_t)carry;
+		}
+	}
+
+	// unnormalize remainder
+	for (unsigned int i = 0; i < vn; ++i)
+		r[i] = (us[i] >> s) | (s ? us[i + 1] << (32 - s) : 0);
+
+	lusp_memory_deallocate(us);
+	lusp_memory_deallocate(vs);
+}
+
+static struct lusp_object_t add_signed(struct operand_t* a, bool a_negative, struct operand_t* b, bool b_negative)
+{
+	// make a the operand with larger magnitude
+	if (compare_magnitude(a->limbs, a->count, b->limbs, b->count) < 0)
+	{
+		struct operand_t* t = a;
+		a = b;
+		b = t;
+
+		bool tn = a_negative;
+		a_negative = b_negative;
+		b_negative = tn;
+	}
+
+	uint32_t* r = allocate_limbs(a->count + 1);
+
+	// same signs add magnitudes, different signs subtract smaller magnitude from larger one
+	if (a_negative == b_negative)
+		add_magnitude(r, a->limbs, a->count, b->limbs, b->count);
+	else
+	{
+		subtract_magnitude(r, a->limbs, a->count, b->limbs, b->count);
+		r[a->count] = 0;
+	}
+
+	struct lusp_object_t result = make_result(r, a->count + 1, a_negative);
+
+	lusp_memory_deallocate(r);
+
+	return result;
+}
+
+struct lusp_object_t lusp_bignum_add(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	struct operand_t a, b;
+	load_operand(&a, left);
+	load_operand(&b, right);
+
+	return add_signed(&a, a.negative, &b, b.negative);
+}
+
+struct lusp_object_t lusp_bignum_subtract(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	struct operand_t a, b;
+	load_operand(&a, left);
+	load_operand(&b, right);
+
+	return add_signed(&a, a.negative, &b, !b.negative);
+}
+
+struct lusp_object_t lusp_bignum_multiply(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	struct operand_t a, b;
+	load_operand(&a, left);
+	load_operand(&b, right);
+
+	uint32_t* r = allocate_limbs(a.count + b.count);
+
+	multiply_magnitude(r, a.limbs, a.count, b.limbs, b.count);
+
+	struct lusp_object_t result = make_result(r, a.count + b.count, a.negative != b.negative);
+
+	lusp_memory_deallocate(r);
+
+	return result;
+}
+
+static struct lusp_object_t divide_signed(struct lusp_object_t* left, struct lusp_object_t* right, bool modulo)
+{
+	struct operand_t a, b;
+	load_operand(&a, left);
+	load_operand(&b, right);
+
+	assert(b.count > 0);
+
+	// dividend is smaller than divisor
+	if (a.count < b.count) return modulo ? *left : lusp_mkinteger(0);
+
+	uint32_t* q = allocate_limbs(a.count - b.count + 1);
+	uint32_t* r = allocate_limbs(b.count);
+
+	divide_magnitude(q, r, a.limbs, a.count, b.limbs, b.count);
+
+	struct lusp_object_t result = modulo ? make_result(r, b.count, a.negative) : make_result(q, a.count - b.count + 1, a.negative != b.negative);
+
+	lusp_memory_deallocate(r);
+	lusp_memory_deallocate(q);
+
+	return result;
+}
+
+struct lusp_object_t lusp_bignum_divide(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	return divide_signed(left, right, false);
+}
+
+struct lusp_object_t lusp_bignum_modulo(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	return divide_signed(left, right, true);
+}
+
+int lusp_bignum_compare(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	struct operand_t a, b;
+	load_operand(&a, left);
+	load_operand(&b, right);
+
+	// zero has no sign
+	bool an = a.negative && a.count > 0;
+	bool bn = b.negative && b.count > 0;
+
+	if (an != bn) return an ? -1 : 1;
+
+	int result = compare_magnitude(a.limbs, a.count, b.limbs, b.count);
+
+	return an ? -result : result;
+}
+
+double lusp_bignum_to_real(struct lusp_bignum_t* value)
+{
+	double result = 0;
+
+	for (unsigned int i = value->count; i > 0; --i)
+		result = result * 4294967296.0 + value->limbs[i - 1];
+
+	return value->negative ? -result : result;
+}
+
+struct lusp_object_t lusp_bignum_from_real(double value)
+{
+	assert(value - value == 0 && value == floor(value));
+
+	if (value == 0) return lusp_mkinteger(0);
+
+	// magnitude is a 53-bit mantissa shifted left; the largest finite double needs 1024 bits
+	int exponent;
+	double fraction = frexp(fabs(value), &exponent);
+
+	uint64_t mantissa = (uint64_t)ldexp(fraction, 53);
+	int shift = exponent - 53;
+
+	uint32_t limbs[1024 / 32 + 2] = {0};
+
+	if (shift < 0)
+	{
+		// small values are integral, so shifting right loses no bits
+		mantissa >>= -shift;
+		shift = 0;
+	}
+
+	unsigned int index = (unsigned int)shift / 32;
+	unsigned int bit = (unsigned int)shift % 32;
+
+	limbs[index] = (uint32_t)(mantissa << bit);
+	limbs[index + 1] = (uint32_t)(mantissa >> (32 - bit));
+	limbs[index + 2] = bit ? (uint32_t)(mantissa >> (64 - bit)) : 0;
+
+	return make_result(limbs, index + 3, value < 0);
+}
+
+char* lusp_bignum_format(struct lusp_bignum_t* value)
+{
+	// split magnitude into base 10^9 chunks, least significant first
+	uint32_t* temp = allocate_limbs(value->count);
+	uint32_t* chunks = allocate_limbs(value->count * 2 + 1);
+
+	memcpy(temp, value->limbs, value->count * sizeof(uint32_t));
+
+	unsigned int count = value->count;
+	unsigned int chunk_count = 0;
+
+	while (count > 0)
+	{
+		uint64_t rem = 0;
+
+		for (unsigned int i = count; i > 0; --i)
+		{
+			uint64_t cur = (rem << 32) | temp[i - 1];
+			temp[i - 1] = (uint32_t)(cur / 1000000000);
+			rem = cur % 1000000000;
+		}
+
+		chunks[chunk_count++] = (uint32_t)rem;
+		count = trim(temp, count);
+	}
+
+	// sign, up to 9 digits per chunk, terminator
+	char* result = (char*)lusp_memory_allocate(chunk_count * 9 + 2);
+	assert(result);
+
+	char* out = result;
+
+	if (value->negative) *out++ = '-';
+
+	for (unsigned int i = chunk_count; i > 0; --i)
+	{
+		char digits[9];
+		uint32_t chunk = chunks[i - 1];
+
+		for (unsigned int j = 0; j < 9; ++j)
+		{
+			digits[8 - j] = (char)('0' + chunk % 10);
+			chunk /= 10;
+		}
+
+		// most significant chunk is not zero-padded
+		unsigned int skip = 0;
+		if (i == chunk_count)
+			while (skip < 8 && digits[skip] == '0') skip++;
+
+		memcpy(out, digits + skip, 9 - skip);
+		out += 9 - skip;
+	}
+
+	*out = 0;
+
+	lusp_memory_deallocate(chunks);
+	lusp_memory_deallocate(temp);
+
+	return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "object.h"
+
+// arbitrary-precision integer; magnitude is stored as little-endian 32-bit limbs without leading zero limbs
+// bignums are always normalized: values that fit in int64_t are represented as LUSP_OBJECT_INTEGER instead
+struct lusp_bignum_t
+{
+	bool negative;
+	unsigned int count;
+	uint32_t limbs[1];
+};
+
+// operands are integers or bignums; results are normalized
+struct lusp_object_t lusp_bignum_add(struct lusp_object_t* left, struct lusp_object_t* right);
+struct lusp_object_t lusp_bignum_subtract(struct lusp_object_t* left, struct lusp_object_t* right);
+struct lusp_object_t lusp_bignum_multiply(struct lusp_object_t* left, struct lusp_object_t* right);
+
+// right operand must not be zero; division truncates, remainder has the sign of the dividend
+struct lusp_object_t lusp_bignum_divide(struct lusp_object_t* left, struct lusp_object_t* right);
+struct lusp_object_t lusp_bignum_modulo(struct lusp_object_t* left, struct lusp_object_t* right);
+
+// returns -1, 0 or 1
+int lusp_bignum_compare(struct lusp_object_t* left, struct lusp_object_t* right);
+
+double lusp_bignum_to_real(struct lusp_bignum_t* value);
+
+// value must be finite and integral; result is normalized
+struct lusp_object_t lusp_bignum_from_real(double value);
+
+// returns decimal representation allocated with lusp_memory_allocate
+char* lusp_bignum_format(struct lusp_bignum_t* value);
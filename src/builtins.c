@@ -0,0 +1,424 @@
+#include "builtins.h"
+
+#include "coroutine.h"
+#include "environment.h"
+#include "eval.h"
+#include "memory.h"
+#include "object.h"
+#include "parallel.h"
+#include "state.h"
+#include "table.h"
+
+#include <assert.h>
+#include <string.h>
+
+static struct lusp_object_t builtin_length(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1) return lusp_mknull();
+
+	switch (args[0].type)
+	{
+	case LUSP_OBJECT_VECTOR:
+		return lusp_mkinteger(args[0].vector->length);
+
+	case LUSP_OBJECT_TABLE:
+		return lusp_mkinteger(lusp_table_count(args[0].table));
+
+	case LUSP_OBJECT_STRING:
+		return lusp_mkinteger(args[0].string->length);
+
+	case LUSP_OBJECT_BUILDER:
+		return lusp_mkinteger(args[0].builder->length);
+
+	default:
+		return lusp_mknull();
+	}
+}
+
+static struct lusp_object_t builtin_push(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_VECTOR) return lusp_mknull();
+
+	// append all remaining arguments
+	for (unsigned int i = 1; i < count; ++i)
+		lusp_vector_push(args[0].vector, args[i]);
+
+	return args[0];
+}
+
+static struct lusp_object_t builtin_table(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	// optional capacity hint
+	unsigned int capacity = (count > 0 && args[0].type == LUSP_OBJECT_INTEGER && args[0].integer > 0) ? (unsigned int)args[0].integer : 0;
+
+	return lusp_mktable(capacity);
+}
+
+static struct lusp_object_t builtin_delete(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 2 || args[0].type != LUSP_OBJECT_TABLE) return lusp_mknull();
+
+	return lusp_mkboolean(lusp_table_delete(args[0].table, &args[1]));
+}
+
+static struct lusp_object_t builtin_next(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_TABLE) return lusp_mknull();
+
+	struct lusp_object_t key = (count > 1) ? args[1] : lusp_mknull();
+
+	return lusp_table_next(args[0].table, &key);
+}
+
+static struct lusp_object_t builtin_concat(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	unsigned int length = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (args[i].type != LUSP_OBJECT_STRING) return lusp_mknull();
+
+		length += args[i].string->length;
+	}
+
+	// copy all pieces into a single allocation
+	struct lusp_object_t result = lusp_mkstring_n(0, length);
+	char* data = result.string->storage;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		memcpy(data, args[i].string->data, args[i].string->length);
+		data += args[i].string->length;
+	}
+
+	return result;
+}
+
+static struct lusp_object_t builtin_substring(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 2 || args[0].type != LUSP_OBJECT_STRING || args[1].type != LUSP_OBJECT_INTEGER) return lusp_mknull();
+
+	struct lusp_string_t* string = args[0].string;
+
+	// range is clamped to string bounds; length defaults to the rest of the string
+	int64_t offset = args[1].integer < 0 ? 0 : args[1].integer > string->length ? string->length : args[1].integer;
+	int64_t length = (count > 2 && args[2].type == LUSP_OBJECT_INTEGER) ? args[2].integer : string->length;
+
+	if (length < 0) length = 0;
+	if (length > string->length - offset) length = string->length - offset;
+
+	return lusp_mkstring_view(string, (unsigned int)offset, (unsigned int)length);
+}
+
+static struct lusp_object_t builtin_compare(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 2 || args[0].type != LUSP_OBJECT_STRING || args[1].type != LUSP_OBJECT_STRING) return lusp_mknull();
+
+	return lusp_mkinteger(lusp_string_compare(args[0].string, args[1].string));
+}
+
+static struct lusp_object_t builtin_hash(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_STRING) return lusp_mknull();
+
+	return lusp_mkinteger(lusp_string_hash(args[0].string));
+}
+
+static struct lusp_object_t builtin_builder(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	for (unsigned int i = 0; i < count; ++i)
+		if (args[i].type != LUSP_OBJECT_STRING)
+			return lusp_mknull();
+
+	struct lusp_object_t result = lusp_mkbuilder();
+
+	// initial contents
+	for (unsigned int i = 0; i < count; ++i)
+		lusp_builder_append(result.builder, args[i].string);
+
+	return result;
+}
+
+static struct lusp_object_t builtin_append(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_BUILDER) return lusp_mknull();
+
+	// check all pieces upfront so that a bad argument doesn't leave the builder partially appended
+	for (unsigned int i = 1; i < count; ++i)
+		if (args[i].type != LUSP_OBJECT_STRING && args[i].type != LUSP_OBJECT_BUILDER)
+			return lusp_mknull();
+
+	struct lusp_builder_t* builder = args[0].builder;
+
+	for (unsigned int i = 1; i < count; ++i)
+	{
+		if (args[i].type == LUSP_OBJECT_BUILDER)
+		{
+			// appending a builder appends its pieces; read count upfront in case builder is appended to itself
+			struct lusp_builder_t* other = args[i].builder;
+			unsigned int piece_count = other->piece_count;
+
+			for (unsigned int j = 0; j < piece_count; ++j)
+				lusp_builder_append(builder, other->pieces[j]);
+		}
+		else
+			lusp_builder_append(builder, args[i].string);
+	}
+
+	return args[0];
+}
+
+static struct lusp_object_t builtin_flatten(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_BUILDER) return lusp_mknull();
+
+	return lusp_builder_flatten(args[0].builder);
+}
+
+// parallel loops are split into about this many chunks; stealing balances chunks of uneven cost
+#define PARALLEL_CHUNKS 1024
+
+struct parallel_t
+{
+	struct lusp_environment_t* env;
+	struct lusp_object_t function;
+
+	struct lusp_object_t* input;
+	struct lusp_object_t* output;
+	unsigned int count;
+
+	// items per block for reduce
+	unsigned int block;
+};
+
+static inline unsigned int get_grain(unsigned int count)
+{
+	return count > PARALLEL_CHUNKS ? count / PARALLEL_CHUNKS : 1;
+}
+
+static inline struct lusp_object_t call(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t function, struct lusp_object_t* args, unsigned int count)
+{
+	// remaining items of an aborted evaluation are skipped; the status is reported by the loop
+	if (state->status != LUSP_EVAL_OK) return lusp_mknull();
+
+	if (function.type == LUSP_OBJECT_FUNCTION) return ((lusp_function_t)function.function)(state, env, args, count);
+
+	struct lusp_object_t result;
+	lusp_call(state, function, args, count, &result);
+
+	return result;
+}
+
+static void map_chunk(struct lusp_state_t* state, void* context, unsigned int begin, unsigned int end)
+{
+	struct parallel_t* parallel = (struct parallel_t*)context;
+
+	for (unsigned int i = begin; i < end; ++i)
+		parallel->output[i] = call(state, parallel->env, parallel->function, &parallel->input[i], 1);
+}
+
+static void reduce_chunk(struct lusp_state_t* state, void* context, unsigned int begin, unsigned int end)
+{
+	struct parallel_t* parallel = (struct parallel_t*)context;
+
+	// every block is reduced left to right, so function only has to be associative
+	for (unsigned int i = begin; i < end; ++i)
+	{
+		unsigned int first = i * parallel->block;
+		unsigned int last = parallel->count - first > parallel->block ? first + parallel->block : parallel->count;
+
+		struct lusp_object_t args[2] = {parallel->input[first]};
+
+		for (unsigned int j = first + 1; j < last; ++j)
+		{
+			args[1] = parallel->input[j];
+			args[0] = call(state, parallel->env, parallel->function, args, 2);
+		}
+
+		parallel->output[i] = args[0];
+	}
+}
+
+static void for_chunk(struct lusp_state_t* state, void* context, unsigned int begin, unsigned int end)
+{
+	struct parallel_t* parallel = (struct parallel_t*)context;
+
+	for (unsigned int i = begin; i < end; ++i)
+	{
+		struct lusp_object_t index = lusp_mkinteger(i);
+
+		call(state, parallel->env, parallel->function, &index, 1);
+	}
+}
+
+static struct lusp_object_t builtin_pmap(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	if (count < 2 || args[1].type != LUSP_OBJECT_VECTOR) return lusp_mknull();
+
+	unsigned int length = args[1].vector->length;
+
+	// results are stored by index, so chunks never write to the same memory
+	struct lusp_object_t result = lusp_mkvector(length);
+	result.vector->length = length;
+
+	struct parallel_t parallel = {env, args[0], args[1].vector->data, result.vector->data, length, 0};
+
+	lusp_parallel_for(state, length, get_grain(length), map_chunk, &parallel);
+
+	return result;
+}
+
+static struct lusp_object_t builtin_preduce(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	if (count < 2 || args[1].type != LUSP_OBJECT_VECTOR) return lusp_mknull();
+
+	unsigned int length = args[1].vector->length;
+	struct lusp_object_t function = args[0];
+
+	// optional initial value is combined with block results on the calling thread
+	bool has_init = count > 2;
+	struct lusp_object_t init = has_init ? args[2] : lusp_mknull();
+
+	if (length == 0) return init;
+
+	unsigned int block = get_grain(length);
+	unsigned int block_count = length / block + (length % block != 0);
+
+	struct lusp_object_t* partials = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * block_count);
+	assert(partials);
+
+	struct parallel_t parallel = {env, function, args[1].vector->data, partials, length, block};
+
+	lusp_parallel_for(state, block_count, 1, reduce_chunk, &parallel);
+
+	struct lusp_object_t pair[2] = {has_init ? init : partials[0]};
+
+	for (unsigned int i = has_init ? 0 : 1; i < block_count; ++i)
+	{
+		pair[1] = partials[i];
+		pair[0] = call(state, env, function, pair, 2);
+	}
+
+	lusp_memory_deallocate(partials);
+
+	return pair[0];
+}
+
+static struct lusp_object_t builtin_pfor(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	if (count < 2 || args[1].type != LUSP_OBJECT_INTEGER) return lusp_mknull();
+
+	unsigned int length = args[1].integer > 0 ? (unsigned int)args[1].integer : 0;
+
+	struct parallel_t parallel = {env, args[0], 0, 0, length, 0};
+
+	lusp_parallel_for(state, length, get_grain(length), for_chunk, &parallel);
+
+	return lusp_mknull();
+}
+
+static struct lusp_object_t builtin_spawn(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_CLOSURE) return lusp_mknull();
+
+	// optional register stack size
+	unsigned int stack_size = (count > 1 && args[1].type == LUSP_OBJECT_INTEGER && args[1].integer > 0) ? (unsigned int)args[1].integer : 0;
+
+	return lusp_mkcoroutine(args[0], stack_size);
+}
+
+static struct lusp_object_t builtin_resume(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_COROUTINE) return lusp_mknull();
+
+	return lusp_coroutine_resume(state, args[0].coroutine, args + 1, count - 1);
+}
+
+static struct lusp_object_t builtin_yield(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	// yield outside of coroutines does nothing
+	if (!lusp_coroutine_yield(state)) return lusp_mknull();
+
+	return count > 0 ? args[0] : lusp_mknull();
+}
+
+static struct lusp_object_t builtin_done(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count < 1 || args[0].type != LUSP_OBJECT_COROUTINE) return lusp_mknull();
+
+	return lusp_mkboolean(args[0].coroutine->status == LUSP_COROUTINE_DEAD);
+}
+
+static void put(struct lusp_environment_t* env, const char* name, lusp_function_t function)
+{
+	lusp_environment_put(env, lusp_mksymbol(name), lusp_mkfunction(function));
+}
+
+void lusp_register_builtins(struct lusp_environment_t* env)
+{
+	put(env, "length", builtin_length);
+	put(env, "push", builtin_push);
+	put(env, "table", builtin_table);
+	put(env, "delete", builtin_delete);
+	put(env, "next", builtin_next);
+	put(env, "concat", builtin_concat);
+	put(env, "substring", builtin_substring);
+	put(env, "compare", builtin_compare);
+	put(env, "hash", builtin_hash);
+	put(env, "builder", builtin_builder);
+	put(env, "append", builtin_append);
+	put(env, "flatten", builtin_flatten);
+	put(env, "pmap", builtin_pmap);
+	put(env, "preduce", builtin_preduce);
+	put(env, "pfor", builtin_pfor);
+	put(env, "spawn", builtin_spawn);
+	put(env, "resume", builtin_resume);
+	put(env, "yield", builtin_yield);
+	put(env, "done", builtin_done);
+}
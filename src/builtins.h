@@ -0,0 +1,11 @@
+#pragma once
+
+struct lusp_environment_t;
+
+// registers builtin functions in env; environments start out empty
+// pmap, preduce and pfor run functions on several threads at once (see lusp_parallel_for); these builtins only read
+// their arguments and can be called on objects that other threads access: length, next, concat, substring, compare,
+// hash, table, builder, pmap, preduce, pfor, done, yield; push, delete, append and flatten (which caches the result in
+// the builder) modify their first argument, so it has to be created by the calling thread; resume runs a coroutine
+// on the calling thread and a coroutine can only be resumed by one thread at a time
+void lusp_register_builtins(struct lusp_environment_t* env);
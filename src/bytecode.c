@@ -1,150 +1,265 @@
-#include "bytecode.h"
-
-#include "environment.h"
-#include "object.h"
-#include "write.h"
-
-#include <stdio.h>
-#include <string.h>
-
-static void dump_bytecode(struct lusp_vm_bytecode_t* code, const char* indent, bool deep)
-{
-	printf("%s%d registers, %d upvals\n", indent, code->reg_count, code->upval_count);
-
-	for (unsigned int i = 0; i < code->op_count; ++i)
-	{
-		struct lusp_vm_op_t* op = &code->ops[i];
-
-		printf("%s%02d: ", indent, i);
-
-		switch (op->opcode)
-		{
-		case LUSP_VMOP_LOAD_CONST:
-			printf("load_const r%d, %p [ ", op->reg, op->load_const.object);
-			lusp_write(*op->load_const.object);
-			printf(" ]\n");
-			break;
-
-		case LUSP_VMOP_LOAD_GLOBAL:
-			printf("load_global r%d, %p [ %s ]\n", op->reg, op->loadstore_global.slot, op->loadstore_global.slot->name->name);
-			break;
-
-		case LUSP_VMOP_STORE_GLOBAL:
-			printf("store_global %p [ %s ], r%d\n", op->loadstore_global.slot, op->loadstore_global.slot->name->name, op->reg);
-			break;
-
-		case LUSP_VMOP_LOAD_UPVAL:
-			printf("load_upval r%d, u%d\n", op->reg, op->loadstore_upval.index);
-			break;
-
-		case LUSP_VMOP_STORE_UPVAL:
-			printf("store_upval u%d, r%d\n", op->loadstore_upval.index, op->reg);
-			break;
-
-		case LUSP_VMOP_MOVE:
-			printf("move r%d, r%d\n", op->reg, op->move.index);
-			break;
-
-		case LUSP_VMOP_CALL:
-			printf("call r%d, r%d, %d\n", op->reg, op->call.args, op->call.count);
-			break;
-
-		case LUSP_VMOP_RETURN:
-			printf("return r%d\n", op->reg);
-			break;
-
-		case LUSP_VMOP_JUMP:
-			printf("jump %+d\n", op->jump.offset);
-			break;
-
-		case LUSP_VMOP_JUMP_IF:
-			printf("jump_if r%d, %+d\n", op->reg, op->jump.offset);
-			break;
-
-		case LUSP_VMOP_JUMP_IFNOT:
-			printf("jump_ifnot r%d, %+d\n", op->reg, op->jump.offset);
-			break;
-
-		case LUSP_VMOP_CREATE_CLOSURE:
-			printf("create_closure r%d, %p\n", op->reg, op->create_closure.code);
-
-			if (deep)
-			{
-				char new_indent[256];
-
-				strncpy(new_indent, indent, sizeof(new_indent));
-				strncat(new_indent, "\t", sizeof(new_indent));
-
-				dump_bytecode(op->create_closure.code, new_indent, deep);
-			}
-			break;
-
-		case LUSP_VMOP_CLOSE:
-			printf("close r%d\n", op->close.begin);
-			break;
-
-		case LUSP_VMOP_ADD:
-			printf("add r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_SUBTRACT:
-			printf("subtract r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_MULTIPLY:
-			printf("multiply r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_DIVIDE:
-			printf("divide r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_MODULO:
-			printf("modulo r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_EQUAL:
-			printf("equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_NOT_EQUAL:
-			printf("not_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_LESS:
-			printf("less r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_LESS_EQUAL:
-			printf("less_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_GREATER:
-			printf("greater r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		case LUSP_VMOP_GREATER_EQUAL:
-			printf("greater_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
-			break;
-
-		default:
-			printf("unknown\n");
-		}
-	}
-}
-
-void lusp_dump_bytecode(struct lusp_vm_bytecode_t* code, bool deep)
-{
-	dump_bytecode(code, "", deep);
-}
-
-void lusp_setup_bytecode(struct lusp_vm_bytecode_t* code)
-{
-#if DL_WINDOWS
-	struct lusp_object_t lusp_eval_jit_x86_stub(struct lusp_vm_bytecode_t * code, struct lusp_vm_closure_t * closure, struct lusp_object_t * regs, unsigned int arg_count);
-
-	code->jit = lusp_eval_jit_x86_stub;
-#else
-	code->jit = 0;
-#endif
-}
+#include "bytecode.h"
+
+#include "environment.h"
+#include "memory.h"
+#include "object.h"
+#include "write.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static void dump_bytecode(struct lusp_vm_bytecode_t* code, const char* indent, bool deep)
+{
+	printf("%s%d registers, %d upvals, %d params\n", indent, code->reg_count, code->upval_count, code->param_count);
+
+	for (unsigned int i = 0; i < code->op_count; ++i)
+	{
+		struct lusp_vm_op_t* op = &code->ops[i];
+
+		printf("%s%02d: ", indent, i);
+
+		switch (op->opcode)
+		{
+		case LUSP_VMOP_LOAD_CONST:
+			printf("load_const r%d, %p [ ", op->reg, op->load_const.object);
+			lusp_write(*op->load_const.object);
+			printf(" ]\n");
+			break;
+
+		case LUSP_VMOP_LOAD_GLOBAL:
+			printf("load_global r%d, g%d [ %s ]\n", op->reg, op->loadstore_global.index, code->global_names[op->loadstore_global.index]->name);
+			break;
+
+		case LUSP_VMOP_STORE_GLOBAL:
+			printf("store_global g%d [ %s ], r%d\n", op->loadstore_global.index, code->global_names[op->loadstore_global.index]->name, op->reg);
+			break;
+
+		case LUSP_VMOP_LOAD_UPVAL:
+			printf("load_upval r%d, u%d\n", op->reg, op->loadstore_upval.index);
+			break;
+
+		case LUSP_VMOP_STORE_UPVAL:
+			printf("store_upval u%d, r%d\n", op->loadstore_upval.index, op->reg);
+			break;
+
+		case LUSP_VMOP_MOVE:
+			printf("move r%d, r%d\n", op->reg, op->move.index);
+			break;
+
+		case LUSP_VMOP_CALL:
+			printf("call r%d, r%d, %d\n", op->reg, op->call.args, op->call.count);
+			break;
+
+		case LUSP_VMOP_RETURN:
+			printf("return r%d\n", op->reg);
+			break;
+
+		case LUSP_VMOP_JUMP:
+			printf("jump %+d\n", op->jump.offset);
+			break;
+
+		case LUSP_VMOP_JUMP_IF:
+			printf("jump_if r%d, %+d\n", op->reg, op->jump.offset);
+			break;
+
+		case LUSP_VMOP_JUMP_IFNOT:
+			printf("jump_ifnot r%d, %+d\n", op->reg, op->jump.offset);
+			break;
+
+		case LUSP_VMOP_CREATE_CLOSURE:
+			printf("create_closure r%d, %p\n", op->reg, op->create_closure.code);
+
+			if (deep)
+			{
+				char new_indent[256];
+
+				// leave room for the extra tab
+				strncpy(new_indent, indent, sizeof(new_indent) - 2);
+				new_indent[sizeof(new_indent) - 2] = 0;
+				strcat(new_indent, "\t");
+
+				dump_bytecode(op->create_closure.code, new_indent, deep);
+			}
+			break;
+
+		case LUSP_VMOP_CLOSE:
+			printf("close r%d\n", op->close.begin);
+			break;
+
+		case LUSP_VMOP_CREATE_VECTOR:
+			printf("create_vector r%d, r%d, %d\n", op->reg, op->create_vector.first, op->create_vector.count);
+			break;
+
+		case LUSP_VMOP_INDEX_GET:
+			printf("index_get r%d, r%d[r%d]\n", op->reg, op->index.object, op->index.key);
+			break;
+
+		case LUSP_VMOP_INDEX_SET:
+			printf("index_set r%d[r%d], r%d\n", op->index.object, op->index.key, op->reg);
+			break;
+
+		case LUSP_VMOP_ADD:
+			printf("add r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_SUBTRACT:
+			printf("subtract r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_MULTIPLY:
+			printf("multiply r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_DIVIDE:
+			printf("divide r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_MODULO:
+			printf("modulo r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_EQUAL:
+			printf("equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_NOT_EQUAL:
+			printf("not_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_LESS:
+			printf("less r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_LESS_EQUAL:
+			printf("less_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_GREATER:
+			printf("greater r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		case LUSP_VMOP_GREATER_EQUAL:
+			printf("greater_equal r%d, r%d, r%d\n", op->reg, op->binop.left, op->binop.right);
+			break;
+
+		default:
+			printf("unknown\n");
+		}
+	}
+}
+
+void lusp_dump_bytecode(struct lusp_vm_bytecode_t* code, bool deep)
+{
+	dump_bytecode(code, "", deep);
+}
+
+void lusp_setup_bytecode(struct lusp_vm_bytecode_t* code)
+{
+#if DL_WINDOWS
+	struct lusp_object_t lusp_eval_jit_x86_stub(struct lusp_state_t * state, struct lusp_vm_bytecode_t * code, struct lusp_vm_closure_t * closure, struct lusp_object_t * regs, unsigned int arg_count);
+
+	code->jit = lusp_eval_jit_x86_stub;
+	code->jit_exact = lusp_eval_jit_x86_stub;
+#else
+	code->jit = 0;
+	code->jit_exact = 0;
+#endif
+}
+
+bool lusp_is_valid_op(struct lusp_vm_bytecode_t* proto, unsigned int index, struct lusp_vm_op_t* op, unsigned int global_count)
+{
+	unsigned int reg_count = proto->reg_count;
+
+	switch (op->opcode)
+	{
+	case LUSP_VMOP_LOAD_CONST:
+	case LUSP_VMOP_CREATE_CLOSURE:
+	case LUSP_VMOP_RETURN:
+		return op->reg < reg_count;
+
+	case LUSP_VMOP_LOAD_GLOBAL:
+	case LUSP_VMOP_STORE_GLOBAL:
+		return op->reg < reg_count && op->loadstore_global.index < global_count;
+
+	case LUSP_VMOP_LOAD_UPVAL:
+	case LUSP_VMOP_STORE_UPVAL:
+		return op->reg < reg_count && op->loadstore_upval.index < proto->upval_count;
+
+	case LUSP_VMOP_MOVE:
+		return op->reg < reg_count && op->move.index < reg_count;
+
+	case LUSP_VMOP_CALL:
+		// call frame occupies two registers below the arguments
+		return op->reg < reg_count && op->call.args >= 2 && op->call.args + op->call.count <= reg_count;
+
+	case LUSP_VMOP_JUMP:
+	case LUSP_VMOP_JUMP_IF:
+	case LUSP_VMOP_JUMP_IFNOT:
+		// jumps only go forward, so calls remain the only way to repeat code
+		return (op->opcode == LUSP_VMOP_JUMP || op->reg < reg_count) && op->jump.offset >= 0 &&
+		       (unsigned int)op->jump.offset < proto->op_count - index - 1;
+
+	case LUSP_VMOP_CLOSE:
+		return op->close.begin <= reg_count;
+
+	case LUSP_VMOP_CREATE_VECTOR:
+		return op->reg < reg_count && op->create_vector.first + op->create_vector.count <= reg_count;
+
+	case LUSP_VMOP_INDEX_GET:
+	case LUSP_VMOP_INDEX_SET:
+		return op->reg < reg_count && op->index.object < reg_count && op->index.key < reg_count;
+
+	default:
+		return op->opcode <= LUSP_VMOP_GREATER_EQUAL && op->reg < reg_count && op->binop.left < reg_count && op->binop.right < reg_count;
+	}
+}
+
+bool lusp_has_valid_captures(struct lusp_vm_bytecode_t* protos, unsigned int proto_count)
+{
+	// closure op is followed by a capture op for every upvalue of the created proto
+	for (unsigned int i = 0; i < proto_count; ++i)
+	{
+		struct lusp_vm_bytecode_t* proto = &protos[i];
+
+		for (unsigned int j = 0; j < proto->op_count; ++j)
+		{
+			if (proto->ops[j].opcode != LUSP_VMOP_CREATE_CLOSURE) continue;
+
+			unsigned int upval_count = proto->ops[j].create_closure.code->upval_count;
+
+			if (upval_count >= proto->op_count - j) return false;
+
+			for (unsigned int k = 1; k <= upval_count; ++k)
+				if (proto->ops[j + k].opcode != LUSP_VMOP_MOVE && proto->ops[j + k].opcode != LUSP_VMOP_LOAD_UPVAL)
+					return false;
+		}
+	}
+
+	return true;
+}
+
+struct lusp_vm_globals_t* lusp_bind_globals(struct lusp_vm_bytecode_t* code, struct lusp_environment_t* env)
+{
+	struct lusp_vm_globals_t* globals = (struct lusp_vm_globals_t*)lusp_memory_allocate(offsetof(struct lusp_vm_globals_t, slots) + sizeof(struct lusp_environment_slot_t*) * code->global_count);
+	assert(globals);
+
+	globals->env = env;
+
+	for (unsigned int i = 0; i < code->global_count; ++i)
+	{
+		struct lusp_object_t name;
+		name.type = LUSP_OBJECT_SYMBOL;
+		name.symbol = code->global_names[i];
+
+		globals->slots[i] = lusp_environment_get_slot(env, name);
+	}
+
+	return globals;
+}
+
+struct lusp_object_t lusp_bind_bytecode(struct lusp_vm_bytecode_t* code, struct lusp_environment_t* env)
+{
+	return lusp_mkclosure(code, lusp_bind_globals(code, env), 0);
+}
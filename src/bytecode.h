@@ -1,142 +1,194 @@
-#pragma once
-
-#include "object.h"
-
-#include <stdint.h>
-
-struct lusp_environment_t;
-struct lusp_environment_slot_t;
-struct lusp_vm_bytecode_t;
-
-enum lusp_vm_opcode_t
-{
-	LUSP_VMOP_LOAD_CONST,
-	LUSP_VMOP_LOAD_GLOBAL,
-	LUSP_VMOP_STORE_GLOBAL,
-	LUSP_VMOP_LOAD_UPVAL,
-	LUSP_VMOP_STORE_UPVAL,
-	LUSP_VMOP_MOVE,
-	LUSP_VMOP_CALL,
-	LUSP_VMOP_RETURN,
-	LUSP_VMOP_JUMP,
-	LUSP_VMOP_JUMP_IF,
-	LUSP_VMOP_JUMP_IFNOT,
-	LUSP_VMOP_CREATE_CLOSURE,
-	LUSP_VMOP_CLOSE,
-
-	LUSP_VMOP_ADD,
-	LUSP_VMOP_SUBTRACT,
-	LUSP_VMOP_MULTIPLY,
-	LUSP_VMOP_DIVIDE,
-	LUSP_VMOP_MODULO,
-	LUSP_VMOP_EQUAL,
-	LUSP_VMOP_NOT_EQUAL,
-	LUSP_VMOP_LESS,
-	LUSP_VMOP_LESS_EQUAL,
-	LUSP_VMOP_GREATER,
-	LUSP_VMOP_GREATER_EQUAL
-};
-
-struct lusp_vm_op_t
-{
-	uint8_t opcode;
-	uint8_t padding;
-	uint16_t reg;
-
-	union {
-		struct
-		{
-			struct lusp_object_t* object;
-		} load_const;
-
-		struct
-		{
-			struct lusp_environment_slot_t* slot;
-		} loadstore_global;
-
-		struct
-		{
-			unsigned int index;
-		} loadstore_upval;
-
-		struct
-		{
-			unsigned int index;
-		} move;
-
-		struct
-		{
-			uint16_t args;
-			uint16_t count;
-		} call;
-
-		struct
-		{
-			int offset;
-		} jump;
-
-		struct
-		{
-			struct lusp_vm_bytecode_t* code;
-		} create_closure;
-
-		struct
-		{
-			unsigned int begin;
-		} close;
-
-		struct
-		{
-			uint16_t left;
-			uint16_t right;
-		} binop;
-
-		uint32_t dummy;
-	};
-};
-
-struct lusp_vm_upval_t
-{
-	struct lusp_object_t* ref;
-
-	union {
-		// for closed upval
-		struct lusp_object_t object;
-
-		// for open upval
-		struct lusp_vm_upval_t* next;
-	};
-};
-
-struct lusp_vm_bytecode_t;
-
-struct lusp_vm_closure_t
-{
-	struct lusp_vm_bytecode_t* code;
-	struct lusp_vm_upval_t* upvals[1];
-};
-
-struct lusp_vm_call_frame_t
-{
-	struct lusp_object_t* regs;
-	struct lusp_vm_closure_t* closure;
-	struct lusp_vm_op_t* pc;
-};
-
-typedef struct lusp_object_t (*lusp_vm_evaluator_t)(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
-
-struct lusp_vm_bytecode_t
-{
-	struct lusp_environment_t* env;
-
-	unsigned int reg_count;
-	unsigned int upval_count;
-
-	struct lusp_vm_op_t* ops;
-	unsigned int op_count;
-
-	void* jit;
-};
-
-void lusp_dump_bytecode(struct lusp_vm_bytecode_t* code, bool deep);
-void lusp_setup_bytecode(struct lusp_vm_bytecode_t* code);
+#pragma once
+
+#include "object.h"
+
+#include <stdint.h>
+
+struct lusp_environment_t;
+struct lusp_environment_slot_t;
+struct lusp_state_t;
+struct lusp_vm_bytecode_t;
+
+enum lusp_vm_opcode_t
+{
+	LUSP_VMOP_LOAD_CONST,
+	LUSP_VMOP_LOAD_GLOBAL,
+	LUSP_VMOP_STORE_GLOBAL,
+	LUSP_VMOP_LOAD_UPVAL,
+	LUSP_VMOP_STORE_UPVAL,
+	LUSP_VMOP_MOVE,
+	LUSP_VMOP_CALL,
+	LUSP_VMOP_RETURN,
+	LUSP_VMOP_JUMP,
+	LUSP_VMOP_JUMP_IF,
+	LUSP_VMOP_JUMP_IFNOT,
+	LUSP_VMOP_CREATE_CLOSURE,
+	LUSP_VMOP_CLOSE,
+	LUSP_VMOP_CREATE_VECTOR,
+	LUSP_VMOP_INDEX_GET,
+	LUSP_VMOP_INDEX_SET,
+
+	LUSP_VMOP_ADD,
+	LUSP_VMOP_SUBTRACT,
+	LUSP_VMOP_MULTIPLY,
+	LUSP_VMOP_DIVIDE,
+	LUSP_VMOP_MODULO,
+	LUSP_VMOP_EQUAL,
+	LUSP_VMOP_NOT_EQUAL,
+	LUSP_VMOP_LESS,
+	LUSP_VMOP_LESS_EQUAL,
+	LUSP_VMOP_GREATER,
+	LUSP_VMOP_GREATER_EQUAL
+};
+
+// operand types observed by interpreter for arithmetic and comparison ops; feedback is read and written with relaxed
+// atomics, threads that share bytecode may lose each other's updates, which is harmless since JIT guards all
+// specialized paths
+enum lusp_vm_feedback_t
+{
+	LUSP_VM_FEEDBACK_INTEGER = 1 << 0, // both operands are integers
+	LUSP_VM_FEEDBACK_REAL = 1 << 1,    // both operands are reals
+	LUSP_VM_FEEDBACK_OTHER = 1 << 2,   // mixed or non-numeric operands
+};
+
+struct lusp_vm_op_t
+{
+	uint8_t opcode;
+	uint8_t feedback;
+	uint16_t reg;
+
+	union {
+		struct
+		{
+			struct lusp_object_t* object;
+		} load_const;
+
+		struct
+		{
+			unsigned int index;
+		} loadstore_global;
+
+		struct
+		{
+			unsigned int index;
+		} loadstore_upval;
+
+		struct
+		{
+			unsigned int index;
+		} move;
+
+		struct
+		{
+			uint16_t args;
+			uint16_t count;
+		} call;
+
+		struct
+		{
+			int offset;
+		} jump;
+
+		struct
+		{
+			struct lusp_vm_bytecode_t* code;
+		} create_closure;
+
+		struct
+		{
+			unsigned int begin;
+		} close;
+
+		struct
+		{
+			uint16_t first;
+			uint16_t count;
+		} create_vector;
+
+		struct
+		{
+			uint16_t object;
+			uint16_t key;
+		} index;
+
+		struct
+		{
+			uint16_t left;
+			uint16_t right;
+		} binop;
+
+		uint32_t dummy;
+	};
+};
+
+struct lusp_vm_upval_t
+{
+	struct lusp_object_t* ref;
+
+	union {
+		// for closed upval
+		struct lusp_object_t object;
+
+		// for open upval
+		struct lusp_vm_upval_t* next;
+	};
+};
+
+// global slots of a program resolved in an environment, indexed by global ops; shared by closures of the program
+struct lusp_vm_globals_t
+{
+	struct lusp_environment_t* env;
+	struct lusp_environment_slot_t* slots[1];
+};
+
+struct lusp_vm_closure_t
+{
+	struct lusp_vm_bytecode_t* code;
+	struct lusp_vm_globals_t* globals;
+	struct lusp_vm_upval_t* upvals[1];
+};
+
+struct lusp_vm_call_frame_t
+{
+	struct lusp_object_t* regs;
+	struct lusp_vm_closure_t* closure;
+	struct lusp_vm_op_t* pc;
+};
+
+typedef struct lusp_object_t (*lusp_vm_evaluator_t)(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+
+// bytecode is immutable apart from type feedback and can be shared by threads and environments
+struct lusp_vm_bytecode_t
+{
+	// names of globals used by the program, shared by all of its functions
+	struct lusp_symbol_t** global_names;
+	unsigned int global_count;
+
+	unsigned int reg_count;
+	unsigned int upval_count;
+	unsigned int param_count;
+
+	struct lusp_vm_op_t* ops;
+	unsigned int op_count;
+
+	// generic entry (handles any argument count) and exact-arity entry (assumes arg_count == param_count)
+	void* jit;
+	void* jit_exact;
+};
+
+void lusp_dump_bytecode(struct lusp_vm_bytecode_t* code, bool deep);
+void lusp_setup_bytecode(struct lusp_vm_bytecode_t* code);
+
+// checks for loaders of untrusted bytecode: register, upvalue, global and jump operands of op at index have to be in
+// range for proto; constant and closure operands are stored differently by every loader and are checked by the caller
+bool lusp_is_valid_op(struct lusp_vm_bytecode_t* proto, unsigned int index, struct lusp_vm_op_t* op, unsigned int global_count);
+
+// checks that every closure op of protos is followed by a capture op for every upvalue of the created proto; closure
+// operands have to point to valid protos
+bool lusp_has_valid_captures(struct lusp_vm_bytecode_t* protos, unsigned int proto_count);
+
+// resolves global names of program code in env; the result can be shared by any number of closures of the program
+struct lusp_vm_globals_t* lusp_bind_globals(struct lusp_vm_bytecode_t* code, struct lusp_environment_t* env);
+
+// creates top-level closure that runs program code with globals resolved in env
+struct lusp_object_t lusp_bind_bytecode(struct lusp_vm_bytecode_t* code, struct lusp_environment_t* env);
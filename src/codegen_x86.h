@@ -1,74 +1,150 @@
-#pragma once
-
-#define CODE() code
-#define EMIT8(value) (*code++ = (uint8_t)(value), (uint8_t*)0)
-#define EMIT32(value) (*(uint32_t*)code = (uint32_t)(uintptr_t)(value), code += sizeof(uint32_t), (uint8_t*)0)
-
-#define MODRMSIB(mod, spare, reg) EMIT8((mod << 6) | (spare << 3) | reg) \
-                                  , (reg == ESP ? EMIT8(0x24) : (uint8_t*)0)
-#define PREG_OFF(reg, offset, spare) ((offset) == 0 ? MODRMSIB(0, spare, reg) : (char)(offset) == (int)(offset) ? (MODRMSIB(1, spare, reg), EMIT8(offset)) : (MODRMSIB(2, spare, reg), EMIT32(offset)))
-
-#define EAX 0
-#define ECX 1
-#define EDX 2
-#define EBX 3
-#define ESP 4
-#define EBP 5
-#define ESI 6
-#define EDI 7
-
-#define RET() EMIT8(0xc3)
-
-#define MOV_REG_IMM(reg, value) EMIT8(0xb8 + reg) \
-                                , EMIT32(value)
-#define MOV_REG_PIMM(reg, addr) (reg == EAX ? EMIT8(0xa1) : (EMIT8(0x3e), EMIT8(0x8b), EMIT8((reg << 3) + 5))), EMIT32(addr)
-#define MOV_PIMM_REG(addr, reg) (reg == EAX ? EMIT8(0xa3) : (EMIT8(0x3e), EMIT8(0x89), EMIT8((reg << 3) + 5))), EMIT32(addr)
-#define MOV_REG_REG(reg1, reg2) EMIT8(0x8b) \
-                                , EMIT8(0xc0 + (reg1 << 3) + reg2)
-#define MOV_PREG_OFF_REG(reg1, offset, reg2) EMIT8(0x89) \
-                                             , PREG_OFF(reg1, offset, reg2)
-#define MOV_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x8b) \
-                                             , PREG_OFF(reg2, offset, reg1)
-
-#define LEA_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x8d) \
-                                             , PREG_OFF(reg2, offset, reg1)
-
-#define ADD_REG_IMM8(reg, value) EMIT8(0x83) \
-                                 , EMIT8(0xc0 + reg), EMIT8(value)
-#define ADD_REG_REG(reg1, reg2) EMIT8(0x03) \
-                                , EMIT8(0xc0 + (reg1 << 3) + reg2)
-
-#define SHL_REG_IMM8(reg, value) EMIT8(0xc1) \
-                                 , EMIT8(0xe0 + reg), EMIT8(value)
-
-#define PUSH_IMM(value) ((char)(intptr_t)(value) == (int)(intptr_t)(value) ? (EMIT8(0x6a), EMIT8(value)) : (EMIT8(0x68), EMIT32(value)))
-#define PUSH_REG(reg) EMIT8(0x50 + reg)
-#define POP_REG(reg) EMIT8(0x58 + reg)
-
-#define JMP_IMM32(offset) EMIT8(0xe9) \
-                          , EMIT32(offset)
-#define JMP_FUNC(func) JMP_IMM32((uint8_t*)func - CODE() - 4)
-
-#define JE_IMM32(offset) EMIT8(0x0f) \
-                         , EMIT8(0x84), EMIT32(offset)
-#define JNE_IMM32(offset) EMIT8(0x0f) \
-                          , EMIT8(0x85), EMIT32(offset)
-
-#define JMP_IMM8(label) EMIT8(0xeb) \
-                        , label = CODE(), EMIT8(0)
-#define JE_IMM8(label) EMIT8(0x74) \
-                       , label = CODE(), EMIT8(0)
-#define JNE_IMM8(label) EMIT8(0x75) \
-                        , label = CODE(), EMIT8(0)
-
-#define LABEL8(label) *(uint8_t*)label = (uint8_t)(uintptr_t)(CODE() - label - 1)
-#define LABEL32(label, code) *(uint32_t*)label = (uint32_t)(uintptr_t)(code - label - 4)
-
-#define CMP_REG_IMM8(reg, value) EMIT8(0x83) \
-                                 , EMIT8(0xF8 + reg), EMIT8(value)
-
-#define CALL_REG(reg) EMIT8(0xff) \
-                      , EMIT8(0xd0 + reg)
-#define CALL_IMM32(offset) EMIT8(0xe8) \
-                           , EMIT32(offset)
-#define CALL_FUNC(func) CALL_IMM32((uint8_t*)func - CODE() - 4)
+#pragma once
+
+#define CODE() code
+#define EMIT8(value) (*code++ = (uint8_t)(value), (uint8_t*)0)
+#define EMIT32(value) (*(uint32_t*)code = (uint32_t)(uintptr_t)(value), code += sizeof(uint32_t), (uint8_t*)0)
+
+#define MODRMSIB(mod, spare, reg) EMIT8((mod << 6) | (spare << 3) | reg) \
+                                  , (reg == ESP ? EMIT8(0x24) : (uint8_t*)0)
+#define PREG_OFF(reg, offset, spare) ((offset) == 0 ? MODRMSIB(0, spare, reg) : (char)(offset) == (int)(offset) ? (MODRMSIB(1, spare, reg), EMIT8(offset)) : (MODRMSIB(2, spare, reg), EMIT32(offset)))
+
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define ESP 4
+#define EBP 5
+#define ESI 6
+#define EDI 7
+
+#define RET() EMIT8(0xc3)
+
+#define MOV_REG_IMM(reg, value) EMIT8(0xb8 + reg) \
+                                , EMIT32(value)
+#define MOV_REG_PIMM(reg, addr) (reg == EAX ? EMIT8(0xa1) : (EMIT8(0x3e), EMIT8(0x8b), EMIT8((reg << 3) + 5))), EMIT32(addr)
+#define MOV_PIMM_REG(addr, reg) (reg == EAX ? EMIT8(0xa3) : (EMIT8(0x3e), EMIT8(0x89), EMIT8((reg << 3) + 5))), EMIT32(addr)
+#define MOV_REG_REG(reg1, reg2) EMIT8(0x8b) \
+                                , EMIT8(0xc0 + (reg1 << 3) + reg2)
+#define MOV_PREG_OFF_REG(reg1, offset, reg2) EMIT8(0x89) \
+                                             , PREG_OFF(reg1, offset, reg2)
+#define MOV_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x8b) \
+                                             , PREG_OFF(reg2, offset, reg1)
+
+#define MOV_PREG_OFF_IMM(reg, offset, value) EMIT8(0xc7) \
+                                             , PREG_OFF(reg, offset, 0), EMIT32(value)
+
+#define LEA_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x8d) \
+                                             , PREG_OFF(reg2, offset, reg1)
+
+#define ADD_REG_IMM8(reg, value) EMIT8(0x83) \
+                                 , EMIT8(0xc0 + reg), EMIT8(value)
+#define ADD_REG_REG(reg1, reg2) EMIT8(0x03) \
+                                , EMIT8(0xc0 + (reg1 << 3) + reg2)
+#define ADD_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x03) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define ADC_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x13) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define SUB_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x2b) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define SBB_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x1b) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define SUB_PREG_OFF_IMM8(reg, offset, value) EMIT8(0x83) \
+                                              , PREG_OFF(reg, offset, 5), EMIT8(value)
+#define SBB_PREG_OFF_IMM8(reg, offset, value) EMIT8(0x83) \
+                                              , PREG_OFF(reg, offset, 3), EMIT8(value)
+#define XOR_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x33) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define OR_REG_REG(reg1, reg2) EMIT8(0x0b) \
+                               , EMIT8(0xc0 + (reg1 << 3) + reg2)
+
+#define SHL_REG_IMM8(reg, value) EMIT8(0xc1) \
+                                 , EMIT8(0xe0 + reg), EMIT8(value)
+
+#define PUSH_IMM(value) ((char)(intptr_t)(value) == (int)(intptr_t)(value) ? (EMIT8(0x6a), EMIT8(value)) : (EMIT8(0x68), EMIT32(value)))
+#define PUSH_REG(reg) EMIT8(0x50 + reg)
+#define POP_REG(reg) EMIT8(0x58 + reg)
+
+#define JMP_IMM32(offset) EMIT8(0xe9) \
+                          , EMIT32(offset)
+#define JMP_FUNC(func) JMP_IMM32((uint8_t*)func - CODE() - 4)
+
+#define JE_IMM32(offset) EMIT8(0x0f) \
+                         , EMIT8(0x84), EMIT32(offset)
+#define JNE_IMM32(offset) EMIT8(0x0f) \
+                          , EMIT8(0x85), EMIT32(offset)
+#define JAE_IMM32(offset) EMIT8(0x0f) \
+                          , EMIT8(0x83), EMIT32(offset)
+
+#define JMP_IMM8(label) EMIT8(0xeb) \
+                        , label = CODE(), EMIT8(0)
+#define JE_IMM8(label) EMIT8(0x74) \
+                       , label = CODE(), EMIT8(0)
+#define JNE_IMM8(label) EMIT8(0x75) \
+                        , label = CODE(), EMIT8(0)
+#define JA_IMM8(label) EMIT8(0x77) \
+                       , label = CODE(), EMIT8(0)
+#define JO_IMM8(label) EMIT8(0x70) \
+                       , label = CODE(), EMIT8(0)
+#define JNS_IMM8(label) EMIT8(0x79) \
+                        , label = CODE(), EMIT8(0)
+
+#define LABEL8(label) *(uint8_t*)label = (uint8_t)(uintptr_t)(CODE() - label - 1)
+#define LABEL32(label, code) *(uint32_t*)label = (uint32_t)(uintptr_t)(code - label - 4)
+
+#define CMP_REG_IMM8(reg, value) EMIT8(0x83) \
+                                 , EMIT8(0xF8 + reg), EMIT8(value)
+#define CMP_REG_IMM32(reg, value) EMIT8(0x81) \
+                                  , EMIT8(0xF8 + reg), EMIT32(value)
+#define CMP_PREG_OFF_IMM32(reg, offset, value) EMIT8(0x81) \
+                                               , PREG_OFF(reg, offset, 7), EMIT32(value)
+#define CMP_REG_PREG_OFF(reg1, reg2, offset) EMIT8(0x3b) \
+                                             , PREG_OFF(reg2, offset, reg1)
+#define CMP_REG_REG(reg1, reg2) EMIT8(0x3b) \
+                                , EMIT8(0xc0 + (reg1 << 3) + reg2)
+
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_L 0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G 0xf
+
+#define SETCC_REG8(cc, reg) EMIT8(0x0f) \
+                            , EMIT8(0x90 + cc), EMIT8(0xc0 + reg)
+#define MOVZX_REG_REG8(reg1, reg2) EMIT8(0x0f) \
+                                   , EMIT8(0xb6), EMIT8(0xc0 + (reg1 << 3) + reg2)
+
+#define XMM0 0
+
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5c
+#define SSE_DIV 0x5e
+
+#define MOVUPS_XMM_PREG_OFF(xmm, reg, offset) EMIT8(0x0f) \
+                                              , EMIT8(0x10), PREG_OFF(reg, offset, xmm)
+#define MOVUPS_PREG_OFF_XMM(reg, offset, xmm) EMIT8(0x0f) \
+                                              , EMIT8(0x11), PREG_OFF(reg, offset, xmm)
+#define MOVUPS_XMM_PIMM(xmm, addr) EMIT8(0x0f) \
+                                   , EMIT8(0x10), EMIT8((xmm << 3) + 5), EMIT32(addr)
+#define MOVUPS_PIMM_XMM(addr, xmm) EMIT8(0x0f) \
+                                   , EMIT8(0x11), EMIT8((xmm << 3) + 5), EMIT32(addr)
+
+#define MOVSD_XMM_PREG_OFF(xmm, reg, offset) EMIT8(0xf2) \
+                                             , EMIT8(0x0f), EMIT8(0x10), PREG_OFF(reg, offset, xmm)
+#define MOVSD_PREG_OFF_XMM(reg, offset, xmm) EMIT8(0xf2) \
+                                             , EMIT8(0x0f), EMIT8(0x11), PREG_OFF(reg, offset, xmm)
+#define SSEOPSD_XMM_PREG_OFF(sseop, xmm, reg, offset) EMIT8(0xf2) \
+                                                      , EMIT8(0x0f), EMIT8(sseop), PREG_OFF(reg, offset, xmm)
+#define COMISD_XMM_PREG_OFF(xmm, reg, offset) EMIT8(0x66) \
+                                              , EMIT8(0x0f), EMIT8(0x2f), PREG_OFF(reg, offset, xmm)
+
+#define CALL_REG(reg) EMIT8(0xff) \
+                      , EMIT8(0xd0 + reg)
+#define CALL_IMM32(offset) EMIT8(0xe8) \
+                           , EMIT32(offset)
+#define CALL_FUNC(func) CALL_IMM32((uint8_t*)func - CODE() - 4)
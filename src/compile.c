@@ -1,36 +1,395 @@
-#include "compile.h"
-
-#include "compiler.h"
-#include "lexer.h"
-
-#include <setjmp.h>
-#include <stdarg.h>
-#include <stdio.h>
-
-void error_handler(struct lusp_lexer_t* lexer, const char* message, ...)
-{
-	printf("error: compile failed (");
-
-	va_list list;
-
-	va_start(list, message);
-	vprintf(message, list);
-	va_end(list);
-
-	printf(") at line %d\n", lexer->lexeme_line);
-
-	longjmp(*(jmp_buf*)lexer->error_context, 1);
-}
-
-struct lusp_object_t lusp_compile(struct lusp_environment_t* env, struct mem_arena_t* arena, const char* string, unsigned int flags)
-{
-	jmp_buf buf;
-	if (setjmp(buf))
-		return lusp_mknull();
-
-	struct lusp_lexer_t lexer;
-	lusp_lexer_init(&lexer, string, &buf, error_handler);
-
-	struct lusp_object_t bytecode = lusp_compile_ex(env, &lexer, arena, flags);
-	return bytecode;
-}
+#include "compile.h"
+
+#include "arena.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "memory.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+void error_handler(struct lusp_lexer_t* lexer, const char* message, ...)
+{
+	printf("error: compile failed (");
+
+	va_list list;
+
+	va_start(list, message);
+	vprintf(message, list);
+	va_end(list);
+
+	printf(") at line %d\n", lexer->lexeme_line);
+
+	longjmp(*(jmp_buf*)lexer->error_context, 1);
+}
+
+// globals of a cached program resolved in one environment; every environment that compiles the source gets one
+struct cache_binding_t
+{
+	struct cache_binding_t* next;
+
+	struct lusp_vm_globals_t* globals;
+};
+
+// compile cache entries are in a chained hash table; entries stay until the cache is cleared
+struct cache_entry_t
+{
+	struct cache_entry_t* chain;
+
+	uint32_t hash;
+	unsigned int flags;
+
+	struct lusp_vm_bytecode_t* code;
+	struct cache_binding_t* bindings;
+
+	unsigned int length;
+	char source[1];
+};
+
+static struct cache_entry_t** g_cache_buckets;
+static unsigned int g_cache_bucket_count;
+
+static struct lusp_compile_cache_stats_t g_cache_stats;
+
+// protects all cache state; compilation itself runs outside of the lock
+static struct lusp_lock_t g_cache_lock;
+
+static uint32_t hash_key(const char* string, unsigned int length, unsigned int flags)
+{
+	uint32_t hash = lusp_hash_string(string, length);
+
+	// mix in flags
+	uint64_t key = ((uint64_t)flags << 48) ^ hash;
+
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+
+	return (uint32_t)key;
+}
+
+static size_t get_bytecode_size(struct lusp_vm_bytecode_t* code)
+{
+	size_t result = sizeof(struct lusp_vm_bytecode_t) + sizeof(struct lusp_vm_op_t) * code->op_count;
+
+	for (unsigned int i = 0; i < code->op_count; ++i)
+		if (code->ops[i].opcode == LUSP_VMOP_CREATE_CLOSURE)
+			result += get_bytecode_size(code->ops[i].create_closure.code);
+
+	return result;
+}
+
+static size_t get_binding_size(struct lusp_vm_bytecode_t* code)
+{
+	return sizeof(struct cache_binding_t) + offsetof(struct lusp_vm_globals_t, slots) + sizeof(struct lusp_environment_slot_t*) * code->global_count;
+}
+
+static bool cache_fits(size_t size)
+{
+	if (g_cache_stats.size + size <= g_cache_stats.budget) return true;
+
+	g_cache_stats.rejections++;
+	return false;
+}
+
+static void cache_grow()
+{
+	unsigned int bucket_count = g_cache_bucket_count ? g_cache_bucket_count * 2 : 64;
+
+	struct cache_entry_t** buckets = (struct cache_entry_t**)lusp_memory_allocate(sizeof(struct cache_entry_t*) * bucket_count);
+	assert(buckets);
+
+	memset(buckets, 0, sizeof(struct cache_entry_t*) * bucket_count);
+
+	for (unsigned int i = 0; i < g_cache_bucket_count; ++i)
+	{
+		for (struct cache_entry_t* entry = g_cache_buckets[i]; entry;)
+		{
+			struct cache_entry_t* next = entry->chain;
+			struct cache_entry_t** bucket = &buckets[entry->hash & (bucket_count - 1)];
+
+			entry->chain = *bucket;
+			*bucket = entry;
+
+			entry = next;
+		}
+	}
+
+	if (g_cache_buckets) lusp_memory_deallocate(g_cache_buckets);
+
+	g_cache_buckets = buckets;
+	g_cache_bucket_count = bucket_count;
+}
+
+static struct cache_entry_t* cache_find(uint32_t hash, const char* string, unsigned int length, unsigned int flags)
+{
+	if (!g_cache_buckets) return 0;
+
+	for (struct cache_entry_t* entry = g_cache_buckets[hash & (g_cache_bucket_count - 1)]; entry; entry = entry->chain)
+		if (entry->hash == hash && entry->flags == flags && entry->length == length &&
+		    memcmp(entry->source, string, length) == 0)
+			return entry;
+
+	return 0;
+}
+
+static struct cache_binding_t* cache_bind(struct cache_entry_t* entry, struct lusp_vm_globals_t* globals)
+{
+	struct cache_binding_t* binding = (struct cache_binding_t*)lusp_memory_allocate(sizeof(struct cache_binding_t));
+	assert(binding);
+
+	binding->next = entry->bindings;
+	binding->globals = globals;
+
+	entry->bindings = binding;
+
+	g_cache_stats.size += get_binding_size(entry->code);
+
+	return binding;
+}
+
+static void cache_insert(uint32_t hash, const char* string, unsigned int length, unsigned int flags, struct lusp_vm_bytecode_t* code, struct lusp_vm_globals_t* globals)
+{
+	size_t size = offsetof(struct cache_entry_t, source) + length + 1;
+
+	// another thread may have cached the same source
+	if (cache_find(hash, string, length, flags) || !cache_fits(size + get_bytecode_size(code) + get_binding_size(code))) return;
+
+	if (g_cache_stats.count >= g_cache_bucket_count) cache_grow();
+
+	struct cache_entry_t* entry = (struct cache_entry_t*)lusp_memory_allocate(size);
+	assert(entry);
+
+	entry->hash = hash;
+	entry->flags = flags;
+	entry->code = code;
+	entry->bindings = 0;
+	entry->length = length;
+
+	memcpy(entry->source, string, length + 1);
+
+	struct cache_entry_t** bucket = &g_cache_buckets[hash & (g_cache_bucket_count - 1)];
+
+	entry->chain = *bucket;
+	*bucket = entry;
+
+	g_cache_stats.count++;
+	g_cache_stats.size += size + get_bytecode_size(code);
+
+	cache_bind(entry, globals);
+}
+
+static void cache_clear()
+{
+	for (unsigned int i = 0; i < g_cache_bucket_count; ++i)
+	{
+		for (struct cache_entry_t* entry = g_cache_buckets[i]; entry;)
+		{
+			struct cache_entry_t* next = entry->chain;
+
+			// bytecode and globals are not freed since closures created from them may still be alive
+			for (struct cache_binding_t* binding = entry->bindings; binding;)
+			{
+				struct cache_binding_t* next_binding = binding->next;
+				lusp_memory_deallocate(binding);
+				binding = next_binding;
+			}
+
+			lusp_memory_deallocate(entry);
+
+			entry = next;
+		}
+	}
+
+	if (g_cache_buckets) lusp_memory_deallocate(g_cache_buckets);
+
+	g_cache_buckets = 0;
+	g_cache_bucket_count = 0;
+
+	g_cache_stats.count = 0;
+	g_cache_stats.size = 0;
+}
+
+void lusp_compile_cache_set_budget(size_t budget)
+{
+	lusp_lock_acquire(&g_cache_lock);
+
+	g_cache_stats.budget = budget;
+
+	if (g_cache_stats.size > budget) cache_clear();
+
+	lusp_lock_release(&g_cache_lock);
+}
+
+void lusp_compile_cache_clear()
+{
+	lusp_lock_acquire(&g_cache_lock);
+	cache_clear();
+	lusp_lock_release(&g_cache_lock);
+}
+
+void lusp_compile_cache_get_stats(struct lusp_compile_cache_stats_t* stats)
+{
+	lusp_lock_acquire(&g_cache_lock);
+	*stats = g_cache_stats;
+	lusp_lock_release(&g_cache_lock);
+}
+
+static struct lusp_object_t compile(struct lusp_environment_t* env, struct mem_arena_t* arena, const char* string, unsigned int flags)
+{
+	struct lusp_lexer_t lexer;
+
+	jmp_buf buf;
+	if (setjmp(buf))
+	{
+		lusp_lexer_term(&lexer);
+		return lusp_mknull();
+	}
+
+	lusp_lexer_init(&lexer, string, &buf, error_handler);
+
+	struct lusp_object_t bytecode = lusp_compile_ex(env, &lexer, arena, flags);
+
+	lusp_lexer_term(&lexer);
+	return bytecode;
+}
+
+struct lusp_object_t lusp_compile(struct lusp_environment_t* env, struct mem_arena_t* arena, const char* string, unsigned int flags)
+{
+	lusp_lock_acquire(&g_cache_lock);
+
+	if (g_cache_stats.budget == 0)
+	{
+		lusp_lock_release(&g_cache_lock);
+		return compile(env, arena, string, flags);
+	}
+
+	unsigned int length = (unsigned int)strlen(string);
+	uint32_t hash = hash_key(string, length, flags);
+
+	struct cache_entry_t* entry = cache_find(hash, string, length, flags);
+
+	if (entry)
+	{
+		g_cache_stats.hits++;
+
+		// bytecode does not depend on the environment, so entries are shared by all environments; globals are resolved
+		// once per environment (slot creation locks environments, which never take the cache lock)
+		struct cache_binding_t* binding = entry->bindings;
+		while (binding && binding->globals->env != env) binding = binding->next;
+
+		struct lusp_vm_globals_t* globals = binding ? binding->globals : lusp_bind_globals(entry->code, env);
+
+		// globals for environments that don't fit the budget are resolved on every hit
+		if (!binding && cache_fits(get_binding_size(entry->code))) cache_bind(entry, globals);
+
+		struct lusp_object_t result = lusp_mkclosure(entry->code, globals, 0);
+
+		lusp_lock_release(&g_cache_lock);
+
+		return result;
+	}
+
+	g_cache_stats.misses++;
+
+	lusp_lock_release(&g_cache_lock);
+
+	struct lusp_object_t result = compile(env, arena, string, flags);
+
+	// compilation errors are not cached
+	if (result.type == LUSP_OBJECT_CLOSURE)
+	{
+		lusp_lock_acquire(&g_cache_lock);
+		cache_insert(hash, string, length, flags, result.closure->code, result.closure->globals);
+		lusp_lock_release(&g_cache_lock);
+	}
+
+	return result;
+}
+
+struct lusp_object_t lusp_compile_stream(struct lusp_environment_t* env, struct mem_arena_t* arena, lusp_lexer_refill_t refill, void* refill_context, unsigned int flags)
+{
+	struct lusp_lexer_t lexer;
+
+	jmp_buf buf;
+	if (setjmp(buf))
+	{
+		lusp_lexer_term(&lexer);
+		return lusp_mknull();
+	}
+
+	lusp_lexer_init_stream(&lexer, refill, refill_context, &buf, error_handler);
+
+	struct lusp_object_t bytecode = lusp_compile_ex(env, &lexer, arena, flags);
+
+	lusp_lexer_term(&lexer);
+	return bytecode;
+}
+
+struct batch_t
+{
+	struct lusp_environment_t* env;
+	unsigned int flags;
+
+	const char* const* sources;
+	struct lusp_object_t* results;
+	unsigned int count;
+
+	// index of the last source taken by a worker
+	volatile long next;
+};
+
+static void batch_worker(void* context)
+{
+	struct batch_t* batch = (struct batch_t*)context;
+
+	// each worker reuses its own arena for compiler temporaries
+	struct mem_arena_t arena;
+	mem_arena_init(&arena, 65536);
+
+	for (;;)
+	{
+		long index = lusp_atomic_increment(&batch->next);
+		if (index >= (long)batch->count) break;
+
+		batch->results[index] = lusp_compile(batch->env, &arena, batch->sources[index], batch->flags);
+	}
+
+	mem_arena_term(&arena);
+}
+
+void lusp_compile_batch(struct lusp_environment_t* env, const char* const* sources, unsigned int count, unsigned int flags, unsigned int thread_count, struct lusp_object_t* results)
+{
+	struct batch_t batch = {env, flags, sources, results, count, -1};
+
+	if (thread_count == 0) thread_count = lusp_thread_get_processor_count();
+	if (thread_count > count) thread_count = count;
+
+	// calling thread works on the batch as well
+	struct lusp_thread_t** threads = 0;
+
+	if (thread_count > 1)
+	{
+		threads = (struct lusp_thread_t**)lusp_memory_allocate(sizeof(struct lusp_thread_t*) * (thread_count - 1));
+		assert(threads);
+
+		// threads that fail to start leave their share of the work to the others
+		for (unsigned int i = 0; i < thread_count - 1; ++i)
+			threads[i] = lusp_thread_create(batch_worker, &batch);
+	}
+
+	batch_worker(&batch);
+
+	if (threads)
+	{
+		for (unsigned int i = 0; i < thread_count - 1; ++i)
+			if (threads[i]) lusp_thread_join(threads[i]);
+
+		lusp_memory_deallocate(threads);
+	}
+}
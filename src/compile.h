@@ -1,16 +1,57 @@
-#pragma once
-
-#include "object.h"
-
-struct lusp_environment_t;
-struct mem_arena_t;
-
-enum
-{
-	LUSP_COMPILE_DEBUG_INFO = 1 << 0,
-	LUSP_COMPILE_OPTIMIZE = 1 << 1,
-
-	LUSP_COMPILE_DEFAULT = LUSP_COMPILE_DEBUG_INFO | LUSP_COMPILE_OPTIMIZE
-};
-
-struct lusp_object_t lusp_compile(struct lusp_environment_t* env, struct mem_arena_t* arena, const char* string, unsigned int flags);
+#pragma once
+
+#include "lexer.h"
+#include "object.h"
+
+#include <stddef.h>
+
+struct lusp_environment_t;
+struct mem_arena_t;
+
+enum
+{
+	LUSP_COMPILE_DEBUG_INFO = 1 << 0,
+	LUSP_COMPILE_OPTIMIZE = 1 << 1,
+
+	LUSP_COMPILE_DEFAULT = LUSP_COMPILE_DEBUG_INFO | LUSP_COMPILE_OPTIMIZE
+};
+
+// compiles code for environment; compiler temporaries are allocated from arena, or from a temporary arena if arena is 0,
+// and are released before returning; an arena can only be used by one thread at a time
+struct lusp_object_t lusp_compile(struct lusp_environment_t* env, struct mem_arena_t* arena, const char* string, unsigned int flags);
+
+// compiles input that is read in chunks with refill while compiling; streaming compiles bypass compile cache
+struct lusp_object_t lusp_compile_stream(struct lusp_environment_t* env, struct mem_arena_t* arena, lusp_lexer_refill_t refill, void* refill_context, unsigned int flags);
+
+// compiles sources into separate closures, using thread_count threads including the calling one (0 uses one thread
+// per processor); results are null for sources that fail to compile
+// compilation of different sources may run concurrently with each other and with compilation on other threads,
+// but not with evaluation or other modification of the environment
+void lusp_compile_batch(struct lusp_environment_t* env, const char* const* sources, unsigned int count, unsigned int flags, unsigned int thread_count, struct lusp_object_t* results);
+
+// compile cache maps source text and flags to compiled bytecode, which is shared by all environments, and keeps the
+// globals of every environment that compiled the source; it is disabled until a budget is set
+// there is no collector, so bytecode is never freed once closures are created from it: the cache keeps entries until
+// it is cleared rather than evicting and recompiling them, and sources compiled when the cache is full are not cached;
+// the budget bounds the memory retained by the cache, not the memory of compiles that bypass it
+struct lusp_compile_cache_stats_t
+{
+	unsigned int hits;
+	unsigned int misses;
+
+	// sources or environments that were not cached because the cache was full
+	unsigned int rejections;
+
+	unsigned int count;
+
+	// memory accounted to cached entries (source copies, bytecode and globals)
+	size_t size;
+	size_t budget;
+};
+
+// budgets below the current size clear the cache; 0 disables and clears the cache
+// clearing the cache releases the entries but not bytecode or globals, which closures may still reference
+void lusp_compile_cache_set_budget(size_t budget);
+void lusp_compile_cache_clear();
+
+void lusp_compile_cache_get_stats(struct lusp_compile_cache_stats_t* stats);
@@ -1,687 +1,926 @@
-#include "compiler.h"
-
-#include "bytecode.h"
-#include "compile.h"
-#include "environment.h"
-#include "memory.h"
-#include "object.h"
-
-#include "codegen.h"
-#include "internal.h"
-#include "lexer.h"
-
-#include <string.h>
-
-static inline struct binding_t* find_bind_local(struct scope_t* scope, struct lusp_object_t symbol)
-{
-	for (unsigned int i = 0; i < scope->bind_count; ++i)
-		if (scope->binds[i].symbol.symbol == symbol.symbol)
-			return &scope->binds[i];
-
-	return 0;
-}
-
-static inline struct binding_t* find_bind(struct compiler_t* compiler, struct lusp_object_t symbol, struct scope_t** scope)
-{
-	for (struct scope_t* current = compiler->scope; current; current = current->parent)
-	{
-		struct binding_t* result = find_bind_local(current, symbol);
-
-		if (result)
-		{
-			*scope = current;
-			return result;
-		}
-	}
-
-	return 0;
-}
-
-static inline unsigned int find_upval(struct compiler_t* compiler, struct scope_t* scope, struct binding_t* binding)
-{
-	// look for an existing upval
-	for (unsigned int i = 0; i < compiler->upval_count; ++i)
-		if (compiler->upvals[i].binding == binding)
-		{
-			assert(compiler->upvals[i].scope == scope);
-			return i;
-		}
-
-	// mark scope
-	scope->has_upvals = true;
-
-	// add new upval
-	compiler->upvals[compiler->upval_count].binding = binding;
-	compiler->upvals[compiler->upval_count].scope = scope;
-
-	return compiler->upval_count++;
-}
-
-static inline void push_scope(struct compiler_t* compiler, struct scope_t* scope)
-{
-	scope->parent = compiler->scope;
-	compiler->scope = scope;
-}
-
-static inline void pop_scope(struct compiler_t* compiler, unsigned int first_reg)
-{
-	struct scope_t* scope = compiler->scope;
-
-	// close bindings
-	if (scope->has_upvals) emit_close(compiler, first_reg);
-
-	compiler->scope = scope->parent;
-}
-
-static inline unsigned int allocate_registers(struct compiler_t* compiler, unsigned int count)
-{
-	unsigned int result = compiler->free_reg;
-	compiler->free_reg += count;
-	if (compiler->reg_count < compiler->free_reg)
-		compiler->reg_count = compiler->free_reg;
-	return result;
-}
-
-static inline struct binding_t* add_bind(struct compiler_t* compiler, struct scope_t* scope, struct lusp_object_t symbol)
-{
-	// allocate register
-	unsigned int reg = allocate_registers(compiler, 1);
-
-	// add binding
-	struct binding_t* bind = &scope->binds[scope->bind_count++];
-
-	bind->symbol = symbol;
-	bind->index = reg;
-
-	return bind;
-}
-
-static void create_compiler(struct compiler_t* compiler, struct compiler_t* parent)
-{
-	// create compiler
-	compiler->env = parent->env;
-	compiler->scope = parent->scope;
-	compiler->free_reg = 0;
-	compiler->reg_count = 0;
-	compiler->upval_count = 0;
-	compiler->op_count = 0;
-	compiler->flags = parent->flags;
-}
-
-static struct lusp_vm_bytecode_t* create_closure(struct compiler_t* compiler)
-{
-	// create new closure
-	unsigned int ops_size = compiler->op_count * sizeof(struct lusp_vm_op_t);
-
-	struct lusp_vm_op_t* ops = (struct lusp_vm_op_t*)lusp_memory_allocate(ops_size);
-	assert(ops);
-
-	memcpy(ops, compiler->ops, ops_size);
-
-	struct lusp_vm_bytecode_t* code = (struct lusp_vm_bytecode_t*)lusp_memory_allocate(sizeof(struct lusp_vm_bytecode_t));
-	assert(code);
-
-	code->env = compiler->env;
-	code->reg_count = compiler->reg_count;
-	code->upval_count = compiler->upval_count;
-	code->ops = ops;
-	code->op_count = compiler->op_count;
-
-	lusp_setup_bytecode(code);
-
-	return code;
-}
-
-static void compile_literal(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t object)
-{
-	struct lusp_object_t o = lusp_mkcons(object, object);
-
-	emit_load_const(compiler, reg, o.cons);
-}
-
-static void compile_bind_getset(struct compiler_t* compiler, unsigned int reg, struct scope_t* scope, struct binding_t* bind, bool set)
-{
-	if (scope->compiler == compiler)
-	{
-		// local variable
-		set ? emit_move(compiler, bind->index, reg) : emit_move(compiler, reg, bind->index);
-	}
-	else
-	{
-		// upvalue
-		unsigned int index = find_upval(compiler, scope, bind);
-
-		emit_loadstore_upval(compiler, reg, index, set);
-	}
-}
-
-static void compile_symbol_getset(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol, bool set)
-{
-	assert(symbol.type == LUSP_OBJECT_SYMBOL);
-
-	struct scope_t* scope = 0;
-	struct binding_t* bind = find_bind(compiler, symbol, &scope);
-
-	if (bind)
-	{
-		// local variable or upvalue
-		compile_bind_getset(compiler, reg, scope, bind, set);
-	}
-	else
-	{
-		// global variable
-		emit_loadstore_global(compiler, reg, lusp_environment_get_slot(compiler->env, symbol), set);
-	}
-}
-
-static void compile_symbol(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
-{
-	compile_symbol_getset(compiler, reg, symbol, false);
-}
-
-static void compile_expr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg);
-static void compile_block(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg);
-
-static void compile_literal_next(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t object)
-{
-	lusp_lexer_next(lexer);
-
-	return compile_literal(compiler, reg, object);
-}
-
-static void compile_call(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
-{
-	// skip open paren
-	assert(lexer->lexeme == LUSP_LEXEME_OPEN_PAREN);
-	lusp_lexer_next(lexer);
-
-	unsigned int free_reg = compiler->free_reg;
-
-	// allocate registers for call frame
-	unsigned int frame_regs = allocate_registers(compiler, 2);
-	unsigned int arg_regs = frame_regs + 2;
-	unsigned int last_arg_reg = arg_regs - 1; // does not really mean anything for first argument
-
-	while (lexer->lexeme != LUSP_LEXEME_CLOSE_PAREN)
-	{
-		// allocate register for new argument
-		unsigned int arg_reg = allocate_registers(compiler, 1);
-		assert(arg_reg == last_arg_reg + 1);
-		last_arg_reg = arg_reg;
-
-		// evaluate argument
-		compile_expr(lexer, compiler, arg_reg);
-
-		if (lexer->lexeme == LUSP_LEXEME_COMMA)
-			CHECK(lusp_lexer_next(lexer) != LUSP_LEXEME_CLOSE_PAREN, "expected argument after comma");
-		else
-			CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN, "comma or closing paren expected in argument list");
-	}
-
-	// skip close paren
-	assert(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN);
-	lusp_lexer_next(lexer);
-
-	// evaluate function
-	compile_symbol(compiler, reg, symbol);
-
-	// call function
-	unsigned int arg_count = last_arg_reg + 1 - arg_regs;
-
-	emit_call(compiler, reg, arg_regs, arg_count);
-
-	// free temporary registers
-	compiler->free_reg = free_reg;
-}
-
-static void compile_assign(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
-{
-	// skip assign sign
-	assert(lexer->lexeme == LUSP_LEXEME_ASSIGN);
-	lusp_lexer_next(lexer);
-
-	// evaluate expression
-	compile_expr(lexer, compiler, reg);
-
-	// assign
-	compile_symbol_getset(compiler, reg, symbol, true);
-}
-
-static void compile_let(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// skip let
-	assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_LET);
-	lusp_lexer_next(lexer);
-
-	// read symbol
-	CHECK(lexer->lexeme == LUSP_LEXEME_SYMBOL, "variable name expected after let");
-
-	struct lusp_object_t symbol = lusp_mksymbol(lexer->value.symbol);
-	lusp_lexer_next(lexer);
-
-	// add variable to current scope
-	CHECK(find_bind_local(compiler->scope, symbol) == 0, "%s: variable redefinition", symbol.symbol->name);
-
-	struct binding_t* bind = add_bind(compiler, compiler->scope, symbol);
-
-	// is it assigned right away?
-	if (lexer->lexeme == LUSP_LEXEME_ASSIGN)
-		compile_assign(lexer, compiler, reg, symbol);
-	else
-		emit_move(compiler, reg, bind->index);
-}
-
-static void compile_if(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// skip if
-	assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_IF);
-	lusp_lexer_next(lexer);
-
-	// evaluate condition
-	compile_expr(lexer, compiler, reg);
-
-	// jump over if code
-	unsigned int jump_ifnot_op = compiler->op_count;
-
-	emit_jump_ifnot(compiler, reg, 0);
-
-	// evaluate if code
-	compile_block(lexer, compiler, reg);
-
-	if (lexer->lexeme == LUSP_LEXEME_SYMBOL_ELSE)
-	{
-		// skip else
-		assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_ELSE);
-		lusp_lexer_next(lexer);
-
-		// jump over else code
-		unsigned int jump_op = compiler->op_count;
-
-		emit_jump(compiler, 0);
-
-		// evaluate else code
-		compile_block(lexer, compiler, reg);
-
-		// fixup jumps
-		fixup_jump(compiler, jump_ifnot_op, jump_op + 1);
-		fixup_jump(compiler, jump_op, compiler->op_count);
-	}
-	else
-	{
-		// fixup jumps
-		fixup_jump(compiler, jump_ifnot_op, compiler->op_count);
-	}
-}
-
-static void compile_list(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, enum lusp_lexeme_t stop_lexeme)
-{
-	if (lexer->lexeme == stop_lexeme) compile_literal(compiler, reg, lusp_mknull());
-
-	while (lexer->lexeme != stop_lexeme)
-		compile_expr(lexer, compiler, reg);
-}
-
-static void compile_block(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	if (lexer->lexeme == LUSP_LEXEME_OPEN_BRACE)
-	{
-		// skip open brace
-		assert(lexer->lexeme == LUSP_LEXEME_OPEN_BRACE);
-		lusp_lexer_next(lexer);
-
-		// compile block contents
-		compile_list(lexer, compiler, reg, LUSP_LEXEME_CLOSE_BRACE);
-
-		// skip close brace
-		assert(lexer->lexeme == LUSP_LEXEME_CLOSE_BRACE);
-		lusp_lexer_next(lexer);
-	}
-	else
-		compile_expr(lexer, compiler, reg);
-}
-
-static void compile_closure_body(struct lusp_lexer_t* lexer, struct compiler_t* compiler, bool global)
-{
-	// add new scope
-	struct scope_t scope;
-	scope.compiler = compiler;
-	scope.bind_count = 0;
-	scope.has_upvals = false;
-
-	// remember last free register (should always be 0?)
-	unsigned int free_reg = compiler->free_reg;
-
-	if (!global)
-	{
-		// skip vertical bar
-		assert(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR);
-		lusp_lexer_next(lexer);
-
-		// parse parameter list
-		while (lexer->lexeme != LUSP_LEXEME_VERTICAL_BAR)
-		{
-			// read symbol
-			CHECK(lexer->lexeme == LUSP_LEXEME_SYMBOL, "expected symbol");
-			struct lusp_object_t symbol = lusp_mksymbol(lexer->value.symbol);
-
-			lusp_lexer_next(lexer);
-
-			// add binding
-			struct binding_t* bind = add_bind(compiler, &scope, symbol);
-			assert(bind->index + 1 == scope.bind_count);
-
-			if (lexer->lexeme == LUSP_LEXEME_COMMA)
-				CHECK(lusp_lexer_next(lexer) == LUSP_LEXEME_SYMBOL, "expected symbol after comma");
-			else
-				CHECK(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR, "comma or vertical bar expected in parameter list");
-		}
-
-		// skip vertical bar
-		assert(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR);
-		lusp_lexer_next(lexer);
-	}
-
-	// allocate register for return value
-	unsigned int ret_reg = allocate_registers(compiler, 1);
-
-	// evaluate body in new scope
-	push_scope(compiler, &scope);
-	global ? compile_list(lexer, compiler, ret_reg, LUSP_LEXEME_EOF) : compile_block(lexer, compiler, ret_reg);
-	pop_scope(compiler, free_reg);
-
-	emit_return(compiler, ret_reg);
-}
-
-static void compile_closure(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// create new compiler
-	struct compiler_t child;
-
-	create_compiler(&child, compiler);
-
-	// compile closure
-	compile_closure_body(lexer, &child, false);
-
-	// create bytecode
-	struct lusp_vm_bytecode_t* bytecode = create_closure(&child);
-
-	// creeate closure
-	emit_create_closure(compiler, reg, bytecode);
-
-	// set upvalues
-	for (unsigned int i = 0; i < child.upval_count; ++i)
-	{
-		struct upval_t u = child.upvals[i];
-
-		compile_bind_getset(compiler, 0, u.scope, u.binding, false);
-	}
-}
-
-static void compile_parens(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// skip open paren
-	assert(lexer->lexeme == LUSP_LEXEME_OPEN_PAREN);
-	lusp_lexer_next(lexer);
-
-	// evaluate expression
-	compile_expr(lexer, compiler, reg);
-
-	// skip close paren
-	CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN, "expected close paren");
-	lusp_lexer_next(lexer);
-}
-
-static void compile_term(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	switch (lexer->lexeme)
-	{
-	case LUSP_LEXEME_LITERAL_BOOLEAN:
-		return compile_literal_next(lexer, compiler, reg, lusp_mkboolean(lexer->value.boolean));
-
-	case LUSP_LEXEME_LITERAL_INTEGER:
-		return compile_literal_next(lexer, compiler, reg, lusp_mkinteger(lexer->value.integer));
-
-	case LUSP_LEXEME_LITERAL_REAL:
-		return compile_literal_next(lexer, compiler, reg, lusp_mkreal(lexer->value.real));
-
-	case LUSP_LEXEME_LITERAL_STRING:
-		return compile_literal_next(lexer, compiler, reg, lusp_mkstring(lexer->value.string));
-
-	case LUSP_LEXEME_VERTICAL_BAR:
-		return compile_closure(lexer, compiler, reg);
-
-	case LUSP_LEXEME_OPEN_PAREN:
-		return compile_parens(lexer, compiler, reg);
-
-	case LUSP_LEXEME_SYMBOL:
-	{
-		struct lusp_object_t symbol = lusp_mksymbol(lexer->value.symbol);
-
-		switch (lusp_lexer_next(lexer))
-		{
-		case LUSP_LEXEME_OPEN_PAREN:
-			return compile_call(lexer, compiler, reg, symbol);
-
-		case LUSP_LEXEME_ASSIGN:
-			return compile_assign(lexer, compiler, reg, symbol);
-
-		default:
-			return compile_symbol(compiler, reg, symbol);
-		}
-	}
-	break;
-
-	default:
-		CHECK(false, "expected term");
-	}
-}
-
-static void compile_addexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// evaluate left expression
-	compile_term(lexer, compiler, reg);
-
-	while (lexer->lexeme == LUSP_LEXEME_ADD || lexer->lexeme == LUSP_LEXEME_SUBTRACT)
-	{
-		// consume lexeme
-		enum lusp_lexeme_t lexeme = lexer->lexeme;
-		lusp_lexer_next(lexer);
-
-		// allocate register
-		unsigned int free_reg = compiler->free_reg;
-		unsigned int temp_reg = allocate_registers(compiler, 1);
-
-		// evaluate right expression
-		compile_term(lexer, compiler, temp_reg);
-
-		// evaluate relop
-		switch (lexeme)
-		{
-		case LUSP_LEXEME_ADD:
-			emit_binop(compiler, LUSP_VMOP_ADD, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_SUBTRACT:
-			emit_binop(compiler, LUSP_VMOP_SUBTRACT, reg, reg, temp_reg);
-			break;
-
-		default:
-			assert(false);
-		}
-
-		// free register
-		compiler->free_reg = free_reg;
-	}
-}
-
-static void compile_mulexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// evaluate left expression
-	compile_addexpr(lexer, compiler, reg);
-
-	while (lexer->lexeme == LUSP_LEXEME_MULTIPLY || lexer->lexeme == LUSP_LEXEME_DIVIDE ||
-	       lexer->lexeme == LUSP_LEXEME_MODULO)
-	{
-		// consume lexeme
-		enum lusp_lexeme_t lexeme = lexer->lexeme;
-		lusp_lexer_next(lexer);
-
-		// allocate register
-		unsigned int free_reg = compiler->free_reg;
-		unsigned int temp_reg = allocate_registers(compiler, 1);
-
-		// evaluate right expression
-		compile_addexpr(lexer, compiler, temp_reg);
-
-		// evaluate relop
-		switch (lexeme)
-		{
-		case LUSP_LEXEME_MULTIPLY:
-			emit_binop(compiler, LUSP_VMOP_MULTIPLY, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_DIVIDE:
-			emit_binop(compiler, LUSP_VMOP_DIVIDE, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_MODULO:
-			emit_binop(compiler, LUSP_VMOP_MODULO, reg, reg, temp_reg);
-			break;
-
-		default:
-			assert(false);
-		}
-
-		// free register
-		compiler->free_reg = free_reg;
-	}
-}
-
-static void compile_relexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// evaluate left expression
-	compile_mulexpr(lexer, compiler, reg);
-
-	while (lexer->lexeme == LUSP_LEXEME_LESS || lexer->lexeme == LUSP_LEXEME_LESS_EQUAL ||
-	       lexer->lexeme == LUSP_LEXEME_GREATER || lexer->lexeme == LUSP_LEXEME_GREATER_EQUAL)
-	{
-		// consume lexeme
-		enum lusp_lexeme_t lexeme = lexer->lexeme;
-		lusp_lexer_next(lexer);
-
-		// allocate register
-		unsigned int free_reg = compiler->free_reg;
-		unsigned int temp_reg = allocate_registers(compiler, 1);
-
-		// evaluate right expression
-		compile_mulexpr(lexer, compiler, temp_reg);
-
-		// evaluate relop
-		switch (lexeme)
-		{
-		case LUSP_LEXEME_LESS:
-			emit_binop(compiler, LUSP_VMOP_LESS, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_LESS_EQUAL:
-			emit_binop(compiler, LUSP_VMOP_LESS_EQUAL, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_GREATER:
-			emit_binop(compiler, LUSP_VMOP_GREATER, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_GREATER_EQUAL:
-			emit_binop(compiler, LUSP_VMOP_GREATER_EQUAL, reg, reg, temp_reg);
-			break;
-
-		default:
-			assert(false);
-		}
-
-		// free register
-		compiler->free_reg = free_reg;
-	}
-}
-
-static void compile_eqexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	// evaluate left expression
-	compile_relexpr(lexer, compiler, reg);
-
-	while (lexer->lexeme == LUSP_LEXEME_EQUAL || lexer->lexeme == LUSP_LEXEME_NOT_EQUAL)
-	{
-		// consume lexeme
-		enum lusp_lexeme_t lexeme = lexer->lexeme;
-		lusp_lexer_next(lexer);
-
-		// allocate register
-		unsigned int free_reg = compiler->free_reg;
-		unsigned int temp_reg = allocate_registers(compiler, 1);
-
-		// evaluate right expression
-		compile_relexpr(lexer, compiler, temp_reg);
-
-		// evaluate relop
-		switch (lexeme)
-		{
-		case LUSP_LEXEME_EQUAL:
-			emit_binop(compiler, LUSP_VMOP_EQUAL, reg, reg, temp_reg);
-			break;
-
-		case LUSP_LEXEME_NOT_EQUAL:
-			emit_binop(compiler, LUSP_VMOP_NOT_EQUAL, reg, reg, temp_reg);
-			break;
-
-		default:
-			assert(false);
-		}
-
-		// free register
-		compiler->free_reg = free_reg;
-	}
-}
-
-static void compile_expr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
-{
-	switch (lexer->lexeme)
-	{
-	case LUSP_LEXEME_SYMBOL_LET:
-		return compile_let(lexer, compiler, reg);
-
-	case LUSP_LEXEME_SYMBOL_IF:
-		return compile_if(lexer, compiler, reg);
-
-	default:
-		return compile_eqexpr(lexer, compiler, reg);
-	}
-}
-
-struct lusp_object_t lusp_compile_ex(struct lusp_environment_t* env, struct lusp_lexer_t* lexer, struct mem_arena_t* arena, unsigned int flags)
-{
-	(void)arena;
-
-	// create fake parent compiler
-	struct compiler_t parent;
-
-	parent.env = env;
-	parent.scope = 0;
-	parent.flags = flags;
-
-	// create actual compiler
-	struct compiler_t compiler;
-
-	create_compiler(&compiler, &parent);
-
-	// compile closure body
-	compile_closure_body(lexer, &compiler, true);
-
-	// create bytecode
-	struct lusp_vm_bytecode_t* bytecode = create_closure(&compiler);
-
-	// check correctness
-	assert(compiler.upval_count == 0);
-
-	// create resulting closure
-	return lusp_mkclosure(bytecode, 0);
-}
+#include "compiler.h"
+
+#include "bytecode.h"
+#include "compile.h"
+#include "environment.h"
+#include "memory.h"
+#include "object.h"
+
+#include "codegen.h"
+#include "internal.h"
+#include "lexer.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+static inline struct binding_t* find_bind_local(struct scope_t* scope, struct lusp_object_t symbol)
+{
+	for (unsigned int i = 0; i < scope->bind_count; ++i)
+		if (scope->binds[i].symbol.symbol == symbol.symbol)
+			return &scope->binds[i];
+
+	return 0;
+}
+
+static inline struct binding_t* find_bind(struct compiler_t* compiler, struct lusp_object_t symbol, struct scope_t** scope)
+{
+	for (struct scope_t* current = compiler->scope; current; current = current->parent)
+	{
+		struct binding_t* result = find_bind_local(current, symbol);
+
+		if (result)
+		{
+			*scope = current;
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+static inline unsigned int find_upval(struct compiler_t* compiler, struct scope_t* scope, struct binding_t* binding)
+{
+	// look for an existing upval
+	for (unsigned int i = 0; i < compiler->upval_count; ++i)
+		if (compiler->upvals[i].binding == binding)
+		{
+			assert(compiler->upvals[i].scope == scope);
+			return i;
+		}
+
+	// mark scope
+	scope->has_upvals = true;
+
+	// add new upval
+	if (compiler->upval_count == compiler->upval_capacity)
+		compiler->upvals = (struct upval_t*)buffer_grow(compiler->arena, compiler->upvals, compiler->upval_count, &compiler->upval_capacity, sizeof(struct upval_t));
+
+	compiler->upvals[compiler->upval_count].binding = binding;
+	compiler->upvals[compiler->upval_count].scope = scope;
+
+	return compiler->upval_count++;
+}
+
+static inline unsigned int find_global(struct compiler_t* compiler, struct lusp_object_t symbol)
+{
+	struct global_table_t* globals = compiler->globals;
+
+	// keep the index at most half full
+	if ((globals->count + 1) * 2 > globals->index_capacity)
+	{
+		unsigned int capacity = globals->index_capacity ? globals->index_capacity * 2 : 64;
+
+		globals->index = (unsigned int*)mem_arena_allocate(compiler->arena, capacity * sizeof(unsigned int));
+		globals->index_capacity = capacity;
+		memset(globals->index, 0, capacity * sizeof(unsigned int));
+
+		for (unsigned int i = 0; i < globals->count; ++i)
+		{
+			unsigned int slot = globals->names[i]->hash & (capacity - 1);
+			while (globals->index[slot]) slot = (slot + 1) & (capacity - 1);
+
+			globals->index[slot] = i + 1;
+		}
+	}
+
+	// look for an existing global
+	unsigned int mask = globals->index_capacity - 1;
+	unsigned int slot = symbol.symbol->hash & mask;
+
+	for (; globals->index[slot]; slot = (slot + 1) & mask)
+		if (globals->names[globals->index[slot] - 1] == symbol.symbol)
+			return globals->index[slot] - 1;
+
+	// add new global
+	if (globals->count == globals->capacity)
+		globals->names = (struct lusp_symbol_t**)buffer_grow(compiler->arena, globals->names, globals->count, &globals->capacity, sizeof(struct lusp_symbol_t*));
+
+	globals->names[globals->count] = symbol.symbol;
+	globals->index[slot] = globals->count + 1;
+
+	return globals->count++;
+}
+
+static inline void push_scope(struct compiler_t* compiler, struct scope_t* scope)
+{
+	scope->parent = compiler->scope;
+	compiler->scope = scope;
+}
+
+static inline void pop_scope(struct compiler_t* compiler, unsigned int first_reg)
+{
+	struct scope_t* scope = compiler->scope;
+
+	// close bindings
+	if (scope->has_upvals) emit_close(compiler, first_reg);
+
+	compiler->scope = scope->parent;
+}
+
+static inline unsigned int allocate_registers(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int count)
+{
+	unsigned int result = compiler->free_reg;
+	compiler->free_reg += count;
+
+	// register operands are 16-bit
+	CHECK(compiler->free_reg <= UINT16_MAX, "too many registers in function");
+
+	if (compiler->reg_count < compiler->free_reg)
+		compiler->reg_count = compiler->free_reg;
+	return result;
+}
+
+static inline struct binding_t* add_bind(struct lusp_lexer_t* lexer, struct compiler_t* compiler, struct scope_t* scope, struct lusp_object_t symbol)
+{
+	// allocate register
+	unsigned int reg = allocate_registers(lexer, compiler, 1);
+
+	// add binding; scopes of enclosing compilers do not change while a closure is compiled, so upvalue bindings stay valid
+	if (scope->bind_count == scope->bind_capacity)
+		scope->binds = (struct binding_t*)buffer_grow(compiler->arena, scope->binds, scope->bind_count, &scope->bind_capacity, sizeof(struct binding_t));
+
+	struct binding_t* bind = &scope->binds[scope->bind_count++];
+
+	bind->symbol = symbol;
+	bind->index = reg;
+
+	return bind;
+}
+
+static void create_compiler(struct compiler_t* compiler, struct compiler_t* parent, unsigned int op_capacity)
+{
+	// create compiler
+	compiler->globals = parent->globals;
+	compiler->arena = parent->arena;
+	compiler->scope = parent->scope;
+	compiler->free_reg = 0;
+	compiler->reg_count = 0;
+	compiler->param_count = 0;
+	compiler->upvals = 0;
+	compiler->upval_count = 0;
+	compiler->upval_capacity = 0;
+	compiler->ops = (struct lusp_vm_op_t*)mem_arena_allocate(compiler->arena, op_capacity * sizeof(struct lusp_vm_op_t));
+	compiler->op_count = 0;
+	compiler->op_capacity = op_capacity;
+	compiler->flags = parent->flags;
+	compiler->protos = parent->protos;
+}
+
+static struct lusp_vm_bytecode_t* create_closure(struct compiler_t* compiler)
+{
+	// create new closure
+	unsigned int ops_size = compiler->op_count * sizeof(struct lusp_vm_op_t);
+
+	struct lusp_vm_op_t* ops = (struct lusp_vm_op_t*)lusp_memory_allocate(ops_size);
+	assert(ops);
+
+	memcpy(ops, compiler->ops, ops_size);
+
+	struct lusp_vm_bytecode_t* code = (struct lusp_vm_bytecode_t*)lusp_memory_allocate(sizeof(struct lusp_vm_bytecode_t));
+	assert(code);
+
+	code->global_names = 0;
+	code->global_count = 0;
+	code->reg_count = compiler->reg_count;
+	code->upval_count = compiler->upval_count;
+	code->param_count = compiler->param_count;
+	code->ops = ops;
+	code->op_count = compiler->op_count;
+
+	lusp_setup_bytecode(code);
+
+	// remember bytecode so that it can be released if compilation fails later
+	struct proto_list_t* protos = compiler->protos;
+
+	if (protos->count == protos->capacity)
+		protos->data = (struct lusp_vm_bytecode_t**)buffer_grow(compiler->arena, protos->data, protos->count, &protos->capacity, sizeof(struct lusp_vm_bytecode_t*));
+
+	protos->data[protos->count++] = code;
+
+	return code;
+}
+
+static void compile_literal(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t object)
+{
+	struct lusp_object_t o = lusp_mkcons(object, object);
+
+	emit_load_const(compiler, reg, o.cons);
+}
+
+static void compile_bind_getset(struct compiler_t* compiler, unsigned int reg, struct scope_t* scope, struct binding_t* bind, bool set)
+{
+	if (scope->compiler == compiler)
+	{
+		// local variable
+		set ? emit_move(compiler, bind->index, reg) : emit_move(compiler, reg, bind->index);
+	}
+	else
+	{
+		// upvalue
+		unsigned int index = find_upval(compiler, scope, bind);
+
+		emit_loadstore_upval(compiler, reg, index, set);
+	}
+}
+
+static void compile_symbol_getset(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol, bool set)
+{
+	assert(symbol.type == LUSP_OBJECT_SYMBOL);
+
+	struct scope_t* scope = 0;
+	struct binding_t* bind = find_bind(compiler, symbol, &scope);
+
+	if (bind)
+	{
+		// local variable or upvalue
+		compile_bind_getset(compiler, reg, scope, bind, set);
+	}
+	else
+	{
+		// global variable
+		emit_loadstore_global(compiler, reg, find_global(compiler, symbol), set);
+	}
+}
+
+static void compile_symbol(struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
+{
+	compile_symbol_getset(compiler, reg, symbol, false);
+}
+
+static void compile_expr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg);
+static void compile_block(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg);
+
+static void compile_literal_next(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t object)
+{
+	lusp_lexer_next(lexer);
+
+	return compile_literal(compiler, reg, object);
+}
+
+static void compile_call(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
+{
+	// skip open paren
+	assert(lexer->lexeme == LUSP_LEXEME_OPEN_PAREN);
+	lusp_lexer_next(lexer);
+
+	unsigned int free_reg = compiler->free_reg;
+
+	// allocate registers for call frame
+	unsigned int frame_regs = allocate_registers(lexer, compiler, 2);
+	unsigned int arg_regs = frame_regs + 2;
+	unsigned int last_arg_reg = arg_regs - 1; // does not really mean anything for first argument
+
+	while (lexer->lexeme != LUSP_LEXEME_CLOSE_PAREN)
+	{
+		// allocate register for new argument
+		unsigned int arg_reg = allocate_registers(lexer, compiler, 1);
+		assert(arg_reg == last_arg_reg + 1);
+		last_arg_reg = arg_reg;
+
+		// evaluate argument
+		compile_expr(lexer, compiler, arg_reg);
+
+		if (lexer->lexeme == LUSP_LEXEME_COMMA)
+			CHECK(lusp_lexer_next(lexer) != LUSP_LEXEME_CLOSE_PAREN, "expected argument after comma");
+		else
+			CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN, "comma or closing paren expected in argument list");
+	}
+
+	// skip close paren
+	assert(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN);
+	lusp_lexer_next(lexer);
+
+	// evaluate function
+	compile_symbol(compiler, reg, symbol);
+
+	// call function
+	unsigned int arg_count = last_arg_reg + 1 - arg_regs;
+
+	emit_call(compiler, reg, arg_regs, arg_count);
+
+	// free temporary registers
+	compiler->free_reg = free_reg;
+}
+
+static void compile_assign(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, struct lusp_object_t symbol)
+{
+	// skip assign sign
+	assert(lexer->lexeme == LUSP_LEXEME_ASSIGN);
+	lusp_lexer_next(lexer);
+
+	// evaluate expression
+	compile_expr(lexer, compiler, reg);
+
+	// assign
+	compile_symbol_getset(compiler, reg, symbol, true);
+}
+
+static void compile_let(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// skip let
+	assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_LET);
+	lusp_lexer_next(lexer);
+
+	// read symbol
+	CHECK(lexer->lexeme == LUSP_LEXEME_SYMBOL, "variable name expected after let");
+
+	struct lusp_object_t symbol = lusp_mksymbol_n(lexer->value.symbol.data, lexer->value.symbol.length);
+	lusp_lexer_next(lexer);
+
+	// add variable to current scope
+	CHECK(find_bind_local(compiler->scope, symbol) == 0, "%s: variable redefinition", symbol.symbol->name);
+
+	struct binding_t* bind = add_bind(lexer, compiler, compiler->scope, symbol);
+
+	// is it assigned right away?
+	if (lexer->lexeme == LUSP_LEXEME_ASSIGN)
+		compile_assign(lexer, compiler, reg, symbol);
+	else
+	{
+		// temporaries of earlier expressions in the same frame may have used the register, so initialize variable explicitly
+		compile_literal(compiler, bind->index, lusp_mknull());
+		emit_move(compiler, reg, bind->index);
+	}
+}
+
+static void compile_if(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// skip if
+	assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_IF);
+	lusp_lexer_next(lexer);
+
+	// evaluate condition
+	compile_expr(lexer, compiler, reg);
+
+	// jump over if code
+	unsigned int jump_ifnot_op = compiler->op_count;
+
+	emit_jump_ifnot(compiler, reg, 0);
+
+	// evaluate if code
+	compile_block(lexer, compiler, reg);
+
+	if (lexer->lexeme == LUSP_LEXEME_SYMBOL_ELSE)
+	{
+		// skip else
+		assert(lexer->lexeme == LUSP_LEXEME_SYMBOL_ELSE);
+		lusp_lexer_next(lexer);
+
+		// jump over else code
+		unsigned int jump_op = compiler->op_count;
+
+		emit_jump(compiler, 0);
+
+		// evaluate else code
+		compile_block(lexer, compiler, reg);
+
+		// fixup jumps
+		fixup_jump(compiler, jump_ifnot_op, jump_op + 1);
+		fixup_jump(compiler, jump_op, compiler->op_count);
+	}
+	else
+	{
+		// fixup jumps
+		fixup_jump(compiler, jump_ifnot_op, compiler->op_count);
+	}
+}
+
+static void compile_list(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg, enum lusp_lexeme_t stop_lexeme)
+{
+	if (lexer->lexeme == stop_lexeme) compile_literal(compiler, reg, lusp_mknull());
+
+	while (lexer->lexeme != stop_lexeme)
+		compile_expr(lexer, compiler, reg);
+}
+
+static void compile_block(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	if (lexer->lexeme == LUSP_LEXEME_OPEN_BRACE)
+	{
+		// skip open brace
+		assert(lexer->lexeme == LUSP_LEXEME_OPEN_BRACE);
+		lusp_lexer_next(lexer);
+
+		// compile block contents
+		compile_list(lexer, compiler, reg, LUSP_LEXEME_CLOSE_BRACE);
+
+		// skip close brace
+		assert(lexer->lexeme == LUSP_LEXEME_CLOSE_BRACE);
+		lusp_lexer_next(lexer);
+	}
+	else
+		compile_expr(lexer, compiler, reg);
+}
+
+static void compile_closure_body(struct lusp_lexer_t* lexer, struct compiler_t* compiler, bool global)
+{
+	// add new scope
+	struct scope_t scope;
+	scope.compiler = compiler;
+	scope.binds = 0;
+	scope.bind_count = 0;
+	scope.bind_capacity = 0;
+	scope.has_upvals = false;
+
+	// remember last free register (should always be 0?)
+	unsigned int free_reg = compiler->free_reg;
+
+	if (!global)
+	{
+		// skip vertical bar
+		assert(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR);
+		lusp_lexer_next(lexer);
+
+		// parse parameter list
+		while (lexer->lexeme != LUSP_LEXEME_VERTICAL_BAR)
+		{
+			// read symbol
+			CHECK(lexer->lexeme == LUSP_LEXEME_SYMBOL, "expected symbol");
+			struct lusp_object_t symbol = lusp_mksymbol_n(lexer->value.symbol.data, lexer->value.symbol.length);
+
+			lusp_lexer_next(lexer);
+
+			// add binding
+			struct binding_t* bind = add_bind(lexer, compiler, &scope, symbol);
+			assert(bind->index + 1 == scope.bind_count);
+
+			if (lexer->lexeme == LUSP_LEXEME_COMMA)
+				CHECK(lusp_lexer_next(lexer) == LUSP_LEXEME_SYMBOL, "expected symbol after comma");
+			else
+				CHECK(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR, "comma or vertical bar expected in parameter list");
+		}
+
+		// skip vertical bar
+		assert(lexer->lexeme == LUSP_LEXEME_VERTICAL_BAR);
+		lusp_lexer_next(lexer);
+
+		// parameters occupy the first registers
+		compiler->param_count = scope.bind_count;
+	}
+
+	// allocate register for return value
+	unsigned int ret_reg = allocate_registers(lexer, compiler, 1);
+
+	// evaluate body in new scope
+	push_scope(compiler, &scope);
+	global ? compile_list(lexer, compiler, ret_reg, LUSP_LEXEME_EOF) : compile_block(lexer, compiler, ret_reg);
+	pop_scope(compiler, free_reg);
+
+	emit_return(compiler, ret_reg);
+}
+
+static void compile_closure(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// create new compiler
+	struct compiler_t child;
+
+	create_compiler(&child, compiler, 32);
+
+	// compile closure
+	compile_closure_body(lexer, &child, false);
+
+	// create bytecode
+	struct lusp_vm_bytecode_t* bytecode = create_closure(&child);
+
+	// creeate closure
+	emit_create_closure(compiler, reg, bytecode);
+
+	// set upvalues
+	for (unsigned int i = 0; i < child.upval_count; ++i)
+	{
+		struct upval_t u = child.upvals[i];
+
+		compile_bind_getset(compiler, 0, u.scope, u.binding, false);
+	}
+}
+
+static void compile_vector(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// skip open bracket
+	assert(lexer->lexeme == LUSP_LEXEME_OPEN_BRACKET);
+	lusp_lexer_next(lexer);
+
+	unsigned int free_reg = compiler->free_reg;
+
+	// elements are evaluated into consecutive registers
+	unsigned int first_reg = free_reg;
+	unsigned int count = 0;
+
+	while (lexer->lexeme != LUSP_LEXEME_CLOSE_BRACKET)
+	{
+		// allocate register for new element
+		unsigned int element_reg = allocate_registers(lexer, compiler, 1);
+		assert(element_reg == first_reg + count);
+
+		// evaluate element
+		compile_expr(lexer, compiler, element_reg);
+		count++;
+
+		if (lexer->lexeme == LUSP_LEXEME_COMMA)
+			CHECK(lusp_lexer_next(lexer) != LUSP_LEXEME_CLOSE_BRACKET, "expected element after comma");
+		else
+			CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_BRACKET, "comma or closing bracket expected in vector");
+	}
+
+	// skip close bracket
+	assert(lexer->lexeme == LUSP_LEXEME_CLOSE_BRACKET);
+	lusp_lexer_next(lexer);
+
+	// create vector
+	emit_create_vector(compiler, reg, first_reg, count);
+
+	// free temporary registers
+	compiler->free_reg = free_reg;
+}
+
+static void compile_parens(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// skip open paren
+	assert(lexer->lexeme == LUSP_LEXEME_OPEN_PAREN);
+	lusp_lexer_next(lexer);
+
+	// evaluate expression
+	compile_expr(lexer, compiler, reg);
+
+	// skip close paren
+	CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_PAREN, "expected close paren");
+	lusp_lexer_next(lexer);
+}
+
+static void compile_term(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	switch (lexer->lexeme)
+	{
+	case LUSP_LEXEME_LITERAL_BOOLEAN:
+		return compile_literal_next(lexer, compiler, reg, lusp_mkboolean(lexer->value.boolean));
+
+	case LUSP_LEXEME_LITERAL_INTEGER:
+		return compile_literal_next(lexer, compiler, reg, lusp_mkinteger(lexer->value.integer));
+
+	case LUSP_LEXEME_LITERAL_REAL:
+		return compile_literal_next(lexer, compiler, reg, lusp_mkreal(lexer->value.real));
+
+	case LUSP_LEXEME_LITERAL_STRING:
+		return compile_literal_next(lexer, compiler, reg, lusp_mkstring_n(lexer->value.string.data, lexer->value.string.length));
+
+	case LUSP_LEXEME_VERTICAL_BAR:
+		return compile_closure(lexer, compiler, reg);
+
+	case LUSP_LEXEME_OPEN_PAREN:
+		return compile_parens(lexer, compiler, reg);
+
+	case LUSP_LEXEME_OPEN_BRACKET:
+		return compile_vector(lexer, compiler, reg);
+
+	case LUSP_LEXEME_SYMBOL:
+	{
+		struct lusp_object_t symbol = lusp_mksymbol_n(lexer->value.symbol.data, lexer->value.symbol.length);
+
+		switch (lusp_lexer_next(lexer))
+		{
+		case LUSP_LEXEME_OPEN_PAREN:
+			return compile_call(lexer, compiler, reg, symbol);
+
+		case LUSP_LEXEME_ASSIGN:
+			return compile_assign(lexer, compiler, reg, symbol);
+
+		default:
+			return compile_symbol(compiler, reg, symbol);
+		}
+	}
+	break;
+
+	default:
+		CHECK(false, "expected term");
+	}
+}
+
+static void compile_index(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// evaluate object
+	compile_term(lexer, compiler, reg);
+
+	while (lexer->lexeme == LUSP_LEXEME_OPEN_BRACKET)
+	{
+		// skip open bracket
+		lusp_lexer_next(lexer);
+
+		// allocate register
+		unsigned int free_reg = compiler->free_reg;
+		unsigned int key_reg = allocate_registers(lexer, compiler, 1);
+
+		// evaluate key
+		compile_expr(lexer, compiler, key_reg);
+
+		// skip close bracket
+		CHECK(lexer->lexeme == LUSP_LEXEME_CLOSE_BRACKET, "expected close bracket");
+		lusp_lexer_next(lexer);
+
+		if (lexer->lexeme == LUSP_LEXEME_ASSIGN)
+		{
+			// skip assign sign
+			lusp_lexer_next(lexer);
+
+			// evaluate value
+			unsigned int value_reg = allocate_registers(lexer, compiler, 1);
+
+			compile_expr(lexer, compiler, value_reg);
+
+			// store element; assignment evaluates to the stored value
+			emit_index(compiler, value_reg, reg, key_reg, true);
+			emit_move(compiler, reg, value_reg);
+
+			compiler->free_reg = free_reg;
+			break;
+		}
+
+		// load element
+		emit_index(compiler, reg, reg, key_reg, false);
+
+		// free register
+		compiler->free_reg = free_reg;
+	}
+}
+
+static void compile_addexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// evaluate left expression
+	compile_index(lexer, compiler, reg);
+
+	while (lexer->lexeme == LUSP_LEXEME_ADD || lexer->lexeme == LUSP_LEXEME_SUBTRACT)
+	{
+		// consume lexeme
+		enum lusp_lexeme_t lexeme = lexer->lexeme;
+		lusp_lexer_next(lexer);
+
+		// allocate register
+		unsigned int free_reg = compiler->free_reg;
+		unsigned int temp_reg = allocate_registers(lexer, compiler, 1);
+
+		// evaluate right expression
+		compile_index(lexer, compiler, temp_reg);
+
+		// evaluate relop
+		switch (lexeme)
+		{
+		case LUSP_LEXEME_ADD:
+			emit_binop(compiler, LUSP_VMOP_ADD, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_SUBTRACT:
+			emit_binop(compiler, LUSP_VMOP_SUBTRACT, reg, reg, temp_reg);
+			break;
+
+		default:
+			assert(false);
+		}
+
+		// free register
+		compiler->free_reg = free_reg;
+	}
+}
+
+static void compile_mulexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// evaluate left expression
+	compile_addexpr(lexer, compiler, reg);
+
+	while (lexer->lexeme == LUSP_LEXEME_MULTIPLY || lexer->lexeme == LUSP_LEXEME_DIVIDE ||
+	       lexer->lexeme == LUSP_LEXEME_MODULO)
+	{
+		// consume lexeme
+		enum lusp_lexeme_t lexeme = lexer->lexeme;
+		lusp_lexer_next(lexer);
+
+		// allocate register
+		unsigned int free_reg = compiler->free_reg;
+		unsigned int temp_reg = allocate_registers(lexer, compiler, 1);
+
+		// evaluate right expression
+		compile_addexpr(lexer, compiler, temp_reg);
+
+		// evaluate relop
+		switch (lexeme)
+		{
+		case LUSP_LEXEME_MULTIPLY:
+			emit_binop(compiler, LUSP_VMOP_MULTIPLY, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_DIVIDE:
+			emit_binop(compiler, LUSP_VMOP_DIVIDE, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_MODULO:
+			emit_binop(compiler, LUSP_VMOP_MODULO, reg, reg, temp_reg);
+			break;
+
+		default:
+			assert(false);
+		}
+
+		// free register
+		compiler->free_reg = free_reg;
+	}
+}
+
+static void compile_relexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// evaluate left expression
+	compile_mulexpr(lexer, compiler, reg);
+
+	while (lexer->lexeme == LUSP_LEXEME_LESS || lexer->lexeme == LUSP_LEXEME_LESS_EQUAL ||
+	       lexer->lexeme == LUSP_LEXEME_GREATER || lexer->lexeme == LUSP_LEXEME_GREATER_EQUAL)
+	{
+		// consume lexeme
+		enum lusp_lexeme_t lexeme = lexer->lexeme;
+		lusp_lexer_next(lexer);
+
+		// allocate register
+		unsigned int free_reg = compiler->free_reg;
+		unsigned int temp_reg = allocate_registers(lexer, compiler, 1);
+
+		// evaluate right expression
+		compile_mulexpr(lexer, compiler, temp_reg);
+
+		// evaluate relop
+		switch (lexeme)
+		{
+		case LUSP_LEXEME_LESS:
+			emit_binop(compiler, LUSP_VMOP_LESS, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_LESS_EQUAL:
+			emit_binop(compiler, LUSP_VMOP_LESS_EQUAL, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_GREATER:
+			emit_binop(compiler, LUSP_VMOP_GREATER, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_GREATER_EQUAL:
+			emit_binop(compiler, LUSP_VMOP_GREATER_EQUAL, reg, reg, temp_reg);
+			break;
+
+		default:
+			assert(false);
+		}
+
+		// free register
+		compiler->free_reg = free_reg;
+	}
+}
+
+static void compile_eqexpr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	// evaluate left expression
+	compile_relexpr(lexer, compiler, reg);
+
+	while (lexer->lexeme == LUSP_LEXEME_EQUAL || lexer->lexeme == LUSP_LEXEME_NOT_EQUAL)
+	{
+		// consume lexeme
+		enum lusp_lexeme_t lexeme = lexer->lexeme;
+		lusp_lexer_next(lexer);
+
+		// allocate register
+		unsigned int free_reg = compiler->free_reg;
+		unsigned int temp_reg = allocate_registers(lexer, compiler, 1);
+
+		// evaluate right expression
+		compile_relexpr(lexer, compiler, temp_reg);
+
+		// evaluate relop
+		switch (lexeme)
+		{
+		case LUSP_LEXEME_EQUAL:
+			emit_binop(compiler, LUSP_VMOP_EQUAL, reg, reg, temp_reg);
+			break;
+
+		case LUSP_LEXEME_NOT_EQUAL:
+			emit_binop(compiler, LUSP_VMOP_NOT_EQUAL, reg, reg, temp_reg);
+			break;
+
+		default:
+			assert(false);
+		}
+
+		// free register
+		compiler->free_reg = free_reg;
+	}
+}
+
+static void compile_expr(struct lusp_lexer_t* lexer, struct compiler_t* compiler, unsigned int reg)
+{
+	switch (lexer->lexeme)
+	{
+	case LUSP_LEXEME_SYMBOL_LET:
+		return compile_let(lexer, compiler, reg);
+
+	case LUSP_LEXEME_SYMBOL_IF:
+		return compile_if(lexer, compiler, reg);
+
+	default:
+		return compile_eqexpr(lexer, compiler, reg);
+	}
+}
+
+static void set_global_names(struct lusp_vm_bytecode_t* code, struct lusp_symbol_t** names, unsigned int count)
+{
+	code->global_names = names;
+	code->global_count = count;
+
+	for (unsigned int i = 0; i < code->op_count; ++i)
+		if (code->ops[i].opcode == LUSP_VMOP_CREATE_CLOSURE)
+			set_global_names(code->ops[i].create_closure.code, names, count);
+}
+
+static struct lusp_vm_bytecode_t* compile_program(struct lusp_lexer_t* lexer, struct mem_arena_t* arena, unsigned int flags)
+{
+	// bytecode of functions compiled before an error is released with the error
+	struct proto_list_t* protos = (struct proto_list_t*)mem_arena_allocate(arena, sizeof(struct proto_list_t));
+
+	protos->data = 0;
+	protos->count = 0;
+	protos->capacity = 0;
+
+	// intercept errors so that the caller can release temporaries
+	void* error_context = lexer->error_context;
+	jmp_buf buf;
+
+	if (setjmp(buf))
+	{
+		lexer->error_context = error_context;
+
+		for (unsigned int i = 0; i < protos->count; ++i)
+		{
+			lusp_memory_deallocate(protos->data[i]->ops);
+			lusp_memory_deallocate(protos->data[i]);
+		}
+
+		return 0;
+	}
+
+	lexer->error_context = &buf;
+
+	// create fake parent compiler
+	struct global_table_t globals = {0, 0, 0, 0, 0};
+	struct compiler_t parent;
+
+	parent.globals = &globals;
+	parent.arena = arena;
+	parent.scope = 0;
+	parent.flags = flags;
+	parent.protos = protos;
+
+	// create actual compiler; initial op buffer is sized from source length (or buffered length for streaming input)
+	struct compiler_t compiler;
+
+	size_t length = (size_t)(lexer->end - lexer->data);
+
+	create_compiler(&compiler, &parent, length / 8 < 64 ? 64 : length / 8 > 65536 ? 65536 : (unsigned int)(length / 8));
+
+	// compile closure body
+	compile_closure_body(lexer, &compiler, true);
+
+	// create bytecode
+	struct lusp_vm_bytecode_t* bytecode = create_closure(&compiler);
+
+	// check correctness
+	assert(compiler.upval_count == 0);
+
+	// global names are resolved when bytecode is bound to an environment
+	if (globals.count)
+	{
+		struct lusp_symbol_t** names = (struct lusp_symbol_t**)lusp_memory_allocate(sizeof(struct lusp_symbol_t*) * globals.count);
+		assert(names);
+
+		memcpy(names, globals.names, sizeof(struct lusp_symbol_t*) * globals.count);
+
+		set_global_names(bytecode, names, globals.count);
+	}
+
+	lexer->error_context = error_context;
+
+	return bytecode;
+}
+
+struct lusp_object_t lusp_compile_ex(struct lusp_environment_t* env, struct lusp_lexer_t* lexer, struct mem_arena_t* arena, unsigned int flags)
+{
+	// compiler buffers are allocated from the arena and released in bulk; bytecode is allocated from the heap
+	// without an arena every call uses its own, so that compiling into one environment from several threads is safe
+	struct mem_arena_t local_arena;
+	if (!arena) mem_arena_init(&local_arena, 65536);
+
+	struct mem_arena_t* scratch = arena ? arena : &local_arena;
+	struct mem_arena_mark_t mark = mem_arena_get_mark(scratch);
+
+	struct lusp_vm_bytecode_t* bytecode = compile_program(lexer, scratch, flags);
+
+	mem_arena_release(scratch, mark);
+	if (!arena) mem_arena_term(&local_arena);
+
+	// pass the error on
+	if (!bytecode) longjmp(*(jmp_buf*)lexer->error_context, 1);
+
+	// create resulting closure
+	return lusp_bind_bytecode(bytecode, env);
+}
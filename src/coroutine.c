@@ -0,0 +1,187 @@
+#include "coroutine.h"
+
+#include "bytecode.h"
+#include "memory.h"
+#include "state.h"
+
+#include <assert.h>
+#include <string.h>
+
+// VM entry points
+struct lusp_object_t lusp_eval_vm(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+struct lusp_object_t lusp_resume_vm(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, struct lusp_object_t value);
+
+struct lusp_object_t lusp_mkcoroutine(struct lusp_object_t function, unsigned int stack_size)
+{
+	assert(function.type == LUSP_OBJECT_CLOSURE);
+
+	if (stack_size == 0) stack_size = LUSP_COROUTINE_STACK_SIZE;
+
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_COROUTINE;
+
+	result.coroutine = (struct lusp_coroutine_t*)lusp_memory_allocate(sizeof(struct lusp_coroutine_t));
+	assert(result.coroutine);
+
+	struct lusp_coroutine_t* coroutine = result.coroutine;
+
+	coroutine->function = function.closure;
+	coroutine->status = LUSP_COROUTINE_SUSPENDED;
+	coroutine->preempted = false;
+
+	coroutine->stack = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * stack_size);
+	assert(coroutine->stack);
+
+	coroutine->stack_size = stack_size;
+
+	coroutine->closure = 0;
+	coroutine->pc = 0;
+	coroutine->regs = 0;
+	coroutine->upvals = 0;
+
+	return result;
+}
+
+static inline struct lusp_object_t* rebase(struct lusp_object_t* pointer, struct lusp_object_t* from, struct lusp_object_t* to)
+{
+	return to + (pointer - from);
+}
+
+// called by the VM when the running coroutine needs a stack of size registers; context is saved into the coroutine,
+// and frames, saved registers and open upvals are moved to the new stack
+// coroutine code never runs while native functions of the same coroutine are active, so nothing else refers to the stack
+bool lusp_coroutine_grow(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, size_t size)
+{
+	if (size > LUSP_COROUTINE_STACK_LIMIT) return false;
+
+	size_t stack_size = coroutine->stack_size;
+	while (stack_size < size) stack_size *= 2;
+	if (stack_size > LUSP_COROUTINE_STACK_LIMIT) stack_size = LUSP_COROUTINE_STACK_LIMIT;
+
+	struct lusp_object_t* stack = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * stack_size);
+	if (!stack) return false;
+
+	struct lusp_object_t* old_stack = coroutine->stack;
+	struct lusp_object_t* old_end = old_stack + coroutine->stack_size;
+
+	memcpy(stack, old_stack, sizeof(struct lusp_object_t) * coroutine->stack_size);
+
+	// every frame stores the registers of its caller, the top-level frame stores 0
+	if (coroutine->regs)
+	{
+		coroutine->regs = rebase(coroutine->regs, old_stack, stack);
+
+		for (struct lusp_object_t* regs = coroutine->regs; regs;)
+		{
+			struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)regs[-2].call_frame;
+
+			if (frame->regs) frame->regs = rebase(frame->regs, old_stack, stack);
+
+			regs = frame->regs;
+		}
+	}
+
+	// open upvals refer to registers of the coroutine, the list ends with an upval that refers to no register
+	for (struct lusp_vm_upval_t* upval = coroutine->upvals; upval && upval->ref >= old_stack && upval->ref < old_end; upval = upval->next)
+		upval->ref = rebase(upval->ref, old_stack, stack);
+
+	lusp_memory_deallocate(old_stack);
+
+	coroutine->stack = stack;
+	coroutine->stack_size = (unsigned int)stack_size;
+
+	state->stack_top = rebase(state->stack_top, old_stack, stack);
+	state->stack = stack;
+	state->stack_size = (unsigned int)stack_size;
+
+	return true;
+}
+
+static struct lusp_object_t start(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, struct lusp_object_t* args, unsigned int count)
+{
+	struct lusp_vm_bytecode_t* code = coroutine->function->code;
+
+	if (count > code->param_count) count = code->param_count;
+
+	// function does not fit on the largest stack; the coroutine has not returned, so resume releases it
+	if (2 + code->reg_count > coroutine->stack_size && !lusp_coroutine_grow(state, coroutine, 2 + code->reg_count))
+	{
+		lusp_eval_abort(state, LUSP_EVAL_STACK_OVERFLOW);
+		return lusp_mknull();
+	}
+
+	// setup top-level frame
+	struct lusp_object_t* stack = coroutine->stack;
+
+	stack[0].type = LUSP_OBJECT_CALL_FRAME;
+
+	struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)stack[0].call_frame;
+
+	frame->regs = 0;
+	frame->closure = 0;
+	frame->pc = 0;
+
+	// copy arguments
+	for (unsigned int i = 0; i < count; ++i) stack[2 + i] = args[i];
+
+	// coroutines always run in the interpreter since only the VM can save its context
+	return lusp_eval_vm(state, code, coroutine->function, stack + 2, count);
+}
+
+struct lusp_object_t lusp_coroutine_resume(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, struct lusp_object_t* args, unsigned int count)
+{
+	// aborted evaluations don't resume coroutines
+	if (coroutine->status != LUSP_COROUTINE_SUSPENDED || state->status != LUSP_EVAL_OK) return lusp_mknull();
+
+	// switch to coroutine stack; arguments stay on the stack of the caller
+	struct lusp_object_t* stack = state->stack;
+	unsigned int stack_size = state->stack_size;
+	struct lusp_object_t* stack_top = state->stack_top;
+	struct lusp_coroutine_t* parent = state->coroutine;
+
+	// resumes from outside of evaluations get the full budget, others share the budget of the evaluation
+	if (state->depth++ == 0) state->budget_left = state->budget ? state->budget : INT64_MAX;
+
+	state->stack = coroutine->stack;
+	state->stack_size = coroutine->stack_size;
+	state->stack_top = coroutine->stack;
+	state->coroutine = coroutine;
+
+	coroutine->status = LUSP_COROUTINE_RUNNING;
+
+	struct lusp_object_t result = coroutine->pc ? lusp_resume_vm(state, coroutine, count > 0 ? args[0] : lusp_mknull()) : start(state, coroutine, args, count);
+
+	// VM marks the coroutine as suspended on yield or preemption, so a running coroutine has returned or was aborted
+	if (coroutine->status == LUSP_COROUTINE_RUNNING)
+	{
+		coroutine->status = LUSP_COROUTINE_DEAD;
+
+		lusp_memory_deallocate(coroutine->stack);
+
+		coroutine->stack = 0;
+		coroutine->stack_size = 0;
+		coroutine->closure = 0;
+		coroutine->pc = 0;
+		coroutine->regs = 0;
+		coroutine->upvals = 0;
+	}
+
+	state->stack = stack;
+	state->stack_size = stack_size;
+	state->stack_top = stack_top;
+	state->coroutine = parent;
+
+	// aborted evaluation that resumed the coroutine is unwound by the VM; resumes from outside of evaluations drop the status
+	if (--state->depth == 0) state->status = LUSP_EVAL_OK;
+
+	return result;
+}
+
+bool lusp_coroutine_yield(struct lusp_state_t* state)
+{
+	if (!state->coroutine || state->coroutine->status != LUSP_COROUTINE_RUNNING) return false;
+
+	state->suspend = true;
+
+	return true;
+}
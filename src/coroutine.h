@@ -0,0 +1,57 @@
+#pragma once
+
+#include "object.h"
+
+struct lusp_vm_op_t;
+struct lusp_vm_upval_t;
+
+// default register stack size of coroutines, in objects; kept small so that thousands of coroutines are cheap
+#define LUSP_COROUTINE_STACK_SIZE 256
+
+// coroutine stacks grow on demand up to this size, in objects
+#define LUSP_COROUTINE_STACK_LIMIT (1 << 20)
+
+enum lusp_coroutine_status_t
+{
+	LUSP_COROUTINE_SUSPENDED,
+	LUSP_COROUTINE_RUNNING,
+	LUSP_COROUTINE_DEAD
+};
+
+// closure that runs on its own register stack and can be suspended by yield; call frames of a suspended coroutine
+// stay on its stack and the VM context of the pending yield call is saved, so resuming does not need C stack switching
+// a coroutine can be resumed by any state, but by one state at a time
+struct lusp_coroutine_t
+{
+	struct lusp_vm_closure_t* function;
+	enum lusp_coroutine_status_t status;
+
+	// suspended because the execution budget ran out, rather than by yield
+	bool preempted;
+
+	// register stack, released when the coroutine returns or fails; frames are moved when it grows
+	struct lusp_object_t* stack;
+	unsigned int stack_size;
+
+	// saved VM context; pc is 0 before the first resume
+	struct lusp_vm_closure_t* closure;
+	struct lusp_vm_op_t* pc;
+	struct lusp_object_t* regs;
+	struct lusp_vm_upval_t* upvals;
+};
+
+// stack_size is the number of registers, 0 selects LUSP_COROUTINE_STACK_SIZE
+struct lusp_object_t lusp_mkcoroutine(struct lusp_object_t function, unsigned int stack_size);
+
+// runs coroutine until it yields or returns; arguments of the first resume are passed to the function,
+// the first argument of later resumes becomes the result of the pending yield
+// returns the yielded or returned value, or null if the coroutine is running or dead
+// a coroutine that runs out of budget (see lusp_eval_set_budget) is preempted at a call: resume returns null and sets
+// preempted, the next resume continues the coroutine; a coroutine that runs out of registers or is aborted otherwise
+// becomes dead, resume returns null and the evaluation that called resume is aborted as well
+struct lusp_object_t lusp_coroutine_resume(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, struct lusp_object_t* args, unsigned int count);
+
+// suspends the running coroutine when the calling native function returns; the return value is yielded to resume
+// only native functions that are called by coroutine code directly can yield, nested evaluations can't be suspended;
+// returns false without suspending anything if the native function is called elsewhere
+bool lusp_coroutine_yield(struct lusp_state_t* state);
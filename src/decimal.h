@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// converts mantissa * 10^exponent to the nearest double (ties to even); the result is correctly rounded as long as
+// mantissa holds all significant digits of the decimal value
+double lusp_decimal_to_double(uint64_t mantissa, int64_t exponent);
@@ -1,58 +1,129 @@
-#include "environment.h"
-
-#include "memory.h"
-#include "object.h"
-
-#include <assert.h>
-
-static struct lusp_environment_slot_t* mkslot(struct lusp_environment_slot_t* next, struct lusp_object_t name)
-{
-	assert(name.type == LUSP_OBJECT_SYMBOL);
-
-	struct lusp_environment_slot_t* result = (struct lusp_environment_slot_t*)lusp_memory_allocate(sizeof(struct lusp_environment_slot_t));
-	assert(result);
-
-	result->name = name.symbol;
-	result->next = next;
-	result->value = lusp_mknull();
-
-	return result;
-}
-
-struct lusp_environment_slot_t* find_slot(struct lusp_environment_t* env, struct lusp_object_t name)
-{
-	assert(name.type == LUSP_OBJECT_SYMBOL);
-
-	for (struct lusp_environment_slot_t* slot = env->head; slot; slot = slot->next)
-		if (slot->name == name.symbol)
-			return slot;
-
-	return 0;
-}
-
-struct lusp_environment_t* lusp_environment_create()
-{
-	struct lusp_environment_t* result = (struct lusp_environment_t*)lusp_memory_allocate(sizeof(struct lusp_environment_t));
-	assert(result);
-
-	result->head = 0;
-
-	return result;
-}
-
-struct lusp_environment_slot_t* lusp_environment_get_slot(struct lusp_environment_t* env, struct lusp_object_t name)
-{
-	struct lusp_environment_slot_t* result = find_slot(env, name);
-
-	return result ? result : (env->head = mkslot(env->head, name));
-}
-
-struct lusp_object_t lusp_environment_get(struct lusp_environment_t* env, struct lusp_object_t name)
-{
-	return lusp_environment_get_slot(env, name)->value;
-}
-
-void lusp_environment_put(struct lusp_environment_t* env, struct lusp_object_t name, struct lusp_object_t object)
-{
-	lusp_environment_get_slot(env, name)->value = object;
-}
+#include "environment.h"
+
+#include "memory.h"
+#include "object.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+// slot tables use open addressing and are read without locking; slots are published after construction and never freed
+// a full table is replaced with a larger copy, and the old one is kept alive since readers may still use it
+// slot insertion is serialized across all environments since it only happens once per global name
+struct lusp_environment_table_t
+{
+	struct lusp_environment_table_t* retired;
+
+	unsigned int capacity;
+	struct lusp_environment_slot_t* slots[1];
+};
+
+static struct lusp_lock_t g_lock;
+
+static struct lusp_environment_slot_t* mkslot(struct lusp_object_t name)
+{
+	assert(name.type == LUSP_OBJECT_SYMBOL);
+
+	struct lusp_environment_slot_t* result = (struct lusp_environment_slot_t*)lusp_memory_allocate(sizeof(struct lusp_environment_slot_t));
+	assert(result);
+
+	result->name = name.symbol;
+	result->value = lusp_mknull();
+
+	return result;
+}
+
+static struct lusp_environment_slot_t* find_slot(struct lusp_environment_t* env, struct lusp_object_t name)
+{
+	assert(name.type == LUSP_OBJECT_SYMBOL);
+
+	struct lusp_environment_table_t* table = (struct lusp_environment_table_t*)lusp_atomic_load_pointer((void* volatile*)&env->table);
+	if (!table) return 0;
+
+	unsigned int mask = table->capacity - 1;
+
+	for (unsigned int index = name.symbol->hash & mask;; index = (index + 1) & mask)
+	{
+		struct lusp_environment_slot_t* slot = (struct lusp_environment_slot_t*)lusp_atomic_load_pointer((void* volatile*)&table->slots[index]);
+
+		if (!slot || slot->name == name.symbol) return slot;
+	}
+}
+
+static void insert_slot(struct lusp_environment_table_t* table, struct lusp_environment_slot_t* slot)
+{
+	unsigned int mask = table->capacity - 1;
+	unsigned int index = slot->name->hash & mask;
+
+	while (table->slots[index]) index = (index + 1) & mask;
+
+	lusp_atomic_store_pointer((void* volatile*)&table->slots[index], slot);
+}
+
+static void grow_table(struct lusp_environment_t* env)
+{
+	struct lusp_environment_table_t* table = env->table;
+	unsigned int capacity = table ? table->capacity * 2 : 16;
+
+	struct lusp_environment_table_t* result = (struct lusp_environment_table_t*)lusp_memory_allocate(offsetof(struct lusp_environment_table_t, slots) + sizeof(struct lusp_environment_slot_t*) * capacity);
+	assert(result);
+
+	result->retired = table;
+	result->capacity = capacity;
+	memset(result->slots, 0, sizeof(struct lusp_environment_slot_t*) * capacity);
+
+	if (table)
+		for (unsigned int i = 0; i < table->capacity; ++i)
+			if (table->slots[i])
+				insert_slot(result, table->slots[i]);
+
+	lusp_atomic_store_pointer((void* volatile*)&env->table, result);
+}
+
+struct lusp_environment_t* lusp_environment_create(struct lusp_state_t* state)
+{
+	struct lusp_environment_t* result = (struct lusp_environment_t*)lusp_memory_allocate(sizeof(struct lusp_environment_t));
+	assert(result);
+
+	result->state = state;
+	result->table = 0;
+	result->count = 0;
+
+	return result;
+}
+
+struct lusp_environment_slot_t* lusp_environment_get_slot(struct lusp_environment_t* env, struct lusp_object_t name)
+{
+	struct lusp_environment_slot_t* result = find_slot(env, name);
+	if (result) return result;
+
+	lusp_lock_acquire(&g_lock);
+
+	// slot may have been added since the lookup
+	result = find_slot(env, name);
+
+	if (!result)
+	{
+		// keep the table at most half full
+		if (!env->table || (env->count + 1) * 2 > env->table->capacity) grow_table(env);
+
+		result = mkslot(name);
+		insert_slot(env->table, result);
+		env->count++;
+	}
+
+	lusp_lock_release(&g_lock);
+
+	return result;
+}
+
+struct lusp_object_t lusp_environment_get(struct lusp_environment_t* env, struct lusp_object_t name)
+{
+	return lusp_environment_get_slot(env, name)->value;
+}
+
+void lusp_environment_put(struct lusp_environment_t* env, struct lusp_object_t name, struct lusp_object_t object)
+{
+	lusp_environment_get_slot(env, name)->value = object;
+}
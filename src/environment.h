@@ -1,23 +1,34 @@
-#pragma once
-
-#include "object.h"
-
-struct lusp_environment_slot_t
-{
-	struct lusp_symbol_t* name;
-	struct lusp_environment_slot_t* next;
-
-	struct lusp_object_t value;
-};
-
-struct lusp_environment_t
-{
-	struct lusp_environment_slot_t* head;
-};
-
-struct lusp_environment_t* lusp_environment_create();
-
-struct lusp_environment_slot_t* lusp_environment_get_slot(struct lusp_environment_t* env, struct lusp_object_t name);
-
-struct lusp_object_t lusp_environment_get(struct lusp_environment_t* env, struct lusp_object_t name);
-void lusp_environment_put(struct lusp_environment_t* env, struct lusp_object_t name, struct lusp_object_t object);
+#pragma once
+
+#include "object.h"
+
+struct lusp_state_t;
+
+struct lusp_environment_slot_t
+{
+	struct lusp_symbol_t* name;
+
+	struct lusp_object_t value;
+};
+
+struct lusp_environment_table_t;
+
+// environment holds global slots; bytecode is not tied to an environment and is bound to one with lusp_bind_bytecode
+// environment belongs to a state, which evaluates code bound to it
+struct lusp_environment_t
+{
+	struct lusp_state_t* state;
+
+	// slots hashed by name
+	struct lusp_environment_table_t* table;
+	unsigned int count;
+};
+
+// environment starts out empty; lusp_register_builtins adds the builtin functions
+struct lusp_environment_t* lusp_environment_create(struct lusp_state_t* state);
+
+// slots are created on first use; slot lookup and creation are safe to call from multiple threads
+struct lusp_environment_slot_t* lusp_environment_get_slot(struct lusp_environment_t* env, struct lusp_object_t name);
+
+struct lusp_object_t lusp_environment_get(struct lusp_environment_t* env, struct lusp_object_t name);
+void lusp_environment_put(struct lusp_environment_t* env, struct lusp_object_t name, struct lusp_object_t object);
@@ -1,50 +1,102 @@
-#include "eval.h"
-
-#include "bytecode.h"
-
-static lusp_vm_evaluator_t g_evaluator;
-
-// available evaluator functions
-struct lusp_object_t lusp_eval_vm(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
-
-#if DL_WINDOWS
-struct lusp_object_t lusp_eval_jit_x86(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
-#endif
-
-void lusp_jit_set(bool enabled)
-{
-#if DL_WINDOWS
-	g_evaluator = enabled ? lusp_eval_jit_x86 : lusp_eval_vm;
-#else
-	(void)enabled;
-	g_evaluator = lusp_eval_vm;
-#endif
-}
-
-bool lusp_jit_get()
-{
-#if DL_WINDOWS
-	return g_evaluator == lusp_eval_jit_x86;
-#else
-	return false;
-#endif
-}
-
-struct lusp_object_t lusp_eval(struct lusp_object_t object)
-{
-	if (object.type != LUSP_OBJECT_CLOSURE) return lusp_mknull();
-
-	struct lusp_object_t eval_stack[1024];
-
-	// setup top-level frame
-	eval_stack[0].type = LUSP_OBJECT_CALL_FRAME;
-
-	struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)eval_stack[0].call_frame;
-
-	frame->regs = 0;
-	frame->closure = 0;
-	frame->pc = 0;
-
-	// call
-	return g_evaluator(object.closure->code, object.closure, eval_stack + 2, 0);
-}
+#include "eval.h"
+
+#include "bytecode.h"
+#include "state.h"
+
+// available evaluator functions
+struct lusp_object_t lusp_eval_vm(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+
+#if DL_WINDOWS
+struct lusp_object_t lusp_eval_jit_x86(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+#endif
+
+void lusp_jit_set(struct lusp_state_t* state, bool enabled)
+{
+#if DL_WINDOWS
+	state->evaluator = enabled ? lusp_eval_jit_x86 : lusp_eval_vm;
+#else
+	(void)enabled;
+	state->evaluator = lusp_eval_vm;
+#endif
+}
+
+bool lusp_jit_get(struct lusp_state_t* state)
+{
+#if DL_WINDOWS
+	return state->evaluator == lusp_eval_jit_x86;
+#else
+	(void)state;
+	return false;
+#endif
+}
+
+void lusp_eval_set_budget(struct lusp_state_t* state, unsigned int budget)
+{
+	state->budget = budget;
+}
+
+enum lusp_eval_status_t lusp_call(struct lusp_state_t* state, struct lusp_object_t object, struct lusp_object_t* args, unsigned int count, struct lusp_object_t* result)
+{
+	*result = lusp_mknull();
+
+	// nested evaluations of an aborted evaluation don't run, so that native functions that start them return quickly
+	if (state->status != LUSP_EVAL_OK) return state->status;
+
+	if (object.type != LUSP_OBJECT_CLOSURE) return LUSP_EVAL_OK;
+
+	struct lusp_vm_bytecode_t* code = object.closure->code;
+
+	if (count > code->param_count) count = code->param_count;
+
+	// nested evaluation starts above the arguments of the native function that is running
+	struct lusp_object_t* eval_stack = state->stack_top;
+
+	if (eval_stack + 2 + code->reg_count > state->stack + state->stack_size)
+	{
+		lusp_eval_abort(state, LUSP_EVAL_STACK_OVERFLOW);
+		return LUSP_EVAL_STACK_OVERFLOW;
+	}
+
+	// setup top-level frame
+	eval_stack[0].type = LUSP_OBJECT_CALL_FRAME;
+
+	struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)eval_stack[0].call_frame;
+
+	frame->regs = 0;
+	frame->closure = 0;
+	frame->pc = 0;
+
+	// copy arguments
+	for (unsigned int i = 0; i < count; ++i) eval_stack[2 + i] = args[i];
+
+	// native frames can't be suspended, so nested evaluation runs outside of the current coroutine
+	struct lusp_coroutine_t* coroutine = state->coroutine;
+	state->coroutine = 0;
+
+	// outermost evaluation gets the full budget
+	if (state->depth++ == 0) state->budget_left = state->budget ? state->budget : INT64_MAX;
+
+	// call; aborted evaluations return null
+	*result = state->evaluator(state, code, object.closure, eval_stack + 2, count);
+
+	state->stack_top = eval_stack;
+	state->coroutine = coroutine;
+
+	enum lusp_eval_status_t status = state->status;
+
+	// outermost evaluation reports the status, nested ones leave it to unwind the native function that called them
+	if (--state->depth == 0) state->status = LUSP_EVAL_OK;
+
+	return status;
+}
+
+enum lusp_eval_status_t lusp_eval(struct lusp_state_t* state, struct lusp_object_t object, struct lusp_object_t* result)
+{
+	return lusp_call(state, object, 0, 0, result);
+}
+
+void lusp_eval_abort(struct lusp_state_t* state, enum lusp_eval_status_t status)
+{
+	// first reason is kept; outside of evaluations there is nothing to abort
+	if (state->depth > 0 && state->status == LUSP_EVAL_OK) state->status = status;
+}
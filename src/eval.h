@@ -1,8 +1,38 @@
-#pragma once
-
-#include "object.h"
-
-void lusp_jit_set(bool enabled);
-bool lusp_jit_get();
-
-struct lusp_object_t lusp_eval(struct lusp_object_t object);
+#pragma once
+
+#include "object.h"
+
+struct lusp_state_t;
+
+enum lusp_eval_status_t
+{
+	LUSP_EVAL_OK,
+
+	// execution budget ran out in code that can't be preempted
+	LUSP_EVAL_BUDGET,
+
+	// register stack ran out, or a coroutine stack reached LUSP_COROUTINE_STACK_LIMIT
+	LUSP_EVAL_STACK_OVERFLOW,
+
+	// native function called lusp_eval_abort
+	LUSP_EVAL_ABORTED
+};
+
+void lusp_jit_set(struct lusp_state_t* state, bool enabled);
+bool lusp_jit_get(struct lusp_state_t* state);
+
+// limits the number of calls per evaluation, 0 disables the limit; evaluations and coroutine resumes that start outside
+// of other evaluations get the full budget, nested evaluations, parallel loops and resumes share it
+// coroutine code that runs out of budget is preempted (see lusp_coroutine_resume), other code is aborted
+void lusp_eval_set_budget(struct lusp_state_t* state, unsigned int budget);
+
+// evaluates closure on the register stack of state; can be called from native functions running on the same state
+// returns LUSP_EVAL_OK and stores the result of the closure, or returns the reason the evaluation was aborted and stores null
+enum lusp_eval_status_t lusp_eval(struct lusp_state_t* state, struct lusp_object_t object, struct lusp_object_t* result);
+
+// calls closure with arguments that are copied to the register stack; extra arguments are dropped, missing ones are null
+enum lusp_eval_status_t lusp_call(struct lusp_state_t* state, struct lusp_object_t object, struct lusp_object_t* args, unsigned int count, struct lusp_object_t* result);
+
+// aborts the evaluation that runs the calling native function, which should return afterwards; all nested evaluations
+// are unwound and the outermost lusp_eval or lusp_call returns status, nested ones return it as soon as they are called
+void lusp_eval_abort(struct lusp_state_t* state, enum lusp_eval_status_t status);
@@ -1,525 +1,972 @@
-#ifdef DL_WINDOWS
-
-#include "environment.h"
-#include "object.h"
-
-#include "bytecode.h"
-#include "codegen_x86.h"
-#include "utils.h"
-
-#include <windows.h>
-
-void* allocate_code()
-{
-	return VirtualAlloc(0, 16 * 1024, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-}
-
-static struct lusp_vm_upval_t g_dummy_upval = {0, {{LUSP_OBJECT_NULL, {0}}}};
-
-// ecx = ref, edx = unused
-static struct lusp_vm_upval_t* __fastcall jit_mkupval(struct lusp_object_t* ref, unsigned int unused, struct lusp_vm_upval_t** list)
-{
-	(void)unused;
-
-	return mkupval(list, ref);
-}
-
-static struct lusp_vm_upval_t* __fastcall jit_close_upvals(struct lusp_vm_upval_t* list, struct lusp_object_t* begin)
-{
-	return close_upvals(list, begin);
-}
-
-#define BINOP(func)                                                                                                  \
-	static struct lusp_object_t __fastcall jit_binop_##func(struct lusp_object_t* left, struct lusp_object_t* right) \
-	{                                                                                                                \
-		return binop_##func(left, right);                                                                            \
-	}
-
-typedef struct lusp_object_t(__fastcall* binop_function_t)(struct lusp_object_t*, struct lusp_object_t*);
-
-BINOP(add);
-BINOP(subtract);
-BINOP(multiply);
-BINOP(divide);
-BINOP(modulo);
-BINOP(equal);
-BINOP(not_equal);
-BINOP(less);
-BINOP(less_equal);
-BINOP(greater);
-BINOP(greater_equal);
-
-#undef BINOP
-
-// registers:
-// ebx: closure
-// esi: regs
-// ecx: arg_count, used for internal calculations
-// eax, edx, edi: used for internal calculations
-
-static inline uint8_t* compile_prologue(uint8_t* code)
-{
-	// store volatile registers to stack
-	PUSH_REG(EBX);
-	PUSH_REG(ESI);
-	PUSH_REG(EDI);
-
-	// store upval list on stack
-	PUSH_IMM(&g_dummy_upval);
-
-	// assuming the following declaration, load arguments from stack:
-	// typedef struct lusp_object_t (*lusp_vm_evaluator_t)(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
-	const unsigned int stack_offset = 20;
-
-	// load arg_count into ecx
-	MOV_REG_PREG_OFF(ECX, ESP, stack_offset + 12);
-
-	// load regs into esi
-	MOV_REG_PREG_OFF(ESI, ESP, stack_offset + 8);
-
-	// load closure into ebx
-	MOV_REG_PREG_OFF(EBX, ESP, stack_offset + 4);
-
-	return code;
-}
-
-static inline uint8_t* compile_epilogue(uint8_t* code)
-{
-	// load upval list from stack
-	POP_REG(ECX);
-
-	// load volatile registers from stack
-	POP_REG(EDI);
-	POP_REG(ESI);
-	POP_REG(EBX);
-
-	return code;
-}
-
-static inline uint8_t* compile_load_reg(uint8_t* code, unsigned int reg)
-{
-	MOV_REG_PREG_OFF(EAX, ESI, reg * sizeof(struct lusp_object_t) + 0);
-	MOV_REG_PREG_OFF(EDX, ESI, reg * sizeof(struct lusp_object_t) + 4);
-
-	return code;
-}
-
-static inline uint8_t* compile_store_reg(uint8_t* code, unsigned int reg)
-{
-	MOV_PREG_OFF_REG(ESI, reg * sizeof(struct lusp_object_t) + 0, EAX);
-	MOV_PREG_OFF_REG(ESI, reg * sizeof(struct lusp_object_t) + 4, EDX);
-
-	return code;
-}
-
-static inline uint8_t* compile_load_const(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// load object from fixed address
-	MOV_REG_PIMM(EAX, &op.load_const.object->type);
-	MOV_REG_PIMM(EDX, &op.load_const.object->object);
-
-	// store to regs
-	return compile_store_reg(code, op.reg);
-}
-
-static inline uint8_t* compile_loadstore_global(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// object is in environment slot
-	struct lusp_object_t* value = &op.loadstore_global.slot->value;
-
-	if (op.opcode == LUSP_VMOP_LOAD_GLOBAL)
-	{
-		// load from slot
-		MOV_REG_PIMM(EAX, &value->type);
-		MOV_REG_PIMM(EDX, &value->object);
-
-		// store to regs
-		code = compile_store_reg(code, op.reg);
-	}
-	else
-	{
-		// load from regs
-		code = compile_load_reg(code, op.reg);
-
-		// store to slot
-		MOV_PIMM_REG(&value->type, EAX);
-		MOV_PIMM_REG(&value->object, EDX);
-	}
-
-	return code;
-}
-
-static inline uint8_t* compile_loadstore_upval(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// object is in upvalue
-	size_t offset = offsetof(struct lusp_vm_closure_t, upvals[op.loadstore_upval.index]);
-
-	// load upval address
-	MOV_REG_PREG_OFF(ECX, EBX, offset);
-	MOV_REG_PREG_OFF(ECX, ECX, offsetof(struct lusp_vm_upval_t, ref));
-
-	if (op.opcode == LUSP_VMOP_LOAD_UPVAL)
-	{
-		// load from upval
-		MOV_REG_PREG_OFF(EAX, ECX, 0);
-		MOV_REG_PREG_OFF(EDX, ECX, 4);
-
-		// store to regs
-		code = compile_store_reg(code, op.reg);
-	}
-	else
-	{
-		// load from regs
-		code = compile_load_reg(code, op.reg);
-
-		// store to upval
-		MOV_PREG_OFF_REG(ECX, 0, EAX);
-		MOV_PREG_OFF_REG(ECX, 4, EDX);
-	}
-
-	return code;
-}
-
-static inline uint8_t* compile_move(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// load from regs
-	code = compile_load_reg(code, op.move.index);
-
-	// store to regs
-	return compile_store_reg(code, op.reg);
-}
-
-static inline uint8_t* compile_call(uint8_t* code, struct lusp_vm_op_t op, struct lusp_environment_t* env)
-{
-	// load from regs
-	code = compile_load_reg(code, op.reg);
-
-	// compute args start
-	LEA_REG_PREG_OFF(ECX, ESI, op.call.args * sizeof(struct lusp_object_t));
-
-	// is this a function?
-	DL_STATIC_ASSERT(offsetof(struct lusp_object_t, type) == 0);
-	CMP_REG_IMM8(EAX, LUSP_OBJECT_FUNCTION);
-
-	// it's not, jump to closure call
-	uint8_t* closure;
-	JNE_IMM8(closure);
-
-	// push arguments (environment pointer, argument array, call count)
-	PUSH_IMM(op.call.count);
-	PUSH_REG(ECX);
-	PUSH_IMM(env);
-
-	// call function by pointer
-	CALL_REG(EDX);
-
-	// pop arguments
-	ADD_REG_IMM8(ESP, 12);
-
-	// jmp end
-	uint8_t* end;
-	JMP_IMM8(end);
-
-	// closure:
-	LABEL8(closure);
-
-	// load bytecode pointer
-	MOV_REG_PREG_OFF(EAX, EDX, offsetof(struct lusp_vm_closure_t, code));
-
-	// push arguments (bytecode, closure, argument array, call count)
-	PUSH_IMM(op.call.count);
-	PUSH_REG(ECX);
-	PUSH_REG(EDX);
-	PUSH_REG(EAX);
-
-	// call closure
-	MOV_REG_PREG_OFF(EAX, EAX, offsetof(struct lusp_vm_bytecode_t, jit));
-	CALL_REG(EAX);
-
-	// pop arguments
-	ADD_REG_IMM8(ESP, 16);
-
-	// end:
-	LABEL8(end);
-
-	// store to regs
-	return compile_store_reg(code, op.reg);
-}
-
-static inline uint8_t* compile_ret(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// load from regs
-	code = compile_load_reg(code, op.reg);
-
-	// epilogue
-	code = compile_epilogue(code);
-
-	// ret
-	RET();
-
-	return code;
-}
-
-static inline uint8_t* compile_jump(uint8_t* code, struct lusp_vm_op_t op)
-{
-	(void)op;
-
-	// jmp offset
-	JMP_IMM32(0);
-
-	return code;
-}
-
-static inline uint8_t* compile_jump_cond(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// load from regs
-	code = compile_load_reg(code, op.reg);
-
-	// merge type and boolean value in single value
-	MOV_REG_REG(ECX, EDX);
-	SHL_REG_IMM8(ECX, 24);
-	ADD_REG_REG(ECX, EAX);
-
-	// compare with 'false' value and jump
-	CMP_REG_IMM8(ECX, LUSP_OBJECT_BOOLEAN);
-	(op.opcode == LUSP_VMOP_JUMP_IFNOT) ? (JE_IMM32(0)) : (JNE_IMM32(0));
-
-	return code;
-}
-
-static inline uint8_t* compile_create_closure(uint8_t* code, struct lusp_vm_op_t op, struct lusp_vm_op_t* upval_ops)
-{
-	unsigned int upval_count = op.create_closure.code->upval_count;
-
-	// push arguments (bytecode, upvalue count)
-	PUSH_IMM(upval_count);
-	PUSH_IMM(op.create_closure.code);
-
-	// create closure
-	CALL_FUNC(lusp_mkclosure);
-
-	// pop arguments
-	ADD_REG_IMM8(ESP, 8);
-
-	// if closure has no upvalues, we're done
-	if (upval_count == 0) return compile_store_reg(code, op.reg);
-
-	// save closure pointer
-	MOV_REG_REG(EDI, EDX);
-
-	// set upvalues
-	for (unsigned int i = 0; i < upval_count; ++i)
-	{
-		struct lusp_vm_op_t op = upval_ops[i];
-
-		switch (op.opcode)
-		{
-		case LUSP_VMOP_MOVE:
-			// push arguments (ref, list)
-			LEA_REG_PREG_OFF(ECX, ESI, op.move.index * sizeof(struct lusp_object_t));
-			PUSH_REG(ESP);
-
-			// make upval
-			CALL_FUNC(jit_mkupval);
-			break;
-
-		case LUSP_VMOP_LOAD_UPVAL:
-			// get upval from closure upval list
-			MOV_REG_PREG_OFF(EAX, EBX, offsetof(struct lusp_vm_closure_t, upvals[op.loadstore_upval.index]));
-			break;
-
-		default:
-			assert(!"unexpected instruction");
-		}
-
-		// store upval
-		MOV_PREG_OFF_REG(EDI, offsetof(struct lusp_vm_closure_t, upvals[i]), EAX);
-	}
-
-	// fix closure
-	MOV_REG_IMM(EAX, LUSP_OBJECT_CLOSURE);
-	MOV_REG_REG(EDX, EDI);
-
-	// store to reg
-	return compile_store_reg(code, op.reg);
-}
-
-static inline uint8_t* compile_close(uint8_t* code, struct lusp_vm_op_t op)
-{
-	// push arguments (upval list, begin)
-	POP_REG(ECX);
-	LEA_REG_PREG_OFF(EDX, ESI, op.close.begin * sizeof(struct lusp_object_t));
-
-	// close
-	CALL_FUNC(jit_close_upvals);
-
-	// store upval list
-	PUSH_REG(EAX);
-
-	return code;
-}
-
-static inline uint8_t* compile_binop(uint8_t* code, struct lusp_vm_op_t op, binop_function_t function)
-{
-	// push arguments (left, right)
-	LEA_REG_PREG_OFF(ECX, ESI, op.binop.left * sizeof(struct lusp_object_t));
-	LEA_REG_PREG_OFF(EDX, ESI, op.binop.right * sizeof(struct lusp_object_t));
-
-	// call function
-	CALL_FUNC(function);
-
-	// store to reg
-	return compile_store_reg(code, op.reg);
-}
-
-static void compile(uint8_t* code, struct lusp_environment_t* env, struct lusp_vm_op_t* ops, unsigned int op_count)
-{
-	uint8_t* labels[1024];
-	uint8_t* jumps[1024];
-
-	// prologue
-	code = compile_prologue(code);
-
-	// first pass: compile code
-	for (unsigned int i = 0; i < op_count; ++i)
-	{
-		struct lusp_vm_op_t op = ops[i];
-
-		// store label
-		labels[i] = code;
-
-		// compile code
-		switch (op.opcode)
-		{
-		case LUSP_VMOP_LOAD_CONST:
-			code = compile_load_const(code, op);
-			break;
-
-		case LUSP_VMOP_LOAD_GLOBAL:
-		case LUSP_VMOP_STORE_GLOBAL:
-			code = compile_loadstore_global(code, op);
-			break;
-
-		case LUSP_VMOP_LOAD_UPVAL:
-		case LUSP_VMOP_STORE_UPVAL:
-			code = compile_loadstore_upval(code, op);
-			break;
-
-		case LUSP_VMOP_MOVE:
-			code = compile_move(code, op);
-			break;
-
-		case LUSP_VMOP_CALL:
-			code = compile_call(code, op, env);
-			break;
-
-		case LUSP_VMOP_RETURN:
-			code = compile_ret(code, op);
-			break;
-
-		case LUSP_VMOP_JUMP:
-			code = compile_jump(code, op);
-			jumps[i] = code - sizeof(uint32_t);
-			break;
-
-		case LUSP_VMOP_JUMP_IF:
-		case LUSP_VMOP_JUMP_IFNOT:
-			code = compile_jump_cond(code, op);
-			jumps[i] = code - sizeof(uint32_t);
-			break;
-
-		case LUSP_VMOP_CREATE_CLOSURE:
-			code = compile_create_closure(code, op, &ops[i + 1]);
-
-			// skip upvalue instructions
-			i += op.create_closure.code->upval_count;
-			break;
-
-		case LUSP_VMOP_CLOSE:
-			code = compile_close(code, op);
-			break;
-
-		case LUSP_VMOP_ADD:
-			code = compile_binop(code, op, jit_binop_add);
-			break;
-
-		case LUSP_VMOP_SUBTRACT:
-			code = compile_binop(code, op, jit_binop_subtract);
-			break;
-
-		case LUSP_VMOP_MULTIPLY:
-			code = compile_binop(code, op, jit_binop_multiply);
-			break;
-
-		case LUSP_VMOP_DIVIDE:
-			code = compile_binop(code, op, jit_binop_divide);
-			break;
-
-		case LUSP_VMOP_MODULO:
-			code = compile_binop(code, op, jit_binop_modulo);
-			break;
-
-		case LUSP_VMOP_EQUAL:
-			code = compile_binop(code, op, jit_binop_equal);
-			break;
-
-		case LUSP_VMOP_NOT_EQUAL:
-			code = compile_binop(code, op, jit_binop_not_equal);
-			break;
-
-		case LUSP_VMOP_LESS:
-			code = compile_binop(code, op, jit_binop_less);
-			break;
-
-		case LUSP_VMOP_LESS_EQUAL:
-			code = compile_binop(code, op, jit_binop_less_equal);
-			break;
-
-		case LUSP_VMOP_GREATER:
-			code = compile_binop(code, op, jit_binop_greater);
-			break;
-
-		case LUSP_VMOP_GREATER_EQUAL:
-			code = compile_binop(code, op, jit_binop_greater_equal);
-			break;
-
-		default:
-			assert(false);
-		}
-	}
-
-	// second pass: fixup labels
-	for (unsigned int i = 0; i < op_count; ++i)
-	{
-		struct lusp_vm_op_t op = ops[i];
-
-		if (op.opcode != LUSP_VMOP_JUMP && op.opcode != LUSP_VMOP_JUMP_IF && op.opcode != LUSP_VMOP_JUMP_IFNOT) continue;
-
-		LABEL32(jumps[i], labels[i + op.jump.offset + 1]);
-	}
-}
-
-static void compile_jit(struct lusp_vm_bytecode_t* code)
-{
-	code->jit = allocate_code();
-
-	compile((unsigned char*)code->jit, code->env, code->ops, code->op_count);
-}
-
-struct lusp_object_t lusp_eval_jit_x86_stub(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
-{
-	if (code->jit == lusp_eval_jit_x86_stub) compile_jit(code);
-
-	lusp_vm_evaluator_t function = (lusp_vm_evaluator_t)code->jit;
-
-	return function(code, closure, regs, arg_count);
-}
-
-struct lusp_object_t lusp_eval_jit_x86(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
-{
-	lusp_vm_evaluator_t function = (lusp_vm_evaluator_t)code->jit;
-
-	return function(code, closure, regs, arg_count);
-}
-
-#endif
+#ifdef DL_WINDOWS
+
+#include "environment.h"
+#include "memory.h"
+#include "object.h"
+#include "state.h"
+#include "thread.h"
+
+#include "bytecode.h"
+#include "codegen_x86.h"
+#include "utils.h"
+
+#include <setjmp.h>
+#include <windows.h>
+
+// upper bounds of machine code size for entry points, argument fixup or clearing per register and a single op
+#define CODE_SIZE_ENTRY 256
+#define CODE_SIZE_PARAM 32
+#define CODE_SIZE_OP 256
+
+void* allocate_code(size_t size)
+{
+	return VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+}
+
+static struct lusp_vm_upval_t g_dummy_upval = {0, {{LUSP_OBJECT_NULL, {0}}}};
+
+// ecx = ref, edx = unused
+static struct lusp_vm_upval_t* __fastcall jit_mkupval(struct lusp_object_t* ref, unsigned int unused, struct lusp_vm_upval_t** list)
+{
+	(void)unused;
+
+	return mkupval(list, ref);
+}
+
+static struct lusp_vm_upval_t* __fastcall jit_close_upvals(struct lusp_vm_upval_t* list, struct lusp_object_t* begin)
+{
+	return close_upvals(list, begin);
+}
+
+// objects do not fit in edx:eax, so helpers store the result by pointer instead of returning it
+#define BINOP(func)                                                                                                                       \
+	static void __fastcall jit_binop_##func(struct lusp_object_t* left, struct lusp_object_t* right, struct lusp_object_t* result) \
+	{                                                                                                                                     \
+		*result = binop_##func(left, right);                                                                                              \
+	}
+
+typedef void(__fastcall* binop_function_t)(struct lusp_object_t*, struct lusp_object_t*, struct lusp_object_t*);
+
+BINOP(add);
+BINOP(subtract);
+BINOP(multiply);
+BINOP(divide);
+BINOP(modulo);
+BINOP(equal);
+BINOP(not_equal);
+BINOP(less);
+BINOP(less_equal);
+BINOP(greater);
+BINOP(greater_equal);
+
+#undef BINOP
+
+// ecx = elements, edx = count
+static void __fastcall jit_create_vector(struct lusp_object_t* elements, unsigned int count, struct lusp_object_t* result)
+{
+	*result = create_vector(elements, count);
+}
+
+static void __fastcall jit_index_get(struct lusp_object_t* object, struct lusp_object_t* key, struct lusp_object_t* result)
+{
+	*result = index_get(object, key);
+}
+
+static void __fastcall jit_index_set(struct lusp_object_t* object, struct lusp_object_t* key, struct lusp_object_t* value)
+{
+	index_set(object, key, value);
+}
+
+// compiled functions call each other directly, so aborts unwind compiled frames to the innermost JIT evaluation
+static void __fastcall jit_abort(struct lusp_state_t* state, enum lusp_eval_status_t status)
+{
+	lusp_eval_abort(state, status);
+
+	longjmp(*(jmp_buf*)state->jit_context, 1);
+}
+
+// compiled code never runs coroutines, so running out of budget aborts the evaluation unless a parallel loop has calls left
+static void __fastcall jit_refill_budget(struct lusp_state_t* state)
+{
+	if (!lusp_state_refill_budget(state)) jit_abort(state, LUSP_EVAL_BUDGET);
+}
+
+// registers:
+// ebx: closure
+// esi: regs
+// ecx: arg_count, used for internal calculations
+// eax, edx, edi: used for internal calculations
+// xmm0: used for object copies and real arithmetic
+
+// objects are 16 bytes (type, padding, 8-byte value) and are copied with a single unaligned SSE load/store;
+// functions returning objects (evaluators, lusp_function_t, lusp_mkclosure) take a hidden result pointer as first argument
+#define OBJECT_SIZE 16
+#define OBJECT_TYPE offsetof(struct lusp_object_t, type)
+#define OBJECT_VALUE offsetof(struct lusp_object_t, object)
+#define REG(index) ((index) * OBJECT_SIZE)
+
+// offset of the state argument from esp in function body (upval list, saved registers, return address, result pointer)
+#define STATE_OFFSET 24
+
+static inline uint8_t* compile_arity(uint8_t* code, unsigned int param_count)
+{
+	// generic entry is called with the same arguments as the exact-arity entry, no registers are saved yet:
+	// typedef struct lusp_object_t (*lusp_vm_evaluator_t)(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+	// the first stack argument is the hidden result pointer
+	const unsigned int stack_offset = 8;
+
+	// load arg_count into ecx
+	MOV_REG_PREG_OFF(ECX, ESP, stack_offset + 16);
+
+	// load regs into edx
+	MOV_REG_PREG_OFF(EDX, ESP, stack_offset + 12);
+
+	// fill missing arguments with null
+	for (unsigned int i = 0; i < param_count; ++i)
+	{
+		// argument is present if arg_count > i
+		CMP_REG_IMM32(ECX, i);
+
+		uint8_t* skip;
+		JA_IMM8(skip);
+
+		MOV_PREG_OFF_IMM(EDX, REG(i) + OBJECT_TYPE, LUSP_OBJECT_NULL);
+
+		LABEL8(skip);
+	}
+
+	// fall through to exact-arity entry
+	return code;
+}
+
+static inline uint8_t* compile_prologue(uint8_t* code)
+{
+	// store volatile registers to stack
+	PUSH_REG(EBX);
+	PUSH_REG(ESI);
+	PUSH_REG(EDI);
+
+	// store upval list on stack
+	PUSH_IMM(&g_dummy_upval);
+
+	// assuming the following declaration, load arguments from stack (skipping hidden result pointer):
+	// typedef struct lusp_object_t (*lusp_vm_evaluator_t)(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+	const unsigned int stack_offset = STATE_OFFSET;
+
+	// load arg_count into ecx
+	MOV_REG_PREG_OFF(ECX, ESP, stack_offset + 16);
+
+	// load regs into esi
+	MOV_REG_PREG_OFF(ESI, ESP, stack_offset + 12);
+
+	// load closure into ebx
+	MOV_REG_PREG_OFF(EBX, ESP, stack_offset + 8);
+
+	return code;
+}
+
+static inline uint8_t* compile_entry_check(uint8_t* code, unsigned int reg_count)
+{
+	// load state pointer; volatile registers are saved and arg_count in ecx is not used after the prologue
+	MOV_REG_PREG_OFF(EAX, ESP, STATE_OFFSET);
+
+	// registers of the function must fit on the stack: regs + reg_count <= stack + stack_size
+	MOV_REG_PREG_OFF(EDX, EAX, offsetof(struct lusp_state_t, stack_size));
+	SHL_REG_IMM8(EDX, 4);
+	ADD_REG_PREG_OFF(EDX, EAX, offsetof(struct lusp_state_t, stack));
+	LEA_REG_PREG_OFF(EDI, ESI, REG(reg_count));
+	CMP_REG_REG(EDI, EDX);
+
+	uint8_t* overflow;
+	JA_IMM8(overflow);
+
+	// calls are counted at function entry like in the VM; 64-bit decrement of budget_left
+	SUB_PREG_OFF_IMM8(EAX, offsetof(struct lusp_state_t, budget_left), 1);
+	SBB_PREG_OFF_IMM8(EAX, offsetof(struct lusp_state_t, budget_left) + 4, 0);
+
+	uint8_t* end;
+	JNS_IMM8(end);
+
+	// jit_refill_budget(state) returns if there are calls left; scratch registers are not used after the check
+	MOV_REG_REG(ECX, EAX);
+	CALL_FUNC(jit_refill_budget);
+
+	uint8_t* refilled;
+	JMP_IMM8(refilled);
+
+	// overflow:
+	LABEL8(overflow);
+
+	// jit_abort(state, status) does not return
+	MOV_REG_IMM(EDX, LUSP_EVAL_STACK_OVERFLOW);
+	MOV_REG_REG(ECX, EAX);
+	CALL_FUNC(jit_abort);
+
+	// end:
+	LABEL8(end);
+	LABEL8(refilled);
+
+	return code;
+}
+
+static inline uint8_t* compile_epilogue(uint8_t* code)
+{
+	// load upval list from stack
+	POP_REG(ECX);
+
+	// load volatile registers from stack
+	POP_REG(EDI);
+	POP_REG(ESI);
+	POP_REG(EBX);
+
+	return code;
+}
+
+static inline uint8_t* compile_load_const(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// load object from fixed address
+	MOVUPS_XMM_PIMM(XMM0, op.load_const.object);
+
+	// store to regs
+	MOVUPS_PREG_OFF_XMM(ESI, REG(op.reg), XMM0);
+
+	return code;
+}
+
+static inline uint8_t* compile_loadstore_global(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// object is in environment slot, bytecode is shared between environments so slot is found through closure globals
+	size_t offset = offsetof(struct lusp_vm_globals_t, slots[op.loadstore_global.index]);
+
+	// load slot address
+	MOV_REG_PREG_OFF(ECX, EBX, offsetof(struct lusp_vm_closure_t, globals));
+	MOV_REG_PREG_OFF(ECX, ECX, offset);
+
+	if (op.opcode == LUSP_VMOP_LOAD_GLOBAL)
+	{
+		// load from slot, store to regs
+		MOVUPS_XMM_PREG_OFF(XMM0, ECX, offsetof(struct lusp_environment_slot_t, value));
+		MOVUPS_PREG_OFF_XMM(ESI, REG(op.reg), XMM0);
+	}
+	else
+	{
+		// load from regs, store to slot
+		MOVUPS_XMM_PREG_OFF(XMM0, ESI, REG(op.reg));
+		MOVUPS_PREG_OFF_XMM(ECX, offsetof(struct lusp_environment_slot_t, value), XMM0);
+	}
+
+	return code;
+}
+
+static inline uint8_t* compile_loadstore_upval(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// object is in upvalue
+	size_t offset = offsetof(struct lusp_vm_closure_t, upvals[op.loadstore_upval.index]);
+
+	// load upval address
+	MOV_REG_PREG_OFF(ECX, EBX, offset);
+	MOV_REG_PREG_OFF(ECX, ECX, offsetof(struct lusp_vm_upval_t, ref));
+
+	if (op.opcode == LUSP_VMOP_LOAD_UPVAL)
+	{
+		// load from upval, store to regs
+		MOVUPS_XMM_PREG_OFF(XMM0, ECX, 0);
+		MOVUPS_PREG_OFF_XMM(ESI, REG(op.reg), XMM0);
+	}
+	else
+	{
+		// load from regs, store to upval
+		MOVUPS_XMM_PREG_OFF(XMM0, ESI, REG(op.reg));
+		MOVUPS_PREG_OFF_XMM(ECX, 0, XMM0);
+	}
+
+	return code;
+}
+
+static inline uint8_t* compile_move(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// load from regs, store to regs
+	MOVUPS_XMM_PREG_OFF(XMM0, ESI, REG(op.move.index));
+	MOVUPS_PREG_OFF_XMM(ESI, REG(op.reg), XMM0);
+
+	return code;
+}
+
+static inline uint8_t* compile_call(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// load from regs
+	MOV_REG_PREG_OFF(EAX, ESI, REG(op.reg) + OBJECT_TYPE);
+	MOV_REG_PREG_OFF(EDX, ESI, REG(op.reg) + OBJECT_VALUE);
+
+	// compute args start
+	LEA_REG_PREG_OFF(ECX, ESI, REG(op.call.args));
+
+	// result is stored directly to function register
+	LEA_REG_PREG_OFF(EDI, ESI, REG(op.reg));
+
+	// is this a function?
+	CMP_REG_IMM8(EAX, LUSP_OBJECT_FUNCTION);
+
+	// it's not, jump to closure call
+	uint8_t* closure;
+	JNE_IMM8(closure);
+
+	// load environment of the running closure
+	MOV_REG_PREG_OFF(EAX, EBX, offsetof(struct lusp_vm_closure_t, globals));
+	MOV_REG_PREG_OFF(EAX, EAX, offsetof(struct lusp_vm_globals_t, env));
+
+	// push arguments (result pointer, state pointer, environment pointer, argument array, call count)
+	PUSH_IMM(op.call.count);
+	PUSH_REG(ECX);
+	PUSH_REG(EAX);
+
+	// load state pointer, skipping 3 pushed arguments
+	MOV_REG_PREG_OFF(EAX, ESP, STATE_OFFSET + 12);
+
+	// native function may evaluate code on the same stack above its arguments
+	LEA_REG_PREG_OFF(ECX, ESI, REG(op.call.args + op.call.count));
+	MOV_PREG_OFF_REG(EAX, offsetof(struct lusp_state_t, stack_top), ECX);
+
+	PUSH_REG(EAX);
+	PUSH_REG(EDI);
+
+	// call function by pointer
+	CALL_REG(EDX);
+
+	// pop arguments
+	ADD_REG_IMM8(ESP, 20);
+
+	// native function aborted the evaluation, or returned from an aborted nested evaluation
+	MOV_REG_PREG_OFF(EAX, ESP, STATE_OFFSET);
+	CMP_PREG_OFF_IMM32(EAX, offsetof(struct lusp_state_t, status), LUSP_EVAL_OK);
+
+	uint8_t* ok;
+	JE_IMM8(ok);
+
+	MOV_REG_REG(ECX, EAX);
+	MOV_REG_PREG_OFF(EDX, EAX, offsetof(struct lusp_state_t, status));
+	CALL_FUNC(jit_abort);
+
+	// ok:
+	LABEL8(ok);
+
+	// jmp end
+	uint8_t* end;
+	JMP_IMM8(end);
+
+	// closure:
+	LABEL8(closure);
+
+	// load bytecode pointer
+	MOV_REG_PREG_OFF(EAX, EDX, offsetof(struct lusp_vm_closure_t, code));
+
+	// push arguments (result pointer, state pointer, bytecode, closure, argument array, call count)
+	PUSH_IMM(op.call.count);
+	PUSH_REG(ECX);
+	PUSH_REG(EDX);
+	PUSH_REG(EAX);
+
+	// load state pointer, skipping 4 pushed arguments
+	MOV_REG_PREG_OFF(ECX, ESP, STATE_OFFSET + 16);
+
+	PUSH_REG(ECX);
+	PUSH_REG(EDI);
+
+	// use exact-arity entry if argument count matches, since it skips argument checks
+	CMP_PREG_OFF_IMM32(EAX, offsetof(struct lusp_vm_bytecode_t, param_count), op.call.count);
+
+	uint8_t* generic;
+	JNE_IMM8(generic);
+
+	MOV_REG_PREG_OFF(EAX, EAX, offsetof(struct lusp_vm_bytecode_t, jit_exact));
+
+	uint8_t* call;
+	JMP_IMM8(call);
+
+	// generic:
+	LABEL8(generic);
+
+	MOV_REG_PREG_OFF(EAX, EAX, offsetof(struct lusp_vm_bytecode_t, jit));
+
+	// call:
+	LABEL8(call);
+
+	// call closure
+	CALL_REG(EAX);
+
+	// pop arguments
+	ADD_REG_IMM8(ESP, 24);
+
+	// end:
+	LABEL8(end);
+
+	return code;
+}
+
+static inline uint8_t* compile_ret(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// load hidden result pointer (stack has 4 saved values and return address)
+	MOV_REG_PREG_OFF(EAX, ESP, 20);
+
+	// copy result; result pointer is returned in eax
+	MOVUPS_XMM_PREG_OFF(XMM0, ESI, REG(op.reg));
+	MOVUPS_PREG_OFF_XMM(EAX, 0, XMM0);
+
+	// epilogue
+	code = compile_epilogue(code);
+
+	// ret
+	RET();
+
+	return code;
+}
+
+static inline uint8_t* compile_jump(uint8_t* code, struct lusp_vm_op_t op)
+{
+	(void)op;
+
+	// jmp offset
+	JMP_IMM32(0);
+
+	return code;
+}
+
+static inline uint8_t* compile_jump_cond(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// load from regs
+	MOV_REG_PREG_OFF(EAX, ESI, REG(op.reg) + OBJECT_TYPE);
+	MOV_REG_PREG_OFF(EDX, ESI, REG(op.reg) + OBJECT_VALUE);
+
+	// merge type and boolean value in single value
+	MOV_REG_REG(ECX, EDX);
+	SHL_REG_IMM8(ECX, 24);
+	ADD_REG_REG(ECX, EAX);
+
+	// compare with 'false' value and jump
+	CMP_REG_IMM8(ECX, LUSP_OBJECT_BOOLEAN);
+	(op.opcode == LUSP_VMOP_JUMP_IFNOT) ? (JE_IMM32(0)) : (JNE_IMM32(0));
+
+	return code;
+}
+
+static inline uint8_t* compile_create_closure(uint8_t* code, struct lusp_vm_op_t op, struct lusp_vm_op_t* upval_ops)
+{
+	unsigned int upval_count = op.create_closure.code->upval_count;
+
+	// push arguments (result pointer, bytecode, globals of the running closure, upvalue count)
+	LEA_REG_PREG_OFF(EAX, ESI, REG(op.reg));
+	MOV_REG_PREG_OFF(ECX, EBX, offsetof(struct lusp_vm_closure_t, globals));
+	PUSH_IMM(upval_count);
+	PUSH_REG(ECX);
+	PUSH_IMM(op.create_closure.code);
+	PUSH_REG(EAX);
+
+	// create closure, result is stored directly to regs
+	CALL_FUNC(lusp_mkclosure);
+
+	// pop arguments
+	ADD_REG_IMM8(ESP, 16);
+
+	// if closure has no upvalues, we're done
+	if (upval_count == 0) return code;
+
+	// load closure pointer
+	MOV_REG_PREG_OFF(EDI, ESI, REG(op.reg) + OBJECT_VALUE);
+
+	// set upvalues
+	for (unsigned int i = 0; i < upval_count; ++i)
+	{
+		struct lusp_vm_op_t op = upval_ops[i];
+
+		switch (op.opcode)
+		{
+		case LUSP_VMOP_MOVE:
+			// push arguments (ref, list)
+			LEA_REG_PREG_OFF(ECX, ESI, REG(op.move.index));
+			PUSH_REG(ESP);
+
+			// make upval
+			CALL_FUNC(jit_mkupval);
+			break;
+
+		case LUSP_VMOP_LOAD_UPVAL:
+			// get upval from closure upval list
+			MOV_REG_PREG_OFF(EAX, EBX, offsetof(struct lusp_vm_closure_t, upvals[op.loadstore_upval.index]));
+			break;
+
+		default:
+			assert(!"unexpected instruction");
+		}
+
+		// store upval
+		MOV_PREG_OFF_REG(EDI, offsetof(struct lusp_vm_closure_t, upvals[i]), EAX);
+	}
+
+	return code;
+}
+
+static inline uint8_t* compile_close(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// push arguments (upval list, begin)
+	POP_REG(ECX);
+	LEA_REG_PREG_OFF(EDX, ESI, REG(op.close.begin));
+
+	// close
+	CALL_FUNC(jit_close_upvals);
+
+	// store upval list
+	PUSH_REG(EAX);
+
+	return code;
+}
+
+static inline uint8_t* compile_create_vector(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// push arguments (elements, count, result)
+	LEA_REG_PREG_OFF(ECX, ESI, REG(op.create_vector.first));
+	MOV_REG_IMM(EDX, op.create_vector.count);
+	LEA_REG_PREG_OFF(EAX, ESI, REG(op.reg));
+	PUSH_REG(EAX);
+
+	// create vector, result is stored directly to regs
+	CALL_FUNC(jit_create_vector);
+
+	return code;
+}
+
+static inline uint8_t* compile_index(uint8_t* code, struct lusp_vm_op_t op)
+{
+	// push arguments (object, key, result or value)
+	LEA_REG_PREG_OFF(ECX, ESI, REG(op.index.object));
+	LEA_REG_PREG_OFF(EDX, ESI, REG(op.index.key));
+	LEA_REG_PREG_OFF(EAX, ESI, REG(op.reg));
+	PUSH_REG(EAX);
+
+	// load or store element
+	if (op.opcode == LUSP_VMOP_INDEX_SET)
+		CALL_FUNC(jit_index_set);
+	else
+		CALL_FUNC(jit_index_get);
+
+	return code;
+}
+
+static inline uint8_t* compile_binop_call(uint8_t* code, struct lusp_vm_op_t op, binop_function_t function)
+{
+	// push arguments (left, right, result)
+	LEA_REG_PREG_OFF(ECX, ESI, REG(op.binop.left));
+	LEA_REG_PREG_OFF(EDX, ESI, REG(op.binop.right));
+	LEA_REG_PREG_OFF(EAX, ESI, REG(op.reg));
+	PUSH_REG(EAX);
+
+	// call function, result is stored directly to regs
+	CALL_FUNC(function);
+
+	return code;
+}
+
+static inline bool is_ordering(uint8_t opcode)
+{
+	return opcode == LUSP_VMOP_LESS || opcode == LUSP_VMOP_LESS_EQUAL || opcode == LUSP_VMOP_GREATER || opcode == LUSP_VMOP_GREATER_EQUAL;
+}
+
+static inline int get_real_operation(uint8_t opcode)
+{
+	switch (opcode)
+	{
+	case LUSP_VMOP_ADD:
+		return SSE_ADD;
+	case LUSP_VMOP_SUBTRACT:
+		return SSE_SUB;
+	case LUSP_VMOP_MULTIPLY:
+		return SSE_MUL;
+	case LUSP_VMOP_DIVIDE:
+		return SSE_DIV;
+	default:
+		return -1;
+	}
+}
+
+static inline bool can_specialize(struct lusp_vm_op_t op)
+{
+	switch (op.feedback)
+	{
+	case LUSP_VM_FEEDBACK_INTEGER:
+		// multiplication, division and modulo are left to the generic path because of 64-bit overflow and zero divisor handling
+		return op.opcode == LUSP_VMOP_ADD || op.opcode == LUSP_VMOP_SUBTRACT || op.opcode == LUSP_VMOP_EQUAL || op.opcode == LUSP_VMOP_NOT_EQUAL || is_ordering(op.opcode);
+
+	case LUSP_VM_FEEDBACK_REAL:
+		// equality is left to the generic path because of nan handling
+		return get_real_operation(op.opcode) >= 0 || is_ordering(op.opcode);
+
+	default:
+		return false;
+	}
+}
+
+static inline uint8_t* compile_store_boolean(uint8_t* code, struct lusp_vm_op_t op, int condition)
+{
+	// make boolean from flags
+	SETCC_REG8(condition, EDX);
+	MOVZX_REG_REG8(EDX, EDX);
+
+	// store to regs
+	MOV_PREG_OFF_IMM(ESI, REG(op.reg) + OBJECT_TYPE, LUSP_OBJECT_BOOLEAN);
+	MOV_PREG_OFF_REG(ESI, REG(op.reg) + OBJECT_VALUE, EDX);
+
+	return code;
+}
+
+static inline uint8_t* compile_binop_integer(uint8_t* code, struct lusp_vm_op_t op, uint8_t** overflow)
+{
+	size_t left = REG(op.binop.left) + OBJECT_VALUE;
+	size_t right = REG(op.binop.right) + OBJECT_VALUE;
+
+	if (op.opcode == LUSP_VMOP_EQUAL || op.opcode == LUSP_VMOP_NOT_EQUAL)
+	{
+		// compare both halves at once
+		MOV_REG_PREG_OFF(EAX, ESI, left);
+		MOV_REG_PREG_OFF(EDX, ESI, left + 4);
+		XOR_REG_PREG_OFF(EAX, ESI, right);
+		XOR_REG_PREG_OFF(EDX, ESI, right + 4);
+		OR_REG_REG(EAX, EDX);
+
+		return compile_store_boolean(code, op, op.opcode == LUSP_VMOP_EQUAL ? CC_E : CC_NE);
+	}
+
+	if (is_ordering(op.opcode))
+	{
+		// 64-bit signed comparison: low halves set carry, high halves subtract with borrow; a > b is b < a, a <= b is b >= a
+		bool swap = (op.opcode == LUSP_VMOP_GREATER || op.opcode == LUSP_VMOP_LESS_EQUAL);
+		bool strict = (op.opcode == LUSP_VMOP_LESS || op.opcode == LUSP_VMOP_GREATER);
+
+		MOV_REG_PREG_OFF(EAX, ESI, swap ? right : left);
+		MOV_REG_PREG_OFF(EDX, ESI, (swap ? right : left) + 4);
+		CMP_REG_PREG_OFF(EAX, ESI, swap ? left : right);
+		SBB_REG_PREG_OFF(EDX, ESI, (swap ? left : right) + 4);
+
+		return compile_store_boolean(code, op, strict ? CC_L : CC_GE);
+	}
+
+	// compute result
+	MOV_REG_PREG_OFF(EAX, ESI, left);
+	MOV_REG_PREG_OFF(EDX, ESI, left + 4);
+
+	switch (op.opcode)
+	{
+	case LUSP_VMOP_ADD:
+		ADD_REG_PREG_OFF(EAX, ESI, right);
+		ADC_REG_PREG_OFF(EDX, ESI, right + 4);
+		break;
+
+	case LUSP_VMOP_SUBTRACT:
+		SUB_REG_PREG_OFF(EAX, ESI, right);
+		SBB_REG_PREG_OFF(EDX, ESI, right + 4);
+		break;
+
+	default:
+		assert(!"unexpected instruction");
+	}
+
+	// overflow is handled by generic path
+	JO_IMM8(*overflow);
+
+	// store to regs
+	MOV_PREG_OFF_IMM(ESI, REG(op.reg) + OBJECT_TYPE, LUSP_OBJECT_INTEGER);
+	MOV_PREG_OFF_REG(ESI, REG(op.reg) + OBJECT_VALUE, EAX);
+	MOV_PREG_OFF_REG(ESI, REG(op.reg) + OBJECT_VALUE + 4, EDX);
+
+	return code;
+}
+
+static inline uint8_t* compile_binop_real(uint8_t* code, struct lusp_vm_op_t op)
+{
+	size_t left = REG(op.binop.left) + OBJECT_VALUE;
+	size_t right = REG(op.binop.right) + OBJECT_VALUE;
+
+	int operation = get_real_operation(op.opcode);
+
+	if (operation >= 0)
+	{
+		// compute result
+		MOVSD_XMM_PREG_OFF(XMM0, ESI, left);
+		SSEOPSD_XMM_PREG_OFF(operation, XMM0, ESI, right);
+
+		// store to regs
+		MOV_PREG_OFF_IMM(ESI, REG(op.reg) + OBJECT_TYPE, LUSP_OBJECT_REAL);
+		MOVSD_PREG_OFF_XMM(ESI, REG(op.reg) + OBJECT_VALUE, XMM0);
+
+		return code;
+	}
+
+	// compare so that unordered operands (nan) produce false: a < b is b > a, a <= b is b >= a
+	bool swap = (op.opcode == LUSP_VMOP_LESS || op.opcode == LUSP_VMOP_LESS_EQUAL);
+	bool strict = (op.opcode == LUSP_VMOP_LESS || op.opcode == LUSP_VMOP_GREATER);
+
+	MOVSD_XMM_PREG_OFF(XMM0, ESI, swap ? right : left);
+	COMISD_XMM_PREG_OFF(XMM0, ESI, swap ? left : right);
+
+	return compile_store_boolean(code, op, strict ? CC_A : CC_AE);
+}
+
+static inline uint8_t* compile_binop(uint8_t* code, struct lusp_vm_op_t op, binop_function_t function)
+{
+	// no useful type feedback, call generic function
+	if (!can_specialize(op)) return compile_binop_call(code, op, function);
+
+	enum lusp_object_type_t type = (op.feedback == LUSP_VM_FEEDBACK_INTEGER) ? LUSP_OBJECT_INTEGER : LUSP_OBJECT_REAL;
+
+	// guard: check operand types
+	CMP_PREG_OFF_IMM32(ESI, REG(op.binop.left) + OBJECT_TYPE, type);
+
+	uint8_t* left_mismatch;
+	JNE_IMM8(left_mismatch);
+
+	CMP_PREG_OFF_IMM32(ESI, REG(op.binop.right) + OBJECT_TYPE, type);
+
+	uint8_t* right_mismatch;
+	JNE_IMM8(right_mismatch);
+
+	// specialized code, stores result to regs
+	uint8_t* overflow = 0;
+
+	code = (type == LUSP_OBJECT_INTEGER) ? compile_binop_integer(code, op, &overflow) : compile_binop_real(code, op);
+
+	// jmp end
+	uint8_t* end;
+	JMP_IMM8(end);
+
+	// guard failed or overflow: call generic function
+	LABEL8(left_mismatch);
+	LABEL8(right_mismatch);
+	if (overflow) LABEL8(overflow);
+
+	code = compile_binop_call(code, op, function);
+
+	// end:
+	LABEL8(end);
+
+	return code;
+}
+
+static uint8_t* compile(uint8_t* code, struct lusp_vm_op_t* ops, unsigned int op_count, unsigned int param_count, unsigned int reg_count)
+{
+	uint8_t** labels = (uint8_t**)lusp_memory_allocate(sizeof(uint8_t*) * op_count * 2);
+	uint8_t** jumps = labels + op_count;
+	assert(labels);
+
+	// generic entry: argument fixup
+	code = compile_arity(code, param_count);
+
+	// exact-arity entry
+	uint8_t* exact = code;
+
+	// prologue
+	code = compile_prologue(code);
+
+	// stack and budget check, before registers are cleared
+	code = compile_entry_check(code, reg_count);
+
+	// clear registers above parameters, including extra arguments, so that the function never sees values left by earlier frames
+	for (unsigned int i = param_count; i < reg_count; ++i)
+		MOV_PREG_OFF_IMM(ESI, REG(i) + OBJECT_TYPE, LUSP_OBJECT_NULL);
+
+	// first pass: compile code
+	for (unsigned int i = 0; i < op_count; ++i)
+	{
+		// interpreters on other threads may update feedback while the function is compiled, so it is loaded atomically
+		// and the rest of the op is copied around it
+		struct lusp_vm_op_t op;
+
+		op.opcode = ops[i].opcode;
+		op.feedback = lusp_atomic_load_relaxed_u8(&ops[i].feedback);
+		op.reg = ops[i].reg;
+		memcpy(&op.load_const, &ops[i].load_const, sizeof(op) - offsetof(struct lusp_vm_op_t, load_const));
+
+		// store label
+		labels[i] = code;
+
+		// compile code
+		switch (op.opcode)
+		{
+		case LUSP_VMOP_LOAD_CONST:
+			code = compile_load_const(code, op);
+			break;
+
+		case LUSP_VMOP_LOAD_GLOBAL:
+		case LUSP_VMOP_STORE_GLOBAL:
+			code = compile_loadstore_global(code, op);
+			break;
+
+		case LUSP_VMOP_LOAD_UPVAL:
+		case LUSP_VMOP_STORE_UPVAL:
+			code = compile_loadstore_upval(code, op);
+			break;
+
+		case LUSP_VMOP_MOVE:
+			code = compile_move(code, op);
+			break;
+
+		case LUSP_VMOP_CALL:
+			code = compile_call(code, op);
+			break;
+
+		case LUSP_VMOP_RETURN:
+			code = compile_ret(code, op);
+			break;
+
+		case LUSP_VMOP_JUMP:
+			code = compile_jump(code, op);
+			jumps[i] = code - sizeof(uint32_t);
+			break;
+
+		case LUSP_VMOP_JUMP_IF:
+		case LUSP_VMOP_JUMP_IFNOT:
+			code = compile_jump_cond(code, op);
+			jumps[i] = code - sizeof(uint32_t);
+			break;
+
+		case LUSP_VMOP_CREATE_CLOSURE:
+			code = compile_create_closure(code, op, &ops[i + 1]);
+
+			// skip upvalue instructions
+			i += op.create_closure.code->upval_count;
+			break;
+
+		case LUSP_VMOP_CLOSE:
+			code = compile_close(code, op);
+			break;
+
+		case LUSP_VMOP_CREATE_VECTOR:
+			code = compile_create_vector(code, op);
+			break;
+
+		case LUSP_VMOP_INDEX_GET:
+		case LUSP_VMOP_INDEX_SET:
+			code = compile_index(code, op);
+			break;
+
+		case LUSP_VMOP_ADD:
+			code = compile_binop(code, op, jit_binop_add);
+			break;
+
+		case LUSP_VMOP_SUBTRACT:
+			code = compile_binop(code, op, jit_binop_subtract);
+			break;
+
+		case LUSP_VMOP_MULTIPLY:
+			code = compile_binop(code, op, jit_binop_multiply);
+			break;
+
+		case LUSP_VMOP_DIVIDE:
+			code = compile_binop(code, op, jit_binop_divide);
+			break;
+
+		case LUSP_VMOP_MODULO:
+			code = compile_binop(code, op, jit_binop_modulo);
+			break;
+
+		case LUSP_VMOP_EQUAL:
+			code = compile_binop(code, op, jit_binop_equal);
+			break;
+
+		case LUSP_VMOP_NOT_EQUAL:
+			code = compile_binop(code, op, jit_binop_not_equal);
+			break;
+
+		case LUSP_VMOP_LESS:
+			code = compile_binop(code, op, jit_binop_less);
+			break;
+
+		case LUSP_VMOP_LESS_EQUAL:
+			code = compile_binop(code, op, jit_binop_less_equal);
+			break;
+
+		case LUSP_VMOP_GREATER:
+			code = compile_binop(code, op, jit_binop_greater);
+			break;
+
+		case LUSP_VMOP_GREATER_EQUAL:
+			code = compile_binop(code, op, jit_binop_greater_equal);
+			break;
+
+		default:
+			assert(false);
+		}
+	}
+
+	// second pass: fixup labels
+	for (unsigned int i = 0; i < op_count; ++i)
+	{
+		struct lusp_vm_op_t* op = &ops[i];
+
+		if (op->opcode != LUSP_VMOP_JUMP && op->opcode != LUSP_VMOP_JUMP_IF && op->opcode != LUSP_VMOP_JUMP_IFNOT) continue;
+
+		LABEL32(jumps[i], labels[i + op->jump.offset + 1]);
+	}
+
+	lusp_memory_deallocate(labels);
+
+	return exact;
+}
+
+// bytecode may be shared by threads, so functions are compiled under a lock and entry points are published when complete
+static struct lusp_lock_t g_jit_lock;
+
+struct lusp_object_t lusp_eval_jit_x86_stub(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count);
+
+static void compile_jit(struct lusp_vm_bytecode_t* code)
+{
+	DL_STATIC_ASSERT(sizeof(struct lusp_object_t) == OBJECT_SIZE);
+	DL_STATIC_ASSERT(offsetof(struct lusp_object_t, type) == 0);
+
+	lusp_lock_acquire(&g_jit_lock);
+
+	// another thread may have compiled the function since the check
+	if (code->jit == lusp_eval_jit_x86_stub)
+	{
+		size_t size = CODE_SIZE_ENTRY + CODE_SIZE_PARAM * (code->param_count + code->reg_count) + CODE_SIZE_OP * code->op_count;
+
+		uint8_t* jit = (uint8_t*)allocate_code(size);
+		uint8_t* jit_exact = compile(jit, code->ops, code->op_count, code->param_count, code->reg_count);
+
+		lusp_atomic_store_pointer((void* volatile*)&code->jit_exact, jit_exact);
+		lusp_atomic_store_pointer((void* volatile*)&code->jit, jit);
+	}
+
+	lusp_lock_release(&g_jit_lock);
+}
+
+struct lusp_object_t lusp_eval_jit_x86_stub(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
+{
+	if (lusp_atomic_load_pointer((void* volatile*)&code->jit) == lusp_eval_jit_x86_stub) compile_jit(code);
+
+	lusp_vm_evaluator_t function = (lusp_vm_evaluator_t)code->jit;
+
+	return function(state, code, closure, regs, arg_count);
+}
+
+struct lusp_object_t lusp_eval_jit_x86(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
+{
+	lusp_vm_evaluator_t function = (lusp_vm_evaluator_t)code->jit;
+
+	// aborted evaluation returns null; status is reported by lusp_call
+	void* parent = state->jit_context;
+	jmp_buf context;
+
+	state->jit_context = &context;
+
+	if (setjmp(context))
+	{
+		state->jit_context = parent;
+		return lusp_mknull();
+	}
+
+	struct lusp_object_t result = function(state, code, closure, regs, arg_count);
+
+	state->jit_context = parent;
+
+	return result;
+}
+
+#endif
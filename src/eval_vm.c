@@ -1,167 +1,294 @@
-#include "environment.h"
-#include "object.h"
-
-#include "bytecode.h"
-#include "utils.h"
-
-static struct lusp_vm_upval_t g_dummy_upval = {0, {{LUSP_OBJECT_NULL, {0}}}};
-
-struct lusp_object_t lusp_eval_vm(struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
-{
-	(void)arg_count;
-
-	struct lusp_vm_op_t* pc = code->ops;
-	struct lusp_vm_upval_t* upvals = &g_dummy_upval;
-
-	for (;;)
-	{
-		struct lusp_vm_op_t op = *pc++;
-
-		switch (op.opcode)
-		{
-		case LUSP_VMOP_LOAD_CONST:
-			regs[op.reg] = *op.load_const.object;
-			break;
-
-		case LUSP_VMOP_LOAD_GLOBAL:
-			regs[op.reg] = op.loadstore_global.slot->value;
-			break;
-
-		case LUSP_VMOP_STORE_GLOBAL:
-			op.loadstore_global.slot->value = regs[op.reg];
-			break;
-
-		case LUSP_VMOP_LOAD_UPVAL:
-			regs[op.reg] = *closure->upvals[op.loadstore_upval.index]->ref;
-			break;
-
-		case LUSP_VMOP_STORE_UPVAL:
-			*closure->upvals[op.loadstore_upval.index]->ref = regs[op.reg];
-			break;
-
-		case LUSP_VMOP_MOVE:
-			regs[op.reg] = regs[op.move.index];
-			break;
-
-		case LUSP_VMOP_CALL:
-		{
-			struct lusp_object_t func = regs[op.reg];
-			struct lusp_object_t* args = regs + op.call.args;
-			unsigned int count = op.call.count;
-
-			assert(func.type == LUSP_OBJECT_CLOSURE || func.type == LUSP_OBJECT_FUNCTION);
-
-			if (func.type == LUSP_OBJECT_CLOSURE)
-			{
-				// store call frame
-				args[-2].type = LUSP_OBJECT_CALL_FRAME;
-				struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)args[-2].call_frame;
-
-				frame->closure = closure;
-				frame->pc = pc;
-				frame->regs = regs;
-
-				// transfer control
-				regs = args;
-				closure = func.closure;
-				pc = closure->code->ops;
-				arg_count = count;
-			}
-			else
-			{
-				regs[op.reg] = ((lusp_function_t)func.function)(code->env, args, count);
-			}
-		}
-		break;
-
-		case LUSP_VMOP_RETURN:
-		{
-			assert(regs[-2].type == LUSP_OBJECT_CALL_FRAME);
-
-			struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)regs[-2].call_frame;
-			struct lusp_object_t* result = regs + op.reg;
-
-			// top-level return
-			if (frame->regs == 0) return *result;
-
-			// restore regs
-			regs = frame->regs;
-			closure = frame->closure;
-			pc = frame->pc;
-
-			// store result
-			assert((pc - 1)->opcode == LUSP_VMOP_CALL);
-			regs[(pc - 1)->reg] = *result;
-		}
-		break;
-
-		case LUSP_VMOP_JUMP:
-			pc += op.jump.offset;
-			break;
-
-		case LUSP_VMOP_JUMP_IF:
-			if (regs[op.reg].type != LUSP_OBJECT_BOOLEAN || regs[op.reg].boolean) pc += op.jump.offset;
-			break;
-
-		case LUSP_VMOP_JUMP_IFNOT:
-			if (regs[op.reg].type == LUSP_OBJECT_BOOLEAN && !regs[op.reg].boolean) pc += op.jump.offset;
-			break;
-
-		case LUSP_VMOP_CREATE_CLOSURE:
-		{
-			unsigned int upval_count = op.create_closure.code->upval_count;
-
-			regs[op.reg] = lusp_mkclosure(op.create_closure.code, upval_count);
-
-			struct lusp_vm_closure_t* newclosure = regs[op.reg].closure;
-
-			// set upvalues
-			for (unsigned int i = 0; i < upval_count; ++i)
-			{
-				struct lusp_vm_op_t op = *pc++;
-
-				switch (op.opcode)
-				{
-				case LUSP_VMOP_MOVE:
-					newclosure->upvals[i] = mkupval(&upvals, &regs[op.move.index]);
-					break;
-
-				case LUSP_VMOP_LOAD_UPVAL:
-					newclosure->upvals[i] = closure->upvals[op.loadstore_upval.index];
-					break;
-
-				default:
-					assert(!"unexpected instruction");
-				}
-			}
-		}
-		break;
-
-		case LUSP_VMOP_CLOSE:
-			upvals = close_upvals(upvals, regs + op.close.begin);
-			break;
-
-#define BINOP(opcode, func)                                               \
-	case opcode:                                                          \
-		regs[op.reg] = func(regs + op.binop.left, regs + op.binop.right); \
-		break
-
-			BINOP(LUSP_VMOP_ADD, binop_add);
-			BINOP(LUSP_VMOP_SUBTRACT, binop_subtract);
-			BINOP(LUSP_VMOP_MULTIPLY, binop_multiply);
-			BINOP(LUSP_VMOP_DIVIDE, binop_divide);
-			BINOP(LUSP_VMOP_MODULO, binop_modulo);
-			BINOP(LUSP_VMOP_EQUAL, binop_equal);
-			BINOP(LUSP_VMOP_NOT_EQUAL, binop_not_equal);
-			BINOP(LUSP_VMOP_LESS, binop_less);
-			BINOP(LUSP_VMOP_LESS_EQUAL, binop_less_equal);
-			BINOP(LUSP_VMOP_GREATER, binop_greater);
-			BINOP(LUSP_VMOP_GREATER_EQUAL, binop_greater_equal);
-
-#undef BINOP
-
-		default:
-			assert(!"unexpected instruction");
-		}
-	}
-}
+#include "environment.h"
+#include "object.h"
+
+#include "bytecode.h"
+#include "coroutine.h"
+#include "state.h"
+#include "thread.h"
+#include "utils.h"
+
+static struct lusp_vm_upval_t g_dummy_upval = {0, {{LUSP_OBJECT_NULL, {0}}}};
+
+// moves the stack of the running coroutine, see coroutine.c
+bool lusp_coroutine_grow(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, size_t size);
+
+// aborted evaluation drops its frames; registers may be reused or released, so open upvals are closed first
+static struct lusp_object_t unwind(struct lusp_state_t* state, struct lusp_vm_upval_t* upvals, enum lusp_eval_status_t status)
+{
+	close_upvals(upvals, state->stack);
+
+	lusp_eval_abort(state, status);
+
+	return lusp_mknull();
+}
+
+static struct lusp_object_t execute(struct lusp_state_t* state, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, struct lusp_vm_op_t* pc, struct lusp_vm_upval_t* upvals)
+{
+	// global slots of the running closure
+	struct lusp_vm_globals_t* globals = closure->globals;
+
+	for (;;)
+	{
+		// feedback is left out of the copy, since other threads may update it in shared bytecode; binary ops access it
+		// atomically through pc
+		struct lusp_vm_op_t op;
+
+		op.opcode = pc->opcode;
+		op.feedback = 0;
+		op.reg = pc->reg;
+		memcpy(&op.load_const, &pc->load_const, sizeof(op) - offsetof(struct lusp_vm_op_t, load_const));
+
+		pc++;
+
+		switch (op.opcode)
+		{
+		case LUSP_VMOP_LOAD_CONST:
+			regs[op.reg] = *op.load_const.object;
+			break;
+
+		case LUSP_VMOP_LOAD_GLOBAL:
+			regs[op.reg] = globals->slots[op.loadstore_global.index]->value;
+			break;
+
+		case LUSP_VMOP_STORE_GLOBAL:
+			globals->slots[op.loadstore_global.index]->value = regs[op.reg];
+			break;
+
+		case LUSP_VMOP_LOAD_UPVAL:
+			regs[op.reg] = *closure->upvals[op.loadstore_upval.index]->ref;
+			break;
+
+		case LUSP_VMOP_STORE_UPVAL:
+			*closure->upvals[op.loadstore_upval.index]->ref = regs[op.reg];
+			break;
+
+		case LUSP_VMOP_MOVE:
+			regs[op.reg] = regs[op.move.index];
+			break;
+
+		case LUSP_VMOP_CALL:
+		{
+			struct lusp_object_t func = regs[op.reg];
+			struct lusp_object_t* args = regs + op.call.args;
+			unsigned int count = op.call.count;
+
+			assert(func.type == LUSP_OBJECT_CLOSURE || func.type == LUSP_OBJECT_FUNCTION);
+
+			if (func.type == LUSP_OBJECT_CLOSURE)
+			{
+				// store call frame
+				args[-2].type = LUSP_OBJECT_CALL_FRAME;
+				struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)args[-2].call_frame;
+
+				frame->closure = closure;
+				frame->pc = pc;
+				frame->regs = regs;
+
+				// transfer control
+				regs = args;
+				closure = func.closure;
+				globals = closure->globals;
+				pc = closure->code->ops;
+
+				// coroutine stacks start small and grow when they run out of registers, other stacks have a fixed size
+				if (regs + closure->code->reg_count > state->stack + state->stack_size)
+				{
+					struct lusp_coroutine_t* coroutine = state->coroutine;
+
+					if (!coroutine) return unwind(state, upvals, LUSP_EVAL_STACK_OVERFLOW);
+
+					coroutine->regs = regs;
+					coroutine->upvals = upvals;
+
+					if (!lusp_coroutine_grow(state, coroutine, (size_t)(regs - state->stack) + closure->code->reg_count))
+						return unwind(state, upvals, LUSP_EVAL_STACK_OVERFLOW);
+
+					regs = coroutine->regs;
+					upvals = coroutine->upvals;
+				}
+
+				// fill missing arguments and clear the remaining registers
+				fill_args(regs, count, closure->code->param_count, closure->code->reg_count);
+
+				// calls are the only way to repeat code, so counting them bounds running time
+				if (--state->budget_left < 0 && !lusp_state_refill_budget(state))
+				{
+					struct lusp_coroutine_t* coroutine = state->coroutine;
+
+					// code outside of coroutines can't be suspended, so the evaluation is aborted
+					if (!coroutine) return unwind(state, upvals, LUSP_EVAL_BUDGET);
+
+					// preempt at callee entry, resume continues from there
+					coroutine->status = LUSP_COROUTINE_SUSPENDED;
+					coroutine->preempted = true;
+					coroutine->closure = closure;
+					coroutine->pc = pc;
+					coroutine->regs = regs;
+					coroutine->upvals = upvals;
+
+					return lusp_mknull();
+				}
+			}
+			else
+			{
+				// native function may evaluate code on the same stack above its arguments
+				state->stack_top = args + count;
+
+				regs[op.reg] = ((lusp_function_t)func.function)(state, globals->env, args, count);
+
+				// native function aborted the evaluation, or returned from an aborted nested evaluation
+				if (state->status != LUSP_EVAL_OK) return unwind(state, upvals, state->status);
+
+				// native function yielded: save context into the running coroutine, call result is the yielded value
+				if (state->suspend)
+				{
+					struct lusp_coroutine_t* coroutine = state->coroutine;
+
+					state->suspend = false;
+
+					coroutine->status = LUSP_COROUTINE_SUSPENDED;
+					coroutine->closure = closure;
+					coroutine->pc = pc;
+					coroutine->regs = regs;
+					coroutine->upvals = upvals;
+
+					return regs[op.reg];
+				}
+			}
+		}
+		break;
+
+		case LUSP_VMOP_RETURN:
+		{
+			assert(regs[-2].type == LUSP_OBJECT_CALL_FRAME);
+
+			struct lusp_vm_call_frame_t* frame = (struct lusp_vm_call_frame_t*)regs[-2].call_frame;
+			struct lusp_object_t* result = regs + op.reg;
+
+			// top-level return
+			if (frame->regs == 0) return *result;
+
+			// restore regs
+			regs = frame->regs;
+			closure = frame->closure;
+			globals = closure->globals;
+			pc = frame->pc;
+
+			// store result
+			assert((pc - 1)->opcode == LUSP_VMOP_CALL);
+			regs[(pc - 1)->reg] = *result;
+		}
+		break;
+
+		case LUSP_VMOP_JUMP:
+			pc += op.jump.offset;
+			break;
+
+		case LUSP_VMOP_JUMP_IF:
+			if (regs[op.reg].type != LUSP_OBJECT_BOOLEAN || regs[op.reg].boolean) pc += op.jump.offset;
+			break;
+
+		case LUSP_VMOP_JUMP_IFNOT:
+			if (regs[op.reg].type == LUSP_OBJECT_BOOLEAN && !regs[op.reg].boolean) pc += op.jump.offset;
+			break;
+
+		case LUSP_VMOP_CREATE_CLOSURE:
+		{
+			unsigned int upval_count = op.create_closure.code->upval_count;
+
+			regs[op.reg] = lusp_mkclosure(op.create_closure.code, globals, upval_count);
+
+			struct lusp_vm_closure_t* newclosure = regs[op.reg].closure;
+
+			// set upvalues
+			for (unsigned int i = 0; i < upval_count; ++i)
+			{
+				struct lusp_vm_op_t op = *pc++;
+
+				switch (op.opcode)
+				{
+				case LUSP_VMOP_MOVE:
+					newclosure->upvals[i] = mkupval(&upvals, &regs[op.move.index]);
+					break;
+
+				case LUSP_VMOP_LOAD_UPVAL:
+					newclosure->upvals[i] = closure->upvals[op.loadstore_upval.index];
+					break;
+
+				default:
+					assert(!"unexpected instruction");
+				}
+			}
+		}
+		break;
+
+		case LUSP_VMOP_CLOSE:
+			upvals = close_upvals(upvals, regs + op.close.begin);
+			break;
+
+		case LUSP_VMOP_CREATE_VECTOR:
+			regs[op.reg] = create_vector(regs + op.create_vector.first, op.create_vector.count);
+			break;
+
+		case LUSP_VMOP_INDEX_GET:
+			regs[op.reg] = index_get(regs + op.index.object, regs + op.index.key);
+			break;
+
+		case LUSP_VMOP_INDEX_SET:
+			index_set(regs + op.index.object, regs + op.index.key, regs + op.reg);
+			break;
+
+// feedback is only stored when it changes, so that ops in read-only images are never written; threads that share
+// bytecode access it atomically and may lose each other's bits
+#define BINOP(opcode, func)                                                                     \
+	case opcode:                                                                                \
+	{                                                                                           \
+		uint8_t observed = lusp_atomic_load_relaxed_u8(&(pc - 1)->feedback);                    \
+		uint8_t feedback = observed | binop_feedback(regs + op.binop.left, regs + op.binop.right); \
+		if (feedback != observed) lusp_atomic_store_relaxed_u8(&(pc - 1)->feedback, feedback);  \
+		regs[op.reg] = func(regs + op.binop.left, regs + op.binop.right);                       \
+	}                                                                                           \
+	break
+
+			BINOP(LUSP_VMOP_ADD, binop_add);
+			BINOP(LUSP_VMOP_SUBTRACT, binop_subtract);
+			BINOP(LUSP_VMOP_MULTIPLY, binop_multiply);
+			BINOP(LUSP_VMOP_DIVIDE, binop_divide);
+			BINOP(LUSP_VMOP_MODULO, binop_modulo);
+			BINOP(LUSP_VMOP_EQUAL, binop_equal);
+			BINOP(LUSP_VMOP_NOT_EQUAL, binop_not_equal);
+			BINOP(LUSP_VMOP_LESS, binop_less);
+			BINOP(LUSP_VMOP_LESS_EQUAL, binop_less_equal);
+			BINOP(LUSP_VMOP_GREATER, binop_greater);
+			BINOP(LUSP_VMOP_GREATER_EQUAL, binop_greater_equal);
+
+#undef BINOP
+
+		default:
+			assert(!"unexpected instruction");
+		}
+	}
+}
+
+struct lusp_object_t lusp_eval_vm(struct lusp_state_t* state, struct lusp_vm_bytecode_t* code, struct lusp_vm_closure_t* closure, struct lusp_object_t* regs, unsigned int arg_count)
+{
+	// generic entry: fill missing arguments and clear the remaining registers
+	fill_args(regs, arg_count, code->param_count, code->reg_count);
+
+	return execute(state, closure, regs, code->ops, &g_dummy_upval);
+}
+
+struct lusp_object_t lusp_resume_vm(struct lusp_state_t* state, struct lusp_coroutine_t* coroutine, struct lusp_object_t value)
+{
+	struct lusp_vm_op_t* pc = coroutine->pc;
+
+	// resume value is the result of the yield call; preempted coroutines continue at the entry of a function
+	if (coroutine->preempted) coroutine->preempted = false;
+	else
+	{
+		assert((pc - 1)->opcode == LUSP_VMOP_CALL);
+		coroutine->regs[(pc - 1)->reg] = value;
+	}
+
+	return execute(state, coroutine->closure, coroutine->regs, pc, coroutine->upvals);
+}
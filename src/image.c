@@ -0,0 +1,597 @@
+#include "image.h"
+
+#include "bytecode.h"
+#include "memory.h"
+#include "object.h"
+#include "symbol.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef DL_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// image layout:
+// header, relocations (offsets of pointers that need to be adjusted if image is not mapped at base address)
+// read-only section: ops, constants, strings, global names
+// writable section (aligned to the largest supported page size): bytecode headers, interned global names
+#define IMAGE_MAGIC 0x474d494c // LIMG
+#define IMAGE_VERSION 3
+#define IMAGE_PAGE_SIZE 65536
+
+struct image_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pointer_size;
+	uint32_t object_size;
+
+	uint64_t base;
+	uint64_t size;
+
+	uint32_t relocation_count;
+	uint32_t proto_count;
+	uint32_t global_count;
+	uint32_t padding;
+
+	// offsets from image start
+	uint64_t global_names;
+	uint64_t writable;
+
+	// sections that ops and constants point to, so that loading can check every pointer
+	uint64_t ops;
+	uint64_t constants;
+	uint32_t op_count;
+	uint32_t constant_count;
+};
+
+struct image_builder_t
+{
+	char* data;
+	size_t size;
+	uintptr_t base;
+
+	uint32_t* relocations;
+	unsigned int relocation_count;
+};
+
+static inline size_t align(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static unsigned int find_pointer(void** array, unsigned int count, void* pointer)
+{
+	for (unsigned int i = 0; i < count; ++i)
+		if (array[i] == pointer)
+			return i;
+
+	return count;
+}
+
+static unsigned int add_pointer(void** array, unsigned int* count, unsigned int capacity, void* pointer)
+{
+	unsigned int index = find_pointer(array, *count, pointer);
+
+	if (index == *count)
+	{
+		assert(*count < capacity);
+		(void)capacity;
+
+		array[(*count)++] = pointer;
+	}
+
+	return index;
+}
+
+static void* image_pointer(struct image_builder_t* builder, void* field, size_t offset)
+{
+	// pointer values are computed for base address; their location is recorded for relocation
+	builder->relocations[builder->relocation_count++] = (uint32_t)((char*)field - builder->data);
+
+	return (void*)(builder->base + offset);
+}
+
+static size_t get_string_size(unsigned int length)
+{
+	return align(sizeof(struct lusp_string_t) + length, 16);
+}
+
+static size_t write_string(struct image_builder_t* builder, size_t offset, const char* data, unsigned int length)
+{
+	struct lusp_string_t* string = (struct lusp_string_t*)(builder->data + offset);
+
+	string->data = (const char*)image_pointer(builder, &string->data, offset + offsetof(struct lusp_string_t, storage));
+	string->length = length;
+
+	// hash is precomputed since image pages are read-only
+	string->hash = lusp_hash_string(data, length);
+
+	memcpy(string->storage, data, length);
+	string->storage[length] = 0;
+
+	return offset + get_string_size(length);
+}
+
+bool lusp_save_image(struct lusp_vm_bytecode_t* code, const char* path, uintptr_t base)
+{
+	if (base == 0) base = (sizeof(void*) == 8) ? (uintptr_t)0x200000000000ull : (uintptr_t)0x50000000;
+
+	// gather protos; every proto adds at most op_count protos or constants
+	unsigned int op_total = code->op_count;
+	unsigned int capacity = 1;
+
+	struct lusp_vm_bytecode_t** protos = (struct lusp_vm_bytecode_t**)lusp_memory_allocate(sizeof(void*));
+	assert(protos);
+
+	unsigned int proto_count = 0;
+	add_pointer((void**)protos, &proto_count, 1, code);
+
+	for (unsigned int i = 0; i < proto_count; ++i)
+		for (unsigned int j = 0; j < protos[i]->op_count; ++j)
+			if (protos[i]->ops[j].opcode == LUSP_VMOP_CREATE_CLOSURE &&
+			    find_pointer((void**)protos, proto_count, protos[i]->ops[j].create_closure.code) == proto_count)
+			{
+				if (proto_count == capacity)
+				{
+					struct lusp_vm_bytecode_t** data = (struct lusp_vm_bytecode_t**)lusp_memory_allocate(sizeof(void*) * capacity * 2);
+					assert(data);
+
+					memcpy(data, protos, sizeof(void*) * proto_count);
+					lusp_memory_deallocate(protos);
+
+					protos = data;
+					capacity *= 2;
+				}
+
+				protos[proto_count++] = protos[i]->ops[j].create_closure.code;
+				op_total += protos[proto_count - 1]->op_count;
+			}
+
+	// gather constants
+	struct lusp_object_t** constants = (struct lusp_object_t**)lusp_memory_allocate(sizeof(void*) * (op_total + 1));
+	assert(constants);
+
+	unsigned int constant_count = 0;
+	size_t string_size = 0;
+	bool result = true;
+
+	unsigned int global_count = code->global_count;
+
+	for (unsigned int i = 0; i < global_count; ++i)
+		string_size += get_string_size(code->global_names[i]->length);
+
+	for (unsigned int i = 0; i < proto_count; ++i)
+		for (unsigned int j = 0; j < protos[i]->op_count; ++j)
+		{
+			struct lusp_vm_op_t* op = &protos[i]->ops[j];
+
+			if (op->opcode == LUSP_VMOP_LOAD_CONST)
+			{
+				struct lusp_object_t* object = op->load_const.object;
+
+				add_pointer((void**)constants, &constant_count, op_total, object);
+
+				// only plain values can live in shared pages
+				if (object->type == LUSP_OBJECT_STRING)
+					string_size += get_string_size(object->string->length);
+				else if (object->type != LUSP_OBJECT_NULL && object->type != LUSP_OBJECT_BOOLEAN &&
+				         object->type != LUSP_OBJECT_INTEGER && object->type != LUSP_OBJECT_REAL)
+					result = false;
+			}
+		}
+
+	// compute layout
+	size_t relocation_capacity = op_total + constant_count + global_count + proto_count;
+
+	size_t ops_offset = align(sizeof(struct image_header_t) + sizeof(uint32_t) * relocation_capacity, 16);
+	size_t constants_offset = align(ops_offset + sizeof(struct lusp_vm_op_t) * op_total, 16);
+	size_t strings_offset = align(constants_offset + sizeof(struct lusp_object_t) * constant_count, 16);
+	size_t global_names_offset = strings_offset + string_size;
+	size_t protos_offset = align(global_names_offset + sizeof(void*) * global_count, IMAGE_PAGE_SIZE);
+	size_t symbols_offset = align(protos_offset + sizeof(struct lusp_vm_bytecode_t) * proto_count, 16);
+	size_t size = symbols_offset + sizeof(struct lusp_symbol_t*) * global_count;
+
+	struct image_builder_t builder;
+	builder.data = (char*)lusp_memory_allocate(size);
+	builder.size = size;
+	builder.base = base;
+	builder.relocations = (uint32_t*)(builder.data + sizeof(struct image_header_t));
+	builder.relocation_count = 0;
+	assert(builder.data);
+
+	memset(builder.data, 0, size);
+
+	// constants
+	size_t string_offset = strings_offset;
+
+	for (unsigned int i = 0; i < constant_count; ++i)
+	{
+		struct lusp_object_t* object = (struct lusp_object_t*)(builder.data + constants_offset) + i;
+
+		*object = *constants[i];
+
+		if (object->type == LUSP_OBJECT_STRING)
+		{
+			object->string = (struct lusp_string_t*)image_pointer(&builder, &object->string, string_offset);
+			string_offset = write_string(&builder, string_offset, constants[i]->string->data, constants[i]->string->length);
+		}
+	}
+
+	// global names; symbols are interned on load
+	for (unsigned int i = 0; i < global_count; ++i)
+	{
+		struct lusp_string_t** name = (struct lusp_string_t**)(builder.data + global_names_offset) + i;
+
+		*name = (struct lusp_string_t*)image_pointer(&builder, name, string_offset);
+		string_offset = write_string(&builder, string_offset, code->global_names[i]->name, code->global_names[i]->length);
+	}
+
+	// protos and ops
+	struct lusp_vm_op_t* ops = (struct lusp_vm_op_t*)(builder.data + ops_offset);
+
+	for (unsigned int i = 0; i < proto_count; ++i)
+	{
+		struct lusp_vm_bytecode_t* proto = (struct lusp_vm_bytecode_t*)(builder.data + protos_offset) + i;
+
+		proto->global_count = global_count;
+		proto->reg_count = protos[i]->reg_count;
+		proto->upval_count = protos[i]->upval_count;
+		proto->param_count = protos[i]->param_count;
+		proto->op_count = protos[i]->op_count;
+		proto->ops = (struct lusp_vm_op_t*)image_pointer(&builder, &proto->ops, (char*)ops - builder.data);
+
+		for (unsigned int j = 0; j < proto->op_count; ++j, ++ops)
+		{
+			*ops = protos[i]->ops[j];
+
+			switch (ops->opcode)
+			{
+			case LUSP_VMOP_LOAD_CONST:
+				ops->load_const.object = (struct lusp_object_t*)image_pointer(&builder, &ops->load_const.object,
+				    constants_offset + sizeof(struct lusp_object_t) * find_pointer((void**)constants, constant_count, ops->load_const.object));
+				break;
+
+			case LUSP_VMOP_LOAD_GLOBAL:
+			case LUSP_VMOP_STORE_GLOBAL:
+				// index into global names, resolved by lusp_bind_bytecode
+				break;
+
+			case LUSP_VMOP_CREATE_CLOSURE:
+				ops->create_closure.code = (struct lusp_vm_bytecode_t*)image_pointer(&builder, &ops->create_closure.code,
+				    protos_offset + sizeof(struct lusp_vm_bytecode_t) * find_pointer((void**)protos, proto_count, ops->create_closure.code));
+				break;
+
+			default:
+				// saturate feedback so that interpreter never writes to shared pages
+				ops->feedback = LUSP_VM_FEEDBACK_INTEGER | LUSP_VM_FEEDBACK_REAL | LUSP_VM_FEEDBACK_OTHER;
+			}
+		}
+	}
+
+	assert(builder.relocation_count <= relocation_capacity);
+
+	// header
+	struct image_header_t* header = (struct image_header_t*)builder.data;
+
+	header->magic = IMAGE_MAGIC;
+	header->version = IMAGE_VERSION;
+	header->pointer_size = sizeof(void*);
+	header->object_size = sizeof(struct lusp_object_t);
+	header->base = base;
+	header->size = size;
+	header->relocation_count = builder.relocation_count;
+	header->proto_count = proto_count;
+	header->global_count = global_count;
+	header->global_names = global_names_offset;
+	header->writable = protos_offset;
+	header->ops = ops_offset;
+	header->constants = constants_offset;
+	header->op_count = op_total;
+	header->constant_count = constant_count;
+
+	// write file
+	FILE* file = result ? fopen(path, "wb") : 0;
+
+	if (file)
+	{
+		result = fwrite(builder.data, 1, size, file) == size;
+		result &= fclose(file) == 0;
+	}
+	else
+		result = false;
+
+	lusp_memory_deallocate(builder.data);
+	lusp_memory_deallocate(constants);
+	lusp_memory_deallocate(protos);
+
+	return result;
+}
+
+static size_t get_page_size()
+{
+#ifdef DL_WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static bool is_valid_header(struct image_header_t* header, uint64_t file_size)
+{
+	if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION || header->pointer_size != sizeof(void*) ||
+	    header->object_size != sizeof(struct lusp_object_t) || header->size != file_size || header->proto_count == 0)
+		return false;
+
+	// all sections have to be inside the file, so that loading never touches memory outside of the mapping
+	// counts are 32-bit, so none of these computations overflow
+	uint64_t relocations_end = sizeof(struct image_header_t) + sizeof(uint32_t) * (uint64_t)header->relocation_count;
+	uint64_t ops_end = header->ops + sizeof(struct lusp_vm_op_t) * (uint64_t)header->op_count;
+	uint64_t constants_end = header->constants + sizeof(struct lusp_object_t) * (uint64_t)header->constant_count;
+	uint64_t global_names_end = header->global_names + sizeof(void*) * (uint64_t)header->global_count;
+	uint64_t symbols_offset = (header->writable + sizeof(struct lusp_vm_bytecode_t) * (uint64_t)header->proto_count + 15) & ~(uint64_t)15;
+
+	return header->writable <= header->size && header->writable % get_page_size() == 0 &&
+	       relocations_end <= header->ops && header->ops % sizeof(void*) == 0 && ops_end <= header->constants &&
+	       header->constants % sizeof(void*) == 0 && constants_end <= header->global_names &&
+	       header->global_names % sizeof(void*) == 0 && global_names_end <= header->writable &&
+	       symbols_offset + sizeof(struct lusp_symbol_t*) * (uint64_t)header->global_count <= header->size;
+}
+
+static bool is_valid_name(char* data, size_t size, struct lusp_string_t* name)
+{
+	// name and its characters have to be inside the image
+	uintptr_t begin = (uintptr_t)data;
+	uintptr_t string = (uintptr_t)name;
+
+	if (string < begin || string - begin > size - sizeof(struct lusp_string_t) || string % sizeof(void*) != 0) return false;
+
+	uintptr_t chars = (uintptr_t)name->data;
+
+	return chars >= begin && chars - begin <= size && name->length <= size - (chars - begin);
+}
+
+// index of the item that pointer points to in an array of count items at offset, or count if there is none
+static uint32_t find_item(char* data, uint64_t offset, uint32_t count, size_t item_size, const void* pointer)
+{
+	uintptr_t begin = (uintptr_t)data + (uintptr_t)offset;
+	uintptr_t address = (uintptr_t)pointer;
+
+	if (address < begin || (address - begin) % item_size != 0 || (address - begin) / item_size >= count) return count;
+
+	return (uint32_t)((address - begin) / item_size);
+}
+
+// protos, ops and constants get the same checks as serialized bytecode, so that corrupted images are rejected instead
+// of sending the interpreter to arbitrary addresses
+static bool is_valid_image(char* data, struct image_header_t* header, struct lusp_vm_bytecode_t* protos)
+{
+	struct lusp_object_t* constants = (struct lusp_object_t*)(data + header->constants);
+
+	for (uint32_t i = 0; i < header->constant_count; ++i)
+	{
+		enum lusp_object_type_t type = constants[i].type;
+
+		if (type == LUSP_OBJECT_STRING ? !is_valid_name(data, (size_t)header->size, constants[i].string) :
+		                                 type != LUSP_OBJECT_NULL && type != LUSP_OBJECT_BOOLEAN && type != LUSP_OBJECT_INTEGER && type != LUSP_OBJECT_REAL)
+			return false;
+	}
+
+	for (uint32_t i = 0; i < header->proto_count; ++i)
+	{
+		struct lusp_vm_bytecode_t* proto = &protos[i];
+
+		// top-level proto is bound without upvalues; every proto has to end with a return
+		if (proto->global_count != header->global_count || proto->param_count > proto->reg_count || (i == 0 && proto->upval_count != 0))
+			return false;
+
+		uint32_t first = find_item(data, header->ops, header->op_count, sizeof(struct lusp_vm_op_t), proto->ops);
+
+		if (first == header->op_count || proto->op_count == 0 || proto->op_count > header->op_count - first) return false;
+
+		for (unsigned int j = 0; j < proto->op_count; ++j)
+		{
+			struct lusp_vm_op_t* op = &proto->ops[j];
+
+			if (!lusp_is_valid_op(proto, j, op, header->global_count)) return false;
+
+			if (op->opcode == LUSP_VMOP_LOAD_CONST &&
+			    find_item(data, header->constants, header->constant_count, sizeof(struct lusp_object_t), op->load_const.object) == header->constant_count)
+				return false;
+
+			if (op->opcode == LUSP_VMOP_CREATE_CLOSURE &&
+			    find_item(data, header->writable, header->proto_count, sizeof(struct lusp_vm_bytecode_t), op->create_closure.code) == header->proto_count)
+				return false;
+		}
+
+		if (proto->ops[proto->op_count - 1].opcode != LUSP_VMOP_RETURN) return false;
+	}
+
+	return lusp_has_valid_captures(protos, header->proto_count);
+}
+
+// adjusts all internal pointers of an image that is not mapped at its base address
+static bool relocate(char* data, struct image_header_t* header)
+{
+	const uint32_t* relocations = (const uint32_t*)(data + sizeof(struct image_header_t));
+	uintptr_t delta = (uintptr_t)data - (uintptr_t)header->base;
+	size_t size = (size_t)header->size;
+
+	for (unsigned int i = 0; i < header->relocation_count; ++i)
+	{
+		if (relocations[i] > size - sizeof(uintptr_t) || relocations[i] % sizeof(uintptr_t) != 0) return false;
+
+		*(uintptr_t*)(data + relocations[i]) += delta;
+	}
+
+	return true;
+}
+
+#ifdef DL_WINDOWS
+
+// maps image with code and constants read-only and the rest copy-on-write; returns 0 on error
+static char* map_image(const char* path, struct image_header_t* header)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+
+	DWORD bytes = 0;
+	LARGE_INTEGER file_size;
+
+	if (!ReadFile(file, header, sizeof(*header), &bytes, 0) || bytes != sizeof(*header) || !GetFileSizeEx(file, &file_size) ||
+	    !is_valid_header(header, (uint64_t)file_size.QuadPart))
+	{
+		CloseHandle(file);
+		return 0;
+	}
+
+	size_t size = (size_t)header->size;
+
+	// copy-on-write view keeps untouched pages shared with the file cache; the view keeps the mapping alive
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+	CloseHandle(file);
+
+	if (!mapping) return 0;
+
+	// try to map at prelinked address
+	char* data = (char*)MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, size, (void*)(uintptr_t)header->base);
+
+	if (!data)
+	{
+		// relocation fallback: adjust all internal pointers
+		data = (char*)MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, size, 0);
+
+		if (data && !relocate(data, header))
+		{
+			UnmapViewOfFile(data);
+			data = 0;
+		}
+	}
+
+	CloseHandle(mapping);
+
+	if (!data) return 0;
+
+	// bytecode headers and interned names stay copy-on-write
+	DWORD protection;
+
+	if (!VirtualProtect(data, (size_t)header->writable, PAGE_READONLY, &protection))
+	{
+		UnmapViewOfFile(data);
+		return 0;
+	}
+
+	return data;
+}
+
+static void unmap_image(char* data, size_t size)
+{
+	(void)size;
+
+	UnmapViewOfFile(data);
+}
+
+#else
+
+// maps image with code and constants read-only and the rest private and writable; returns 0 on error
+static char* map_image(const char* path, struct image_header_t* header)
+{
+	int file = open(path, O_RDONLY);
+	if (file < 0) return 0;
+
+	struct stat info;
+
+	if (read(file, header, sizeof(*header)) != sizeof(*header) || fstat(file, &info) != 0 || !is_valid_header(header, (uint64_t)info.st_size))
+	{
+		close(file);
+		return 0;
+	}
+
+	size_t size = (size_t)header->size;
+
+	// try to map at prelinked address; private mapping keeps untouched pages shared with page cache
+	char* data = (char*)mmap((void*)(uintptr_t)header->base, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+	if (data != MAP_FAILED && data != (char*)(uintptr_t)header->base)
+	{
+		// relocation fallback: adjust all internal pointers
+		munmap(data, size);
+
+		data = (char*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+		if (data != MAP_FAILED && !relocate(data, header))
+		{
+			munmap(data, size);
+			data = (char*)MAP_FAILED;
+		}
+
+		if (data != MAP_FAILED) mprotect(data, (size_t)header->writable, PROT_READ);
+	}
+
+	close(file);
+
+	if (data == MAP_FAILED) return 0;
+
+	// bytecode headers and interned names are private
+	if (mprotect(data + header->writable, size - (size_t)header->writable, PROT_READ | PROT_WRITE) != 0)
+	{
+		munmap(data, size);
+		return 0;
+	}
+
+	return data;
+}
+
+static void unmap_image(char* data, size_t size)
+{
+	munmap(data, size);
+}
+
+#endif
+
+struct lusp_vm_bytecode_t* lusp_load_image(const char* path)
+{
+	struct image_header_t header;
+
+	char* data = map_image(path, &header);
+	if (!data) return 0;
+
+	size_t size = (size_t)header.size;
+
+	struct lusp_vm_bytecode_t* protos = (struct lusp_vm_bytecode_t*)(data + header.writable);
+	struct lusp_symbol_t** symbols = (struct lusp_symbol_t**)(data + align((size_t)header.writable + sizeof(struct lusp_vm_bytecode_t) * header.proto_count, 16));
+	struct lusp_string_t** names = (struct lusp_string_t**)(data + header.global_names);
+
+	bool valid = is_valid_image(data, &header, protos);
+
+	for (unsigned int i = 0; i < header.global_count && valid; ++i)
+		valid = is_valid_name(data, size, names[i]);
+
+	if (!valid)
+	{
+		unmap_image(data, size);
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < header.global_count; ++i)
+		symbols[i] = lusp_symbol_intern(names[i]->data, names[i]->length);
+
+	for (unsigned int i = 0; i < header.proto_count; ++i)
+	{
+		protos[i].global_names = header.global_count ? symbols : 0;
+		lusp_setup_bytecode(&protos[i]);
+	}
+
+	return protos;
+}
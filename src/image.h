@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct lusp_vm_bytecode_t;
+
+// saves a native image with bytecode, constants and global names that is prelinked to load at base address
+// (0 selects a default); the image is specific to pointer size and byte order of the process that created it
+bool lusp_save_image(struct lusp_vm_bytecode_t* code, const char* path, uintptr_t base);
+
+// maps image into memory; code and constants are executed from shared read-only pages, only bytecode headers and
+// interned global names are private; bytecode is run in an environment with lusp_bind_bytecode
+// if base address is not available, the image is relocated which makes all touched pages private
+// images are not trusted: every proto, op operand and constant or closure pointer is checked before the image is used
+// returns 0 on error or if the image is malformed; image stays mapped for the lifetime of the process
+struct lusp_vm_bytecode_t* lusp_load_image(const char* path);
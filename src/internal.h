@@ -1,57 +1,107 @@
-#pragma once
-
-struct compiler_t;
-
-struct binding_t
-{
-	struct lusp_object_t symbol;
-	unsigned int index;
-};
-
-struct scope_t
-{
-	struct compiler_t* compiler;
-
-	struct scope_t* parent;
-
-	struct binding_t binds[1024];
-	unsigned int bind_count;
-
-	bool has_upvals;
-};
-
-struct upval_t
-{
-	struct scope_t* scope;
-	struct binding_t* binding;
-};
-
-struct compiler_t
-{
-	// global environment
-	struct lusp_environment_t* env;
-
-	// scope stack
-	struct scope_t* scope;
-
-	// registers
-	unsigned int free_reg;
-	unsigned int reg_count;
-
-	// upvalues
-	struct upval_t upvals[1024];
-	unsigned int upval_count;
-
-	// opcode buffer
-	struct lusp_vm_op_t ops[1024];
-	unsigned int op_count;
-
-	// compilation parameters
-	unsigned int flags;
-};
-
-#define CHECK(condition, message, ...)                                         \
-	do                                                                         \
-	{                                                                          \
-		if (!(condition)) lexer->error_handler(lexer, message, ##__VA_ARGS__); \
-	} while (0)
+#pragma once
+
+#include "arena.h"
+
+#include <string.h>
+
+struct compiler_t;
+
+struct binding_t
+{
+	struct lusp_object_t symbol;
+	unsigned int index;
+};
+
+struct scope_t
+{
+	struct compiler_t* compiler;
+
+	struct scope_t* parent;
+
+	struct binding_t* binds;
+	unsigned int bind_count;
+	unsigned int bind_capacity;
+
+	bool has_upvals;
+};
+
+struct upval_t
+{
+	struct scope_t* scope;
+	struct binding_t* binding;
+};
+
+// names of globals referenced by the program; shared by compilers of all functions in the program
+struct global_table_t
+{
+	struct lusp_symbol_t** names;
+	unsigned int count;
+	unsigned int capacity;
+
+	// open addressing index of names by symbol hash; entries are name index + 1, 0 marks an empty entry
+	unsigned int* index;
+	unsigned int index_capacity;
+};
+
+// bytecode created for functions of the program; shared by compilers of all functions in the program
+struct proto_list_t
+{
+	struct lusp_vm_bytecode_t** data;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+struct compiler_t
+{
+	// global names
+	struct global_table_t* globals;
+
+	// arena for temporary buffers
+	struct mem_arena_t* arena;
+
+	// scope stack
+	struct scope_t* scope;
+
+	// registers
+	unsigned int free_reg;
+	unsigned int reg_count;
+
+	// parameters
+	unsigned int param_count;
+
+	// upvalues
+	struct upval_t* upvals;
+	unsigned int upval_count;
+	unsigned int upval_capacity;
+
+	// opcode buffer
+	struct lusp_vm_op_t* ops;
+	unsigned int op_count;
+	unsigned int op_capacity;
+
+	// compilation parameters
+	unsigned int flags;
+
+	// created bytecode
+	struct proto_list_t* protos;
+};
+
+// doubles buffer capacity; element pointers into the old buffer are invalidated, old buffer is released with the arena
+static inline void* buffer_grow(struct mem_arena_t* arena, void* data, unsigned int count, unsigned int* capacity, size_t element_size)
+{
+	unsigned int new_capacity = *capacity ? *capacity * 2 : 8;
+
+	void* result = mem_arena_allocate(arena, new_capacity * element_size);
+
+	if (data) memcpy(result, data, count * element_size);
+
+	*capacity = new_capacity;
+
+	return result;
+}
+
+#define CHECK(condition, message, ...)                                         \
+	do                                                                         \
+	{                                                                          \
+		if (!(condition)) lexer->error_handler(lexer, message, ##__VA_ARGS__); \
+	} while (0)
@@ -1,417 +1,889 @@
-#include "lexer.h"
-
-#include <assert.h>
-#include <math.h>
-#include <string.h>
-
-static const bool g_delimiter_table[256] =
-    {
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0-15, whitespace symbols
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 16-31, whitespace symbols
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 32-47, space, !"#$%&'()*+,-./
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, // 48-63, :;<=>?
-        1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 64-79, @
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, // 80-95, [\]^
-        1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 96-111, `
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, // 112-127, {|}~
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 128-143
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 144-159
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 160-175
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 176-191
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 192-207
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 208-223
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 224-239
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 240-255
-};
-
-static inline bool is_whitespace(char data)
-{
-	return (unsigned char)(data - 1) < ' ';
-}
-
-static inline bool is_delimiter(char data)
-{
-	return g_delimiter_table[(unsigned char)data];
-}
-
-static inline char to_lower(char data)
-{
-	return (unsigned char)(data - 'A') < 26 ? data - 'A' + 'a' : data;
-}
-
-static inline bool is_digit(char data)
-{
-	return (unsigned char)(data - '0') < 10;
-}
-
-static inline void check(struct lusp_lexer_t* lexer, bool condition, const char* message)
-{
-	if (!condition) lexer->error_handler(lexer, message);
-}
-
-static inline char nextchar(struct lusp_lexer_t* lexer)
-{
-	return *++lexer->data;
-}
-
-static inline char peekchar(struct lusp_lexer_t* lexer)
-{
-	return *lexer->data;
-}
-
-static inline void skipws(struct lusp_lexer_t* lexer)
-{
-	// skip whitespace
-	while (is_whitespace(peekchar(lexer)))
-	{
-		// count lines
-		lexer->line += (peekchar(lexer) == '\n');
-
-		nextchar(lexer);
-	}
-
-	// skip comment
-	if (peekchar(lexer) == ';')
-	{
-		char ch;
-
-		while ((ch = peekchar(lexer)) != 0 && ch != '\n')
-			nextchar(lexer);
-
-		// skip trailing ws
-		skipws(lexer);
-	}
-}
-
-static inline void parse_string(struct lusp_lexer_t* lexer)
-{
-	char* buffer = lexer->value.string;
-	char* buffer_end = buffer + sizeof(lexer->value.string) - 1;
-
-	// skip "
-	assert(peekchar(lexer) == '"');
-
-	// scan for closing quote
-	char ch;
-
-	while ((ch = nextchar(lexer)) != 0 && ch != '"')
-	{
-		check(lexer, buffer < buffer_end, "string is too long");
-
-		// count lines
-		lexer->line += (ch == '\n');
-
-		// unescape
-		if (ch == '\\')
-		{
-			ch = nextchar(lexer);
-			check(lexer, ch != 0, "premature end of string");
-		}
-
-		*buffer++ = ch;
-	}
-
-	check(lexer, ch == '"', "premature end of string");
-	nextchar(lexer);
-
-	// this is safe since buffer is one byte larger than buffer_end tells us
-	*buffer = 0;
-}
-
-static inline void parse_symbol(struct lusp_lexer_t* lexer)
-{
-	char* buffer = lexer->value.symbol;
-	char* buffer_end = buffer + sizeof(lexer->value.symbol) - 1;
-
-	// scan for delimiter
-	char ch = peekchar(lexer);
-	check(lexer, !is_delimiter(ch), "symbol expected");
-
-	do
-	{
-		check(lexer, buffer < buffer_end, "symbol is too long");
-
-		*buffer++ = ch;
-	} while (!is_delimiter(ch = nextchar(lexer)));
-
-	// this is safe since buffer is one byte larger than buffer_end tells us
-	*buffer = 0;
-}
-
-static inline enum lusp_lexeme_t get_symbol_lexeme(const char* value)
-{
-	switch (*value)
-	{
-	case 'e':
-		if (strcmp(value, "else") == 0) return LUSP_LEXEME_SYMBOL_ELSE;
-		return LUSP_LEXEME_SYMBOL;
-
-	case 'i':
-		if (strcmp(value, "if") == 0) return LUSP_LEXEME_SYMBOL_IF;
-		return LUSP_LEXEME_SYMBOL;
-
-	case 'l':
-		if (strcmp(value, "let") == 0) return LUSP_LEXEME_SYMBOL_LET;
-		return LUSP_LEXEME_SYMBOL;
-
-	default:
-		return LUSP_LEXEME_SYMBOL;
-	}
-}
-
-static inline int parse_sign(struct lusp_lexer_t* lexer)
-{
-	char ch = peekchar(lexer);
-
-	if (ch == '+' || ch == '-') nextchar(lexer);
-
-	return (ch == '-') ? -1 : 1;
-}
-
-static inline int parse_integer(struct lusp_lexer_t* lexer, int base, const char* message)
-{
-	int result = 0;
-	int sign = parse_sign(lexer);
-
-	char ch = peekchar(lexer);
-
-	do
-	{
-		// handle both decimal and hexadecimal digits
-		int digit = is_digit(ch) ? ch - '0' : to_lower(ch) - 'a' + 10;
-
-		check(lexer, digit >= 0 && digit < base, message);
-
-		result = result * base + digit;
-	} while (!is_delimiter(ch = nextchar(lexer)));
-
-	return result * sign;
-}
-
-static inline float parse_real_exp(struct lusp_lexer_t* lexer, float base, int sign)
-{
-	int power = parse_integer(lexer, 10, "decimal digit expected");
-
-	return sign * base * powf(10, (float)power);
-}
-
-static inline float parse_real(struct lusp_lexer_t* lexer, int integer, int sign)
-{
-	float fractional = 0;
-	float power = 0.1f;
-
-	for (char ch = peekchar(lexer); !is_delimiter(ch); ch = nextchar(lexer))
-	{
-		// read exponent part
-		if (to_lower(ch) == 'e')
-		{
-			nextchar(lexer);
-			return parse_real_exp(lexer, integer + fractional, sign);
-		}
-
-		check(lexer, is_digit(ch), "decimal digit expected");
-
-		int digit = ch - '0';
-
-		fractional = fractional + power * digit;
-		power /= 10;
-	}
-
-	return (integer + fractional) * sign;
-}
-
-static inline enum lusp_lexeme_t parse_number(struct lusp_lexer_t* lexer, bool negative)
-{
-	int result = 0;
-
-	// get sign, unless we have a forced negative
-	int sign = negative ? -1 : parse_sign(lexer);
-
-	char ch = peekchar(lexer);
-
-	do
-	{
-		// read fractional part
-		if (ch == '.')
-		{
-			nextchar(lexer);
-			lexer->value.real = parse_real(lexer, result, sign);
-			return LUSP_LEXEME_LITERAL_REAL;
-		}
-
-		// read exponent part
-		if (to_lower(ch) == 'e')
-		{
-			nextchar(lexer);
-			lexer->value.real = parse_real_exp(lexer, (float)result, sign);
-			return LUSP_LEXEME_LITERAL_REAL;
-		}
-
-		check(lexer, is_digit(ch), "decimal digit expected");
-
-		int digit = ch - '0';
-
-		result = result * 10 + digit;
-	} while (!is_delimiter(ch = nextchar(lexer)) || ch == '.');
-
-	lexer->value.integer = sign * result;
-	return LUSP_LEXEME_LITERAL_INTEGER;
-}
-
-static inline enum lusp_lexeme_t parse_sharp_literal(struct lusp_lexer_t* lexer)
-{
-	// skip #
-	assert(peekchar(lexer) == '#');
-
-	// parse literal
-	switch (to_lower(nextchar(lexer)))
-	{
-	case 't':
-		nextchar(lexer);
-		lexer->value.boolean = true;
-		return LUSP_LEXEME_LITERAL_BOOLEAN;
-
-	case 'f':
-		nextchar(lexer);
-		lexer->value.boolean = false;
-		return LUSP_LEXEME_LITERAL_BOOLEAN;
-
-	case 'd':
-		nextchar(lexer);
-		return parse_number(lexer, false);
-
-	case 'b':
-		nextchar(lexer);
-		lexer->value.integer = parse_integer(lexer, 2, "binary digit expected");
-		return LUSP_LEXEME_LITERAL_INTEGER;
-
-	case 'o':
-		nextchar(lexer);
-		lexer->value.integer = parse_integer(lexer, 8, "octal digit expected");
-		return LUSP_LEXEME_LITERAL_INTEGER;
-
-	case 'x':
-		nextchar(lexer);
-		lexer->value.integer = parse_integer(lexer, 16, "hexadecimal digit expected");
-		return LUSP_LEXEME_LITERAL_INTEGER;
-
-	default:
-		check(lexer, false, "wrong literal type");
-		return LUSP_LEXEME_UNKNOWN;
-	}
-}
-
-void lusp_lexer_init(struct lusp_lexer_t* lexer, const char* data, void* error_context, lusp_lexer_error_handler_t error_handler)
-{
-	lexer->lexeme = LUSP_LEXEME_UNKNOWN;
-
-	lexer->data = data;
-	lexer->line = 1;
-
-	lexer->error_context = error_context;
-	lexer->error_handler = error_handler;
-
-	lusp_lexer_next(lexer);
-}
-
-enum lusp_lexeme_t lusp_lexer_next(struct lusp_lexer_t* lexer)
-{
-#define CHAR(c, lex)         \
-	case c:                  \
-		nextchar(lexer);     \
-		lexer->lexeme = lex; \
-		break
-#define CHAR2(c1, c2, lex1, lex2)                  \
-	case c1:                                       \
-		if (nextchar(lexer) == c2)                 \
-			nextchar(lexer), lexer->lexeme = lex2; \
-		else                                       \
-			lexer->lexeme = lex1;                  \
-		break
-
-	// skip whitespaces
-	skipws(lexer);
-
-	// remember lexeme position ($$$)
-	lexer->lexeme_data = lexer->data;
-	lexer->lexeme_line = lexer->line;
-
-	// parse symbol
-	char ch = peekchar(lexer);
-
-	switch (ch)
-	{
-	case 0:
-		lexer->lexeme = LUSP_LEXEME_EOF;
-		break;
-
-	case '#':
-		lexer->lexeme = parse_sharp_literal(lexer);
-		break;
-
-	case '+':
-		if (is_delimiter(nextchar(lexer)))
-			lexer->lexeme = LUSP_LEXEME_ADD;
-		else
-			lexer->lexeme = parse_number(lexer, false);
-		break;
-
-	case '-':
-		if (is_delimiter(nextchar(lexer)))
-			lexer->lexeme = LUSP_LEXEME_SUBTRACT;
-		else
-			lexer->lexeme = parse_number(lexer, true);
-		break;
-
-	case '.':
-		if (!is_delimiter(nextchar(lexer)))
-		{
-			lexer->value.real = parse_real(lexer, 0, 1);
-			lexer->lexeme = LUSP_LEXEME_LITERAL_REAL;
-		}
-		else
-			lexer->lexeme = LUSP_LEXEME_DOT;
-		break;
-
-	case '"':
-		parse_string(lexer);
-		lexer->lexeme = LUSP_LEXEME_LITERAL_STRING;
-		break;
-
-	case '0':
-	case '1':
-	case '2':
-	case '3':
-	case '4':
-	case '5':
-	case '6':
-	case '7':
-	case '8':
-	case '9':
-		lexer->lexeme = parse_number(lexer, false);
-		break;
-
-		CHAR('(', LUSP_LEXEME_OPEN_PAREN);
-		CHAR(')', LUSP_LEXEME_CLOSE_PAREN);
-		CHAR('{', LUSP_LEXEME_OPEN_BRACE);
-		CHAR('}', LUSP_LEXEME_CLOSE_BRACE);
-		CHAR(',', LUSP_LEXEME_COMMA);
-		CHAR('|', LUSP_LEXEME_VERTICAL_BAR);
-		CHAR('*', LUSP_LEXEME_MULTIPLY);
-		CHAR('/', LUSP_LEXEME_DIVIDE);
-		CHAR('%', LUSP_LEXEME_MODULO);
-
-		CHAR2('=', '=', LUSP_LEXEME_ASSIGN, LUSP_LEXEME_EQUAL);
-		CHAR2('>', '=', LUSP_LEXEME_GREATER, LUSP_LEXEME_GREATER_EQUAL);
-		CHAR2('<', '=', LUSP_LEXEME_LESS, LUSP_LEXEME_LESS_EQUAL);
-		CHAR2('!', '=', LUSP_LEXEME_UNKNOWN, LUSP_LEXEME_NOT_EQUAL);
-
-	default:
-		parse_symbol(lexer);
-		lexer->lexeme = get_symbol_lexeme(lexer->value.symbol);
-	}
-
-	return lexer->lexeme;
-
-#undef CHAR
-}
+#include "lexer.h"
+
+#include "decimal.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXER_SIMD 1
+#include <emmintrin.h>
+#endif
+
+// digits are parsed 8 at a time from little-endian 64-bit loads
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LEXER_SWAR 0
+#else
+#define LEXER_SWAR 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+static const bool g_delimiter_table[256] =
+    {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0-15, whitespace symbols
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 16-31, whitespace symbols
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 32-47, space, !"#$%&'()*+,-./
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, // 48-63, :;<=>?
+        1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 64-79, @
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, // 80-95, [\]^
+        1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 96-111, `
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, // 112-127, {|}~
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 128-143
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 144-159
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 160-175
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 176-191
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 192-207
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 208-223
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 224-239
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 240-255
+};
+
+static inline bool is_whitespace(char data)
+{
+	return (unsigned char)(data - 1) < ' ';
+}
+
+static inline bool is_delimiter(char data)
+{
+	return g_delimiter_table[(unsigned char)data];
+}
+
+static inline char to_lower(char data)
+{
+	return (unsigned char)(data - 'A') < 26 ? data - 'A' + 'a' : data;
+}
+
+static inline bool is_digit(char data)
+{
+	return (unsigned char)(data - '0') < 10;
+}
+
+#ifdef LEXER_SIMD
+static inline unsigned int count_trailing_zeros(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long result;
+	_BitScanForward(&result, mask);
+	return result;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned int popcount(unsigned int mask)
+{
+#ifdef _MSC_VER
+	return __popcnt(mask);
+#else
+	return __builtin_popcount(mask);
+#endif
+}
+
+// all masks have one bit per byte; comparisons are signed, so bytes 128-255 are negative
+static inline __m128i simd_range(__m128i v, char min, char max)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(min - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(max + 1)));
+}
+
+static inline unsigned int simd_whitespace_mask(__m128i v)
+{
+	// same as is_whitespace: 1-32
+	__m128i x = _mm_sub_epi8(v, _mm_set1_epi8(1));
+
+	return _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(-1)), _mm_cmplt_epi8(x, _mm_set1_epi8(' '))));
+}
+
+static inline unsigned int simd_delimiter_mask(__m128i v)
+{
+	// same as g_delimiter_table: everything except digits, letters, _, 127 and 128-255
+	// case folding maps letters to a-z and both _ and 127 to 127, and does not map any delimiter to these
+	__m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+	__m128i high = _mm_cmplt_epi8(v, _mm_setzero_si128());
+	__m128i digit = simd_range(v, '0', '9');
+	__m128i letter = simd_range(folded, 'a', 'z');
+	__m128i other = _mm_cmpeq_epi8(folded, _mm_set1_epi8(127));
+
+	return ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(high, digit), _mm_or_si128(letter, other))) & 0xffff;
+}
+
+static inline unsigned int simd_char_mask(__m128i v, char ch)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(ch)));
+}
+#endif
+
+static inline void check(struct lusp_lexer_t* lexer, bool condition, const char* message)
+{
+	if (!condition) lexer->error_handler(lexer, message);
+}
+
+static char refill(struct lusp_lexer_t* lexer)
+{
+	// zero characters before the end of data terminate input, same as for in-memory input
+	if (lexer->data != lexer->end || !lexer->refill) return 0;
+
+	// move the part of current lexeme that was read to the start of the buffer
+	size_t keep = lexer->lexeme_data ? (size_t)(lexer->end - lexer->lexeme_data) : 0;
+	check(lexer, keep < LUSP_LEXER_BUFFER_SIZE, "lexeme is too long");
+
+	if (keep)
+	{
+		memmove(lexer->buffer, lexer->lexeme_data, keep);
+		lexer->lexeme_data = lexer->buffer;
+	}
+
+	size_t size = lexer->refill(lexer->refill_context, lexer->buffer + keep, LUSP_LEXER_BUFFER_SIZE - keep);
+	assert(size <= LUSP_LEXER_BUFFER_SIZE - keep);
+
+	lexer->buffer[keep + size] = 0;
+
+	lexer->data = lexer->buffer + keep;
+	lexer->end = lexer->data + size;
+
+	// stop refilling at the end of stream
+	if (size == 0) lexer->refill = 0;
+
+	return *lexer->data;
+}
+
+static inline char peekchar(struct lusp_lexer_t* lexer)
+{
+	char ch = *lexer->data;
+
+	return ch == 0 ? refill(lexer) : ch;
+}
+
+static inline char nextchar(struct lusp_lexer_t* lexer)
+{
+	++lexer->data;
+
+	return peekchar(lexer);
+}
+
+#ifdef LEXER_SIMD
+// kernels scan 16 bytes at a time while there is enough buffered data and stop at the first byte that needs scalar
+// processing; most lexemes are short, so kernels are only used after several scalar steps and are kept out of line
+NOINLINE static void simd_skip_whitespace(struct lusp_lexer_t* lexer)
+{
+	while (lexer->end - lexer->data >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)lexer->data);
+
+		unsigned int whitespace = simd_whitespace_mask(v);
+		unsigned int newline = simd_char_mask(v, '\n');
+
+		if (whitespace != 0xffff)
+		{
+			unsigned int length = count_trailing_zeros(~whitespace);
+
+			lexer->line += popcount(newline & ((1u << length) - 1));
+			lexer->data += length;
+			return;
+		}
+
+		lexer->line += popcount(newline);
+		lexer->data += 16;
+	}
+}
+
+NOINLINE static void simd_skip_comment(struct lusp_lexer_t* lexer)
+{
+	while (lexer->end - lexer->data >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)lexer->data);
+
+		unsigned int stop = simd_char_mask(v, '\n') | simd_char_mask(v, 0);
+
+		if (stop)
+		{
+			lexer->data += count_trailing_zeros(stop);
+			return;
+		}
+
+		lexer->data += 16;
+	}
+}
+
+NOINLINE static void simd_skip_string(struct lusp_lexer_t* lexer)
+{
+	while (lexer->end - lexer->data >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)lexer->data);
+
+		unsigned int stop = simd_char_mask(v, '"') | simd_char_mask(v, '\\') | simd_char_mask(v, 0);
+		unsigned int newline = simd_char_mask(v, '\n');
+
+		if (stop)
+		{
+			unsigned int length = count_trailing_zeros(stop);
+
+			lexer->line += popcount(newline & ((1u << length) - 1));
+			lexer->data += length;
+			return;
+		}
+
+		lexer->line += popcount(newline);
+		lexer->data += 16;
+	}
+}
+
+NOINLINE static void simd_skip_symbol(struct lusp_lexer_t* lexer)
+{
+	while (lexer->end - lexer->data >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)lexer->data);
+
+		unsigned int delimiter = simd_delimiter_mask(v);
+
+		if (delimiter)
+		{
+			lexer->data += count_trailing_zeros(delimiter);
+			return;
+		}
+
+		lexer->data += 16;
+	}
+}
+#else
+static inline void simd_skip_whitespace(struct lusp_lexer_t* lexer)
+{
+	(void)lexer;
+}
+
+static inline void simd_skip_comment(struct lusp_lexer_t* lexer)
+{
+	(void)lexer;
+}
+
+static inline void simd_skip_string(struct lusp_lexer_t* lexer)
+{
+	(void)lexer;
+}
+
+static inline void simd_skip_symbol(struct lusp_lexer_t* lexer)
+{
+	(void)lexer;
+}
+#endif
+
+// number of scalar steps between kernel invocations, power of two
+#define SIMD_THRESHOLD 8
+
+static inline void skipws(struct lusp_lexer_t* lexer)
+{
+	for (;;)
+	{
+		unsigned int count = 0;
+
+		// skip whitespace
+		while (is_whitespace(peekchar(lexer)))
+		{
+			// count lines
+			lexer->line += (peekchar(lexer) == '\n');
+
+			nextchar(lexer);
+
+			if ((++count & (SIMD_THRESHOLD - 1)) == 0) simd_skip_whitespace(lexer);
+		}
+
+		// skip comment and trailing whitespace
+		if (peekchar(lexer) != ';') break;
+
+		simd_skip_comment(lexer);
+
+		char ch;
+
+		while ((ch = peekchar(lexer)) != 0 && ch != '\n')
+			nextchar(lexer);
+	}
+}
+
+static char* reserve_scratch(struct lusp_lexer_t* lexer, unsigned int length)
+{
+	if (lexer->scratch_capacity < length)
+	{
+		unsigned int capacity = lexer->scratch_capacity ? lexer->scratch_capacity : 64;
+		while (capacity < length) capacity *= 2;
+
+		if (lexer->scratch) lusp_memory_deallocate(lexer->scratch);
+
+		lexer->scratch = (char*)lusp_memory_allocate(capacity);
+		lexer->scratch_capacity = capacity;
+		assert(lexer->scratch);
+	}
+
+	return lexer->scratch;
+}
+
+static void unescape_string(struct lusp_lexer_t* lexer, const char* data, unsigned int length)
+{
+	char* result = reserve_scratch(lexer, length);
+
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		// escaped character is taken as is
+		if (data[i] == '\\') ++i;
+
+		*result++ = data[i];
+	}
+
+	lexer->value.string.data = lexer->scratch;
+	lexer->value.string.length = (unsigned int)(result - lexer->scratch);
+}
+
+static inline void parse_string(struct lusp_lexer_t* lexer)
+{
+	// skip "
+	assert(peekchar(lexer) == '"');
+
+	// scan for closing quote
+	char ch = nextchar(lexer);
+	bool escaped = false;
+	unsigned int count = 0;
+
+	while (ch != 0 && ch != '"')
+	{
+		// count lines
+		lexer->line += (ch == '\n');
+
+		// skip escaped character
+		if (ch == '\\')
+		{
+			escaped = true;
+
+			ch = nextchar(lexer);
+			check(lexer, ch != 0, "premature end of string");
+		}
+
+		ch = nextchar(lexer);
+
+		if ((++count & (SIMD_THRESHOLD - 1)) == 0)
+		{
+			simd_skip_string(lexer);
+			ch = peekchar(lexer);
+		}
+	}
+
+	check(lexer, ch == '"', "premature end of string");
+
+	// string contents follow the opening quote; skipping closing quote may move the lexeme on refill
+	unsigned int length = (unsigned int)(lexer->data - lexer->lexeme_data) - 1;
+
+	nextchar(lexer);
+
+	if (escaped)
+		unescape_string(lexer, lexer->lexeme_data + 1, length);
+	else
+	{
+		lexer->value.string.data = lexer->lexeme_data + 1;
+		lexer->value.string.length = length;
+	}
+}
+
+static inline void parse_symbol(struct lusp_lexer_t* lexer)
+{
+	// scan for delimiter
+	char ch = peekchar(lexer);
+	check(lexer, !is_delimiter(ch), "symbol expected");
+
+	unsigned int count = 0;
+
+	do
+	{
+		ch = nextchar(lexer);
+
+		if ((++count & (SIMD_THRESHOLD - 1)) == 0)
+		{
+			simd_skip_symbol(lexer);
+			ch = peekchar(lexer);
+		}
+	} while (!is_delimiter(ch));
+
+	// symbol is the whole lexeme
+	lexer->value.symbol.data = lexer->lexeme_data;
+	lexer->value.symbol.length = (unsigned int)(lexer->data - lexer->lexeme_data);
+}
+
+struct keyword_t
+{
+	const char* name;
+	unsigned int length;
+	enum lusp_lexeme_t lexeme;
+};
+
+// keywords are looked up with a perfect hash of length and first character; when adding a keyword, put it into the
+// slot given by KEYWORD_HASH and adjust the shift/table size if slots collide (lusp_lexer_init validates the table)
+#define KEYWORD_HASH(data, length) (((unsigned char)(data)[0] ^ ((length) << 2)) & 7)
+
+static const struct keyword_t g_keywords[8] =
+    {
+        {"let", 3, LUSP_LEXEME_SYMBOL_LET},
+        {"if", 2, LUSP_LEXEME_SYMBOL_IF},
+        {0, 0, LUSP_LEXEME_SYMBOL},
+        {0, 0, LUSP_LEXEME_SYMBOL},
+        {0, 0, LUSP_LEXEME_SYMBOL},
+        {"else", 4, LUSP_LEXEME_SYMBOL_ELSE},
+        {0, 0, LUSP_LEXEME_SYMBOL},
+        {0, 0, LUSP_LEXEME_SYMBOL},
+};
+
+static bool validate_keywords(void)
+{
+	for (unsigned int i = 0; i < sizeof(g_keywords) / sizeof(g_keywords[0]); ++i)
+	{
+		const struct keyword_t* keyword = &g_keywords[i];
+
+		if (keyword->name && (strlen(keyword->name) != keyword->length || KEYWORD_HASH(keyword->name, keyword->length) != i))
+			return false;
+	}
+
+	return true;
+}
+
+static inline enum lusp_lexeme_t get_symbol_lexeme(const char* data, unsigned int length)
+{
+	const struct keyword_t* keyword = &g_keywords[KEYWORD_HASH(data, length)];
+
+	// empty slots have zero length and never match since symbols are not empty
+	return (keyword->length == length && memcmp(data, keyword->name, length) == 0) ? keyword->lexeme : LUSP_LEXEME_SYMBOL;
+}
+
+static inline int parse_sign(struct lusp_lexer_t* lexer)
+{
+	char ch = peekchar(lexer);
+
+	if (ch == '+' || ch == '-') nextchar(lexer);
+
+	return (ch == '-') ? -1 : 1;
+}
+
+static inline int64_t make_integer(struct lusp_lexer_t* lexer, uint64_t value, bool overflow, int sign)
+{
+	// magnitude of INT64_MIN is one larger than INT64_MAX
+	check(lexer, !overflow && value <= (uint64_t)INT64_MAX + (sign < 0), "integer literal is too large");
+
+	return (sign < 0) ? (int64_t)(0 - value) : (int64_t)value;
+}
+
+static inline int64_t parse_integer(struct lusp_lexer_t* lexer, int base, const char* message)
+{
+	uint64_t result = 0;
+	bool overflow = false;
+	int sign = parse_sign(lexer);
+
+	char ch = peekchar(lexer);
+
+	do
+	{
+		// handle both decimal and hexadecimal digits
+		int digit = is_digit(ch) ? ch - '0' : to_lower(ch) - 'a' + 10;
+
+		check(lexer, digit >= 0 && digit < base, message);
+
+		overflow |= result > (UINT64_MAX - digit) / base;
+		result = result * base + digit;
+	} while (!is_delimiter(ch = nextchar(lexer)));
+
+	return make_integer(lexer, result, overflow, sign);
+}
+
+// decimal literal as mantissa * 10^exponent
+struct decimal_t
+{
+	// first 19 significant digits; they always fit into 64 bits
+	uint64_t mantissa;
+	int64_t exponent;
+
+	// nonzero digits after the first 19 were dropped
+	bool truncated;
+};
+
+static const uint64_t g_digit_scale[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+static inline unsigned int count_leading_digits(uint64_t chunk)
+{
+	// bytes are digits if they are in 0x30..0x39; carries only corrupt bytes after a non-digit
+	uint64_t nibbles = ((chunk & 0xf0f0f0f0f0f0f0f0ull) | (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) ^ 0x3333333333333333ull;
+	uint64_t other = (((nibbles & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | nibbles) & 0x8080808080808080ull;
+
+	// high bits of all bytes before the first non-digit, summed with a multiply
+	uint64_t prefix = (other - 1) & ~other & 0x8080808080808080ull;
+
+	return (unsigned int)(((prefix >> 7) * 0x0101010101010101ull) >> 56);
+}
+
+static inline uint32_t parse_leading_digits(uint64_t chunk, unsigned int count)
+{
+	// move digits to the top so that missing digits become leading zeros
+	chunk = (chunk - 0x3030303030303030ull) << (8 * (8 - count));
+
+	// combine adjacent digits into 2-digit values, then 2-digit values into 4-digit and 8-digit values
+	chunk = chunk * 10 + (chunk >> 8);
+	chunk = ((chunk & 0x000000ff000000ffull) * 0x000f424000000064ull + ((chunk >> 16) & 0x000000ff000000ffull) * 0x0000271000000001ull) >> 32;
+
+	return (uint32_t)chunk;
+}
+
+static inline void add_digit(struct decimal_t* decimal, int digit, bool fraction)
+{
+	if (decimal->mantissa < 1000000000000000000ull)
+	{
+		decimal->mantissa = decimal->mantissa * 10 + digit;
+		decimal->exponent -= fraction;
+	}
+	else
+	{
+		decimal->truncated |= (digit != 0);
+		decimal->exponent += !fraction;
+	}
+}
+
+static inline char parse_digits(struct lusp_lexer_t* lexer, struct decimal_t* decimal, bool fraction)
+{
+#if LEXER_SWAR
+	// take up to 8 digits at a time while they are buffered and the mantissa has room for them
+	while (lexer->end - lexer->data >= 8 && decimal->mantissa < 100000000000ull)
+	{
+		uint64_t chunk;
+		memcpy(&chunk, lexer->data, sizeof(chunk));
+
+		unsigned int count = count_leading_digits(chunk);
+		if (count == 0) break;
+
+		decimal->mantissa = decimal->mantissa * g_digit_scale[count] + parse_leading_digits(chunk, count);
+		decimal->exponent -= fraction ? count : 0;
+		lexer->data += count;
+
+		if (count < 8) break;
+	}
+#endif
+
+	char ch = peekchar(lexer);
+
+	while (is_digit(ch))
+	{
+		add_digit(decimal, ch - '0', fraction);
+		ch = nextchar(lexer);
+	}
+
+	return ch;
+}
+
+static NOINLINE double parse_real_slow(struct lusp_lexer_t* lexer)
+{
+	const char* data = lexer->lexeme_data;
+
+	// skip #d prefix and sign, the caller applies the sign
+	if (*data == '#') data += 2;
+	if (*data == '+' || *data == '-') data++;
+
+	unsigned int length = (unsigned int)(lexer->data - data);
+	char* buffer = reserve_scratch(lexer, length + 1);
+
+	memcpy(buffer, data, length);
+	buffer[length] = 0;
+
+	return strtod(buffer, 0);
+}
+
+static inline double make_real(struct lusp_lexer_t* lexer, struct decimal_t* decimal, int64_t power, int sign)
+{
+	// digit exponent is bounded by the source length, so the sum can't overflow once power is clamped to a half range
+	const int64_t limit = INT64_MAX / 2;
+	int64_t exponent = decimal->exponent + (power < -limit ? -limit : power > limit ? limit : power);
+
+	// exponents outside of this range produce zero or infinity for any mantissa
+	exponent = exponent < -100000 ? -100000 : exponent > 100000 ? 100000 : exponent;
+
+	double result = lusp_decimal_to_double(decimal->mantissa, exponent);
+
+	// dropped digits only matter if they can change rounding, which is rare enough to defer to strtod
+	if (decimal->truncated && result != lusp_decimal_to_double(decimal->mantissa + 1, exponent))
+		result = parse_real_slow(lexer);
+
+	return sign < 0 ? -result : result;
+}
+
+static inline double parse_real_exp(struct lusp_lexer_t* lexer, struct decimal_t* decimal, int sign)
+{
+	int64_t power = parse_integer(lexer, 10, "decimal digit expected");
+
+	return make_real(lexer, decimal, power, sign);
+}
+
+static inline double parse_real(struct lusp_lexer_t* lexer, struct decimal_t* decimal, int sign)
+{
+	char ch = peekchar(lexer);
+
+	while (!is_delimiter(ch))
+	{
+		// read exponent part
+		if (to_lower(ch) == 'e')
+		{
+			nextchar(lexer);
+			return parse_real_exp(lexer, decimal, sign);
+		}
+
+		check(lexer, is_digit(ch), "decimal digit expected");
+
+		ch = parse_digits(lexer, decimal, true);
+	}
+
+	return make_real(lexer, decimal, 0, sign);
+}
+
+static inline enum lusp_lexeme_t parse_number(struct lusp_lexer_t* lexer, bool negative)
+{
+	struct decimal_t decimal = {0, 0, false};
+
+	// get sign, unless we have a forced negative
+	int sign = negative ? -1 : parse_sign(lexer);
+
+	char ch = peekchar(lexer);
+
+	do
+	{
+		// read fractional part
+		if (ch == '.')
+		{
+			nextchar(lexer);
+			lexer->value.real = parse_real(lexer, &decimal, sign);
+			return LUSP_LEXEME_LITERAL_REAL;
+		}
+
+		// read exponent part
+		if (to_lower(ch) == 'e')
+		{
+			nextchar(lexer);
+			lexer->value.real = parse_real_exp(lexer, &decimal, sign);
+			return LUSP_LEXEME_LITERAL_REAL;
+		}
+
+		check(lexer, is_digit(ch), "decimal digit expected");
+
+		ch = parse_digits(lexer, &decimal, false);
+	} while (!is_delimiter(ch) || ch == '.');
+
+	// integer part only has a nonzero exponent if it has more than 19 significant digits
+	lexer->value.integer = make_integer(lexer, decimal.mantissa, decimal.exponent != 0, sign);
+	return LUSP_LEXEME_LITERAL_INTEGER;
+}
+
+static inline enum lusp_lexeme_t parse_sharp_literal(struct lusp_lexer_t* lexer)
+{
+	// skip #
+	assert(peekchar(lexer) == '#');
+
+	// parse literal
+	switch (to_lower(nextchar(lexer)))
+	{
+	case 't':
+		nextchar(lexer);
+		lexer->value.boolean = true;
+		return LUSP_LEXEME_LITERAL_BOOLEAN;
+
+	case 'f':
+		nextchar(lexer);
+		lexer->value.boolean = false;
+		return LUSP_LEXEME_LITERAL_BOOLEAN;
+
+	case 'd':
+		nextchar(lexer);
+		return parse_number(lexer, false);
+
+	case 'b':
+		nextchar(lexer);
+		lexer->value.integer = parse_integer(lexer, 2, "binary digit expected");
+		return LUSP_LEXEME_LITERAL_INTEGER;
+
+	case 'o':
+		nextchar(lexer);
+		lexer->value.integer = parse_integer(lexer, 8, "octal digit expected");
+		return LUSP_LEXEME_LITERAL_INTEGER;
+
+	case 'x':
+		nextchar(lexer);
+		lexer->value.integer = parse_integer(lexer, 16, "hexadecimal digit expected");
+		return LUSP_LEXEME_LITERAL_INTEGER;
+
+	default:
+		check(lexer, false, "wrong literal type");
+		return LUSP_LEXEME_UNKNOWN;
+	}
+}
+
+void lusp_lexer_init(struct lusp_lexer_t* lexer, const char* data, void* error_context, lusp_lexer_error_handler_t error_handler)
+{
+	lexer->lexeme = LUSP_LEXEME_UNKNOWN;
+
+	lexer->lexeme_data = 0;
+
+	lexer->data = data;
+	lexer->end = data + strlen(data);
+	lexer->line = 1;
+
+	lexer->refill = 0;
+	lexer->refill_context = 0;
+
+	lexer->scratch = 0;
+	lexer->scratch_capacity = 0;
+
+	lexer->error_context = error_context;
+	lexer->error_handler = error_handler;
+
+	assert(validate_keywords());
+
+	lusp_lexer_next(lexer);
+}
+
+void lusp_lexer_init_stream(struct lusp_lexer_t* lexer, lusp_lexer_refill_t refill, void* refill_context, void* error_context, lusp_lexer_error_handler_t error_handler)
+{
+	lexer->lexeme = LUSP_LEXEME_UNKNOWN;
+
+	// start with empty buffer, first character read triggers a refill
+	lexer->buffer[0] = 0;
+
+	lexer->lexeme_data = 0;
+
+	lexer->data = lexer->buffer;
+	lexer->end = lexer->buffer;
+	lexer->line = 1;
+
+	lexer->refill = refill;
+	lexer->refill_context = refill_context;
+
+	lexer->scratch = 0;
+	lexer->scratch_capacity = 0;
+
+	lexer->error_context = error_context;
+	lexer->error_handler = error_handler;
+
+	assert(validate_keywords());
+
+	lusp_lexer_next(lexer);
+}
+
+void lusp_lexer_term(struct lusp_lexer_t* lexer)
+{
+	if (lexer->scratch) lusp_memory_deallocate(lexer->scratch);
+
+	lexer->scratch = 0;
+	lexer->scratch_capacity = 0;
+}
+
+enum lusp_lexeme_t lusp_lexer_next(struct lusp_lexer_t* lexer)
+{
+#define CHAR(c, lex)         \
+	case c:                  \
+		nextchar(lexer);     \
+		lexer->lexeme = lex; \
+		break
+#define CHAR2(c1, c2, lex1, lex2)                  \
+	case c1:                                       \
+		if (nextchar(lexer) == c2)                 \
+			nextchar(lexer), lexer->lexeme = lex2; \
+		else                                       \
+			lexer->lexeme = lex1;                  \
+		break
+
+	// skip whitespaces; previous lexeme does not need to be kept on refill
+	lexer->lexeme_data = 0;
+
+	skipws(lexer);
+
+	// remember lexeme position ($$$)
+	lexer->lexeme_data = lexer->data;
+	lexer->lexeme_line = lexer->line;
+
+	// parse symbol
+	char ch = peekchar(lexer);
+
+	switch (ch)
+	{
+	case 0:
+		lexer->lexeme = LUSP_LEXEME_EOF;
+		break;
+
+	case '#':
+		lexer->lexeme = parse_sharp_literal(lexer);
+		break;
+
+	case '+':
+		if (is_delimiter(nextchar(lexer)))
+			lexer->lexeme = LUSP_LEXEME_ADD;
+		else
+			lexer->lexeme = parse_number(lexer, false);
+		break;
+
+	case '-':
+		if (is_delimiter(nextchar(lexer)))
+			lexer->lexeme = LUSP_LEXEME_SUBTRACT;
+		else
+			lexer->lexeme = parse_number(lexer, true);
+		break;
+
+	case '.':
+		if (!is_delimiter(nextchar(lexer)))
+		{
+			struct decimal_t decimal = {0, 0, false};
+
+			lexer->value.real = parse_real(lexer, &decimal, 1);
+			lexer->lexeme = LUSP_LEXEME_LITERAL_REAL;
+		}
+		else
+			lexer->lexeme = LUSP_LEXEME_DOT;
+		break;
+
+	case '"':
+		parse_string(lexer);
+		lexer->lexeme = LUSP_LEXEME_LITERAL_STRING;
+		break;
+
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		lexer->lexeme = parse_number(lexer, false);
+		break;
+
+		CHAR('(', LUSP_LEXEME_OPEN_PAREN);
+		CHAR(')', LUSP_LEXEME_CLOSE_PAREN);
+		CHAR('{', LUSP_LEXEME_OPEN_BRACE);
+		CHAR('}', LUSP_LEXEME_CLOSE_BRACE);
+		CHAR('[', LUSP_LEXEME_OPEN_BRACKET);
+		CHAR(']', LUSP_LEXEME_CLOSE_BRACKET);
+		CHAR(',', LUSP_LEXEME_COMMA);
+		CHAR('|', LUSP_LEXEME_VERTICAL_BAR);
+		CHAR('*', LUSP_LEXEME_MULTIPLY);
+		CHAR('/', LUSP_LEXEME_DIVIDE);
+		CHAR('%', LUSP_LEXEME_MODULO);
+
+		CHAR2('=', '=', LUSP_LEXEME_ASSIGN, LUSP_LEXEME_EQUAL);
+		CHAR2('>', '=', LUSP_LEXEME_GREATER, LUSP_LEXEME_GREATER_EQUAL);
+		CHAR2('<', '=', LUSP_LEXEME_LESS, LUSP_LEXEME_LESS_EQUAL);
+		CHAR2('!', '=', LUSP_LEXEME_UNKNOWN, LUSP_LEXEME_NOT_EQUAL);
+
+	default:
+		parse_symbol(lexer);
+		lexer->lexeme = get_symbol_lexeme(lexer->value.symbol.data, lexer->value.symbol.length);
+	}
+
+	return lexer->lexeme;
+
+#undef CHAR
+}
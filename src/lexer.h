@@ -1,70 +1,103 @@
-#pragma once
-
-#include <stdbool.h>
-
-enum lusp_lexeme_t
-{
-	LUSP_LEXEME_UNKNOWN,
-	LUSP_LEXEME_EOF,
-	LUSP_LEXEME_LITERAL_BOOLEAN,
-	LUSP_LEXEME_LITERAL_INTEGER,
-	LUSP_LEXEME_LITERAL_REAL,
-	LUSP_LEXEME_LITERAL_STRING,
-	LUSP_LEXEME_OPEN_PAREN,
-	LUSP_LEXEME_CLOSE_PAREN,
-	LUSP_LEXEME_OPEN_BRACE,
-	LUSP_LEXEME_CLOSE_BRACE,
-	LUSP_LEXEME_COMMA,
-	LUSP_LEXEME_DOT,
-	LUSP_LEXEME_ASSIGN,
-	LUSP_LEXEME_VERTICAL_BAR,
-	LUSP_LEXEME_ADD,
-	LUSP_LEXEME_SUBTRACT,
-	LUSP_LEXEME_MULTIPLY,
-	LUSP_LEXEME_DIVIDE,
-	LUSP_LEXEME_MODULO,
-	LUSP_LEXEME_GREATER,
-	LUSP_LEXEME_GREATER_EQUAL,
-	LUSP_LEXEME_LESS,
-	LUSP_LEXEME_LESS_EQUAL,
-	LUSP_LEXEME_EQUAL,
-	LUSP_LEXEME_NOT_EQUAL,
-	LUSP_LEXEME_SYMBOL,
-	LUSP_LEXEME_SYMBOL_LET,
-	LUSP_LEXEME_SYMBOL_IF,
-	LUSP_LEXEME_SYMBOL_ELSE,
-};
-
-union lusp_lexeme_value_t {
-	bool boolean;
-	int integer;
-	float real;
-	char string[1024];
-	char symbol[1024];
-};
-
-struct lusp_lexer_t;
-
-typedef void (*lusp_lexer_error_handler_t)(struct lusp_lexer_t* lexer, const char* message, ...);
-
-struct lusp_lexer_t
-{
-	// current lexeme
-	enum lusp_lexeme_t lexeme;
-	union lusp_lexeme_value_t value;
-
-	// lexeme information
-	const char* lexeme_data;
-	unsigned int lexeme_line;
-
-	// stream information
-	const char* data;
-	unsigned int line;
-
-	// error handler
-	void* error_context;
-	lusp_lexer_error_handler_t error_handler;
-};
-
-void lusp_lexer_init(struct lusp_lexer_t* lexer, const char* data, void* error_context, lusp_lexer_error_handler_t error_handler);
-enum lusp_lexeme_t lusp_lexer_next(struct lusp_lexer_t* lexer);
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum lusp_lexeme_t
+{
+	LUSP_LEXEME_UNKNOWN,
+	LUSP_LEXEME_EOF,
+	LUSP_LEXEME_LITERAL_BOOLEAN,
+	LUSP_LEXEME_LITERAL_INTEGER,
+	LUSP_LEXEME_LITERAL_REAL,
+	LUSP_LEXEME_LITERAL_STRING,
+	LUSP_LEXEME_OPEN_PAREN,
+	LUSP_LEXEME_CLOSE_PAREN,
+	LUSP_LEXEME_OPEN_BRACE,
+	LUSP_LEXEME_CLOSE_BRACE,
+	LUSP_LEXEME_OPEN_BRACKET,
+	LUSP_LEXEME_CLOSE_BRACKET,
+	LUSP_LEXEME_COMMA,
+	LUSP_LEXEME_DOT,
+	LUSP_LEXEME_ASSIGN,
+	LUSP_LEXEME_VERTICAL_BAR,
+	LUSP_LEXEME_ADD,
+	LUSP_LEXEME_SUBTRACT,
+	LUSP_LEXEME_MULTIPLY,
+	LUSP_LEXEME_DIVIDE,
+	LUSP_LEXEME_MODULO,
+	LUSP_LEXEME_GREATER,
+	LUSP_LEXEME_GREATER_EQUAL,
+	LUSP_LEXEME_LESS,
+	LUSP_LEXEME_LESS_EQUAL,
+	LUSP_LEXEME_EQUAL,
+	LUSP_LEXEME_NOT_EQUAL,
+	LUSP_LEXEME_SYMBOL,
+	LUSP_LEXEME_SYMBOL_LET,
+	LUSP_LEXEME_SYMBOL_IF,
+	LUSP_LEXEME_SYMBOL_ELSE,
+};
+
+// string and symbol values point into the input or into lexer scratch buffer (for strings with escapes) and are not
+// zero-terminated; they are valid until the next lexeme is read
+struct lusp_lexeme_slice_t
+{
+	const char* data;
+	unsigned int length;
+};
+
+union lusp_lexeme_value_t {
+	bool boolean;
+	int64_t integer;
+	double real;
+	struct lusp_lexeme_slice_t string;
+	struct lusp_lexeme_slice_t symbol;
+};
+
+struct lusp_lexer_t;
+
+typedef void (*lusp_lexer_error_handler_t)(struct lusp_lexer_t* lexer, const char* message, ...);
+
+// reads up to size bytes of input into buffer; returns the number of bytes read, 0 at the end of input
+typedef size_t (*lusp_lexer_refill_t)(void* context, char* buffer, size_t size);
+
+// input buffer size for streaming lexer
+#define LUSP_LEXER_BUFFER_SIZE 4096
+
+struct lusp_lexer_t
+{
+	// current lexeme
+	enum lusp_lexeme_t lexeme;
+	union lusp_lexeme_value_t value;
+
+	// lexeme information (lexeme_data is 0 while skipping whitespace between lexemes)
+	const char* lexeme_data;
+	unsigned int lexeme_line;
+
+	// stream information; data is always terminated by zero at end
+	const char* data;
+	const char* end;
+	unsigned int line;
+
+	// streaming input (refill is 0 for in-memory input or after the end of stream)
+	lusp_lexer_refill_t refill;
+	void* refill_context;
+	char buffer[LUSP_LEXER_BUFFER_SIZE + 1];
+
+	// unescaped string storage
+	char* scratch;
+	unsigned int scratch_capacity;
+
+	// error handler
+	void* error_context;
+	lusp_lexer_error_handler_t error_handler;
+};
+
+void lusp_lexer_init(struct lusp_lexer_t* lexer, const char* data, void* error_context, lusp_lexer_error_handler_t error_handler);
+
+// lexemes may span refill boundaries; the current lexeme is kept in the buffer, so it can't be longer than the buffer
+void lusp_lexer_init_stream(struct lusp_lexer_t* lexer, lusp_lexer_refill_t refill, void* refill_context, void* error_context, lusp_lexer_error_handler_t error_handler);
+void lusp_lexer_term(struct lusp_lexer_t* lexer);
+
+enum lusp_lexeme_t lusp_lexer_next(struct lusp_lexer_t* lexer);
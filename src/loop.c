@@ -0,0 +1,639 @@
+#ifndef DL_WINDOWS
+// clock_gettime is not declared in strict C99 mode
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "loop.h"
+
+#include "coroutine.h"
+#include "environment.h"
+#include "memory.h"
+#include "state.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef DL_WINDOWS
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// default size limit of read
+#define LOOP_READ_SIZE 4096
+
+enum task_wait_t
+{
+	TASK_READY,
+	TASK_SLEEP,
+	TASK_READ,
+	TASK_WRITE,
+	TASK_EXTERNAL
+};
+
+struct lusp_loop_task_t
+{
+	struct lusp_coroutine_t* coroutine;
+	enum task_wait_t wait;
+
+	// value that is passed to the task when it's resumed
+	struct lusp_object_t result;
+
+	// ready or completed queue link
+	struct lusp_loop_task_t* next;
+
+	// pending operation
+	uint64_t deadline;
+	int fd;
+	unsigned int size;
+	struct lusp_string_t* data;
+	unsigned int offset;
+};
+
+struct lusp_loop_t
+{
+	struct lusp_state_t* state;
+	unsigned int stack_size;
+
+	// task that is running, 0 while the loop waits
+	struct lusp_loop_task_t* current;
+	unsigned int task_count;
+
+	// tasks that run in the next round, in order
+	struct lusp_loop_task_t* ready;
+	struct lusp_loop_task_t* ready_tail;
+
+	// sleeping tasks, binary heap ordered by deadline
+	struct lusp_loop_task_t** timers;
+	unsigned int timer_count;
+	unsigned int timer_capacity;
+
+	// tasks that wait for fd readiness
+	struct lusp_loop_task_t** waiters;
+	unsigned int waiter_count;
+	unsigned int waiter_capacity;
+
+	// tasks that wait for lusp_loop_complete; completed tasks are pushed from any thread under the lock
+	unsigned int external_count;
+
+	struct lusp_lock_t lock;
+	struct lusp_loop_task_t* completed;
+
+	// wakes the loop up when a task is completed by another thread
+#ifdef DL_WINDOWS
+	HANDLE wake;
+#else
+	int wake[2];
+
+	struct pollfd* pollfds;
+	unsigned int pollfd_capacity;
+#endif
+};
+
+static uint64_t get_time()
+{
+#ifdef DL_WINDOWS
+	return GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+static void* grow(void* data, unsigned int count, unsigned int* capacity, size_t size)
+{
+	if (count < *capacity) return data;
+
+	unsigned int new_capacity = *capacity ? *capacity * 2 : 16;
+
+	void* result = lusp_memory_allocate(size * new_capacity);
+	assert(result);
+
+	if (data)
+	{
+		memcpy(result, data, size * count);
+		lusp_memory_deallocate(data);
+	}
+
+	*capacity = new_capacity;
+
+	return result;
+}
+
+static void push_ready(struct lusp_loop_t* loop, struct lusp_loop_task_t* task, struct lusp_object_t result)
+{
+	task->wait = TASK_READY;
+	task->result = result;
+	task->next = 0;
+
+	if (loop->ready_tail) loop->ready_tail->next = task;
+	else loop->ready = task;
+
+	loop->ready_tail = task;
+}
+
+static void push_timer(struct lusp_loop_t* loop, struct lusp_loop_task_t* task)
+{
+	loop->timers = (struct lusp_loop_task_t**)grow(loop->timers, loop->timer_count, &loop->timer_capacity, sizeof(struct lusp_loop_task_t*));
+
+	struct lusp_loop_task_t** heap = loop->timers;
+	unsigned int index = loop->timer_count++;
+
+	// sift up
+	while (index > 0 && heap[(index - 1) / 2]->deadline > task->deadline)
+	{
+		heap[index] = heap[(index - 1) / 2];
+		index = (index - 1) / 2;
+	}
+
+	heap[index] = task;
+}
+
+static struct lusp_loop_task_t* pop_timer(struct lusp_loop_t* loop)
+{
+	struct lusp_loop_task_t** heap = loop->timers;
+	struct lusp_loop_task_t* result = heap[0];
+	struct lusp_loop_task_t* last = heap[--loop->timer_count];
+	unsigned int count = loop->timer_count;
+	unsigned int index = 0;
+
+	// sift down
+	for (;;)
+	{
+		unsigned int child = index * 2 + 1;
+		if (child >= count) break;
+
+		if (child + 1 < count && heap[child + 1]->deadline < heap[child]->deadline) child++;
+		if (last->deadline <= heap[child]->deadline) break;
+
+		heap[index] = heap[child];
+		index = child;
+	}
+
+	if (count > 0) heap[index] = last;
+
+	return result;
+}
+
+static void push_waiter(struct lusp_loop_t* loop, struct lusp_loop_task_t* task)
+{
+	loop->waiters = (struct lusp_loop_task_t**)grow(loop->waiters, loop->waiter_count, &loop->waiter_capacity, sizeof(struct lusp_loop_task_t*));
+	loop->waiters[loop->waiter_count++] = task;
+}
+
+static struct lusp_loop_task_t* create_task(struct lusp_object_t function, unsigned int stack_size)
+{
+	struct lusp_loop_task_t* task = (struct lusp_loop_task_t*)lusp_memory_allocate(sizeof(struct lusp_loop_task_t));
+	assert(task);
+
+	memset(task, 0, sizeof(struct lusp_loop_task_t));
+
+	task->coroutine = lusp_mkcoroutine(function, stack_size).coroutine;
+	task->wait = TASK_READY;
+	task->fd = -1;
+
+	return task;
+}
+
+static void run(struct lusp_loop_t* loop, struct lusp_loop_task_t* task, struct lusp_object_t* args, unsigned int count)
+{
+	// tasks can be started by other tasks
+	struct lusp_loop_task_t* parent = loop->current;
+	loop->current = task;
+
+	task->wait = TASK_READY;
+
+	lusp_coroutine_resume(loop->state, task->coroutine, args, count);
+
+	loop->current = parent;
+
+	if (task->coroutine->status == LUSP_COROUTINE_DEAD)
+	{
+		lusp_memory_deallocate(task);
+		loop->task_count--;
+		return;
+	}
+
+	switch (task->wait)
+	{
+	case TASK_READY:
+		// plain yield, other tasks run first
+		push_ready(loop, task, lusp_mknull());
+		break;
+
+	case TASK_SLEEP:
+		push_timer(loop, task);
+		break;
+
+	case TASK_READ:
+	case TASK_WRITE:
+		push_waiter(loop, task);
+		break;
+
+	case TASK_EXTERNAL:
+		// task is queued by lusp_loop_complete
+		break;
+	}
+}
+
+struct lusp_loop_t* lusp_loop_create(struct lusp_state_t* state, unsigned int stack_size)
+{
+	assert(!state->loop);
+
+	struct lusp_loop_t* loop = (struct lusp_loop_t*)lusp_memory_allocate(sizeof(struct lusp_loop_t));
+	assert(loop);
+
+	memset(loop, 0, sizeof(struct lusp_loop_t));
+
+	loop->state = state;
+	loop->stack_size = stack_size;
+
+#ifdef DL_WINDOWS
+	loop->wake = CreateEvent(0, FALSE, FALSE, 0);
+	assert(loop->wake);
+#else
+	int result = pipe(loop->wake);
+	assert(result == 0);
+	(void)result;
+
+	fcntl(loop->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(loop->wake[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	state->loop = loop;
+
+	return loop;
+}
+
+void lusp_loop_destroy(struct lusp_loop_t* loop)
+{
+	assert(loop->task_count == 0);
+
+	loop->state->loop = 0;
+
+#ifdef DL_WINDOWS
+	CloseHandle(loop->wake);
+#else
+	close(loop->wake[0]);
+	close(loop->wake[1]);
+
+	lusp_memory_deallocate(loop->pollfds);
+#endif
+
+	lusp_memory_deallocate(loop->timers);
+	lusp_memory_deallocate(loop->waiters);
+	lusp_memory_deallocate(loop);
+}
+
+void lusp_loop_spawn(struct lusp_loop_t* loop, struct lusp_object_t function, struct lusp_object_t* args, unsigned int count)
+{
+	struct lusp_loop_task_t* task = create_task(function, loop->stack_size);
+
+	loop->task_count++;
+
+	run(loop, task, args, count);
+}
+
+static struct lusp_loop_task_t* get_task(struct lusp_state_t* state)
+{
+	// returns 0 for code that doesn't run in a task of a loop
+	if (!state->loop || !state->loop->current || state->loop->current->coroutine != state->coroutine) return 0;
+
+	return state->loop->current;
+}
+
+struct lusp_loop_task_t* lusp_loop_suspend(struct lusp_state_t* state)
+{
+	// only the task coroutine itself can be suspended by the loop
+	struct lusp_loop_task_t* task = get_task(state);
+	if (!task) return 0;
+
+	struct lusp_loop_t* loop = state->loop;
+
+	task->wait = TASK_EXTERNAL;
+	loop->external_count++;
+
+	lusp_coroutine_yield(state);
+
+	return task;
+}
+
+void lusp_loop_complete(struct lusp_loop_t* loop, struct lusp_loop_task_t* task, struct lusp_object_t result)
+{
+	assert(task->wait == TASK_EXTERNAL);
+
+	task->result = result;
+
+	lusp_lock_acquire(&loop->lock);
+
+	task->next = loop->completed;
+	loop->completed = task;
+
+	lusp_lock_release(&loop->lock);
+
+#ifdef DL_WINDOWS
+	SetEvent(loop->wake);
+#else
+	// pipe may be full if the loop hasn't woken up yet, which is fine
+	char data = 0;
+	ssize_t written = write(loop->wake[1], &data, 1);
+	(void)written;
+#endif
+}
+
+static void collect_completed(struct lusp_loop_t* loop)
+{
+	lusp_lock_acquire(&loop->lock);
+
+	struct lusp_loop_task_t* completed = loop->completed;
+	loop->completed = 0;
+
+	lusp_lock_release(&loop->lock);
+
+	// completed list is in reverse order
+	struct lusp_loop_task_t* list = 0;
+
+	while (completed)
+	{
+		struct lusp_loop_task_t* next = completed->next;
+
+		completed->next = list;
+		list = completed;
+		completed = next;
+	}
+
+	while (list)
+	{
+		struct lusp_loop_task_t* next = list->next;
+
+		loop->external_count--;
+		push_ready(loop, list, list->result);
+
+		list = next;
+	}
+}
+
+static void collect_timers(struct lusp_loop_t* loop)
+{
+	uint64_t time = get_time();
+
+	while (loop->timer_count > 0 && loop->timers[0]->deadline <= time)
+		push_ready(loop, pop_timer(loop), lusp_mknull());
+}
+
+#ifndef DL_WINDOWS
+static bool perform_read(struct lusp_loop_task_t* task, struct lusp_object_t* result)
+{
+	char* buffer = (char*)lusp_memory_allocate(task->size);
+	assert(buffer);
+
+	ssize_t count = read(task->fd, buffer, task->size);
+
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	{
+		lusp_memory_deallocate(buffer);
+		return false;
+	}
+
+	// empty string is returned at end of file, null on error
+	*result = count >= 0 ? lusp_mkstring_n(buffer, (unsigned int)count) : lusp_mknull();
+
+	lusp_memory_deallocate(buffer);
+
+	return true;
+}
+
+static bool perform_write(struct lusp_loop_task_t* task, struct lusp_object_t* result)
+{
+	while (task->offset < task->data->length)
+	{
+		ssize_t count = write(task->fd, task->data->data + task->offset, task->data->length - task->offset);
+
+		if (count < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return false;
+
+			*result = lusp_mknull();
+			return true;
+		}
+
+		task->offset += (unsigned int)count;
+	}
+
+	*result = lusp_mkinteger(task->data->length);
+
+	return true;
+}
+
+static bool perform(struct lusp_loop_task_t* task, struct lusp_object_t* result)
+{
+	return task->wait == TASK_READ ? perform_read(task, result) : perform_write(task, result);
+}
+#endif
+
+static void wait_events(struct lusp_loop_t* loop, int timeout)
+{
+#ifdef DL_WINDOWS
+	assert(loop->waiter_count == 0);
+
+	WaitForSingleObject(loop->wake, timeout < 0 ? INFINITE : (DWORD)timeout);
+#else
+	unsigned int count = loop->waiter_count;
+
+	// pollfd array is rebuilt every time, slot 0 is the wake pipe
+	if (loop->pollfd_capacity < loop->waiter_capacity + 1)
+	{
+		lusp_memory_deallocate(loop->pollfds);
+
+		loop->pollfd_capacity = loop->waiter_capacity + 1;
+		loop->pollfds = (struct pollfd*)lusp_memory_allocate(sizeof(struct pollfd) * loop->pollfd_capacity);
+		assert(loop->pollfds);
+	}
+
+	struct pollfd* fds = loop->pollfds;
+
+	fds[0].fd = loop->wake[0];
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		fds[i + 1].fd = loop->waiters[i]->fd;
+		fds[i + 1].events = loop->waiters[i]->wait == TASK_READ ? POLLIN : POLLOUT;
+		fds[i + 1].revents = 0;
+	}
+
+	if (poll(fds, count + 1, timeout) <= 0) return;
+
+	if (fds[0].revents)
+	{
+		char buffer[64];
+		while (read(loop->wake[0], buffer, sizeof(buffer)) > 0)
+			;
+	}
+
+	// resume tasks with finished operations and keep the rest in order
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		struct lusp_loop_task_t* task = loop->waiters[i];
+		struct lusp_object_t result;
+
+		if (fds[i + 1].revents && perform(task, &result)) push_ready(loop, task, result);
+		else loop->waiters[kept++] = task;
+	}
+
+	loop->waiter_count = kept;
+#endif
+}
+
+void lusp_loop_run(struct lusp_loop_t* loop)
+{
+	while (loop->task_count > 0)
+	{
+		collect_completed(loop);
+		collect_timers(loop);
+
+		// run tasks that are ready now; tasks that become ready while running go to the next round
+		struct lusp_loop_task_t* ready = loop->ready;
+
+		loop->ready = 0;
+		loop->ready_tail = 0;
+
+		while (ready)
+		{
+			struct lusp_loop_task_t* next = ready->next;
+			struct lusp_object_t result = ready->result;
+
+			run(loop, ready, &result, 1);
+
+			ready = next;
+		}
+
+		if (loop->task_count == 0) break;
+
+		// every live task is either ready, sleeping, waiting for an fd or for the host
+		assert(loop->ready || loop->timer_count || loop->waiter_count || loop->external_count);
+
+		int timeout = -1;
+
+		if (loop->ready) timeout = 0;
+		else if (loop->timer_count)
+		{
+			uint64_t time = get_time();
+			uint64_t deadline = loop->timers[0]->deadline;
+
+			// far deadlines are approached in steps of the longest timeout poll accepts
+			timeout = deadline <= time ? 0 : deadline - time > INT_MAX ? INT_MAX : (int)(deadline - time);
+		}
+
+		wait_events(loop, timeout);
+	}
+}
+
+static struct lusp_object_t builtin_task(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	if (!state->loop || count < 1 || args[0].type != LUSP_OBJECT_CLOSURE) return lusp_mknull();
+
+	lusp_loop_spawn(state->loop, args[0], args + 1, count - 1);
+
+	return lusp_mknull();
+}
+
+static struct lusp_object_t builtin_sleep(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	struct lusp_loop_task_t* task = get_task(state);
+	if (!task) return lusp_mknull();
+
+	int64_t delay = (count > 0 && args[0].type == LUSP_OBJECT_INTEGER && args[0].integer > 0) ? args[0].integer : 0;
+	uint64_t time = get_time();
+
+	// zero delay lets other ready tasks run first; deadline saturates so that huge delays never wrap around
+	task->wait = delay > 0 ? TASK_SLEEP : TASK_READY;
+	task->deadline = (uint64_t)delay > UINT64_MAX - time ? UINT64_MAX : time + (uint64_t)delay;
+
+	lusp_coroutine_yield(state);
+
+	return lusp_mknull();
+}
+
+#ifndef DL_WINDOWS
+static struct lusp_object_t start_io(struct lusp_state_t* state, struct lusp_loop_task_t* task, enum task_wait_t wait, int fd)
+{
+	// fd has to be non-blocking, since the loop doesn't change fd flags that are shared with the host
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || !(flags & O_NONBLOCK)) return lusp_mknull();
+
+	// operations are attempted right away and only suspend the task if the fd is not ready
+	task->wait = wait;
+	task->fd = fd;
+
+	struct lusp_object_t result;
+
+	if (perform(task, &result))
+	{
+		task->wait = TASK_READY;
+		return result;
+	}
+
+	lusp_coroutine_yield(state);
+
+	return lusp_mknull();
+}
+
+static struct lusp_object_t builtin_read(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	struct lusp_loop_task_t* task = get_task(state);
+	if (!task || count < 1 || args[0].type != LUSP_OBJECT_INTEGER) return lusp_mknull();
+
+	// optional size limit
+	task->size = (count > 1 && args[1].type == LUSP_OBJECT_INTEGER && args[1].integer > 0) ? (unsigned int)args[1].integer : LOOP_READ_SIZE;
+
+	return start_io(state, task, TASK_READ, (int)args[0].integer);
+}
+
+static struct lusp_object_t builtin_write(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+
+	struct lusp_loop_task_t* task = get_task(state);
+	if (!task || count < 2 || args[0].type != LUSP_OBJECT_INTEGER || args[1].type != LUSP_OBJECT_STRING) return lusp_mknull();
+
+	task->data = args[1].string;
+	task->offset = 0;
+
+	return start_io(state, task, TASK_WRITE, (int)args[0].integer);
+}
+#endif
+
+static void put(struct lusp_environment_t* env, const char* name, lusp_function_t function)
+{
+	lusp_environment_put(env, lusp_mksymbol(name), lusp_mkfunction(function));
+}
+
+void lusp_loop_register(struct lusp_environment_t* env)
+{
+	put(env, "task", builtin_task);
+	put(env, "sleep", builtin_sleep);
+
+#ifndef DL_WINDOWS
+	put(env, "read", builtin_read);
+	put(env, "write", builtin_write);
+#endif
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "object.h"
+
+struct lusp_loop_t;
+struct lusp_loop_task_t;
+
+// reference event loop that runs script tasks on one state; every task is a coroutine that is suspended
+// while its host operation is outstanding, so one thread keeps many scripts in flight
+// timers and host completions are supported everywhere, fd operations use poll and are POSIX only
+// stack_size is the number of registers of every task, 0 selects LUSP_COROUTINE_STACK_SIZE
+struct lusp_loop_t* lusp_loop_create(struct lusp_state_t* state, unsigned int stack_size);
+void lusp_loop_destroy(struct lusp_loop_t* loop);
+
+// registers task, sleep, read and write functions; they can only be called from code that runs in a loop and return null
+// elsewhere; read and write require fds in non-blocking mode and return null for blocking fds
+void lusp_loop_register(struct lusp_environment_t* env);
+
+// starts function as a task; it runs until it first suspends, the loop resumes it later
+void lusp_loop_spawn(struct lusp_loop_t* loop, struct lusp_object_t function, struct lusp_object_t* args, unsigned int count);
+
+// runs until all tasks are finished
+void lusp_loop_run(struct lusp_loop_t* loop);
+
+// asynchronous host call: a native function called by task code suspends the task, the return value of the function is
+// discarded and the task is resumed with result once the host calls lusp_loop_complete, which is thread-safe
+// returns 0 without suspending if the native function is not called by task code
+struct lusp_loop_task_t* lusp_loop_suspend(struct lusp_state_t* state);
+
+void lusp_loop_complete(struct lusp_loop_t* loop, struct lusp_loop_task_t* task, struct lusp_object_t result);
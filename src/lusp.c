@@ -1,25 +1,25 @@
-#include "lusp.h"
-
-#include "eval.h"
-#include "memory.h"
-#include "object.h"
-
-bool lusp_init(struct mem_arena_t* arena, unsigned int heap_size)
-{
-	// initialize memory
-	if (!lusp_memory_init(arena, heap_size)) return false;
-
-	// initialize builtin objects
-	if (!lusp_object_init()) return false;
-
-	// disable JIT by default
-	lusp_jit_set(false);
-
-	return true;
-}
-
-void lusp_term()
-{
-	lusp_memory_term();
-	lusp_object_term();
-}
+#include "lusp.h"
+
+#include "compile.h"
+#include "memory.h"
+#include "object.h"
+#include "parallel.h"
+
+bool lusp_init(struct mem_arena_t* arena, unsigned int heap_size)
+{
+	// initialize memory
+	if (!lusp_memory_init(arena, heap_size)) return false;
+
+	// initialize builtin objects
+	if (!lusp_object_init()) return false;
+
+	return true;
+}
+
+void lusp_term()
+{
+	lusp_parallel_term();
+	lusp_compile_cache_clear();
+	lusp_memory_term();
+	lusp_object_term();
+}
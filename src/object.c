@@ -1,159 +1,350 @@
-#include "object.h"
-
-#include "bytecode.h"
-#include "memory.h"
-
-#include <assert.h>
-#include <string.h>
-
-static struct lusp_symbol_t* g_lusp_symbols[1024];
-
-static inline const char* mkstring(const char* value)
-{
-	size_t length = strlen(value);
-
-	char* result = (char*)lusp_memory_allocate(length + 1);
-	assert(result);
-
-	strcpy(result, value);
-
-	return result;
-}
-
-static uint32_t hash_string(const char* string)
-{
-	// Jenkins one-at-a-time hash
-	// reference: http://en.wikipedia.org/wiki/Jenkins_hash_function#one-at-a-time
-	uint32_t result = 0;
-
-	while (*string)
-	{
-		result += *string;
-		result += result << 10;
-		result ^= result >> 6;
-	}
-
-	result += result << 3;
-	result ^= result >> 11;
-	result += result << 15;
-
-	return result;
-}
-
-bool lusp_object_init()
-{
-	// intialize symbol hash table
-	memset(g_lusp_symbols, 0, sizeof(g_lusp_symbols));
-
-	return true;
-}
-
-void lusp_object_term()
-{
-}
-
-struct lusp_object_t lusp_mknull()
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_NULL;
-	return result;
-}
-
-struct lusp_object_t lusp_mksymbol(const char* name)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_SYMBOL;
-
-	// compute hash
-	const unsigned int hash_mask = sizeof(g_lusp_symbols) / sizeof(g_lusp_symbols[0]) - 1;
-	unsigned int hash = hash_string(name) & hash_mask;
-
-	// table lookup
-	for (struct lusp_symbol_t* symbol = g_lusp_symbols[hash]; symbol; symbol = symbol->next)
-		if (strcmp(name, symbol->name) == 0)
-		{
-			result.symbol = symbol;
-			return result;
-		}
-
-	// construct new symbol
-	struct lusp_symbol_t* symbol = (struct lusp_symbol_t*)lusp_memory_allocate(sizeof(struct lusp_symbol_t));
-	symbol->name = mkstring(name);
-
-	// insert symbol into hash table
-	symbol->next = g_lusp_symbols[hash];
-	g_lusp_symbols[hash] = symbol;
-
-	result.symbol = symbol;
-	return result;
-}
-
-struct lusp_object_t lusp_mkboolean(bool value)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_BOOLEAN;
-	result.boolean = value;
-	return result;
-}
-
-struct lusp_object_t lusp_mkinteger(int value)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_INTEGER;
-	result.integer = value;
-	return result;
-}
-
-struct lusp_object_t lusp_mkreal(float value)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_REAL;
-	result.real = value;
-	return result;
-}
-
-struct lusp_object_t lusp_mkstring(const char* value)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_STRING;
-	result.string = mkstring(value);
-	return result;
-}
-
-struct lusp_object_t lusp_mkcons(struct lusp_object_t car, struct lusp_object_t cdr)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_CONS;
-	result.cons = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * 2);
-	result.cons[0] = car;
-	result.cons[1] = cdr;
-	return result;
-}
-
-struct lusp_object_t lusp_mkclosure(struct lusp_vm_bytecode_t* code, unsigned int upval_count)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_CLOSURE;
-
-	result.closure = (struct lusp_vm_closure_t*)lusp_memory_allocate(sizeof(struct lusp_vm_closure_t) - sizeof(struct lusp_vm_upval_t*) + sizeof(struct lusp_vm_upval_t*) * upval_count);
-	assert(result.closure);
-
-	result.closure->code = code;
-	return result;
-}
-
-struct lusp_object_t lusp_mkfunction(lusp_function_t code)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_FUNCTION;
-	result.function = code;
-	return result;
-}
-
-struct lusp_object_t lusp_mkobject(void* object)
-{
-	struct lusp_object_t result;
-	result.type = LUSP_OBJECT_OBJECT;
-	result.object = object;
-	return result;
-}
+#include "object.h"
+
+#include "bytecode.h"
+#include "memory.h"
+#include "symbol.h"
+#include "table.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <string.h>
+
+static inline uint32_t rotl32(uint32_t value, int shift)
+{
+	return (value << shift) | (value >> (32 - shift));
+}
+
+uint32_t lusp_hash_string(const char* data, unsigned int length)
+{
+	// MurmurHash3 x86_32, processes 4 bytes at a time
+	// reference: https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+
+	uint32_t result = 0;
+	unsigned int i = 0;
+
+	for (; i + 4 <= length; i += 4)
+	{
+		uint32_t k;
+		memcpy(&k, data + i, sizeof(k));
+
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+
+		result ^= k;
+		result = rotl32(result, 13);
+		result = result * 5 + 0xe6546b64;
+	}
+
+	// tail
+	uint32_t k = 0;
+
+	unsigned int tail = length & 3;
+
+	if (tail >= 3) k ^= (uint32_t)(unsigned char)data[i + 2] << 16;
+	if (tail >= 2) k ^= (uint32_t)(unsigned char)data[i + 1] << 8;
+
+	if (tail >= 1)
+	{
+		k ^= (uint32_t)(unsigned char)data[i];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		result ^= k;
+	}
+
+	// finalization
+	result ^= length;
+	result ^= result >> 16;
+	result *= 0x85ebca6b;
+	result ^= result >> 13;
+	result *= 0xc2b2ae35;
+	result ^= result >> 16;
+
+	return result;
+}
+
+bool lusp_object_init()
+{
+	// intialize symbol table
+	return lusp_symbol_init();
+}
+
+void lusp_object_term()
+{
+	lusp_symbol_term();
+}
+
+struct lusp_object_t lusp_mknull()
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_NULL;
+	return result;
+}
+
+struct lusp_object_t lusp_mksymbol(const char* name)
+{
+	return lusp_mksymbol_n(name, (unsigned int)strlen(name));
+}
+
+struct lusp_object_t lusp_mksymbol_n(const char* name, unsigned int length)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_SYMBOL;
+	result.symbol = lusp_symbol_intern(name, length);
+	return result;
+}
+
+struct lusp_object_t lusp_mkboolean(bool value)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_BOOLEAN;
+	result.boolean = value;
+	return result;
+}
+
+struct lusp_object_t lusp_mkinteger(int64_t value)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_INTEGER;
+	result.integer = value;
+	return result;
+}
+
+struct lusp_object_t lusp_mkreal(double value)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_REAL;
+	result.real = value;
+	return result;
+}
+
+struct lusp_object_t lusp_mkstring(const char* value)
+{
+	return lusp_mkstring_n(value, (unsigned int)strlen(value));
+}
+
+struct lusp_object_t lusp_mkstring_n(const char* data, unsigned int length)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_STRING;
+
+	// header and characters share one allocation; storage[1] accounts for terminator
+	result.string = (struct lusp_string_t*)lusp_memory_allocate(sizeof(struct lusp_string_t) + length);
+	assert(result.string);
+
+	result.string->data = result.string->storage;
+	result.string->length = length;
+	result.string->hash = 0;
+
+	// null data leaves characters uninitialized for the caller to fill
+	if (data) memcpy(result.string->storage, data, length);
+	result.string->storage[length] = 0;
+
+	return result;
+}
+
+struct lusp_object_t lusp_mkstring_view(struct lusp_string_t* string, unsigned int offset, unsigned int length)
+{
+	assert(offset <= string->length && length <= string->length - offset);
+
+	// short substrings are copied, the view header would not be smaller
+	if (length < sizeof(void*) * 2) return lusp_mkstring_n(string->data + offset, length);
+
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_STRING;
+
+	result.string = (struct lusp_string_t*)lusp_memory_allocate(sizeof(struct lusp_string_t));
+	assert(result.string);
+
+	result.string->data = string->data + offset;
+	result.string->length = length;
+	result.string->hash = 0;
+
+	return result;
+}
+
+struct lusp_object_t lusp_mkbuilder()
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_BUILDER;
+
+	result.builder = (struct lusp_builder_t*)lusp_memory_allocate(sizeof(struct lusp_builder_t));
+	assert(result.builder);
+
+	result.builder->pieces = 0;
+	result.builder->piece_count = 0;
+	result.builder->piece_capacity = 0;
+	result.builder->length = 0;
+
+	return result;
+}
+
+struct lusp_object_t lusp_mkcons(struct lusp_object_t car, struct lusp_object_t cdr)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_CONS;
+	result.cons = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * 2);
+	result.cons[0] = car;
+	result.cons[1] = cdr;
+	return result;
+}
+
+struct lusp_object_t lusp_mkvector(unsigned int capacity)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_VECTOR;
+
+	result.vector = (struct lusp_vector_t*)lusp_memory_allocate(sizeof(struct lusp_vector_t));
+	assert(result.vector);
+
+	result.vector->data = capacity ? (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * capacity) : 0;
+	result.vector->length = 0;
+	result.vector->capacity = capacity;
+
+	assert(result.vector->data || capacity == 0);
+
+	return result;
+}
+
+struct lusp_object_t lusp_mktable(unsigned int capacity)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_TABLE;
+	result.table = lusp_table_create(capacity);
+	return result;
+}
+
+struct lusp_object_t lusp_mkclosure(struct lusp_vm_bytecode_t* code, struct lusp_vm_globals_t* globals, unsigned int upval_count)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_CLOSURE;
+
+	result.closure = (struct lusp_vm_closure_t*)lusp_memory_allocate(sizeof(struct lusp_vm_closure_t) - sizeof(struct lusp_vm_upval_t*) + sizeof(struct lusp_vm_upval_t*) * upval_count);
+	assert(result.closure);
+
+	result.closure->code = code;
+	result.closure->globals = globals;
+	return result;
+}
+
+struct lusp_object_t lusp_mkfunction(lusp_function_t code)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_FUNCTION;
+	result.function = code;
+	return result;
+}
+
+struct lusp_object_t lusp_mkobject(void* object)
+{
+	struct lusp_object_t result;
+	result.type = LUSP_OBJECT_OBJECT;
+	result.object = object;
+	return result;
+}
+
+void lusp_vector_push(struct lusp_vector_t* vector, struct lusp_object_t object)
+{
+	if (vector->length == vector->capacity)
+	{
+		// grow storage geometrically so that push is amortized O(1)
+		unsigned int capacity = vector->capacity ? vector->capacity * 2 : 4;
+
+		struct lusp_object_t* data = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * capacity);
+		assert(data);
+
+		if (vector->data)
+		{
+			memcpy(data, vector->data, sizeof(struct lusp_object_t) * vector->length);
+			lusp_memory_deallocate(vector->data);
+		}
+
+		vector->data = data;
+		vector->capacity = capacity;
+	}
+
+	vector->data[vector->length++] = object;
+}
+
+uint32_t lusp_string_hash(struct lusp_string_t* string)
+{
+	// threads that share a string may compute the hash concurrently, they store the same value
+	uint32_t cached = lusp_atomic_load_relaxed_u32(&string->hash);
+	if (cached != 0) return cached;
+
+	// strings in read-only images have precomputed hashes; a zero hash is never stored so those are not written to
+	uint32_t hash = lusp_hash_string(string->data, string->length);
+	if (hash != 0) lusp_atomic_store_relaxed_u32(&string->hash, hash);
+
+	return hash;
+}
+
+int lusp_string_compare(struct lusp_string_t* left, struct lusp_string_t* right)
+{
+	unsigned int length = left->length < right->length ? left->length : right->length;
+
+	int result = memcmp(left->data, right->data, length);
+	if (result != 0) return result < 0 ? -1 : 1;
+
+	return left->length == right->length ? 0 : left->length < right->length ? -1 : 1;
+}
+
+void lusp_builder_append(struct lusp_builder_t* builder, struct lusp_string_t* string)
+{
+	if (string->length == 0) return;
+
+	if (builder->piece_count == builder->piece_capacity)
+	{
+		// grow piece array geometrically so that append is amortized O(1)
+		unsigned int capacity = builder->piece_capacity ? builder->piece_capacity * 2 : 8;
+
+		struct lusp_string_t** pieces = (struct lusp_string_t**)lusp_memory_allocate(sizeof(struct lusp_string_t*) * capacity);
+		assert(pieces);
+
+		if (builder->pieces)
+		{
+			memcpy(pieces, builder->pieces, sizeof(struct lusp_string_t*) * builder->piece_count);
+			lusp_memory_deallocate(builder->pieces);
+		}
+
+		builder->pieces = pieces;
+		builder->piece_capacity = capacity;
+	}
+
+	// strings are immutable, so pieces can be referenced instead of copied
+	builder->pieces[builder->piece_count++] = string;
+	builder->length += string->length;
+}
+
+struct lusp_object_t lusp_builder_flatten(struct lusp_builder_t* builder)
+{
+	// single piece needs no copying
+	if (builder->piece_count == 1)
+	{
+		struct lusp_object_t result;
+		result.type = LUSP_OBJECT_STRING;
+		result.string = builder->pieces[0];
+		return result;
+	}
+
+	struct lusp_object_t result = lusp_mkstring_n(0, builder->length);
+	char* data = result.string->storage;
+
+	for (unsigned int i = 0; i < builder->piece_count; ++i)
+	{
+		memcpy(data, builder->pieces[i]->data, builder->pieces[i]->length);
+		data += builder->pieces[i]->length;
+	}
+
+	// keep flattened string as the only piece so that repeated flattening is free
+	if (builder->piece_count > 0)
+	{
+		builder->pieces[0] = result.string;
+		builder->piece_count = 1;
+	}
+
+	return result;
+}
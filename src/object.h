@@ -1,62 +1,129 @@
-#pragma once
-
-#include <stdbool.h>
-
-struct lusp_vm_bytecode_t;
-struct lusp_vm_closure_t;
-struct lusp_environment_t;
-
-enum lusp_object_type_t
-{
-	LUSP_OBJECT_NULL,
-	LUSP_OBJECT_SYMBOL,
-	LUSP_OBJECT_BOOLEAN,
-	LUSP_OBJECT_INTEGER,
-	LUSP_OBJECT_REAL,
-	LUSP_OBJECT_STRING,
-	LUSP_OBJECT_CONS,
-	LUSP_OBJECT_CLOSURE,
-	LUSP_OBJECT_FUNCTION,
-	LUSP_OBJECT_OBJECT,
-	LUSP_OBJECT_CALL_FRAME,
-};
-
-struct lusp_symbol_t
-{
-	const char* name;
-	struct lusp_symbol_t* next;
-};
-
-struct lusp_object_t
-{
-	enum lusp_object_type_t type;
-
-	union {
-		struct lusp_symbol_t* symbol;
-		bool boolean;
-		int integer;
-		float real;
-		const char* string;
-		struct lusp_object_t* cons;
-		struct lusp_vm_closure_t* closure;
-		void* function;
-		void* object;
-		char call_frame[1];
-	};
-};
-
-typedef struct lusp_object_t (*lusp_function_t)(struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count);
-
-bool lusp_object_init();
-void lusp_object_term();
-
-struct lusp_object_t lusp_mknull();
-struct lusp_object_t lusp_mksymbol(const char* name);
-struct lusp_object_t lusp_mkboolean(bool value);
-struct lusp_object_t lusp_mkinteger(int value);
-struct lusp_object_t lusp_mkreal(float value);
-struct lusp_object_t lusp_mkstring(const char* value);
-struct lusp_object_t lusp_mkcons(struct lusp_object_t car, struct lusp_object_t cdr);
-struct lusp_object_t lusp_mkclosure(struct lusp_vm_bytecode_t* code, unsigned int upval_count);
-struct lusp_object_t lusp_mkfunction(lusp_function_t code);
-struct lusp_object_t lusp_mkobject(void* object);
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct lusp_vm_bytecode_t;
+struct lusp_vm_closure_t;
+struct lusp_vm_globals_t;
+struct lusp_coroutine_t;
+struct lusp_environment_t;
+struct lusp_bignum_t;
+struct lusp_object_t;
+struct lusp_table_t;
+struct lusp_state_t;
+
+enum lusp_object_type_t
+{
+	LUSP_OBJECT_NULL,
+	LUSP_OBJECT_SYMBOL,
+	LUSP_OBJECT_BOOLEAN,
+	LUSP_OBJECT_INTEGER,
+	LUSP_OBJECT_REAL,
+	LUSP_OBJECT_BIGNUM,
+	LUSP_OBJECT_STRING,
+	LUSP_OBJECT_BUILDER,
+	LUSP_OBJECT_CONS,
+	LUSP_OBJECT_VECTOR,
+	LUSP_OBJECT_TABLE,
+	LUSP_OBJECT_CLOSURE,
+	LUSP_OBJECT_FUNCTION,
+	LUSP_OBJECT_COROUTINE,
+	LUSP_OBJECT_OBJECT,
+	LUSP_OBJECT_CALL_FRAME,
+};
+
+struct lusp_symbol_t
+{
+	const char* name;
+	unsigned int length;
+	uint32_t hash;
+};
+
+// immutable string; characters are stored inline after the header and are null-terminated,
+// except for views which reference a range of characters of another string
+struct lusp_string_t
+{
+	const char* data;
+	unsigned int length;
+
+	// cached hash, 0 if not computed yet
+	uint32_t hash;
+
+	char storage[1];
+};
+
+// string builder; appended strings are referenced as pieces and copied once when flattened
+struct lusp_builder_t
+{
+	struct lusp_string_t** pieces;
+	unsigned int piece_count;
+	unsigned int piece_capacity;
+
+	// total length of all pieces
+	unsigned int length;
+};
+
+// elements are stored contiguously; storage grows geometrically on push
+struct lusp_vector_t
+{
+	struct lusp_object_t* data;
+	unsigned int length;
+	unsigned int capacity;
+};
+
+struct lusp_object_t
+{
+	enum lusp_object_type_t type;
+
+	union {
+		struct lusp_symbol_t* symbol;
+		bool boolean;
+		int64_t integer;
+		double real;
+		struct lusp_bignum_t* bignum;
+		struct lusp_string_t* string;
+		struct lusp_builder_t* builder;
+		struct lusp_object_t* cons;
+		struct lusp_vector_t* vector;
+		struct lusp_table_t* table;
+		struct lusp_vm_closure_t* closure;
+		struct lusp_coroutine_t* coroutine;
+		void* function;
+		void* object;
+		char call_frame[1];
+	};
+};
+
+// native function; state and env are those of the calling code
+typedef struct lusp_object_t (*lusp_function_t)(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count);
+
+bool lusp_object_init();
+void lusp_object_term();
+
+struct lusp_object_t lusp_mknull();
+struct lusp_object_t lusp_mksymbol(const char* name);
+struct lusp_object_t lusp_mksymbol_n(const char* name, unsigned int length);
+struct lusp_object_t lusp_mkboolean(bool value);
+struct lusp_object_t lusp_mkinteger(int64_t value);
+struct lusp_object_t lusp_mkreal(double value);
+struct lusp_object_t lusp_mkstring(const char* value);
+struct lusp_object_t lusp_mkstring_n(const char* data, unsigned int length);
+struct lusp_object_t lusp_mkstring_view(struct lusp_string_t* string, unsigned int offset, unsigned int length);
+struct lusp_object_t lusp_mkbuilder();
+struct lusp_object_t lusp_mkcons(struct lusp_object_t car, struct lusp_object_t cdr);
+struct lusp_object_t lusp_mkvector(unsigned int capacity);
+struct lusp_object_t lusp_mktable(unsigned int capacity);
+struct lusp_object_t lusp_mkclosure(struct lusp_vm_bytecode_t* code, struct lusp_vm_globals_t* globals, unsigned int upval_count);
+struct lusp_object_t lusp_mkfunction(lusp_function_t code);
+struct lusp_object_t lusp_mkobject(void* object);
+
+uint32_t lusp_hash_string(const char* data, unsigned int length);
+
+uint32_t lusp_string_hash(struct lusp_string_t* string);
+int lusp_string_compare(struct lusp_string_t* left, struct lusp_string_t* right);
+
+void lusp_builder_append(struct lusp_builder_t* builder, struct lusp_string_t* string);
+struct lusp_object_t lusp_builder_flatten(struct lusp_builder_t* builder);
+
+void lusp_vector_push(struct lusp_vector_t* vector, struct lusp_object_t object);
@@ -0,0 +1,299 @@
+#include "parallel.h"
+
+#include "eval.h"
+#include "memory.h"
+#include "state.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// every participant owns a part of the loop range; the owner takes chunks from the front, thieves take the back half
+struct worker_t
+{
+	struct lusp_lock_t lock;
+	unsigned int begin;
+	unsigned int end;
+
+	struct lusp_state_t* state;
+	struct lusp_thread_t* thread;
+};
+
+struct pool_t
+{
+	// worker 0 is the thread that runs the loop, the rest are pool threads
+	struct worker_t* workers;
+	unsigned int worker_count;
+
+	// thread count the pool was started with
+	unsigned int thread_count;
+
+	struct lusp_semaphore_t* wake;
+	bool stop;
+
+	// current loop
+	lusp_parallel_function_t function;
+	void* context;
+	unsigned int grain;
+
+	// signaled by pool threads that are done with the current loop
+	struct lusp_semaphore_t* done;
+
+	// calls the current loop has left; all participants take calls from it when theirs run out
+	volatile int64_t budget;
+};
+
+static struct pool_t g_pool;
+
+// held while the pool runs a loop or is reconfigured
+static struct lusp_lock_t g_lock;
+
+// requested thread count; it has its own lock, so that loop functions can change it while the pool is busy
+static unsigned int g_thread_count;
+static struct lusp_lock_t g_thread_count_lock;
+
+// chunks on pool threads continue the evaluation that runs the loop: they share its budget and depth, so that nested
+// evaluations don't refill the budget and an aborted chunk keeps the status until the loop reports it
+static void enter(struct lusp_state_t* worker, struct lusp_state_t* state)
+{
+	worker->budget = state->budget;
+	worker->budget_left = 0;
+	worker->budget_shared = &g_pool.budget;
+	worker->depth = state->depth;
+}
+
+static void leave(struct lusp_state_t* worker, struct lusp_state_t* state)
+{
+	// unused calls go back to the loop, and all calls count against the budget of the caller
+	g_pool.budget += worker->budget_left;
+
+	worker->budget_left = 0;
+	worker->budget_shared = 0;
+
+	if (worker->status != LUSP_EVAL_OK) lusp_eval_abort(state, worker->status);
+
+	worker->depth = 0;
+	worker->status = LUSP_EVAL_OK;
+}
+
+static bool take(struct worker_t* worker, unsigned int grain, unsigned int* begin, unsigned int* end)
+{
+	lusp_lock_acquire(&worker->lock);
+
+	bool result = worker->begin < worker->end;
+
+	if (result)
+	{
+		*begin = worker->begin;
+		*end = worker->end - worker->begin > grain ? worker->begin + grain : worker->end;
+
+		worker->begin = *end;
+	}
+
+	lusp_lock_release(&worker->lock);
+
+	return result;
+}
+
+static bool steal(struct worker_t* worker, struct worker_t* victim)
+{
+	lusp_lock_acquire(&victim->lock);
+
+	unsigned int begin = victim->end - (victim->end - victim->begin + 1) / 2;
+	unsigned int end = victim->end;
+
+	victim->end = begin;
+
+	lusp_lock_release(&victim->lock);
+
+	if (begin == end) return false;
+
+	// own range is empty, so only thieves could have looked at it since
+	lusp_lock_acquire(&worker->lock);
+
+	worker->begin = begin;
+	worker->end = end;
+
+	lusp_lock_release(&worker->lock);
+
+	return true;
+}
+
+static void run(struct worker_t* worker)
+{
+	unsigned int index = (unsigned int)(worker - g_pool.workers);
+	unsigned int begin, end;
+
+	for (;;)
+	{
+		while (take(worker, g_pool.grain, &begin, &end)) g_pool.function(worker->state, g_pool.context, begin, end);
+
+		// look for work, starting from the next worker; the loop is complete for this worker when all ranges are empty
+		bool stolen = false;
+
+		for (unsigned int i = 1; i < g_pool.worker_count && !stolen; ++i)
+			stolen = steal(worker, &g_pool.workers[(index + i) % g_pool.worker_count]);
+
+		if (!stolen) break;
+	}
+}
+
+static void worker_main(void* context)
+{
+	struct worker_t* worker = (struct worker_t*)context;
+
+	for (;;)
+	{
+		lusp_semaphore_wait(g_pool.wake);
+
+		if (g_pool.stop) break;
+
+		run(worker);
+
+		lusp_semaphore_signal(g_pool.done, 1);
+	}
+}
+
+static void start_pool(unsigned int requested)
+{
+	unsigned int thread_count = requested ? requested : lusp_thread_get_processor_count() - 1;
+
+	g_pool.workers = (struct worker_t*)lusp_memory_allocate(sizeof(struct worker_t) * (thread_count + 1));
+	assert(g_pool.workers);
+
+	memset(g_pool.workers, 0, sizeof(struct worker_t) * (thread_count + 1));
+
+	g_pool.worker_count = 1;
+	g_pool.thread_count = requested;
+	g_pool.wake = lusp_semaphore_create();
+	g_pool.done = lusp_semaphore_create();
+	g_pool.stop = false;
+
+	for (unsigned int i = 1; i <= thread_count; ++i)
+	{
+		struct worker_t* worker = &g_pool.workers[i];
+
+		worker->state = lusp_state_create(0);
+		worker->thread = lusp_thread_create(worker_main, worker);
+
+		// pool runs with fewer threads if some could not be created
+		if (!worker->thread)
+		{
+			lusp_state_destroy(worker->state);
+			break;
+		}
+
+		g_pool.worker_count++;
+	}
+}
+
+static void stop_pool()
+{
+	g_pool.stop = true;
+
+	lusp_semaphore_signal(g_pool.wake, g_pool.worker_count - 1);
+
+	for (unsigned int i = 1; i < g_pool.worker_count; ++i)
+	{
+		lusp_thread_join(g_pool.workers[i].thread);
+		lusp_state_destroy(g_pool.workers[i].state);
+	}
+
+	lusp_semaphore_destroy(g_pool.wake);
+	lusp_semaphore_destroy(g_pool.done);
+	lusp_memory_deallocate(g_pool.workers);
+
+	memset(&g_pool, 0, sizeof(g_pool));
+}
+
+void lusp_parallel_for(struct lusp_state_t* state, unsigned int count, unsigned int grain, lusp_parallel_function_t function, void* context)
+{
+	if (grain == 0) grain = 1;
+
+	// small loops and loops that can't use the pool run on the calling thread
+	if (count <= grain || !lusp_lock_try_acquire(&g_lock))
+	{
+		for (unsigned int begin = 0; begin < count; begin += grain)
+			function(state, context, begin, count - begin > grain ? begin + grain : count);
+
+		return;
+	}
+
+	lusp_lock_acquire(&g_thread_count_lock);
+	unsigned int thread_count = g_thread_count;
+	lusp_lock_release(&g_thread_count_lock);
+
+	// thread count changes take effect here, since the pool can't be stopped while it runs a loop
+	if (g_pool.workers && g_pool.thread_count != thread_count) stop_pool();
+	if (!g_pool.workers) start_pool(thread_count);
+
+	// wake at most one thread per chunk
+	unsigned int chunk_count = count / grain + (count % grain != 0);
+	unsigned int active = g_pool.worker_count < chunk_count ? g_pool.worker_count : chunk_count;
+
+	// the loop takes over the remaining budget, so that it can't make more calls than the caller has left no matter which
+	// threads run the chunks
+	g_pool.budget = state->budget_left;
+
+	state->budget_left = 0;
+	state->budget_shared = &g_pool.budget;
+
+	// split range evenly between active workers
+	for (unsigned int i = 0; i < g_pool.worker_count; ++i)
+	{
+		struct worker_t* worker = &g_pool.workers[i];
+
+		lusp_lock_acquire(&worker->lock);
+
+		worker->begin = i < active ? (unsigned int)((uint64_t)count * i / active) : 0;
+		worker->end = i < active ? (unsigned int)((uint64_t)count * (i + 1) / active) : 0;
+
+		lusp_lock_release(&worker->lock);
+
+		// pool threads use the same evaluator as the calling thread
+		if (i > 0)
+		{
+			lusp_jit_set(worker->state, lusp_jit_get(state));
+
+			if (i < active) enter(worker->state, state);
+		}
+	}
+
+	g_pool.workers[0].state = state;
+	g_pool.function = function;
+	g_pool.context = context;
+	g_pool.grain = grain;
+
+	lusp_semaphore_signal(g_pool.wake, active - 1);
+
+	run(&g_pool.workers[0]);
+
+	// loop state may be reused once all woken threads are done with it
+	for (unsigned int i = 1; i < active; ++i) lusp_semaphore_wait(g_pool.done);
+
+	for (unsigned int i = 1; i < active; ++i) leave(g_pool.workers[i].state, state);
+
+	state->budget_left += g_pool.budget;
+	state->budget_shared = 0;
+
+	lusp_lock_release(&g_lock);
+}
+
+void lusp_parallel_set_thread_count(unsigned int count)
+{
+	lusp_lock_acquire(&g_thread_count_lock);
+
+	g_thread_count = count;
+
+	lusp_lock_release(&g_thread_count_lock);
+}
+
+void lusp_parallel_term()
+{
+	lusp_lock_acquire(&g_lock);
+
+	if (g_pool.workers) stop_pool();
+
+	lusp_lock_release(&g_lock);
+}
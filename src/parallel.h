@@ -0,0 +1,26 @@
+#pragma once
+
+struct lusp_state_t;
+
+// processes items [begin, end) on the state of the thread that runs the chunk
+typedef void (*lusp_parallel_function_t)(struct lusp_state_t* state, void* context, unsigned int begin, unsigned int end);
+
+// runs function over items [0, count) in chunks of at most grain items on the calling thread and pool threads; every
+// thread owns a part of the range and threads that run out of work steal half of the remaining part of another thread
+// returns when all items are processed; loops started while the pool is busy (nested loops or loops on other threads)
+// run on the calling thread
+// chunks run concurrently on separate states and share the object heap; allocation, symbol interning, global lookup,
+// jit compilation and the caches objects fill on first use (string hashes, type feedback) are thread-safe, and objects
+// created by function are visible to the caller when the loop returns
+// objects are not locked otherwise: chunks may read objects that other chunks access, but may only modify objects that
+// they created themselves; this includes stores to globals and upvalues (see lusp_register_builtins for builtins)
+// chunks are part of the evaluation that runs on state: their calls count against its budget (all threads draw from the
+// budget that is left when the loop starts) and evaluations aborted on pool threads abort it when the loop returns
+void lusp_parallel_for(struct lusp_state_t* state, unsigned int count, unsigned int grain, lusp_parallel_function_t function, void* context);
+
+// sets the number of pool threads (0 uses one per processor, not counting the calling thread); takes effect when the
+// next loop starts on the pool, so it can be called at any time, including from loop functions
+void lusp_parallel_set_thread_count(unsigned int count);
+
+// stops pool threads and releases their states; must not be called from loop functions
+void lusp_parallel_term();
@@ -0,0 +1,581 @@
+#include "serialize.h"
+
+#include "bytecode.h"
+#include "memory.h"
+#include "object.h"
+#include "symbol.h"
+
+#include <assert.h>
+#include <string.h>
+
+// file layout, all integers are little-endian:
+// header: magic, version, proto count, constant count, global count
+// constants: type (u8) followed by value; strings and symbols are length-prefixed
+// globals: length-prefixed symbol names
+// protos: register count, upvalue count, parameter count, op count, followed by 8-byte ops
+// ops: opcode (u8), unused (u8), register (u16), operand (u32); pointer operands are replaced with table indices
+#define SERIALIZE_MAGIC 0x5053554c // LUSP
+#define SERIALIZE_VERSION 1
+
+struct writer_t
+{
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+};
+
+struct reader_t
+{
+	const uint8_t* data;
+	size_t size;
+	size_t offset;
+	bool error;
+};
+
+struct save_context_t
+{
+	struct lusp_vm_bytecode_t** protos;
+	unsigned int proto_count;
+
+	struct lusp_object_t** constants;
+	unsigned int constant_count;
+};
+
+static void write_bytes(struct writer_t* writer, const void* data, size_t size)
+{
+	if (writer->size + size > writer->capacity)
+	{
+		size_t capacity = writer->capacity ? writer->capacity * 2 : 1024;
+		while (capacity < writer->size + size) capacity *= 2;
+
+		uint8_t* buffer = (uint8_t*)lusp_memory_allocate(capacity);
+		assert(buffer);
+
+		if (writer->data)
+		{
+			memcpy(buffer, writer->data, writer->size);
+			lusp_memory_deallocate(writer->data);
+		}
+
+		writer->data = buffer;
+		writer->capacity = capacity;
+	}
+
+	memcpy(writer->data + writer->size, data, size);
+	writer->size += size;
+}
+
+static void write_u8(struct writer_t* writer, uint8_t value)
+{
+	write_bytes(writer, &value, 1);
+}
+
+static void write_u16(struct writer_t* writer, uint16_t value)
+{
+	uint8_t data[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+
+	write_bytes(writer, data, sizeof(data));
+}
+
+static void write_u32(struct writer_t* writer, uint32_t value)
+{
+	uint8_t data[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+
+	write_bytes(writer, data, sizeof(data));
+}
+
+static void write_u64(struct writer_t* writer, uint64_t value)
+{
+	write_u32(writer, (uint32_t)value);
+	write_u32(writer, (uint32_t)(value >> 32));
+}
+
+static void write_name(struct writer_t* writer, const char* data, unsigned int length)
+{
+	write_u32(writer, length);
+	write_bytes(writer, data, length);
+}
+
+static const uint8_t* read_bytes(struct reader_t* reader, size_t size)
+{
+	if (reader->error || reader->size - reader->offset < size)
+	{
+		reader->error = true;
+		return 0;
+	}
+
+	const uint8_t* result = reader->data + reader->offset;
+	reader->offset += size;
+
+	return result;
+}
+
+static uint8_t read_u8(struct reader_t* reader)
+{
+	const uint8_t* data = read_bytes(reader, 1);
+
+	return data ? data[0] : 0;
+}
+
+static uint16_t read_u16(struct reader_t* reader)
+{
+	const uint8_t* data = read_bytes(reader, 2);
+
+	return data ? (uint16_t)(data[0] | (data[1] << 8)) : 0;
+}
+
+static uint32_t read_u32(struct reader_t* reader)
+{
+	const uint8_t* data = read_bytes(reader, 4);
+
+	return data ? (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24) : 0;
+}
+
+static uint64_t read_u64(struct reader_t* reader)
+{
+	uint64_t low = read_u32(reader);
+	uint64_t high = read_u32(reader);
+
+	return low | (high << 32);
+}
+
+static unsigned int add_pointer(void*** array, unsigned int* count, void* pointer, bool unique)
+{
+	// look for existing entry
+	if (unique)
+		for (unsigned int i = 0; i < *count; ++i)
+			if ((*array)[i] == pointer)
+				return i;
+
+	// grow when count reaches a power of two
+	if ((*count & (*count - 1)) == 0)
+	{
+		void** data = (void**)lusp_memory_allocate(sizeof(void*) * (*count ? *count * 2 : 1));
+		assert(data);
+
+		if (*array)
+		{
+			memcpy(data, *array, sizeof(void*) * *count);
+			lusp_memory_deallocate(*array);
+		}
+
+		*array = data;
+	}
+
+	(*array)[*count] = pointer;
+
+	return (*count)++;
+}
+
+static bool can_save_constant(struct lusp_object_t* object)
+{
+	switch (object->type)
+	{
+	case LUSP_OBJECT_NULL:
+	case LUSP_OBJECT_SYMBOL:
+	case LUSP_OBJECT_BOOLEAN:
+	case LUSP_OBJECT_INTEGER:
+	case LUSP_OBJECT_REAL:
+	case LUSP_OBJECT_STRING:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static void write_constant(struct writer_t* writer, struct lusp_object_t* object)
+{
+	write_u8(writer, (uint8_t)object->type);
+
+	switch (object->type)
+	{
+	case LUSP_OBJECT_SYMBOL:
+		write_name(writer, object->symbol->name, object->symbol->length);
+		break;
+
+	case LUSP_OBJECT_BOOLEAN:
+		write_u8(writer, object->boolean);
+		break;
+
+	case LUSP_OBJECT_INTEGER:
+		write_u64(writer, (uint64_t)object->integer);
+		break;
+
+	case LUSP_OBJECT_REAL:
+	{
+		uint64_t bits;
+		memcpy(&bits, &object->real, sizeof(bits));
+
+		write_u64(writer, bits);
+	}
+	break;
+
+	case LUSP_OBJECT_STRING:
+		write_name(writer, object->string->data, object->string->length);
+		break;
+
+	default:
+		;
+	}
+}
+
+static uint32_t get_operand(struct save_context_t* context, struct lusp_vm_op_t* op)
+{
+	switch (op->opcode)
+	{
+	case LUSP_VMOP_LOAD_CONST:
+		return add_pointer((void***)&context->constants, &context->constant_count, op->load_const.object, false);
+
+	case LUSP_VMOP_CREATE_CLOSURE:
+		return add_pointer((void***)&context->protos, &context->proto_count, op->create_closure.code, true);
+
+	default:
+		return op->dummy;
+	}
+}
+
+void* lusp_save_bytecode(struct lusp_vm_bytecode_t* code, size_t* size)
+{
+	struct save_context_t context = {0, 0, 0, 0};
+	struct writer_t protos = {0, 0, 0};
+
+	add_pointer((void***)&context.protos, &context.proto_count, code, true);
+
+	// write protos first to collect constants and nested protos; proto list grows while it is traversed
+	for (unsigned int i = 0; i < context.proto_count; ++i)
+	{
+		struct lusp_vm_bytecode_t* proto = context.protos[i];
+
+		write_u32(&protos, proto->reg_count);
+		write_u32(&protos, proto->upval_count);
+		write_u32(&protos, proto->param_count);
+		write_u32(&protos, proto->op_count);
+
+		for (unsigned int j = 0; j < proto->op_count; ++j)
+		{
+			struct lusp_vm_op_t* op = &proto->ops[j];
+
+			write_u8(&protos, op->opcode);
+			write_u8(&protos, 0);
+			write_u16(&protos, op->reg);
+			write_u32(&protos, get_operand(&context, op));
+		}
+	}
+
+	struct writer_t writer = {0, 0, 0};
+	bool result = true;
+
+	write_u32(&writer, SERIALIZE_MAGIC);
+	write_u32(&writer, SERIALIZE_VERSION);
+	write_u32(&writer, context.proto_count);
+	write_u32(&writer, context.constant_count);
+	write_u32(&writer, code->global_count);
+
+	for (unsigned int i = 0; i < context.constant_count; ++i)
+	{
+		result &= can_save_constant(context.constants[i]);
+
+		write_constant(&writer, context.constants[i]);
+	}
+
+	// global ops store indices into the name table that is shared by all protos
+	for (unsigned int i = 0; i < code->global_count; ++i)
+		write_name(&writer, code->global_names[i]->name, code->global_names[i]->length);
+
+	write_bytes(&writer, protos.data, protos.size);
+
+	lusp_memory_deallocate(protos.data);
+	lusp_memory_deallocate(context.protos);
+	if (context.constants) lusp_memory_deallocate(context.constants);
+
+	if (!result)
+	{
+		lusp_memory_deallocate(writer.data);
+		return 0;
+	}
+
+	*size = writer.size;
+	return writer.data;
+}
+
+static inline size_t align(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+static inline size_t get_string_size(unsigned int length)
+{
+	// header with inline storage, storage[1] accounts for terminator
+	return align(sizeof(struct lusp_string_t) + length);
+}
+
+struct load_layout_t
+{
+	unsigned int proto_count;
+	unsigned int constant_count;
+	unsigned int global_count;
+	unsigned int op_count;
+
+	size_t string_size;
+};
+
+static bool read_header(struct reader_t* reader, struct load_layout_t* layout)
+{
+	if (read_u32(reader) != SERIALIZE_MAGIC || read_u32(reader) != SERIALIZE_VERSION) return false;
+
+	layout->proto_count = read_u32(reader);
+	layout->constant_count = read_u32(reader);
+	layout->global_count = read_u32(reader);
+	layout->op_count = 0;
+	layout->string_size = 0;
+
+	return !reader->error && layout->proto_count > 0;
+}
+
+static bool fits(struct reader_t* reader, uint32_t count, size_t size)
+{
+	// every item takes at least size bytes, so larger counts are rejected before looping over them
+	return !reader->error && count <= (reader->size - reader->offset) / size;
+}
+
+// op is the op at index in proto, with the constant or proto index in dummy
+static bool is_valid_op(struct load_layout_t* layout, struct lusp_vm_bytecode_t* proto, unsigned int index, struct lusp_vm_op_t* op)
+{
+	if (!lusp_is_valid_op(proto, index, op, layout->global_count)) return false;
+
+	switch (op->opcode)
+	{
+	case LUSP_VMOP_LOAD_CONST:
+		return op->dummy < layout->constant_count;
+
+	case LUSP_VMOP_CREATE_CLOSURE:
+		return op->dummy < layout->proto_count;
+
+	default:
+		return true;
+	}
+}
+
+// first pass: validate data and compute allocation size
+static bool measure(struct reader_t* reader, struct load_layout_t* layout)
+{
+	if (!read_header(reader, layout)) return false;
+
+	// constants take at least 1 byte, global names 4 bytes and protos 16 bytes
+	if (!fits(reader, layout->constant_count, 1) || !fits(reader, layout->global_count, 4) || !fits(reader, layout->proto_count, 16))
+		return false;
+
+	for (unsigned int i = 0; i < layout->constant_count && !reader->error; ++i)
+	{
+		switch (read_u8(reader))
+		{
+		case LUSP_OBJECT_NULL:
+			break;
+
+		case LUSP_OBJECT_BOOLEAN:
+			read_u8(reader);
+			break;
+
+		case LUSP_OBJECT_INTEGER:
+		case LUSP_OBJECT_REAL:
+			read_u64(reader);
+			break;
+
+		case LUSP_OBJECT_SYMBOL:
+			read_bytes(reader, read_u32(reader));
+			break;
+
+		case LUSP_OBJECT_STRING:
+		{
+			uint32_t length = read_u32(reader);
+			read_bytes(reader, length);
+
+			layout->string_size += get_string_size(length);
+		}
+		break;
+
+		default:
+			return false;
+		}
+	}
+
+	for (unsigned int i = 0; i < layout->global_count && !reader->error; ++i)
+		read_bytes(reader, read_u32(reader));
+
+	for (unsigned int i = 0; i < layout->proto_count && !reader->error; ++i)
+	{
+		struct lusp_vm_bytecode_t proto;
+		proto.reg_count = read_u32(reader);
+		proto.upval_count = read_u32(reader);
+		proto.param_count = read_u32(reader);
+		proto.op_count = read_u32(reader);
+
+		// top-level proto is bound without upvalues; every proto has to end with a return
+		if (proto.param_count > proto.reg_count || (i == 0 && proto.upval_count != 0)) return false;
+		if (!fits(reader, proto.op_count, 8) || proto.op_count == 0) return false;
+
+		struct lusp_vm_op_t op = {0};
+
+		for (unsigned int j = 0; j < proto.op_count && !reader->error; ++j)
+		{
+			op.opcode = read_u8(reader);
+			read_u8(reader);
+			op.reg = read_u16(reader);
+			op.dummy = read_u32(reader);
+
+			if (!is_valid_op(layout, &proto, j, &op)) return false;
+		}
+
+		if (op.opcode != LUSP_VMOP_RETURN) return false;
+
+		layout->op_count += proto.op_count;
+	}
+
+	return !reader->error && reader->offset == reader->size;
+}
+
+static struct lusp_object_t read_constant(struct reader_t* reader, char** strings)
+{
+	struct lusp_object_t result;
+	result.type = (enum lusp_object_type_t)read_u8(reader);
+
+	switch (result.type)
+	{
+	case LUSP_OBJECT_SYMBOL:
+	{
+		uint32_t length = read_u32(reader);
+
+		result.symbol = lusp_symbol_intern((const char*)read_bytes(reader, length), length);
+	}
+	break;
+
+	case LUSP_OBJECT_BOOLEAN:
+		result.boolean = read_u8(reader) != 0;
+		break;
+
+	case LUSP_OBJECT_INTEGER:
+		result.integer = (int64_t)read_u64(reader);
+		break;
+
+	case LUSP_OBJECT_REAL:
+	{
+		uint64_t bits = read_u64(reader);
+		memcpy(&result.real, &bits, sizeof(bits));
+	}
+	break;
+
+	case LUSP_OBJECT_STRING:
+	{
+		uint32_t length = read_u32(reader);
+
+		// strings are carved from the load allocation
+		struct lusp_string_t* string = (struct lusp_string_t*)*strings;
+		*strings += get_string_size(length);
+
+		string->data = string->storage;
+		string->length = length;
+		string->hash = 0;
+
+		memcpy(string->storage, read_bytes(reader, length), length);
+		string->storage[length] = 0;
+
+		result.string = string;
+	}
+	break;
+
+	default:
+		;
+	}
+
+	return result;
+}
+
+struct lusp_vm_bytecode_t* lusp_load_bytecode(const void* data, size_t size)
+{
+	struct reader_t reader = {(const uint8_t*)data, size, 0, false};
+	struct load_layout_t layout;
+
+	if (!measure(&reader, &layout)) return 0;
+
+	// single allocation: protos, ops, constants, global names, strings
+	size_t protos_size = align(sizeof(struct lusp_vm_bytecode_t) * layout.proto_count);
+	size_t ops_size = align(sizeof(struct lusp_vm_op_t) * layout.op_count);
+	size_t constants_size = align(sizeof(struct lusp_object_t) * layout.constant_count);
+	size_t globals_size = align(sizeof(struct lusp_symbol_t*) * layout.global_count);
+
+	char* memory = (char*)lusp_memory_allocate(protos_size + ops_size + constants_size + globals_size + layout.string_size);
+	assert(memory);
+
+	struct lusp_vm_bytecode_t* protos = (struct lusp_vm_bytecode_t*)memory;
+	struct lusp_vm_op_t* ops = (struct lusp_vm_op_t*)(memory + protos_size);
+	struct lusp_object_t* constants = (struct lusp_object_t*)(memory + protos_size + ops_size);
+	struct lusp_symbol_t** globals = (struct lusp_symbol_t**)(memory + protos_size + ops_size + constants_size);
+	char* strings = memory + protos_size + ops_size + constants_size + globals_size;
+
+	// second pass: data is known to be valid
+	reader.offset = 0;
+	read_header(&reader, &layout);
+
+	for (unsigned int i = 0; i < layout.constant_count; ++i)
+		constants[i] = read_constant(&reader, &strings);
+
+	// global names are resolved to slots when bytecode is bound to an environment
+	for (unsigned int i = 0; i < layout.global_count; ++i)
+	{
+		uint32_t length = read_u32(&reader);
+
+		globals[i] = lusp_symbol_intern((const char*)read_bytes(&reader, length), length);
+	}
+
+	for (unsigned int i = 0; i < layout.proto_count; ++i)
+	{
+		struct lusp_vm_bytecode_t* proto = &protos[i];
+
+		proto->global_names = layout.global_count ? globals : 0;
+		proto->global_count = layout.global_count;
+		proto->reg_count = read_u32(&reader);
+		proto->upval_count = read_u32(&reader);
+		proto->param_count = read_u32(&reader);
+		proto->op_count = read_u32(&reader);
+		proto->ops = ops;
+
+		for (unsigned int j = 0; j < proto->op_count; ++j)
+		{
+			struct lusp_vm_op_t* op = ops++;
+
+			op->opcode = read_u8(&reader);
+			op->feedback = read_u8(&reader);
+			op->reg = read_u16(&reader);
+			op->dummy = read_u32(&reader);
+
+			// resolve indices
+			switch (op->opcode)
+			{
+			case LUSP_VMOP_LOAD_CONST:
+				op->load_const.object = &constants[op->dummy];
+				break;
+
+			case LUSP_VMOP_CREATE_CLOSURE:
+				op->create_closure.code = &protos[op->dummy];
+				break;
+
+			default:
+				;
+			}
+		}
+
+		lusp_setup_bytecode(proto);
+	}
+
+	assert(reader.offset == reader.size && !reader.error);
+
+	// capture ops depend on the upvalue count of another proto, so they are checked once all protos are read
+	if (!lusp_has_valid_captures(protos, layout.proto_count))
+	{
+		lusp_memory_deallocate(memory);
+		return 0;
+	}
+
+	return protos;
+}
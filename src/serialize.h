@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct lusp_vm_bytecode_t;
+
+// saves bytecode and all nested closures; constants are stored by value, globals by name and nested bytecode by index
+// returns buffer allocated with lusp_memory_allocate or 0 if bytecode references objects that can't be serialized
+void* lusp_save_bytecode(struct lusp_vm_bytecode_t* code, size_t* size);
+
+// loads bytecode with a single allocation; bytecode is run in an environment with lusp_bind_bytecode
+// returns 0 if data is malformed
+struct lusp_vm_bytecode_t* lusp_load_bytecode(const void* data, size_t size);
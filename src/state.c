@@ -0,0 +1,71 @@
+#include "state.h"
+
+#include "eval.h"
+#include "memory.h"
+#include "thread.h"
+
+#include <assert.h>
+
+// calls taken from a shared budget at a time; small, so that threads that run out of work leave the rest to others
+#define STATE_BUDGET_SLICE 1024
+
+struct lusp_state_t* lusp_state_create(unsigned int stack_size)
+{
+	if (stack_size == 0) stack_size = LUSP_STATE_STACK_SIZE;
+
+	struct lusp_state_t* state = (struct lusp_state_t*)lusp_memory_allocate(sizeof(struct lusp_state_t));
+	assert(state);
+
+	lusp_jit_set(state, false);
+
+	state->stack = (struct lusp_object_t*)lusp_memory_allocate(sizeof(struct lusp_object_t) * stack_size);
+	assert(state->stack);
+
+	state->stack_size = stack_size;
+	state->stack_top = state->stack;
+
+	state->coroutine = 0;
+	state->suspend = false;
+
+	state->budget = 0;
+	state->budget_left = INT64_MAX;
+	state->budget_shared = 0;
+
+	state->depth = 0;
+	state->status = LUSP_EVAL_OK;
+	state->jit_context = 0;
+
+	state->loop = 0;
+
+	return state;
+}
+
+void lusp_state_destroy(struct lusp_state_t* state)
+{
+	lusp_memory_deallocate(state->stack);
+	lusp_memory_deallocate(state);
+}
+
+bool lusp_state_refill_budget(struct lusp_state_t* state)
+{
+	volatile int64_t* shared = state->budget_shared;
+	if (!shared) return false;
+
+	int64_t left = lusp_atomic_compare_exchange64(shared, 0, 0);
+
+	while (left > 0)
+	{
+		int64_t slice = left < STATE_BUDGET_SLICE ? left : STATE_BUDGET_SLICE;
+		int64_t previous = lusp_atomic_compare_exchange64(shared, left, left - slice);
+
+		if (previous == left)
+		{
+			state->budget_left += slice;
+			return true;
+		}
+
+		left = previous;
+	}
+
+	return false;
+}
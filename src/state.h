@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bytecode.h"
+#include "eval.h"
+
+// default register stack size, in objects
+#define LUSP_STATE_STACK_SIZE 1024
+
+// interpreter state: evaluator choice, register stack and execution context
+// a state is used by one thread at a time; separate states can run concurrently without locking
+// symbols and the object heap are shared by all states and are thread-safe, so objects can be passed between states
+struct lusp_state_t
+{
+	lusp_vm_evaluator_t evaluator;
+
+	// register stack; nested evaluations start above the arguments of the innermost native function call
+	struct lusp_object_t* stack;
+	unsigned int stack_size;
+
+	struct lusp_object_t* stack_top;
+
+	// coroutine that runs on the stack, 0 outside of coroutines; suspend is set by yield and checked by the VM after native calls
+	struct lusp_coroutine_t* coroutine;
+	bool suspend;
+
+	// calls left before the running evaluation runs out of budget; refilled from budget by the outermost evaluation
+	unsigned int budget;
+	int64_t budget_left;
+
+	// budget of the parallel loop that runs chunks on the state, 0 outside of loops; budget_left starts empty and is
+	// refilled from it in slices, so that all threads of the loop draw from the calls that the loop has left
+	volatile int64_t* budget_shared;
+
+	// number of evaluations and coroutine resumes that are running on the state
+	unsigned int depth;
+
+	// reason the running evaluation was aborted; it stays set until the outermost evaluation returns, so that the VM
+	// unwinds native functions that started nested evaluations
+	enum lusp_eval_status_t status;
+
+	// jmp_buf of the innermost JIT evaluation, used to unwind compiled frames on abort
+	void* jit_context;
+
+	// event loop that runs tasks on this state, 0 if none
+	struct lusp_loop_t* loop;
+};
+
+// stack_size is the number of registers, 0 selects LUSP_STATE_STACK_SIZE; JIT is disabled in new states
+struct lusp_state_t* lusp_state_create(unsigned int stack_size);
+void lusp_state_destroy(struct lusp_state_t* state);
+
+// called by evaluators when budget_left runs out; takes more calls from budget_shared and returns false if there are none
+bool lusp_state_refill_budget(struct lusp_state_t* state);
@@ -0,0 +1,164 @@
+#include "symbol.h"
+
+#include "arena.h"
+#include "memory.h"
+#include "thread.h"
+
+#include <assert.h>
+#include <string.h>
+
+// symbols and their names are allocated from an arena that is only released on shutdown
+#define ARENA_CHUNK_SIZE 16384
+
+// open addressing table with linear probing, grows when half full
+// lookups do not lock: slots are only filled once and tables replaced by growth are kept until shutdown
+struct symbol_table_t
+{
+	struct symbol_table_t* retired;
+	unsigned int capacity;
+
+	struct lusp_symbol_t* volatile symbols[1];
+};
+
+static struct symbol_table_t* volatile g_table;
+static unsigned int g_symbol_count;
+
+// protects insertion, growth and the arena
+static struct lusp_lock_t g_lock;
+
+static struct mem_arena_t g_arena;
+
+static struct lusp_symbol_t* find(struct symbol_table_t* table, uint32_t hash, const char* name, unsigned int length, unsigned int* slot)
+{
+	unsigned int mask = table->capacity - 1;
+
+	// comparing hashes first rejects almost all mismatches
+	unsigned int index = hash & mask;
+
+	for (struct lusp_symbol_t* symbol; (symbol = (struct lusp_symbol_t*)lusp_atomic_load_pointer((void* volatile*)&table->symbols[index])) != 0; index = (index + 1) & mask)
+		if (symbol->hash == hash && symbol->length == length && memcmp(symbol->name, name, length) == 0)
+			return symbol;
+
+	*slot = index;
+	return 0;
+}
+
+static void grow(unsigned int capacity)
+{
+	struct symbol_table_t* table = (struct symbol_table_t*)lusp_memory_allocate(offsetof(struct symbol_table_t, symbols) + sizeof(struct lusp_symbol_t*) * capacity);
+	assert(table);
+
+	table->retired = g_table;
+	table->capacity = capacity;
+
+	memset((void*)table->symbols, 0, sizeof(struct lusp_symbol_t*) * capacity);
+
+	// reinsert using cached hashes
+	for (unsigned int i = 0; g_table && i < g_table->capacity; ++i)
+	{
+		struct lusp_symbol_t* symbol = g_table->symbols[i];
+		if (!symbol) continue;
+
+		unsigned int index = symbol->hash & (capacity - 1);
+		while (table->symbols[index]) index = (index + 1) & (capacity - 1);
+
+		table->symbols[index] = symbol;
+	}
+
+	// publish filled table; concurrent lookups may still use the old one
+	lusp_atomic_store_pointer((void* volatile*)&g_table, table);
+}
+
+bool lusp_symbol_init()
+{
+	g_table = 0;
+	g_symbol_count = 0;
+
+	mem_arena_init(&g_arena, ARENA_CHUNK_SIZE);
+
+	grow(1024);
+
+	return true;
+}
+
+void lusp_symbol_term()
+{
+	mem_arena_term(&g_arena);
+
+	while (g_table)
+	{
+		struct symbol_table_t* retired = g_table->retired;
+		lusp_memory_deallocate(g_table);
+		g_table = retired;
+	}
+
+	g_symbol_count = 0;
+}
+
+struct lusp_symbol_t* lusp_symbol_intern(const char* name, unsigned int length)
+{
+	uint32_t hash = lusp_hash_string(name, length);
+	unsigned int index;
+
+	struct lusp_symbol_t* symbol = find((struct symbol_table_t*)lusp_atomic_load_pointer((void* volatile*)&g_table), hash, name, length, &index);
+	if (symbol) return symbol;
+
+	lusp_lock_acquire(&g_lock);
+
+	// symbol may have been inserted, or the table may have grown, since the lookup
+	symbol = find(g_table, hash, name, length, &index);
+
+	if (!symbol)
+	{
+		// construct new symbol, name is stored right after it
+		symbol = (struct lusp_symbol_t*)mem_arena_allocate(&g_arena, sizeof(struct lusp_symbol_t) + length + 1);
+		char* symbol_name = (char*)(symbol + 1);
+
+		memcpy(symbol_name, name, length);
+		symbol_name[length] = 0;
+
+		symbol->name = symbol_name;
+		symbol->length = length;
+		symbol->hash = hash;
+
+		// insert symbol into the free slot found by lookup
+		lusp_atomic_store_pointer((void* volatile*)&g_table->symbols[index], symbol);
+		g_symbol_count++;
+
+		if (g_symbol_count * 2 > g_table->capacity) grow(g_table->capacity * 2);
+	}
+
+	lusp_lock_release(&g_lock);
+
+	return symbol;
+}
+
+void lusp_symbol_get_stats(struct lusp_symbol_stats_t* stats)
+{
+	lusp_lock_acquire(&g_lock);
+
+	unsigned int capacity = g_table->capacity;
+	unsigned int mask = capacity - 1;
+	unsigned int total_probe_length = 0;
+	unsigned int max_probe_length = 0;
+
+	for (unsigned int i = 0; i < capacity; ++i)
+	{
+		struct lusp_symbol_t* symbol = g_table->symbols[i];
+		if (!symbol) continue;
+
+		unsigned int probe_length = ((i - symbol->hash) & mask) + 1;
+
+		total_probe_length += probe_length;
+		if (max_probe_length < probe_length) max_probe_length = probe_length;
+	}
+
+	stats->count = g_symbol_count;
+	stats->capacity = capacity;
+	stats->load_factor = (double)g_symbol_count / capacity;
+	stats->average_probe_length = g_symbol_count ? (double)total_probe_length / g_symbol_count : 0;
+	stats->max_probe_length = max_probe_length;
+	stats->arena_size = mem_arena_get_size(&g_arena);
+
+	lusp_lock_release(&g_lock);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "object.h"
+
+#include <stddef.h>
+
+struct lusp_symbol_stats_t
+{
+	unsigned int count;
+	unsigned int capacity;
+	double load_factor;
+
+	// probe length is the number of slots inspected to find a symbol, 1 for a symbol in its home slot
+	double average_probe_length;
+	unsigned int max_probe_length;
+
+	// memory used by symbol arena chunks
+	size_t arena_size;
+};
+
+bool lusp_symbol_init();
+void lusp_symbol_term();
+
+struct lusp_symbol_t* lusp_symbol_intern(const char* name, unsigned int length);
+
+void lusp_symbol_get_stats(struct lusp_symbol_stats_t* stats);
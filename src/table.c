@@ -0,0 +1,317 @@
+#include "table.h"
+
+#include "bignum.h"
+#include "memory.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <string.h>
+
+// number of old slots migrated per modification
+#define MIGRATE_STEPS 16
+
+static inline uint32_t hash_integer(uint64_t value)
+{
+	// MurmurHash3 64-bit finalizer
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdull;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ull;
+	value ^= value >> 33;
+
+	return (uint32_t)value;
+}
+
+static inline uint32_t hash_real(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	return hash_integer(bits);
+}
+
+static uint32_t hash_object(struct lusp_object_t* key)
+{
+	switch (key->type)
+	{
+	case LUSP_OBJECT_SYMBOL:
+		// symbols are interned, so identity is enough
+		return hash_integer((uintptr_t)key->symbol);
+
+	case LUSP_OBJECT_BOOLEAN:
+		return key->boolean;
+
+	case LUSP_OBJECT_INTEGER:
+		return hash_integer((uint64_t)key->integer);
+
+	case LUSP_OBJECT_REAL:
+		// integral reals are equal to integers and have to hash the same way
+		if (key->real >= -9223372036854775808.0 && key->real < 9223372036854775808.0 && key->real == (double)(int64_t)key->real)
+			return hash_integer((uint64_t)(int64_t)key->real);
+
+		return hash_real(key->real);
+
+	case LUSP_OBJECT_BIGNUM:
+		// bignums are only equal to reals with exactly the same value, which convert back without rounding
+		return hash_real(lusp_bignum_to_real(key->bignum));
+
+	case LUSP_OBJECT_STRING:
+		return lusp_string_hash(key->string);
+
+	default:
+		return hash_integer((uintptr_t)key->object);
+	}
+}
+
+static inline bool is_empty(struct lusp_table_entry_t* entry)
+{
+	return entry->key.type == LUSP_OBJECT_NULL && entry->value.type == LUSP_OBJECT_NULL;
+}
+
+static inline bool is_live(struct lusp_table_entry_t* entry)
+{
+	return entry->key.type != LUSP_OBJECT_NULL;
+}
+
+static struct lusp_table_entry_t* allocate_entries(unsigned int capacity)
+{
+	struct lusp_table_entry_t* result = (struct lusp_table_entry_t*)lusp_memory_allocate(sizeof(struct lusp_table_entry_t) * capacity);
+	assert(result);
+
+	for (unsigned int i = 0; i < capacity; ++i)
+	{
+		result[i].key = lusp_mknull();
+		result[i].value = lusp_mknull();
+	}
+
+	return result;
+}
+
+static struct lusp_table_entry_t* find_entry(struct lusp_table_entry_t* entries, unsigned int capacity, struct lusp_object_t* key, uint32_t hash)
+{
+	if (capacity == 0) return 0;
+
+	unsigned int mask = capacity - 1;
+
+	// probe until an empty slot; old slot array also has tombstones which are skipped
+	for (unsigned int i = hash & mask; !is_empty(&entries[i]); i = (i + 1) & mask)
+		if (is_live(&entries[i]) && is_equal(&entries[i].key, key))
+			return &entries[i];
+
+	return 0;
+}
+
+static struct lusp_table_entry_t* insert_entry(struct lusp_table_entry_t* entries, unsigned int capacity, uint32_t hash)
+{
+	unsigned int mask = capacity - 1;
+	unsigned int i = hash & mask;
+
+	while (!is_empty(&entries[i])) i = (i + 1) & mask;
+
+	return &entries[i];
+}
+
+static void remove_entry(struct lusp_table_entry_t* entries, unsigned int capacity, struct lusp_table_entry_t* entry)
+{
+	unsigned int mask = capacity - 1;
+	unsigned int hole = (unsigned int)(entry - entries);
+
+	// backward shift deletion: move entries that would become unreachable into the hole
+	for (unsigned int i = (hole + 1) & mask; !is_empty(&entries[i]); i = (i + 1) & mask)
+	{
+		unsigned int home = hash_object(&entries[i].key) & mask;
+
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			entries[hole] = entries[i];
+			hole = i;
+		}
+	}
+
+	entries[hole].key = lusp_mknull();
+	entries[hole].value = lusp_mknull();
+}
+
+static void finish_migration(struct lusp_table_t* table)
+{
+	lusp_memory_deallocate(table->old_entries);
+
+	table->old_entries = 0;
+	table->old_capacity = 0;
+	table->old_count = 0;
+	table->old_position = 0;
+}
+
+static void migrate(struct lusp_table_t* table, unsigned int steps)
+{
+	for (; table->old_entries && steps > 0; --steps)
+	{
+		struct lusp_table_entry_t* entry = &table->old_entries[table->old_position++];
+
+		if (is_live(entry))
+		{
+			*insert_entry(table->entries, table->capacity, hash_object(&entry->key)) = *entry;
+			table->count++;
+
+			// leave a tombstone so that probe sequences for remaining old entries stay intact
+			entry->key = lusp_mknull();
+			entry->value = lusp_mkboolean(true);
+			table->old_count--;
+		}
+
+		if (table->old_count == 0 || table->old_position == table->old_capacity) finish_migration(table);
+	}
+}
+
+static void grow(struct lusp_table_t* table)
+{
+	// previous growth has to be complete before starting a new one
+	migrate(table, ~0u);
+
+	unsigned int capacity = table->capacity ? table->capacity * 2 : 8;
+
+	if (table->count > 0)
+	{
+		table->old_entries = table->entries;
+		table->old_capacity = table->capacity;
+		table->old_count = table->count;
+		table->old_position = 0;
+	}
+	else if (table->entries)
+		lusp_memory_deallocate(table->entries);
+
+	table->entries = allocate_entries(capacity);
+	table->capacity = capacity;
+	table->count = 0;
+}
+
+struct lusp_table_t* lusp_table_create(unsigned int capacity)
+{
+	struct lusp_table_t* result = (struct lusp_table_t*)lusp_memory_allocate(sizeof(struct lusp_table_t));
+	assert(result);
+
+	// round capacity up to a power of two that keeps load factor under 3/4
+	unsigned int size = 0;
+
+	if (capacity > 0)
+	{
+		size = 8;
+		while (size / 4 * 3 < capacity) size *= 2;
+	}
+
+	result->entries = size ? allocate_entries(size) : 0;
+	result->capacity = size;
+	result->count = 0;
+
+	result->old_entries = 0;
+	result->old_capacity = 0;
+	result->old_count = 0;
+	result->old_position = 0;
+
+	return result;
+}
+
+unsigned int lusp_table_count(struct lusp_table_t* table)
+{
+	return table->count + table->old_count;
+}
+
+struct lusp_object_t lusp_table_get(struct lusp_table_t* table, struct lusp_object_t* key)
+{
+	uint32_t hash = hash_object(key);
+
+	struct lusp_table_entry_t* entry = find_entry(table->entries, table->capacity, key, hash);
+	if (!entry) entry = find_entry(table->old_entries, table->old_capacity, key, hash);
+
+	return entry ? entry->value : lusp_mknull();
+}
+
+void lusp_table_set(struct lusp_table_t* table, struct lusp_object_t* key, struct lusp_object_t* value)
+{
+	assert(key->type != LUSP_OBJECT_NULL);
+
+	migrate(table, MIGRATE_STEPS);
+
+	uint32_t hash = hash_object(key);
+
+	// update existing entry in place
+	struct lusp_table_entry_t* entry = find_entry(table->entries, table->capacity, key, hash);
+	if (!entry) entry = find_entry(table->old_entries, table->old_capacity, key, hash);
+
+	if (entry)
+	{
+		entry->value = *value;
+		return;
+	}
+
+	// new entries always go to the new slot array
+	if ((lusp_table_count(table) + 1) * 4 > table->capacity * 3) grow(table);
+
+	entry = insert_entry(table->entries, table->capacity, hash);
+	entry->key = *key;
+	entry->value = *value;
+	table->count++;
+}
+
+bool lusp_table_delete(struct lusp_table_t* table, struct lusp_object_t* key)
+{
+	migrate(table, MIGRATE_STEPS);
+
+	uint32_t hash = hash_object(key);
+
+	struct lusp_table_entry_t* entry = find_entry(table->entries, table->capacity, key, hash);
+
+	if (entry)
+	{
+		remove_entry(table->entries, table->capacity, entry);
+		table->count--;
+		return true;
+	}
+
+	entry = find_entry(table->old_entries, table->old_capacity, key, hash);
+
+	if (entry)
+	{
+		entry->key = lusp_mknull();
+		entry->value = lusp_mkboolean(true);
+		table->old_count--;
+
+		if (table->old_count == 0) finish_migration(table);
+		return true;
+	}
+
+	return false;
+}
+
+struct lusp_object_t lusp_table_next(struct lusp_table_t* table, struct lusp_object_t* key)
+{
+	// iteration visits remaining old slots first, then new slots
+	unsigned int position = 0;
+
+	if (key->type != LUSP_OBJECT_NULL)
+	{
+		uint32_t hash = hash_object(key);
+
+		struct lusp_table_entry_t* entry = find_entry(table->entries, table->capacity, key, hash);
+
+		if (entry)
+			position = table->old_capacity + (unsigned int)(entry - table->entries) + 1;
+		else
+		{
+			entry = find_entry(table->old_entries, table->old_capacity, key, hash);
+			if (!entry) return lusp_mknull();
+
+			position = (unsigned int)(entry - table->old_entries) + 1;
+		}
+	}
+
+	for (; position < table->old_capacity; ++position)
+		if (is_live(&table->old_entries[position]))
+			return table->old_entries[position].key;
+
+	for (position -= table->old_capacity; position < table->capacity; ++position)
+		if (is_live(&table->entries[position]))
+			return table->entries[position].key;
+
+	return lusp_mknull();
+}
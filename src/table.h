@@ -0,0 +1,37 @@
+#pragma once
+
+#include "object.h"
+
+struct lusp_table_entry_t
+{
+	struct lusp_object_t key;
+	struct lusp_object_t value;
+};
+
+// open addressing hash table with linear probing; slots with null keys are empty
+// growing is incremental: the previous slot array is kept and drained a few slots per modification
+struct lusp_table_t
+{
+	struct lusp_table_entry_t* entries;
+	unsigned int capacity;
+	unsigned int count;
+
+	// slot array that is being migrated
+	struct lusp_table_entry_t* old_entries;
+	unsigned int old_capacity;
+	unsigned int old_count;
+	unsigned int old_position;
+};
+
+struct lusp_table_t* lusp_table_create(unsigned int capacity);
+
+unsigned int lusp_table_count(struct lusp_table_t* table);
+
+// missing keys yield null
+struct lusp_object_t lusp_table_get(struct lusp_table_t* table, struct lusp_object_t* key);
+void lusp_table_set(struct lusp_table_t* table, struct lusp_object_t* key, struct lusp_object_t* value);
+bool lusp_table_delete(struct lusp_table_t* table, struct lusp_object_t* key);
+
+// returns key that follows the given one (null starts iteration) or null at the end
+// table must not be modified during iteration
+struct lusp_object_t lusp_table_next(struct lusp_table_t* table, struct lusp_object_t* key);
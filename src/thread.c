@@ -0,0 +1,258 @@
+#include "thread.h"
+
+#include "memory.h"
+
+#include <assert.h>
+
+#ifdef DL_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+struct lusp_thread_t
+{
+#ifdef DL_WINDOWS
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+
+	lusp_thread_function_t function;
+	void* context;
+};
+
+#ifdef DL_WINDOWS
+static DWORD WINAPI thread_entry(LPVOID data)
+#else
+static void* thread_entry(void* data)
+#endif
+{
+	struct lusp_thread_t* thread = (struct lusp_thread_t*)data;
+
+	thread->function(thread->context);
+
+	return 0;
+}
+
+struct lusp_thread_t* lusp_thread_create(lusp_thread_function_t function, void* context)
+{
+	struct lusp_thread_t* thread = (struct lusp_thread_t*)lusp_memory_allocate(sizeof(struct lusp_thread_t));
+	assert(thread);
+
+	thread->function = function;
+	thread->context = context;
+
+#ifdef DL_WINDOWS
+	thread->handle = CreateThread(0, 0, thread_entry, thread, 0, 0);
+	bool result = thread->handle != 0;
+#else
+	bool result = pthread_create(&thread->handle, 0, thread_entry, thread) == 0;
+#endif
+
+	if (!result)
+	{
+		lusp_memory_deallocate(thread);
+		return 0;
+	}
+
+	return thread;
+}
+
+void lusp_thread_join(struct lusp_thread_t* thread)
+{
+#ifdef DL_WINDOWS
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, 0);
+#endif
+
+	lusp_memory_deallocate(thread);
+}
+
+unsigned int lusp_thread_get_processor_count()
+{
+#ifdef DL_WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors;
+#else
+	long result = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return result > 0 ? (unsigned int)result : 1;
+#endif
+}
+
+void lusp_thread_yield()
+{
+#ifdef DL_WINDOWS
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+static inline long exchange(volatile long* value, long replacement)
+{
+#ifdef DL_WINDOWS
+	return InterlockedExchange(value, replacement);
+#else
+	return __atomic_exchange_n(value, replacement, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline long load(volatile long* value)
+{
+#ifdef DL_WINDOWS
+	return *value;
+#else
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+void lusp_lock_acquire(struct lusp_lock_t* lock)
+{
+	while (exchange(&lock->state, 1))
+	{
+		// wait until the lock looks free to avoid hammering the cache line with writes
+		while (load(&lock->state)) lusp_thread_yield();
+	}
+}
+
+bool lusp_lock_try_acquire(struct lusp_lock_t* lock)
+{
+	return exchange(&lock->state, 1) == 0;
+}
+
+void lusp_lock_release(struct lusp_lock_t* lock)
+{
+#ifdef DL_WINDOWS
+	InterlockedExchange(&lock->state, 0);
+#else
+	__atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+struct lusp_semaphore_t
+{
+#ifdef DL_WINDOWS
+	HANDLE handle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	unsigned int count;
+#endif
+};
+
+struct lusp_semaphore_t* lusp_semaphore_create()
+{
+	struct lusp_semaphore_t* semaphore = (struct lusp_semaphore_t*)lusp_memory_allocate(sizeof(struct lusp_semaphore_t));
+	assert(semaphore);
+
+#ifdef DL_WINDOWS
+	semaphore->handle = CreateSemaphore(0, 0, 0x7fffffff, 0);
+	assert(semaphore->handle);
+#else
+	pthread_mutex_init(&semaphore->mutex, 0);
+	pthread_cond_init(&semaphore->condition, 0);
+	semaphore->count = 0;
+#endif
+
+	return semaphore;
+}
+
+void lusp_semaphore_destroy(struct lusp_semaphore_t* semaphore)
+{
+#ifdef DL_WINDOWS
+	CloseHandle(semaphore->handle);
+#else
+	pthread_cond_destroy(&semaphore->condition);
+	pthread_mutex_destroy(&semaphore->mutex);
+#endif
+
+	lusp_memory_deallocate(semaphore);
+}
+
+void lusp_semaphore_wait(struct lusp_semaphore_t* semaphore)
+{
+#ifdef DL_WINDOWS
+	WaitForSingleObject(semaphore->handle, INFINITE);
+#else
+	pthread_mutex_lock(&semaphore->mutex);
+
+	while (semaphore->count == 0) pthread_cond_wait(&semaphore->condition, &semaphore->mutex);
+
+	semaphore->count--;
+
+	pthread_mutex_unlock(&semaphore->mutex);
+#endif
+}
+
+void lusp_semaphore_signal(struct lusp_semaphore_t* semaphore, unsigned int count)
+{
+	if (count == 0) return;
+
+#ifdef DL_WINDOWS
+	ReleaseSemaphore(semaphore->handle, (LONG)count, 0);
+#else
+	pthread_mutex_lock(&semaphore->mutex);
+
+	semaphore->count += count;
+
+	if (count == 1) pthread_cond_signal(&semaphore->condition);
+	else pthread_cond_broadcast(&semaphore->condition);
+
+	pthread_mutex_unlock(&semaphore->mutex);
+#endif
+}
+
+long lusp_atomic_increment(volatile long* value)
+{
+#ifdef DL_WINDOWS
+	return InterlockedIncrement(value);
+#else
+	return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+long lusp_atomic_load(volatile long* value)
+{
+#ifdef DL_WINDOWS
+	return InterlockedCompareExchange(value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+int64_t lusp_atomic_compare_exchange64(volatile int64_t* value, int64_t expected, int64_t desired)
+{
+#ifdef DL_WINDOWS
+	return InterlockedCompareExchange64((volatile LONG64*)value, desired, expected);
+#else
+	__atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+	return expected;
+#endif
+}
+
+void* lusp_atomic_load_pointer(void* volatile* pointer)
+{
+#ifdef DL_WINDOWS
+	return InterlockedCompareExchangePointer(pointer, 0, 0);
+#else
+	return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void lusp_atomic_store_pointer(void* volatile* pointer, void* value)
+{
+#ifdef DL_WINDOWS
+	InterlockedExchangePointer(pointer, value);
+#else
+	__atomic_store_n(pointer, value, __ATOMIC_RELEASE);
+#endif
+}
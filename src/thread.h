@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct lusp_thread_t;
+
+typedef void (*lusp_thread_function_t)(void* context);
+
+// starts a thread that runs function(context); returns 0 if the thread could not be created
+struct lusp_thread_t* lusp_thread_create(lusp_thread_function_t function, void* context);
+
+// waits for thread completion and releases the thread
+void lusp_thread_join(struct lusp_thread_t* thread);
+
+unsigned int lusp_thread_get_processor_count();
+
+// gives up the rest of the time slice of the calling thread
+void lusp_thread_yield();
+
+// spin lock for short critical sections; zero-initialized locks are unlocked
+struct lusp_lock_t
+{
+	volatile long state;
+};
+
+void lusp_lock_acquire(struct lusp_lock_t* lock);
+bool lusp_lock_try_acquire(struct lusp_lock_t* lock);
+void lusp_lock_release(struct lusp_lock_t* lock);
+
+// counting semaphore for threads that wait for work without spinning
+struct lusp_semaphore_t;
+
+struct lusp_semaphore_t* lusp_semaphore_create();
+void lusp_semaphore_destroy(struct lusp_semaphore_t* semaphore);
+
+void lusp_semaphore_wait(struct lusp_semaphore_t* semaphore);
+void lusp_semaphore_signal(struct lusp_semaphore_t* semaphore, unsigned int count);
+
+// sequentially consistent increment, returns the new value
+long lusp_atomic_increment(volatile long* value);
+
+// load with acquire semantics
+long lusp_atomic_load(volatile long* value);
+
+// sequentially consistent compare and swap, returns the previous value; value is replaced if it was equal to expected
+int64_t lusp_atomic_compare_exchange64(volatile int64_t* value, int64_t expected, int64_t desired);
+
+// pointer load with acquire semantics and store with release semantics, for data that is read without locks
+void* lusp_atomic_load_pointer(void* volatile* pointer);
+void lusp_atomic_store_pointer(void* volatile* pointer, void* value);
+
+// relaxed load and store for caches that threads may fill concurrently with the same or a wider value, such as string
+// hashes and type feedback; inline since they are used on hot paths
+static inline uint8_t lusp_atomic_load_relaxed_u8(volatile uint8_t* value)
+{
+#ifdef DL_WINDOWS
+	return *value;
+#else
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void lusp_atomic_store_relaxed_u8(volatile uint8_t* value, uint8_t data)
+{
+#ifdef DL_WINDOWS
+	*value = data;
+#else
+	__atomic_store_n(value, data, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint32_t lusp_atomic_load_relaxed_u32(volatile uint32_t* value)
+{
+#ifdef DL_WINDOWS
+	return *value;
+#else
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void lusp_atomic_store_relaxed_u32(volatile uint32_t* value, uint32_t data)
+{
+#ifdef DL_WINDOWS
+	*value = data;
+#else
+	__atomic_store_n(value, data, __ATOMIC_RELAXED);
+#endif
+}
@@ -1,69 +1,339 @@
-#pragma once
-
-#include "bytecode.h"
-#include "memory.h"
-#include "object.h"
-
-#include <assert.h>
-
-static inline struct lusp_vm_upval_t* mkupval(struct lusp_vm_upval_t** list, struct lusp_object_t* ref)
-{
-	// look for ref in list
-	for (struct lusp_vm_upval_t* upval = *list; upval; upval = upval->next)
-		if (upval->ref == ref)
-			return upval;
-
-	// create new upval
-	struct lusp_vm_upval_t* result = (struct lusp_vm_upval_t*)lusp_memory_allocate(sizeof(struct lusp_vm_upval_t));
-	assert(result);
-
-	result->ref = ref;
-	result->next = *list;
-	*list = result;
-
-	return result;
-}
-
-static inline struct lusp_vm_upval_t* close_upvals(struct lusp_vm_upval_t* list, struct lusp_object_t* begin)
-{
-	while (list->ref >= begin)
-	{
-		struct lusp_vm_upval_t* next = list->next;
-
-		list->object = *list->ref;
-		list->ref = &list->object;
-
-		list = next;
-	}
-
-	return list;
-}
-
-#define ARITH(name, op)                                                                              \
-	static inline struct lusp_object_t name(struct lusp_object_t* left, struct lusp_object_t* right) \
-	{                                                                                                \
-		return lusp_mkinteger(left->integer op right->integer);                                      \
-	}
-
-ARITH(binop_add, +);
-ARITH(binop_subtract, -);
-ARITH(binop_multiply, *);
-ARITH(binop_divide, /);
-ARITH(binop_modulo, %);
-
-#undef ARITH
-
-#define COMP(name, op)                                                                               \
-	static inline struct lusp_object_t name(struct lusp_object_t* left, struct lusp_object_t* right) \
-	{                                                                                                \
-		return lusp_mkboolean(left->integer op right->integer);                                      \
-	}
-
-COMP(binop_equal, ==);
-COMP(binop_not_equal, !=);
-COMP(binop_less, <);
-COMP(binop_less_equal, <=);
-COMP(binop_greater, >);
-COMP(binop_greater_equal, >=);
-
-#undef COMP
+#pragma once
+
+#include "bignum.h"
+#include "bytecode.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+static inline struct lusp_vm_upval_t* mkupval(struct lusp_vm_upval_t** list, struct lusp_object_t* ref)
+{
+	// look for ref in list
+	for (struct lusp_vm_upval_t* upval = *list; upval; upval = upval->next)
+		if (upval->ref == ref)
+			return upval;
+
+	// create new upval
+	struct lusp_vm_upval_t* result = (struct lusp_vm_upval_t*)lusp_memory_allocate(sizeof(struct lusp_vm_upval_t));
+	assert(result);
+
+	result->ref = ref;
+	result->next = *list;
+	*list = result;
+
+	return result;
+}
+
+static inline struct lusp_vm_upval_t* close_upvals(struct lusp_vm_upval_t* list, struct lusp_object_t* begin)
+{
+	while (list->ref >= begin)
+	{
+		struct lusp_vm_upval_t* next = list->next;
+
+		list->object = *list->ref;
+		list->ref = &list->object;
+
+		list = next;
+	}
+
+	return list;
+}
+
+static inline void fill_args(struct lusp_object_t* regs, unsigned int count, unsigned int param_count, unsigned int reg_count)
+{
+	// missing arguments are null; extra arguments are ignored and cleared with the rest of the registers,
+	// so that the callee never sees values left by earlier frames; calls with exact arity only clear the registers
+	// above the parameters, like the exact-arity entry of compiled functions
+	for (unsigned int i = count < param_count ? count : param_count; i < reg_count; ++i)
+		regs[i] = lusp_mknull();
+}
+
+static inline struct lusp_object_t create_vector(struct lusp_object_t* elements, unsigned int count)
+{
+	struct lusp_object_t result = lusp_mkvector(count);
+
+	if (count) memcpy(result.vector->data, elements, count * sizeof(struct lusp_object_t));
+	result.vector->length = count;
+
+	return result;
+}
+
+static inline struct lusp_object_t index_get(struct lusp_object_t* object, struct lusp_object_t* key)
+{
+	// reading a missing element yields null
+	if (object->type == LUSP_OBJECT_VECTOR && key->type == LUSP_OBJECT_INTEGER &&
+	    (uint64_t)key->integer < object->vector->length)
+		return object->vector->data[key->integer];
+
+	if (object->type == LUSP_OBJECT_TABLE) return lusp_table_get(object->table, key);
+
+	return lusp_mknull();
+}
+
+static inline void index_set(struct lusp_object_t* object, struct lusp_object_t* key, struct lusp_object_t* value)
+{
+	if (object->type == LUSP_OBJECT_TABLE)
+	{
+		lusp_table_set(object->table, key, value);
+		return;
+	}
+
+	// storing to a missing element is ignored, just like reading it yields null
+	if (object->type != LUSP_OBJECT_VECTOR || key->type != LUSP_OBJECT_INTEGER) return;
+
+	struct lusp_vector_t* vector = object->vector;
+
+	// storing right past the end appends the element
+	if ((uint64_t)key->integer == vector->length)
+		lusp_vector_push(vector, *value);
+	else if ((uint64_t)key->integer < vector->length)
+		vector->data[key->integer] = *value;
+}
+
+static inline bool is_exact(struct lusp_object_t* object)
+{
+	return object->type == LUSP_OBJECT_INTEGER || object->type == LUSP_OBJECT_BIGNUM;
+}
+
+static inline bool is_number(struct lusp_object_t* object)
+{
+	return is_exact(object) || object->type == LUSP_OBJECT_REAL;
+}
+
+static inline double to_real(struct lusp_object_t* object)
+{
+	switch (object->type)
+	{
+	case LUSP_OBJECT_INTEGER:
+		return (double)object->integer;
+
+	case LUSP_OBJECT_BIGNUM:
+		return lusp_bignum_to_real(object->bignum);
+
+	default:
+		return object->real;
+	}
+}
+
+// compares an integer or bignum with a real exactly, without rounding the exact value; returns -1, 0, 1, or 2 if right is nan
+static inline int compare_exact_real(struct lusp_object_t* left, double right)
+{
+	if (right != right) return 2;
+
+	if (right >= -9223372036854775808.0 && right < 9223372036854775808.0)
+	{
+		// normalized bignums are outside of int64_t range
+		if (left->type == LUSP_OBJECT_BIGNUM) return left->bignum->negative ? -1 : 1;
+
+		// integral part of a real in range is exact, fractional part decides ties
+		int64_t whole = (int64_t)right;
+		if (left->integer != whole) return left->integer < whole ? -1 : 1;
+
+		double fraction = right - (double)whole;
+		return fraction > 0 ? -1 : fraction < 0 ? 1 : 0;
+	}
+
+	// reals outside of int64_t range are integral or infinite
+	if (left->type == LUSP_OBJECT_INTEGER || right - right != 0) return right > 0 ? -1 : 1;
+
+	struct lusp_object_t whole = lusp_bignum_from_real(right);
+	return lusp_bignum_compare(left, &whole);
+}
+
+// numbers compare by value regardless of representation; returns -1, 0, 1, or 2 if either number is nan
+static inline int compare_numbers(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	if (is_exact(left) && is_exact(right)) return lusp_bignum_compare(left, right);
+
+	if (left->type == LUSP_OBJECT_REAL && right->type == LUSP_OBJECT_REAL)
+		return left->real < right->real ? -1 : left->real > right->real ? 1 : left->real == right->real ? 0 : 2;
+
+	if (left->type == LUSP_OBJECT_REAL)
+	{
+		int result = compare_exact_real(right, left->real);
+		return result == 2 ? 2 : -result;
+	}
+
+	return compare_exact_real(left, right->real);
+}
+
+static inline bool add_overflow(int64_t left, int64_t right, int64_t* result)
+{
+#ifdef __GNUC__
+	return __builtin_add_overflow(left, right, result);
+#else
+	*result = (int64_t)((uint64_t)left + (uint64_t)right);
+	return ((left ^ *result) & (right ^ *result)) < 0;
+#endif
+}
+
+static inline bool subtract_overflow(int64_t left, int64_t right, int64_t* result)
+{
+#ifdef __GNUC__
+	return __builtin_sub_overflow(left, right, result);
+#else
+	*result = (int64_t)((uint64_t)left - (uint64_t)right);
+	return ((left ^ right) & (left ^ *result)) < 0;
+#endif
+}
+
+static inline bool multiply_overflow(int64_t left, int64_t right, int64_t* result)
+{
+#ifdef __GNUC__
+	return __builtin_mul_overflow(left, right, result);
+#else
+	*result = (int64_t)((uint64_t)left * (uint64_t)right);
+	if (left == 0 || right == 0) return false;
+	if ((left == -1 && right == INT64_MIN) || (right == -1 && left == INT64_MIN)) return true;
+	return *result / right != left;
+#endif
+}
+
+static inline uint8_t binop_feedback(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER) return LUSP_VM_FEEDBACK_INTEGER;
+	if (left->type == LUSP_OBJECT_REAL && right->type == LUSP_OBJECT_REAL) return LUSP_VM_FEEDBACK_REAL;
+
+	return LUSP_VM_FEEDBACK_OTHER;
+}
+
+static inline bool is_equal_string(struct lusp_string_t* left, struct lusp_string_t* right)
+{
+	if (left->length != right->length) return false;
+	if (left->data == right->data) return true;
+
+	// cached hashes reject most mismatches without touching characters
+	if (left->hash && right->hash && left->hash != right->hash) return false;
+
+	return memcmp(left->data, right->data, left->length) == 0;
+}
+
+static inline bool is_equal(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	// numbers compare by exact value regardless of representation, so equality is transitive and matches table hashing
+	if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER) return left->integer == right->integer;
+	if (is_number(left) && is_number(right)) return compare_numbers(left, right) == 0;
+
+	if (left->type != right->type) return false;
+
+	switch (left->type)
+	{
+	case LUSP_OBJECT_NULL:
+		return true;
+
+	case LUSP_OBJECT_SYMBOL:
+		return left->symbol == right->symbol;
+
+	case LUSP_OBJECT_BOOLEAN:
+		return left->boolean == right->boolean;
+
+	case LUSP_OBJECT_STRING:
+		return is_equal_string(left->string, right->string);
+
+	case LUSP_OBJECT_CONS:
+		return left->cons == right->cons;
+
+	case LUSP_OBJECT_CLOSURE:
+		return left->closure == right->closure;
+
+	case LUSP_OBJECT_FUNCTION:
+		return left->function == right->function;
+
+	default:
+		return left->object == right->object;
+	}
+}
+
+// integer operations check for overflow; overflowing results are promoted to bignum
+#define ARITH(name, op, overflow, bignum)                                                            \
+	static inline struct lusp_object_t name(struct lusp_object_t* left, struct lusp_object_t* right) \
+	{                                                                                                \
+		int64_t result;                                                                              \
+                                                                                                     \
+		if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER &&               \
+		    !overflow(left->integer, right->integer, &result))                                       \
+			return lusp_mkinteger(result);                                                           \
+                                                                                                     \
+		if (is_exact(left) && is_exact(right)) return bignum(left, right);                           \
+                                                                                                     \
+		if (!is_number(left) || !is_number(right)) return lusp_mknull();                             \
+                                                                                                     \
+		return lusp_mkreal(to_real(left) op to_real(right));                                         \
+	}
+
+ARITH(binop_add, +, add_overflow, lusp_bignum_add);
+ARITH(binop_subtract, -, subtract_overflow, lusp_bignum_subtract);
+ARITH(binop_multiply, *, multiply_overflow, lusp_bignum_multiply);
+
+#undef ARITH
+
+// division by exact zero is deliberately not an error: scripts can't handle runtime errors, so integer operands follow
+// real arithmetic instead, which keeps 7 / 0 consistent with 7 / 0.0: x / 0 is +-inf, 0 / 0 and x % 0 are nan
+static inline struct lusp_object_t binop_divide(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER)
+	{
+		// INT64_MIN / -1 overflows and is handled by bignum division
+		if (right->integer != 0 && !(left->integer == INT64_MIN && right->integer == -1))
+			return lusp_mkinteger(left->integer / right->integer);
+	}
+
+	if (is_exact(left) && is_exact(right) && !(right->type == LUSP_OBJECT_INTEGER && right->integer == 0))
+		return lusp_bignum_divide(left, right);
+
+	if (!is_number(left) || !is_number(right)) return lusp_mknull();
+
+	return lusp_mkreal(to_real(left) / to_real(right));
+}
+
+static inline struct lusp_object_t binop_modulo(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER)
+	{
+		// modulo by zero uses real modulo (nan) instead of trapping; INT64_MIN % -1 is 0
+		if (right->integer == -1) return lusp_mkinteger(0);
+		if (right->integer != 0) return lusp_mkinteger(left->integer % right->integer);
+	}
+
+	if (is_exact(left) && is_exact(right) && !(right->type == LUSP_OBJECT_INTEGER && right->integer == 0))
+		return lusp_bignum_modulo(left, right);
+
+	if (!is_number(left) || !is_number(right)) return lusp_mknull();
+
+	return lusp_mkreal(fmod(to_real(left), to_real(right)));
+}
+
+static inline struct lusp_object_t binop_equal(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	return lusp_mkboolean(is_equal(left, right));
+}
+
+static inline struct lusp_object_t binop_not_equal(struct lusp_object_t* left, struct lusp_object_t* right)
+{
+	return lusp_mkboolean(!is_equal(left, right));
+}
+
+// ordering is only defined for numbers and is exact for mixed representations; comparing anything else or nan yields false
+#define COMP(name, op)                                                                               \
+	static inline struct lusp_object_t name(struct lusp_object_t* left, struct lusp_object_t* right) \
+	{                                                                                                \
+		if (left->type == LUSP_OBJECT_INTEGER && right->type == LUSP_OBJECT_INTEGER)                 \
+			return lusp_mkboolean(left->integer op right->integer);                                  \
+                                                                                                     \
+		if (!is_number(left) || !is_number(right)) return lusp_mkboolean(false);                     \
+                                                                                                     \
+		int order = compare_numbers(left, right);                                                    \
+                                                                                                     \
+		return lusp_mkboolean(order != 2 && order op 0);                                             \
+	}
+
+COMP(binop_less, <);
+COMP(binop_less_equal, <=);
+COMP(binop_greater, >);
+COMP(binop_greater_equal, >=);
+
+#undef COMP
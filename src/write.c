@@ -1,93 +1,172 @@
-#include "write.h"
-
-#include "object.h"
-
-#include <stdio.h>
-
-static inline void lusp_write_string(struct lusp_object_t object)
-{
-	putc('"', stdout);
-
-	for (const char* value = object.string; *value; ++value)
-	{
-		if (*value == '\\' || *value == '"') putc('\\', stdout);
-		putc(*value, stdout);
-	}
-
-	putc('"', stdout);
-}
-
-static inline void lusp_write_cons(struct lusp_object_t object)
-{
-	printf("(");
-
-	// first element
-	lusp_write(object.cons[0]);
-	object = object.cons[1];
-
-	// remaining list elements
-	while (object.type == LUSP_OBJECT_CONS)
-	{
-		printf(" ");
-		lusp_write(object.cons[0]);
-		object = object.cons[1];
-	}
-
-	// dotted pair
-	if (object.type != LUSP_OBJECT_NULL)
-	{
-		printf(" . ");
-		lusp_write(object);
-	}
-
-	printf(")");
-}
-
-void lusp_write(struct lusp_object_t object)
-{
-	switch (object.type)
-	{
-	case LUSP_OBJECT_NULL:
-		printf("()");
-		break;
-
-	case LUSP_OBJECT_SYMBOL:
-		printf("%s", object.symbol->name);
-		break;
-
-	case LUSP_OBJECT_BOOLEAN:
-		printf(object.boolean ? "#t" : "#f");
-		break;
-
-	case LUSP_OBJECT_INTEGER:
-		printf("%d", object.integer);
-		break;
-
-	case LUSP_OBJECT_REAL:
-		printf("%f", object.real);
-		break;
-
-	case LUSP_OBJECT_STRING:
-		lusp_write_string(object);
-		break;
-
-	case LUSP_OBJECT_CONS:
-		lusp_write_cons(object);
-		break;
-
-	case LUSP_OBJECT_CLOSURE:
-		printf("#<closure:%p>", object.closure);
-		break;
-
-	case LUSP_OBJECT_FUNCTION:
-		printf("#<function:%p>", object.function);
-		break;
-
-	case LUSP_OBJECT_OBJECT:
-		printf("#<object:%p>", object.object);
-		break;
-
-	default:
-		printf("#<unknown>");
-	}
-}
+#include "write.h"
+
+#include "bignum.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+static inline void lusp_write_characters(struct lusp_string_t* string)
+{
+	for (unsigned int i = 0; i < string->length; ++i)
+	{
+		char ch = string->data[i];
+
+		if (ch == '\\' || ch == '"') putc('\\', stdout);
+		putc(ch, stdout);
+	}
+}
+
+static inline void lusp_write_string(struct lusp_object_t object)
+{
+	putc('"', stdout);
+	lusp_write_characters(object.string);
+	putc('"', stdout);
+}
+
+static inline void lusp_write_builder(struct lusp_object_t object)
+{
+	// builder contents are written piece by piece without flattening
+	putc('"', stdout);
+
+	for (unsigned int i = 0; i < object.builder->piece_count; ++i)
+		lusp_write_characters(object.builder->pieces[i]);
+
+	putc('"', stdout);
+}
+
+static inline void lusp_write_bignum(struct lusp_object_t object)
+{
+	char* digits = lusp_bignum_format(object.bignum);
+
+	printf("%s", digits);
+
+	lusp_memory_deallocate(digits);
+}
+
+static inline void lusp_write_cons(struct lusp_object_t object)
+{
+	printf("(");
+
+	// first element
+	lusp_write(object.cons[0]);
+	object = object.cons[1];
+
+	// remaining list elements
+	while (object.type == LUSP_OBJECT_CONS)
+	{
+		printf(" ");
+		lusp_write(object.cons[0]);
+		object = object.cons[1];
+	}
+
+	// dotted pair
+	if (object.type != LUSP_OBJECT_NULL)
+	{
+		printf(" . ");
+		lusp_write(object);
+	}
+
+	printf(")");
+}
+
+static inline void lusp_write_vector(struct lusp_object_t object)
+{
+	printf("[");
+
+	for (unsigned int i = 0; i < object.vector->length; ++i)
+	{
+		if (i > 0) printf(", ");
+		lusp_write(object.vector->data[i]);
+	}
+
+	printf("]");
+}
+
+static inline void lusp_write_table(struct lusp_object_t object)
+{
+	printf("{");
+
+	struct lusp_object_t key = lusp_mknull();
+
+	for (unsigned int i = 0; (key = lusp_table_next(object.table, &key)).type != LUSP_OBJECT_NULL; ++i)
+	{
+		if (i > 0) printf(", ");
+		lusp_write(key);
+		printf(": ");
+		lusp_write(lusp_table_get(object.table, &key));
+	}
+
+	printf("}");
+}
+
+void lusp_write(struct lusp_object_t object)
+{
+	switch (object.type)
+	{
+	case LUSP_OBJECT_NULL:
+		printf("()");
+		break;
+
+	case LUSP_OBJECT_SYMBOL:
+		printf("%s", object.symbol->name);
+		break;
+
+	case LUSP_OBJECT_BOOLEAN:
+		printf(object.boolean ? "#t" : "#f");
+		break;
+
+	case LUSP_OBJECT_INTEGER:
+		printf("%" PRId64, object.integer);
+		break;
+
+	case LUSP_OBJECT_REAL:
+		printf("%f", object.real);
+		break;
+
+	case LUSP_OBJECT_BIGNUM:
+		lusp_write_bignum(object);
+		break;
+
+	case LUSP_OBJECT_STRING:
+		lusp_write_string(object);
+		break;
+
+	case LUSP_OBJECT_BUILDER:
+		lusp_write_builder(object);
+		break;
+
+	case LUSP_OBJECT_CONS:
+		lusp_write_cons(object);
+		break;
+
+	case LUSP_OBJECT_VECTOR:
+		lusp_write_vector(object);
+		break;
+
+	case LUSP_OBJECT_TABLE:
+		lusp_write_table(object);
+		break;
+
+	case LUSP_OBJECT_CLOSURE:
+		printf("#<closure:%p>", object.closure);
+		break;
+
+	case LUSP_OBJECT_FUNCTION:
+		printf("#<function:%p>", object.function);
+		break;
+
+	case LUSP_OBJECT_COROUTINE:
+		printf("#<coroutine:%p>", object.coroutine);
+		break;
+
+	case LUSP_OBJECT_OBJECT:
+		printf("#<object:%p>", object.object);
+		break;
+
+	default:
+		printf("#<unknown>");
+	}
+}
@@ -1,5 +1,5 @@
-#pragma once
-
-struct lusp_object_t;
-
-void lusp_write(struct lusp_object_t object);
+#pragma once
+
+struct lusp_object_t;
+
+void lusp_write(struct lusp_object_t object);
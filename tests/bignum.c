@@ -0,0 +1,86 @@
+#include "test.h"
+
+#include "bignum.h"
+#include "memory.h"
+
+#include <string.h>
+
+static bool is_bignum(struct lusp_object_t value, const char* expected)
+{
+	if (value.type != LUSP_OBJECT_BIGNUM) return false;
+
+	char* text = lusp_bignum_format(value.bignum);
+	bool result = strcmp(text, expected) == 0;
+
+	lusp_memory_deallocate(text);
+
+	return result;
+}
+
+// operators have no precedence and group to the right, so expressions below are parenthesized
+static void test_promotion()
+{
+	// integer operations that overflow produce bignums
+	CHECK(is_bignum(test_eval_ok("9223372036854775807 + 1"), "9223372036854775808"));
+	CHECK(is_bignum(test_eval_ok("(0 - 9223372036854775807) - 2"), "-9223372036854775809"));
+	CHECK(is_bignum(test_eval_ok("4294967296 * 4294967296"), "18446744073709551616"));
+	CHECK(is_bignum(test_eval_ok("(0 - 4294967296) * 4294967296"), "-18446744073709551616"));
+
+	// results that fit are integers again
+	CHECK(test_is_integer(test_eval_ok("(9223372036854775807 + 1) - 1"), INT64_MAX));
+	CHECK(test_is_integer(test_eval_ok("((0 - 9223372036854775807) - 2) + 1"), INT64_MIN));
+	CHECK(test_is_integer(test_eval_ok("(4294967296 * 4294967296) - (4294967296 * 4294967296)"), 0));
+
+	// bignums mix with reals and compare exactly
+	CHECK(test_is_real(test_eval_ok("(4294967296 * 4294967296) + 0.5"), 18446744073709551616.0));
+	CHECK(test_eval_ok("(9223372036854775807 + 1) == 9223372036854775808.0").boolean);
+	CHECK(test_eval_ok("(9223372036854775807 + 2) > 9223372036854775808.0").boolean);
+	CHECK(test_eval_ok("(9223372036854775807 + 1) > 9223372036854775807").boolean);
+}
+
+static void test_division()
+{
+	// INT64_MIN / -1 is the only integer division that overflows
+	CHECK(is_bignum(test_eval_ok("((0 - 9223372036854775807) - 1) / (0 - 1)"), "9223372036854775808"));
+	CHECK(test_is_integer(test_eval_ok("((0 - 9223372036854775807) - 1) % (0 - 1)"), 0));
+
+	// division truncates, remainder has the sign of the dividend
+	CHECK(test_is_integer(test_eval_ok("(4294967296 * 4294967296) / 3"), 6148914691236517205));
+	CHECK(test_is_integer(test_eval_ok("(4294967296 * 4294967296) % 3"), 1));
+	CHECK(test_is_integer(test_eval_ok("(0 - ((4294967296 * 4294967296) + 7)) % 3"), -2));
+	CHECK(test_is_integer(test_eval_ok("(0 - ((4294967296 * 4294967296) + 7)) / (4294967296 * 4294967296)"), -1));
+
+	// multi-limb divisors
+	CHECK(is_bignum(test_eval_ok("(1000000000000000 * 1000000000000000) / 1000000000"), "1000000000000000000000"));
+	CHECK(test_is_integer(test_eval_ok("(1000000000000000 * 1000000000000000) / 1000000000000"), 1000000000000000000));
+	CHECK(test_is_integer(test_eval_ok("(1000000000000000 * 1000000000000000) / (1000000000000000 * 100000000000)"), 10000));
+	CHECK(test_is_integer(test_eval_ok("((1000000000000000 * 1000000000000000) + 12345) % (4294967296 * 4294967296)"), 5076944270305275961));
+	CHECK(test_is_integer(test_eval_ok("(1000000000000000 * 1000000000000000) % ((4294967296 * 4294967296) + 1)"), 5076944216095154992));
+
+	// division by zero follows real arithmetic
+	CHECK(test_is_real(test_eval_ok("(4294967296 * 4294967296) / 0"), 1.0 / 0.0));
+}
+
+static void test_format()
+{
+	CHECK(is_bignum(test_eval_ok("1000000000000000 * 1000000000000000"), "1000000000000000000000000000000"));
+	CHECK(is_bignum(test_eval_ok("(0 - 1000000000000000) * 1000000000000000"), "-1000000000000000000000000000000"));
+	CHECK(is_bignum(test_eval_ok("(1000000000000000 * 1000000000000000) + 7"), "1000000000000000000000000000007"));
+	CHECK(is_bignum(test_eval_ok("(4294967296 * 4294967296) * (4294967296 * 4294967296)"), "340282366920938463463374607431768211456"));
+
+	// conversions from reals are exact
+	CHECK(is_bignum(lusp_bignum_from_real(1e20), "100000000000000000000"));
+	CHECK(is_bignum(lusp_bignum_from_real(-18446744073709551616.0), "-18446744073709551616"));
+	CHECK(test_is_integer(lusp_bignum_from_real(-4096.0), -4096));
+
+	struct lusp_object_t value = lusp_bignum_from_real(1e300);
+
+	CHECK(value.type == LUSP_OBJECT_BIGNUM && lusp_bignum_to_real(value.bignum) == 1e300);
+}
+
+void test_bignum()
+{
+	test_promotion();
+	test_division();
+	test_format();
+}
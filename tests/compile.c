@@ -0,0 +1,131 @@
+#include "test.h"
+
+#include "bytecode.h"
+#include "compile.h"
+#include "environment.h"
+
+static struct lusp_compile_cache_stats_t g_start;
+
+static void reset_stats()
+{
+	lusp_compile_cache_get_stats(&g_start);
+}
+
+static bool check_stats(unsigned int hits, unsigned int misses, unsigned int rejections, unsigned int count)
+{
+	struct lusp_compile_cache_stats_t stats;
+	lusp_compile_cache_get_stats(&stats);
+
+	return stats.hits - g_start.hits == hits && stats.misses - g_start.misses == misses &&
+	       stats.rejections - g_start.rejections == rejections && stats.count == count;
+}
+
+static struct lusp_object_t compile(struct lusp_environment_t* env, const char* source)
+{
+	return lusp_compile(env, 0, source, LUSP_COMPILE_DEFAULT);
+}
+
+static bool run(struct lusp_object_t closure, int64_t expected)
+{
+	struct lusp_object_t result;
+
+	return closure.type == LUSP_OBJECT_CLOSURE && lusp_eval(g_test_state, closure, &result) == LUSP_EVAL_OK && test_is_integer(result, expected);
+}
+
+static void test_hits()
+{
+	lusp_compile_cache_set_budget(1 << 20);
+	reset_stats();
+
+	struct lusp_object_t first = compile(g_test_env, "1 + 2");
+	struct lusp_object_t second = compile(g_test_env, "1 + 2");
+
+	CHECK(check_stats(1, 1, 0, 1));
+	CHECK(run(first, 3) && run(second, 3));
+
+	// hits share bytecode and globals but get a new closure
+	CHECK(first.closure != second.closure);
+	CHECK(first.closure->code == second.closure->code && first.closure->globals == second.closure->globals);
+
+	// flags are part of the key, failed compiles are not cached
+	compile(g_test_env, "1 + 2 + 3");
+	lusp_compile(g_test_env, 0, "1 + 2", 0);
+	compile(g_test_env, "1 +");
+	compile(g_test_env, "1 +");
+
+	CHECK(check_stats(1, 5, 0, 3));
+
+	lusp_compile_cache_set_budget(0);
+}
+
+static void test_environments()
+{
+	struct lusp_environment_t* other = lusp_environment_create(g_test_state);
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("cache_value"), lusp_mkinteger(1));
+	lusp_environment_put(other, lusp_mksymbol("cache_value"), lusp_mkinteger(2));
+
+	lusp_compile_cache_set_budget(1 << 20);
+	reset_stats();
+
+	// bytecode is shared, globals are resolved once per environment and kept while environments alternate
+	struct lusp_object_t first = compile(g_test_env, "cache_value");
+	struct lusp_object_t second = compile(other, "cache_value");
+	struct lusp_object_t third = compile(g_test_env, "cache_value");
+	struct lusp_object_t fourth = compile(other, "cache_value");
+
+	CHECK(check_stats(3, 1, 0, 1));
+	CHECK(run(first, 1) && run(second, 2) && run(third, 1) && run(fourth, 2));
+
+	CHECK(first.closure->code == second.closure->code);
+	CHECK(first.closure->globals != second.closure->globals);
+	CHECK(first.closure->globals == third.closure->globals && second.closure->globals == fourth.closure->globals);
+
+	lusp_compile_cache_set_budget(0);
+}
+
+static void test_budget()
+{
+	lusp_compile_cache_set_budget(1 << 20);
+	reset_stats();
+
+	compile(g_test_env, "1");
+
+	struct lusp_compile_cache_stats_t stats;
+	lusp_compile_cache_get_stats(&stats);
+
+	CHECK(stats.count == 1 && stats.size > 0 && stats.size <= stats.budget);
+
+	// sources that don't fit are compiled every time instead of evicting cached ones
+	lusp_compile_cache_set_budget(stats.size + 16);
+
+	CHECK(run(compile(g_test_env, "2 + 2 + 2 + 2"), 8));
+	CHECK(run(compile(g_test_env, "2 + 2 + 2 + 2"), 8));
+	CHECK(run(compile(g_test_env, "1"), 1));
+
+	CHECK(check_stats(1, 3, 2, 1));
+
+	// lowering the budget below the cached size clears the cache
+	lusp_compile_cache_set_budget(16);
+	lusp_compile_cache_get_stats(&stats);
+
+	CHECK(stats.count == 0 && stats.size == 0);
+
+	CHECK(run(compile(g_test_env, "1"), 1));
+	CHECK(check_stats(1, 4, 3, 0));
+
+	// disabling the cache clears it as well
+	lusp_compile_cache_set_budget(1 << 20);
+	compile(g_test_env, "1");
+	lusp_compile_cache_set_budget(0);
+	lusp_compile_cache_get_stats(&stats);
+
+	CHECK(stats.count == 0 && stats.size == 0);
+}
+
+void test_compile()
+{
+	test_hits();
+	test_environments();
+	test_budget();
+}
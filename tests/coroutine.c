@@ -0,0 +1,120 @@
+#include "test.h"
+
+#include "coroutine.h"
+#include "environment.h"
+
+static struct lusp_object_t builtin_abort(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+	(void)args;
+	(void)count;
+
+	lusp_eval_abort(state, LUSP_EVAL_ABORTED);
+
+	return lusp_mkinteger(1);
+}
+
+static enum lusp_eval_status_t eval_status(const char* source)
+{
+	struct lusp_object_t result;
+	enum lusp_eval_status_t status = test_eval(source, &result);
+
+	// aborted evaluations produce null
+	CHECK(status == LUSP_EVAL_OK || result.type == LUSP_OBJECT_NULL);
+
+	return status;
+}
+
+static void test_yield()
+{
+	test_eval_ok("gen = 0 gen = |i, n| if i < n { yield(i) gen(i + 1, n) } else \"end\"");
+	test_eval_ok("acc = 0 acc = |sum| acc(sum + yield(sum))");
+
+	// yielded values are returned by resume, the first resume passes function arguments
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|n| gen(0, n)) let a = resume(c, 2) let b = resume(c) (a * 10) + b"), 1));
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|n| gen(0, n)) resume(c, 1) let e = resume(c) length(e) + (if done(c) 10 else 0)"), 13));
+	CHECK(test_eval_ok("let c = spawn(|n| gen(0, 0)) resume(c) resume(c)").type == LUSP_OBJECT_NULL);
+
+	// later resumes pass the result of yield
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(acc) resume(c, 10) resume(c, 5) resume(c, 7)"), 22));
+
+	// coroutines can be nested and keep closures alive across yields
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|| { let inner = spawn(|| { yield(1) 2 }) yield(resume(inner)) resume(inner) }) resume(c) resume(c)"), 2));
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|| { let x = 41 yield(|| x + 1) 0 }) let f = resume(c) resume(c) f()"), 42));
+
+	// yield outside of coroutines doesn't suspend anything
+	CHECK(test_eval_ok("yield(1)").type == LUSP_OBJECT_NULL);
+	CHECK(test_is_integer(test_eval_ok("yield(1) 5"), 5));
+}
+
+static void test_stack()
+{
+	test_eval_ok("depth = 0 depth = |n| if n == 0 { 0 } else { 1 + depth(n - 1) }");
+
+	// coroutine stacks start small and grow on demand
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|| depth(5000)) resume(c)"), 5000));
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|| { yield(0) depth(20000) }, 16) resume(c) resume(c)"), 20000));
+
+	// running out of registers aborts the evaluation instead of crashing, the state stays usable
+	CHECK(eval_status("depth(100000000)") == LUSP_EVAL_STACK_OVERFLOW);
+	CHECK(eval_status("let c = spawn(|| depth(100000000)) resume(c) 1") == LUSP_EVAL_STACK_OVERFLOW);
+	CHECK(test_is_integer(test_eval_ok("depth(10)"), 10));
+}
+
+static void test_budget()
+{
+	// makes 2^(n+1)-1 calls with a shallow stack
+	test_eval_ok("tree = 0 tree = |n| if n == 0 1 else tree(n - 1) + tree(n - 1)");
+
+	lusp_eval_set_budget(g_test_state, 10000);
+
+	// code outside of coroutines is aborted when the budget runs out, coroutine code is preempted
+	CHECK(eval_status("tree(20)") == LUSP_EVAL_BUDGET);
+	CHECK(test_is_integer(test_eval_ok("let c = spawn(|| tree(20)) resume(c) if done(c) 1 else 2"), 2));
+	CHECK(eval_status("let c = spawn(|| tree(20)) resume(c) tree(20)") == LUSP_EVAL_BUDGET);
+	CHECK(test_is_integer(test_eval_ok("tree(10)"), 1024));
+
+	// native functions can abort evaluations, including nested ones
+	lusp_environment_put(g_test_env, lusp_mksymbol("abort"), lusp_mkfunction(builtin_abort));
+
+	CHECK(eval_status("abort() 1") == LUSP_EVAL_ABORTED);
+	CHECK(eval_status("let c = spawn(|| abort()) resume(c) 1") == LUSP_EVAL_ABORTED);
+	CHECK(test_is_integer(test_eval_ok("tree(3)"), 8));
+
+	// coroutines resumed by the host are preempted and continue with a fresh budget on the next resume
+	struct lusp_object_t coroutine = test_eval_ok("spawn(|| tree(14))");
+
+	CHECK(coroutine.type == LUSP_OBJECT_COROUTINE);
+	if (coroutine.type != LUSP_OBJECT_COROUTINE) return;
+
+	unsigned int resumes = 0;
+	struct lusp_object_t result = lusp_mknull();
+
+	while (coroutine.coroutine->status != LUSP_COROUTINE_DEAD && resumes < 1000)
+	{
+		result = lusp_coroutine_resume(g_test_state, coroutine.coroutine, 0, 0);
+		resumes++;
+
+		CHECK(coroutine.coroutine->preempted == (coroutine.coroutine->status != LUSP_COROUTINE_DEAD));
+	}
+
+	CHECK(test_is_integer(result, 16384));
+	CHECK(resumes > 1 && resumes < 1000);
+
+	lusp_eval_set_budget(g_test_state, 0);
+}
+
+void test_coroutine()
+{
+	// both evaluators abort the same way; the jit is not available on every platform, in which case this runs the vm twice
+	for (int jit = 0; jit < 2; ++jit)
+	{
+		lusp_jit_set(g_test_state, jit != 0);
+
+		test_yield();
+		test_stack();
+		test_budget();
+	}
+
+	lusp_jit_set(g_test_state, false);
+}
@@ -0,0 +1,85 @@
+#include "test.h"
+
+#include "decimal.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+static bool is_real_literal(const char* source)
+{
+	struct lusp_object_t value = test_eval_ok(source);
+
+	return test_is_real(value, strtod(source, 0));
+}
+
+static void test_conversion()
+{
+	CHECK(lusp_decimal_to_double(0, 0) == 0.0);
+	CHECK(lusp_decimal_to_double(0, 1000) == 0.0);
+	CHECK(lusp_decimal_to_double(1, 0) == 1.0);
+	CHECK(lusp_decimal_to_double(15, -1) == 1.5);
+	CHECK(lusp_decimal_to_double(1, -1) == 0.1);
+	CHECK(lusp_decimal_to_double(17976931348623157ull, 292) == DBL_MAX);
+	CHECK(lusp_decimal_to_double(22250738585072014ull, -324) == DBL_MIN);
+	CHECK(lusp_decimal_to_double(5, -324) == 5e-324);
+
+	// values past the ends of the range round to infinity and zero
+	CHECK(lusp_decimal_to_double(18, 307) == HUGE_VAL);
+	CHECK(lusp_decimal_to_double(1, 100000) == HUGE_VAL);
+	CHECK(lusp_decimal_to_double(2, -325) == 0.0);
+	CHECK(lusp_decimal_to_double(1, -100000) == 0.0);
+
+	// halfway cases round to even
+	CHECK(lusp_decimal_to_double(9007199254740993ull, 0) == 9007199254740992.0);
+	CHECK(lusp_decimal_to_double(9007199254740995ull, 0) == 9007199254740996.0);
+	CHECK(lusp_decimal_to_double(UINT64_MAX, 0) == 18446744073709551616.0);
+}
+
+static void test_literals()
+{
+	CHECK(is_real_literal("0.1"));
+	CHECK(is_real_literal("3.14159265358979323846"));
+	CHECK(is_real_literal("1e23"));
+	CHECK(is_real_literal("8.98846567431158e307"));
+	CHECK(is_real_literal("2.2250738585072011e-308"));
+	CHECK(is_real_literal("4.9e-324"));
+	CHECK(is_real_literal("1.7976931348623157e308"));
+	CHECK(is_real_literal("1.7976931348623159e308"));
+
+	// more digits than the mantissa holds, including ones that decide rounding
+	CHECK(is_real_literal("9007199254740993.0000000000000000000001"));
+	CHECK(is_real_literal("123456789012345678901234567890.123456789"));
+	CHECK(is_real_literal("0.000000000000000000000000000000000000000000000000001"));
+
+	// exponents are clamped instead of overflowing
+	CHECK(is_real_literal("1e400"));
+	CHECK(is_real_literal("1e-400"));
+	CHECK(test_is_real(test_eval_ok("1e99999999999999999"), HUGE_VAL));
+	CHECK(test_is_real(test_eval_ok("1e-99999999999999999"), 0.0));
+	CHECK(test_is_real(test_eval_ok("0e99999999999999999"), 0.0));
+	CHECK(test_is_real(test_eval_ok("0.0000000000000000000001e22"), 1.0));
+
+	// integers
+	CHECK(test_is_integer(test_eval_ok("9223372036854775807"), INT64_MAX));
+	CHECK(test_is_integer(test_eval_ok("-9223372036854775808"), INT64_MIN));
+	CHECK(test_is_integer(test_eval_ok("00000000000000000000000042"), 42));
+}
+
+static void test_errors()
+{
+	struct lusp_object_t result;
+
+	// integer literals that don't fit are compile errors
+	CHECK(test_eval("9223372036854775808", &result) == LUSP_EVAL_OK && result.type == LUSP_OBJECT_NULL);
+	CHECK(test_eval("100000000000000000000", &result) == LUSP_EVAL_OK && result.type == LUSP_OBJECT_NULL);
+	CHECK(test_eval("1.5x", &result) == LUSP_EVAL_OK && result.type == LUSP_OBJECT_NULL);
+	CHECK(test_eval("1e", &result) == LUSP_EVAL_OK && result.type == LUSP_OBJECT_NULL);
+}
+
+void test_decimal()
+{
+	test_conversion();
+	test_literals();
+	test_errors();
+}
@@ -0,0 +1,213 @@
+#include "test.h"
+
+#include "bytecode.h"
+#include "compile.h"
+#include "image.h"
+#include "memory.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE_PATH "lusp_test.img"
+
+static const char* g_program =
+	"let count = 0 count = |l, n| if n == 0 l else count(l + 1, n - 1) "
+	"let adder = |x| |y| x + y let add = adder(1.5) "
+	"count(0, 10) + add(2) + length(concat(\"ab\", \"cd\"))";
+
+static bool save(const char* source, uintptr_t base)
+{
+	struct lusp_object_t closure = lusp_compile(g_test_env, 0, source, LUSP_COMPILE_DEFAULT);
+
+	return lusp_save_image(closure.closure->code, IMAGE_PATH, base);
+}
+
+static char* read_file(size_t* size)
+{
+	FILE* file = fopen(IMAGE_PATH, "rb");
+	if (!file) return 0;
+
+	fseek(file, 0, SEEK_END);
+	*size = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char* data = lusp_memory_allocate(*size);
+	*size = fread(data, 1, *size, file);
+
+	fclose(file);
+
+	return data;
+}
+
+static void write_file(const char* data, size_t size)
+{
+	FILE* file = fopen(IMAGE_PATH, "wb");
+	if (!file) return;
+
+	fwrite(data, 1, size, file);
+	fclose(file);
+}
+
+static bool run(struct lusp_vm_bytecode_t* code, double expected)
+{
+	struct lusp_object_t result;
+
+	return code && lusp_eval(g_test_state, lusp_bind_bytecode(code, g_test_env), &result) == LUSP_EVAL_OK && test_is_real(result, expected);
+}
+
+static void test_load()
+{
+	CHECK(save(g_program, 0));
+
+	// the first image is mapped at its base address, the second one is relocated
+	struct lusp_vm_bytecode_t* code = lusp_load_image(IMAGE_PATH);
+	struct lusp_vm_bytecode_t* relocated = lusp_load_image(IMAGE_PATH);
+
+	CHECK(code != 0 && relocated != 0 && code != relocated);
+	CHECK(run(code, 10 + 1.5 + 2 + 4));
+	CHECK(run(relocated, 10 + 1.5 + 2 + 4));
+
+	CHECK(lusp_load_image("lusp_test_missing.img") == 0);
+}
+
+static void test_malformed()
+{
+	CHECK(save(g_program, 0));
+
+	size_t size = 0;
+	char* data = read_file(&size);
+
+	CHECK(data != 0 && size > 64);
+	if (!data) return;
+
+	// truncated images are rejected
+	write_file(data, 0);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	write_file(data, 16);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	write_file(data, size / 2);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	write_file(data, size - 1);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	// so are images with a wrong magic or version
+	char* corrupted = lusp_memory_allocate(size);
+
+	memcpy(corrupted, data, size);
+	corrupted[0] ^= 1;
+	write_file(corrupted, size);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	memcpy(corrupted, data, size);
+	corrupted[4] ^= 1;
+	write_file(corrupted, size);
+	CHECK(lusp_load_image(IMAGE_PATH) == 0);
+
+	// the intact image still loads
+	write_file(data, size);
+	CHECK(run(lusp_load_image(IMAGE_PATH), 10 + 1.5 + 2 + 4));
+
+	lusp_memory_deallocate(corrupted);
+	lusp_memory_deallocate(data);
+}
+
+static uint64_t read_header(const char* data, size_t offset)
+{
+	uint64_t result;
+	memcpy(&result, data + offset, sizeof(result));
+
+	return result;
+}
+
+static bool load_patched(const char* data, size_t size, size_t offset, const void* value, size_t value_size)
+{
+	char* patched = lusp_memory_allocate(size);
+
+	memcpy(patched, data, size);
+	memcpy(patched + offset, value, value_size);
+	write_file(patched, size);
+
+	lusp_memory_deallocate(patched);
+
+	return lusp_load_image(IMAGE_PATH) != 0;
+}
+
+static void test_corrupted()
+{
+	// nothing else is mapped at this base, so corrupted pointers are checked without relocation
+	uintptr_t base = (sizeof(void*) == 8) ? (uintptr_t)0x300000000000ull : 0;
+
+	CHECK(save(g_program, base));
+
+	size_t size = 0;
+	char* data = read_file(&size);
+
+	CHECK(data != 0 && size > 96);
+	if (!data) return;
+
+	// header offsets of writable section, ops and constants
+	size_t protos = (size_t)read_header(data, 56);
+	size_t ops = (size_t)read_header(data, 64);
+	size_t constants = (size_t)read_header(data, 72);
+	uint32_t op_count = (uint32_t)read_header(data, 80);
+
+	struct lusp_vm_bytecode_t proto;
+	memcpy(&proto, data + protos, sizeof(proto));
+
+	// proto fields
+	unsigned int reg_count = 0;
+	CHECK(!load_patched(data, size, protos + offsetof(struct lusp_vm_bytecode_t, reg_count), &reg_count, sizeof(reg_count)));
+
+	unsigned int large_count = 1 << 20;
+	CHECK(!load_patched(data, size, protos + offsetof(struct lusp_vm_bytecode_t, op_count), &large_count, sizeof(large_count)));
+
+	char* misaligned = (char*)proto.ops + 1;
+	CHECK(!load_patched(data, size, protos + offsetof(struct lusp_vm_bytecode_t, ops), &misaligned, sizeof(misaligned)));
+
+	// constant types
+	uint32_t type = LUSP_OBJECT_CONS;
+	CHECK(!load_patched(data, size, constants + offsetof(struct lusp_object_t, type), &type, sizeof(type)));
+
+	// constant and closure pointers have to point to their sections
+	void* header = (void*)base;
+	bool found_const = false, found_closure = false;
+
+	for (uint32_t i = 0; i < op_count; ++i)
+	{
+		size_t offset = ops + i * sizeof(struct lusp_vm_op_t);
+		uint8_t opcode = (uint8_t)data[offset + offsetof(struct lusp_vm_op_t, opcode)];
+
+		if (opcode == LUSP_VMOP_LOAD_CONST && !found_const)
+		{
+			found_const = true;
+			CHECK(!load_patched(data, size, offset + offsetof(struct lusp_vm_op_t, load_const.object), &header, sizeof(header)));
+		}
+
+		if (opcode == LUSP_VMOP_CREATE_CLOSURE && !found_closure)
+		{
+			found_closure = true;
+			CHECK(!load_patched(data, size, offset + offsetof(struct lusp_vm_op_t, create_closure.code), &header, sizeof(header)));
+		}
+	}
+
+	CHECK(found_const && found_closure);
+
+	// the intact image still loads
+	write_file(data, size);
+	CHECK(run(lusp_load_image(IMAGE_PATH), 10 + 1.5 + 2 + 4));
+
+	lusp_memory_deallocate(data);
+}
+
+void test_image()
+{
+	test_load();
+	test_malformed();
+	test_corrupted();
+
+	remove(IMAGE_PATH);
+}
@@ -0,0 +1,199 @@
+#include "test.h"
+
+#include "compile.h"
+#include "lexer.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+// exercises numbers, strings with escapes, comments and whitespace runs long enough for the vectorized paths
+static const char* g_source =
+	"let value = 12345 + -7.25e-3 ; comment\n"
+	"\n"
+	"    let text = \"abc\\n\\\"quoted\\\" and a string that is longer than sixteen characters\"\n"
+	"                                        \n"
+	"\t\t\tfunction_with_a_long_name(#x1F, #b101, #t, #f, .5, 1e300) ;; second comment spanning some length\n"
+	"if (a >= b) { c != d } else [e <= f, g == h, i % j] | k / l |\n"
+	"\"\" symbol_with_underscores 0.1";
+
+struct stream_t
+{
+	const char* data;
+	size_t size;
+	size_t chunk;
+};
+
+static size_t read_chunk(void* context, char* buffer, size_t size)
+{
+	struct stream_t* stream = (struct stream_t*)context;
+
+	size_t result = stream->size < stream->chunk ? stream->size : stream->chunk;
+	if (result > size) result = size;
+
+	memcpy(buffer, stream->data, result);
+
+	stream->data += result;
+	stream->size -= result;
+
+	return result;
+}
+
+static void error_handler(struct lusp_lexer_t* lexer, const char* message, ...)
+{
+	(void)message;
+
+	longjmp(*(jmp_buf*)lexer->error_context, 1);
+}
+
+static bool is_same_slice(struct lusp_lexeme_slice_t left, struct lusp_lexeme_slice_t right)
+{
+	return left.length == right.length && memcmp(left.data, right.data, left.length) == 0;
+}
+
+static bool is_same_lexeme(struct lusp_lexer_t* left, struct lusp_lexer_t* right)
+{
+	if (left->lexeme != right->lexeme || left->lexeme_line != right->lexeme_line) return false;
+
+	switch (left->lexeme)
+	{
+	case LUSP_LEXEME_LITERAL_BOOLEAN:
+		return left->value.boolean == right->value.boolean;
+
+	case LUSP_LEXEME_LITERAL_INTEGER:
+		return left->value.integer == right->value.integer;
+
+	case LUSP_LEXEME_LITERAL_REAL:
+		return left->value.real == right->value.real;
+
+	case LUSP_LEXEME_LITERAL_STRING:
+		return is_same_slice(left->value.string, right->value.string);
+
+	case LUSP_LEXEME_SYMBOL:
+		return is_same_slice(left->value.symbol, right->value.symbol);
+
+	default:
+		return true;
+	}
+}
+
+// returns the number of lexemes that match lexemes of in-memory input, or -1 if streaming input failed
+static int compare_stream(const char* source, size_t chunk)
+{
+	struct lusp_lexer_t memory, stream;
+	struct stream_t input = {source, strlen(source), chunk};
+	jmp_buf buf;
+
+	// count is read after longjmp
+	volatile int count = 0;
+
+	if (setjmp(buf))
+	{
+		lusp_lexer_term(&stream);
+		return -1;
+	}
+
+	lusp_lexer_init(&memory, source, &buf, error_handler);
+	lusp_lexer_init_stream(&stream, read_chunk, &input, &buf, error_handler);
+
+	while (is_same_lexeme(&memory, &stream) && memory.lexeme != LUSP_LEXEME_EOF)
+	{
+		lusp_lexer_next(&memory);
+		lusp_lexer_next(&stream);
+		count++;
+	}
+
+	bool same = is_same_lexeme(&memory, &stream);
+
+	lusp_lexer_term(&memory);
+	lusp_lexer_term(&stream);
+
+	return same ? count : count - 1;
+}
+
+static void test_refill()
+{
+	int expected = compare_stream(g_source, strlen(g_source));
+
+	CHECK(expected > 40);
+
+	// every chunk size puts refill boundaries at different positions inside lexemes
+	for (size_t chunk = 1; chunk <= 33; ++chunk)
+		CHECK(compare_stream(g_source, chunk) == expected);
+
+	CHECK(compare_stream(g_source, LUSP_LEXER_BUFFER_SIZE) == expected);
+}
+
+static void test_lines()
+{
+	struct lusp_lexer_t lexer;
+	struct stream_t input = {0, 0, 3};
+	jmp_buf buf;
+
+	// lines are counted in whitespace runs of any length and in comments, also when they cross refill boundaries
+	const char* source = "a\nb ; c\n\n\n                                    \n\n d\n;\n\"e\"";
+
+	input.data = source;
+	input.size = strlen(source);
+
+	if (setjmp(buf))
+	{
+		CHECK(false);
+		return;
+	}
+
+	lusp_lexer_init_stream(&lexer, read_chunk, &input, &buf, error_handler);
+
+	unsigned int lines[4] = {1, 2, 7, 9};
+
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		CHECK(lexer.lexeme == (i < 3 ? LUSP_LEXEME_SYMBOL : LUSP_LEXEME_LITERAL_STRING));
+		CHECK(lexer.lexeme_line == lines[i]);
+
+		lusp_lexer_next(&lexer);
+	}
+
+	CHECK(lexer.lexeme == LUSP_LEXEME_EOF);
+
+	lusp_lexer_term(&lexer);
+}
+
+static void test_long_lexeme()
+{
+	// lexemes that are kept in the buffer across refills may be almost as long as the buffer
+	static char source[LUSP_LEXER_BUFFER_SIZE + 16];
+
+	memset(source, 'x', LUSP_LEXER_BUFFER_SIZE - 1);
+	strcpy(source + LUSP_LEXER_BUFFER_SIZE - 1, " y");
+
+	CHECK(compare_stream(source, 1000) == 2);
+
+	// longer lexemes are errors
+	memset(source, 'x', LUSP_LEXER_BUFFER_SIZE + 8);
+	strcpy(source + LUSP_LEXER_BUFFER_SIZE + 8, " y");
+
+	CHECK(compare_stream(source, 1000) == -1);
+}
+
+static void test_compile_stream()
+{
+	const char* source = "let add = |x, y| x + y\n; sum of two\nadd(40, length(\"two\")) - add(1, 0)";
+
+	// whole programs compile the same with any chunk size
+	for (size_t chunk = 1; chunk <= 8; ++chunk)
+	{
+		struct stream_t input = {source, strlen(source), chunk};
+		struct lusp_object_t closure = lusp_compile_stream(g_test_env, 0, read_chunk, &input, LUSP_COMPILE_DEFAULT);
+		struct lusp_object_t result;
+
+		CHECK(lusp_eval(g_test_state, closure, &result) == LUSP_EVAL_OK && test_is_integer(result, 42));
+	}
+}
+
+void test_lexer()
+{
+	test_refill();
+	test_lines();
+	test_long_lexeme();
+	test_compile_stream();
+}
@@ -0,0 +1,260 @@
+#include "test.h"
+
+#include "environment.h"
+#include "loop.h"
+#include "memory.h"
+#include "thread.h"
+
+#include <string.h>
+
+#ifndef DL_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define RECORD_CAPACITY 16
+
+// values recorded by tasks, in the order the tasks ran
+static struct lusp_object_t g_records[RECORD_CAPACITY];
+static unsigned int g_record_count;
+
+static struct lusp_loop_t* g_loop;
+static struct lusp_loop_task_t* g_pending;
+
+static struct lusp_object_t builtin_record(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (g_record_count < RECORD_CAPACITY) g_records[g_record_count++] = count > 0 ? args[0] : lusp_mknull();
+
+	return lusp_mknull();
+}
+
+// starts a host operation that is completed later by complete()
+static struct lusp_object_t builtin_host(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+	(void)args;
+	(void)count;
+
+	g_pending = lusp_loop_suspend(state);
+
+	// return value of suspending calls is discarded
+	return lusp_mkinteger(g_pending ? -1 : 0);
+}
+
+static struct lusp_object_t builtin_complete(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (g_pending) lusp_loop_complete(g_loop, g_pending, count > 0 ? args[0] : lusp_mknull());
+
+	g_pending = 0;
+
+	return lusp_mknull();
+}
+
+static void complete_thread(void* context)
+{
+	lusp_loop_complete(g_loop, (struct lusp_loop_task_t*)context, lusp_mkinteger(7));
+}
+
+static void reset()
+{
+	g_record_count = 0;
+	g_pending = 0;
+}
+
+static void spawn(const char* source)
+{
+	struct lusp_object_t function = test_eval_ok(source);
+
+	CHECK(function.type == LUSP_OBJECT_CLOSURE);
+
+	lusp_loop_spawn(g_loop, function, 0, 0);
+}
+
+static bool is_recorded(unsigned int count, const int64_t* expected)
+{
+	if (g_record_count != count) return false;
+
+	for (unsigned int i = 0; i < count; ++i)
+		if (!test_is_integer(g_records[i], expected[i])) return false;
+
+	return true;
+}
+
+static bool is_recorded_string(unsigned int index, const char* expected)
+{
+	return index < g_record_count && g_records[index].type == LUSP_OBJECT_STRING &&
+	       g_records[index].string->length == strlen(expected) && memcmp(g_records[index].string->data, expected, strlen(expected)) == 0;
+}
+
+static void test_tasks()
+{
+	reset();
+
+	// tasks run until they first suspend, zero sleeps let other ready tasks run first
+	spawn("|| { record(1) sleep(0) record(4) }");
+	spawn("|| { record(2) task(|x| record(x), 3) }");
+
+	int64_t order[] = {1, 2, 3, 4};
+
+	CHECK(is_recorded(3, order));
+
+	lusp_loop_run(g_loop);
+
+	CHECK(is_recorded(4, order));
+
+	// loop functions do nothing outside of tasks
+	CHECK(test_eval_ok("sleep(10)").type == LUSP_OBJECT_NULL);
+	CHECK(test_is_integer(test_eval_ok("host()"), 0));
+}
+
+static void test_sleep()
+{
+	reset();
+
+	// sleeping tasks wake up in deadline order, not in the order they were started
+	spawn("|| { sleep(30) record(30) }");
+	spawn("|| { sleep(10) record(10) }");
+	spawn("|| { sleep(20) record(20) sleep(20) record(40) }");
+	spawn("|| record(0)");
+
+	lusp_loop_run(g_loop);
+
+	int64_t order[] = {0, 10, 20, 30, 40};
+
+	CHECK(is_recorded(5, order));
+}
+
+static void test_complete()
+{
+	reset();
+
+	// suspended tasks continue with the result of the host operation once it is completed
+	spawn("|| record(host())");
+	spawn("|| { sleep(10) complete(42) }");
+
+	lusp_loop_run(g_loop);
+
+	int64_t completed[] = {42};
+
+	CHECK(is_recorded(1, completed));
+
+	// completions may come from other threads
+	reset();
+
+	spawn("|| record(host() + 1)");
+
+	CHECK(g_pending != 0);
+
+	struct lusp_thread_t* thread = lusp_thread_create(complete_thread, g_pending);
+
+	lusp_loop_run(g_loop);
+	lusp_thread_join(thread);
+
+	int64_t threaded[] = {8};
+
+	CHECK(is_recorded(1, threaded));
+}
+
+#ifndef DL_WINDOWS
+static void test_io()
+{
+	int fds[2];
+
+	CHECK(pipe(fds) == 0);
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("rfd"), lusp_mkinteger(fds[0]));
+	lusp_environment_put(g_test_env, lusp_mksymbol("wfd"), lusp_mkinteger(fds[1]));
+
+	// reads of empty pipes suspend until a write makes them ready
+	reset();
+
+	spawn("|| record(read(rfd))");
+	spawn("|| { sleep(10) record(write(wfd, \"hello\")) }");
+
+	lusp_loop_run(g_loop);
+
+	CHECK(g_record_count == 2 && test_is_integer(g_records[0], 5) && is_recorded_string(1, "hello"));
+
+	// writes larger than the pipe buffer suspend until a reader drains it
+	const unsigned int size = 200000;
+
+	char* data = lusp_memory_allocate(size);
+	memset(data, 'x', size);
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("big"), lusp_mkstring_n(data, size));
+	lusp_memory_deallocate(data);
+
+	reset();
+
+	test_eval_ok("drain = 0 drain = |n| if n >= 200000 n else drain(n + length(read(rfd, 65536)))");
+
+	spawn("|| record(write(wfd, big))");
+	spawn("|| record(drain(0))");
+
+	lusp_loop_run(g_loop);
+
+	int64_t sizes[] = {200000, 200000};
+
+	CHECK(is_recorded(2, sizes));
+
+	// reads return an empty string at end of file
+	close(fds[1]);
+
+	reset();
+
+	spawn("|| record(read(rfd))");
+
+	lusp_loop_run(g_loop);
+
+	CHECK(is_recorded_string(0, ""));
+
+	close(fds[0]);
+
+	// blocking fds are rejected instead of blocking the loop
+	CHECK(pipe(fds) == 0);
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("rfd"), lusp_mkinteger(fds[0]));
+
+	reset();
+
+	spawn("|| record(read(rfd))");
+
+	lusp_loop_run(g_loop);
+
+	CHECK(g_record_count == 1 && g_records[0].type == LUSP_OBJECT_NULL);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+#endif
+
+void test_loop()
+{
+	lusp_loop_register(g_test_env);
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("record"), lusp_mkfunction(builtin_record));
+	lusp_environment_put(g_test_env, lusp_mksymbol("host"), lusp_mkfunction(builtin_host));
+	lusp_environment_put(g_test_env, lusp_mksymbol("complete"), lusp_mkfunction(builtin_complete));
+
+	g_loop = lusp_loop_create(g_test_state, 0);
+
+	test_tasks();
+	test_sleep();
+	test_complete();
+
+#ifndef DL_WINDOWS
+	test_io();
+#endif
+
+	lusp_loop_destroy(g_loop);
+	g_loop = 0;
+}
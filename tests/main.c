@@ -0,0 +1,101 @@
+#include "test.h"
+
+#include "builtins.h"
+#include "compile.h"
+#include "environment.h"
+#include "lusp.h"
+#include "state.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// test suites, one per file
+void test_bignum();
+void test_compile();
+void test_coroutine();
+void test_decimal();
+void test_image();
+void test_lexer();
+void test_loop();
+void test_parallel();
+void test_serialize();
+void test_table();
+
+static const struct
+{
+	const char* name;
+	void (*function)();
+} g_suites[] =
+{
+	{"bignum", test_bignum},
+	{"compile", test_compile},
+	{"coroutine", test_coroutine},
+	{"decimal", test_decimal},
+	{"image", test_image},
+	{"lexer", test_lexer},
+	{"loop", test_loop},
+	{"parallel", test_parallel},
+	{"serialize", test_serialize},
+	{"table", test_table},
+};
+
+struct lusp_state_t* g_test_state;
+struct lusp_environment_t* g_test_env;
+
+static unsigned int g_failures;
+
+void test_fail(const char* file, int line, const char* condition)
+{
+	fprintf(stderr, "%s(%d): check failed: %s\n", file, line, condition);
+
+	g_failures++;
+}
+
+enum lusp_eval_status_t test_eval(const char* source, struct lusp_object_t* result)
+{
+	struct lusp_object_t closure = lusp_compile(g_test_env, 0, source, LUSP_COMPILE_DEFAULT);
+
+	return lusp_eval(g_test_state, closure, result);
+}
+
+struct lusp_object_t test_eval_ok(const char* source)
+{
+	struct lusp_object_t result;
+
+	CHECK(test_eval(source, &result) == LUSP_EVAL_OK);
+
+	return result;
+}
+
+// usage: lusp_test [suite...]; runs the named suites, or all of them
+int main(int argc, char** argv)
+{
+	if (!lusp_init(0, 0)) return 1;
+
+	g_test_state = lusp_state_create(0);
+	g_test_env = lusp_environment_create(g_test_state);
+
+	lusp_register_builtins(g_test_env);
+
+	for (size_t i = 0; i < sizeof(g_suites) / sizeof(g_suites[0]); ++i)
+	{
+		bool selected = argc < 2;
+
+		for (int j = 1; j < argc; ++j)
+			if (strcmp(argv[j], g_suites[i].name) == 0)
+				selected = true;
+
+		if (!selected) continue;
+
+		unsigned int failures = g_failures;
+
+		g_suites[i].function();
+
+		printf("%s: %s\n", g_suites[i].name, g_failures == failures ? "ok" : "FAILED");
+	}
+
+	lusp_state_destroy(g_test_state);
+	lusp_term();
+
+	return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include "test.h"
+
+#include "environment.h"
+#include "parallel.h"
+#include "thread.h"
+
+#include <string.h>
+
+// participants of the loops below: the calling thread and three pool threads
+#define THREAD_COUNT 4
+
+// large enough for loops to be split into many chunks
+#define ITEM_COUNT 5000
+
+static volatile long g_arrived;
+static volatile long g_visits[ITEM_COUNT];
+
+// waits until every participant runs a chunk, so that the loop is spread across all threads regardless of processor count
+static struct lusp_object_t builtin_arrive(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+	(void)args;
+	(void)count;
+
+	long arrived = lusp_atomic_increment(&g_arrived);
+
+	for (unsigned int i = 0; i < 1000000 && lusp_atomic_load(&g_arrived) < THREAD_COUNT; ++i) lusp_thread_yield();
+
+	return lusp_mkinteger(arrived);
+}
+
+static struct lusp_object_t builtin_abort(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)env;
+	(void)args;
+	(void)count;
+
+	lusp_eval_abort(state, LUSP_EVAL_ABORTED);
+
+	return lusp_mkinteger(1);
+}
+
+// counts calls per index, so that loops can be checked to visit every index once
+static struct lusp_object_t builtin_visit(struct lusp_state_t* state, struct lusp_environment_t* env, struct lusp_object_t* args, unsigned int count)
+{
+	(void)state;
+	(void)env;
+
+	if (count > 0 && args[0].type == LUSP_OBJECT_INTEGER && args[0].integer >= 0 && args[0].integer < ITEM_COUNT)
+		lusp_atomic_increment(&g_visits[args[0].integer]);
+
+	return lusp_mknull();
+}
+
+static enum lusp_eval_status_t eval_status(const char* source)
+{
+	struct lusp_object_t result;
+
+	return test_eval(source, &result);
+}
+
+static void test_results()
+{
+	const int64_t sum = (int64_t)ITEM_COUNT * (ITEM_COUNT - 1) / 2;
+
+	struct lusp_object_t numbers = lusp_mkvector(ITEM_COUNT);
+
+	for (unsigned int i = 0; i < ITEM_COUNT; ++i) numbers.vector->data[i] = lusp_mkinteger(i);
+	numbers.vector->length = ITEM_COUNT;
+
+	lusp_environment_put(g_test_env, lusp_mksymbol("numbers"), numbers);
+
+	// results are stored by index
+	struct lusp_object_t squares = test_eval_ok("pmap(|x| x * x, numbers)");
+	bool ordered = squares.type == LUSP_OBJECT_VECTOR && squares.vector->length == ITEM_COUNT;
+
+	for (unsigned int i = 0; i < ITEM_COUNT && ordered; ++i) ordered = test_is_integer(squares.vector->data[i], (int64_t)i * i);
+
+	CHECK(ordered);
+	CHECK(test_eval_ok("pmap(|x| x, [])").type == LUSP_OBJECT_VECTOR);
+
+	// blocks are reduced and combined in order, so the function only has to be associative
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, numbers)"), sum));
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, numbers, 100)"), sum + 100));
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a, numbers)"), 0));
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| b, numbers)"), ITEM_COUNT - 1));
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, [5])"), 5));
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, [], 7)"), 7));
+
+	// every index is visited once
+	memset((void*)g_visits, 0, sizeof(g_visits));
+	test_eval_ok("pfor(|i| visit(i), 5000)");
+
+	bool visited = true;
+
+	for (unsigned int i = 0; i < ITEM_COUNT && visited; ++i) visited = g_visits[i] == 1;
+
+	CHECK(visited);
+
+	// nested loops run on the thread that starts them
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, pmap(|x| preduce(|a, b| a + b, [x, x, x]), numbers))"), sum * 3));
+}
+
+static void test_abort()
+{
+	test_eval_ok("deep = 0 deep = |n| if n == 0 0 else 1 + deep(n - 1)");
+
+	// evaluations aborted on pool threads abort the evaluation that runs the loop
+	g_arrived = 0;
+	CHECK(eval_status("pfor(|i| { arrive() if i == 3 abort() else 0 }, 4) 1") == LUSP_EVAL_ABORTED);
+	CHECK(g_arrived == THREAD_COUNT);
+
+	g_arrived = 0;
+	CHECK(eval_status("pfor(|i| { arrive() if i == 2 deep(100000) else 0 }, 4) 1") == LUSP_EVAL_STACK_OVERFLOW);
+	CHECK(g_arrived == THREAD_COUNT);
+
+	CHECK(eval_status("pmap(|x| if x == 4000 abort() else x, numbers)") == LUSP_EVAL_ABORTED);
+	CHECK(eval_status("preduce(|a, b| if b == 10 abort() else a + b, numbers)") == LUSP_EVAL_ABORTED);
+
+	// loops where several chunks fail report one of the failures
+	CHECK(eval_status("pmap(|x| if x == 0 abort() else deep(100000), numbers)") != LUSP_EVAL_OK);
+
+	// pool threads don't keep the status of aborted loops
+	g_arrived = 0;
+	CHECK(eval_status("pfor(|i| arrive(), 4) 1") == LUSP_EVAL_OK);
+	CHECK(test_is_integer(test_eval_ok("preduce(|a, b| a + b, numbers)"), (int64_t)ITEM_COUNT * (ITEM_COUNT - 1) / 2));
+}
+
+static void test_budget()
+{
+	// makes 2^(n+1)-1 calls with a shallow stack
+	test_eval_ok("tree = 0 tree = |n| if n == 0 1 else tree(n - 1) + tree(n - 1)");
+
+	lusp_eval_set_budget(g_test_state, 10000);
+
+	// pool threads share the budget of the loop instead of getting all of it each
+	CHECK(eval_status("pfor(|i| tree(5), 8) 1") == LUSP_EVAL_OK);
+	CHECK(eval_status("pfor(|i| tree(10), 8) 1") == LUSP_EVAL_BUDGET);
+
+	// calls on pool threads count against the evaluation that runs the loop
+	CHECK(eval_status("pfor(|i| tree(8), 8) tree(11)") == LUSP_EVAL_OK);
+	CHECK(eval_status("pfor(|i| tree(8), 8) tree(12)") == LUSP_EVAL_BUDGET);
+
+	// every thread makes fewer calls than the budget, all of them together make more
+	g_arrived = 0;
+	CHECK(eval_status("pfor(|i| { arrive() tree(11) }, 4) 1") == LUSP_EVAL_BUDGET);
+	CHECK(g_arrived == THREAD_COUNT);
+
+	lusp_eval_set_budget(g_test_state, 0);
+
+	CHECK(eval_status("pfor(|i| tree(10), 8) 1") == LUSP_EVAL_OK);
+}
+
+void test_parallel()
+{
+	lusp_environment_put(g_test_env, lusp_mksymbol("arrive"), lusp_mkfunction(builtin_arrive));
+	lusp_environment_put(g_test_env, lusp_mksymbol("abort"), lusp_mkfunction(builtin_abort));
+	lusp_environment_put(g_test_env, lusp_mksymbol("visit"), lusp_mkfunction(builtin_visit));
+	lusp_parallel_set_thread_count(THREAD_COUNT - 1);
+
+	test_results();
+	test_abort();
+	test_budget();
+
+	lusp_parallel_set_thread_count(0);
+}
@@ -0,0 +1,99 @@
+#include "test.h"
+
+#include "builtins.h"
+#include "bytecode.h"
+#include "compile.h"
+#include "environment.h"
+#include "memory.h"
+#include "serialize.h"
+#include "state.h"
+
+#include <string.h>
+
+static const char* g_program =
+	"let count = 0 count = |l, n| if n == 0 l else count(l + 1, n - 1) "
+	"let adder = |x| |y| x + y + offset let add = adder(1.5) "
+	"count(0, 10) + add(2) + length(concat(\"ab\", \"cd\"))";
+
+static void* save(const char* source, size_t* size)
+{
+	struct lusp_object_t closure = lusp_compile(g_test_env, 0, source, LUSP_COMPILE_DEFAULT);
+
+	return lusp_save_bytecode(closure.closure->code, size);
+}
+
+static void test_roundtrip()
+{
+	size_t size = 0;
+	void* data = save(g_program, &size);
+
+	CHECK(data != 0);
+
+	struct lusp_vm_bytecode_t* code = lusp_load_bytecode(data, size);
+
+	CHECK(code != 0);
+
+	// saving loaded bytecode produces the same data
+	size_t resaved_size = 0;
+	void* resaved = lusp_save_bytecode(code, &resaved_size);
+
+	CHECK(resaved_size == size && memcmp(resaved, data, size) == 0);
+
+	// globals are stored by name and resolved in the environment the code is bound to
+	struct lusp_environment_t* env = lusp_environment_create(g_test_state);
+
+	lusp_register_builtins(env);
+	lusp_environment_put(env, lusp_mksymbol("offset"), lusp_mkinteger(100));
+
+	struct lusp_object_t result;
+
+	CHECK(lusp_eval(g_test_state, lusp_bind_bytecode(code, env), &result) == LUSP_EVAL_OK);
+	CHECK(test_is_real(result, 10 + 1.5 + 2 + 100 + 4));
+
+	lusp_memory_deallocate(resaved);
+	lusp_memory_deallocate(data);
+}
+
+static void test_malformed()
+{
+	size_t size = 0;
+	unsigned char* data = save(g_program, &size);
+
+	// truncated data is rejected
+	bool truncated_ok = true;
+
+	for (size_t length = 0; length < size; ++length)
+		truncated_ok &= lusp_load_bytecode(data, length) == 0;
+
+	CHECK(truncated_ok);
+
+	// so is trailing data
+	unsigned char* padded = lusp_memory_allocate(size + 1);
+
+	memcpy(padded, data, size);
+	padded[size] = 0;
+
+	CHECK(lusp_load_bytecode(padded, size + 1) == 0);
+
+	// corrupted counts and offsets are either rejected or loaded, but never read out of bounds
+	unsigned char* corrupted = padded;
+
+	for (size_t offset = 0; offset + 4 <= size; offset += 4)
+	{
+		memcpy(corrupted, data, size);
+		memset(corrupted + offset, 0xff, 4);
+
+		struct lusp_vm_bytecode_t* code = lusp_load_bytecode(corrupted, size);
+
+		if (code) lusp_memory_deallocate(code);
+	}
+
+	lusp_memory_deallocate(padded);
+	lusp_memory_deallocate(data);
+}
+
+void test_serialize()
+{
+	test_roundtrip();
+	test_malformed();
+}
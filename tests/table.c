@@ -0,0 +1,123 @@
+#include "test.h"
+
+#include "table.h"
+
+static struct lusp_object_t get(struct lusp_table_t* table, struct lusp_object_t key)
+{
+	return lusp_table_get(table, &key);
+}
+
+static void set(struct lusp_table_t* table, struct lusp_object_t key, struct lusp_object_t value)
+{
+	lusp_table_set(table, &key, &value);
+}
+
+static bool delete(struct lusp_table_t* table, struct lusp_object_t key)
+{
+	return lusp_table_delete(table, &key);
+}
+
+static void test_numeric_keys()
+{
+	struct lusp_table_t* table = lusp_mktable(0).table;
+
+	// integral reals are the same keys as integers
+	set(table, lusp_mkinteger(1), lusp_mkinteger(10));
+	set(table, lusp_mkreal(2.0), lusp_mkinteger(20));
+
+	CHECK(test_is_integer(get(table, lusp_mkreal(1.0)), 10));
+	CHECK(test_is_integer(get(table, lusp_mkinteger(2)), 20));
+	CHECK(lusp_table_count(table) == 2);
+
+	set(table, lusp_mkreal(1.0), lusp_mkinteger(11));
+
+	CHECK(test_is_integer(get(table, lusp_mkinteger(1)), 11));
+	CHECK(lusp_table_count(table) == 2);
+
+	// zero has one key regardless of sign
+	set(table, lusp_mkreal(-0.0), lusp_mkinteger(0));
+
+	CHECK(test_is_integer(get(table, lusp_mkinteger(0)), 0));
+
+	// fractional reals are separate keys
+	set(table, lusp_mkreal(1.5), lusp_mkinteger(15));
+
+	CHECK(test_is_integer(get(table, lusp_mkreal(1.5)), 15));
+	CHECK(test_is_integer(get(table, lusp_mkinteger(1)), 11));
+	CHECK(get(table, lusp_mkinteger(3)).type == LUSP_OBJECT_NULL);
+
+	CHECK(delete(table, lusp_mkreal(1.0)));
+	CHECK(get(table, lusp_mkinteger(1)).type == LUSP_OBJECT_NULL);
+	CHECK(!delete(table, lusp_mkinteger(1)));
+}
+
+static void test_string_keys()
+{
+	struct lusp_table_t* table = lusp_mktable(0).table;
+
+	// strings are compared by contents, including views into other strings
+	struct lusp_object_t whole = lusp_mkstring("key value");
+
+	set(table, lusp_mkstring("key"), lusp_mkinteger(1));
+	set(table, lusp_mkstring("value"), lusp_mkinteger(2));
+
+	CHECK(test_is_integer(get(table, lusp_mkstring_view(whole.string, 0, 3)), 1));
+	CHECK(test_is_integer(get(table, lusp_mkstring_view(whole.string, 4, 5)), 2));
+	CHECK(get(table, lusp_mkstring("ke")).type == LUSP_OBJECT_NULL);
+
+	// symbols are not strings
+	CHECK(get(table, lusp_mksymbol("key")).type == LUSP_OBJECT_NULL);
+}
+
+static void test_growth()
+{
+	struct lusp_table_t* table = lusp_mktable(0).table;
+
+	// growing migrates slots incrementally, so lookups and deletes hit both slot arrays
+	for (int i = 0; i < 10000; ++i)
+	{
+		set(table, lusp_mkinteger(i), lusp_mkinteger(i * 2));
+
+		if (i % 3 == 0) delete(table, lusp_mkinteger(i / 2));
+	}
+
+	unsigned int count = 0;
+	bool values_ok = true;
+
+	for (int i = 0; i < 10000; ++i)
+	{
+		struct lusp_object_t value = get(table, lusp_mkinteger(i));
+
+		if (value.type == LUSP_OBJECT_NULL) continue;
+
+		values_ok &= test_is_integer(value, i * 2);
+		count++;
+	}
+
+	CHECK(values_ok);
+	CHECK(count == lusp_table_count(table));
+
+	// iteration visits every key once
+	unsigned int visited = 0;
+	struct lusp_object_t key = lusp_mknull();
+
+	while ((key = lusp_table_next(table, &key)).type != LUSP_OBJECT_NULL) visited++;
+
+	CHECK(visited == count);
+}
+
+static void test_script()
+{
+	// bignums are equal to reals with the same value and hash the same way
+	CHECK(test_is_integer(test_eval_ok("let t = table() t[9223372036854775807 + 1] = 5 t[9223372036854775808.0]"), 5));
+	CHECK(test_is_integer(test_eval_ok("let t = table() t[1] = 1 t[1.0] = 2 t[concat(\"a\", \"b\")] = 3 length(t) + t[\"ab\"]"), 5));
+	CHECK(test_is_integer(test_eval_ok("hash(\"abc\") - hash(substring(\"xabc\", 1))"), 0));
+}
+
+void test_table()
+{
+	test_numeric_keys();
+	test_string_keys();
+	test_growth();
+	test_script();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "eval.h"
+#include "object.h"
+
+struct lusp_environment_t;
+
+// failed checks are reported and counted, the test keeps running
+#define CHECK(condition) ((condition) ? (void)0 : test_fail(__FILE__, __LINE__, #condition))
+
+void test_fail(const char* file, int line, const char* condition);
+
+// state and environment with builtins that tests evaluate code in
+extern struct lusp_state_t* g_test_state;
+extern struct lusp_environment_t* g_test_env;
+
+// compiles and evaluates source in the test environment; compile errors evaluate to null
+enum lusp_eval_status_t test_eval(const char* source, struct lusp_object_t* result);
+
+// evaluates source that is expected to succeed and returns its result
+struct lusp_object_t test_eval_ok(const char* source);
+
+static inline bool test_is_integer(struct lusp_object_t object, int64_t value)
+{
+	return object.type == LUSP_OBJECT_INTEGER && object.integer == value;
+}
+
+static inline bool test_is_real(struct lusp_object_t object, double value)
+{
+	return object.type == LUSP_OBJECT_REAL && object.real == value;
+}